@@ -0,0 +1,153 @@
+#include "AtomicFileWriter.h"
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <Windows.h>
+#else
+#include <cerrno>
+#include <cstdio>     // For rename
+#include <filesystem>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+AtomicFileWriter::~AtomicFileWriter() {
+    discard();
+}
+
+#ifdef _WIN32
+
+bool AtomicFileWriter::open(const std::wstring& path) {
+    discard();
+    targetPath = path;
+    temporaryPath = path + L"." + std::to_wstring(GetCurrentProcessId()) + L".tmp";
+
+    HANDLE file = CreateFileW(temporaryPath.c_str(), GENERIC_WRITE, 0, NULL, CREATE_ALWAYS,
+        FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    if (file == INVALID_HANDLE_VALUE) {
+        return false;
+    }
+    fileHandle = file;
+    opened = true;
+    failed = false;
+    return true;
+}
+
+bool AtomicFileWriter::write(const void* data, size_t size) {
+    const char* bytes = static_cast<const char*>(data);
+    while (opened && !failed && size > 0) {
+        DWORD chunk = static_cast<DWORD>(size < (1u << 30) ? size : (1u << 30));
+        DWORD written = 0;
+        if (!WriteFile(fileHandle, bytes, chunk, &written, NULL) || written == 0) {
+            failed = true;
+            break;
+        }
+        bytes += written;
+        size -= written;
+    }
+    return opened && !failed;
+}
+
+bool AtomicFileWriter::commit() {
+    if (!opened || failed || !FlushFileBuffers(fileHandle)) {
+        discard();
+        return false;
+    }
+    closeHandle();
+    // Same volume, so this is a rename; WRITE_THROUGH returns once it is on disk.
+    if (!MoveFileExW(temporaryPath.c_str(), targetPath.c_str(), MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH)) {
+        discard();
+        return false;
+    }
+    opened = false;
+    return true;
+}
+
+void AtomicFileWriter::discard() {
+    closeHandle();
+    if (opened) {
+        DeleteFileW(temporaryPath.c_str());
+    }
+    opened = false;
+}
+
+void AtomicFileWriter::closeHandle() {
+    if (fileHandle) {
+        CloseHandle(fileHandle);
+    }
+    fileHandle = nullptr;
+}
+
+#else
+
+bool AtomicFileWriter::open(const std::wstring& path) {
+    discard();
+    targetPath = path;
+    temporaryPath = path + L"." + std::to_wstring(getpid()) + L".tmp";
+
+    // A replaced file keeps its permissions; a new one gets the usual defaults.
+    mode_t mode = 0666;
+    struct stat info;
+    if (stat(std::filesystem::path(targetPath).c_str(), &info) == 0) {
+        mode = info.st_mode & 07777;
+    }
+    int fd = ::open(std::filesystem::path(temporaryPath).c_str(), O_WRONLY | O_CREAT | O_TRUNC, mode);
+    if (fd < 0) {
+        return false;
+    }
+    fileDescriptor = fd;
+    opened = true;
+    failed = false;
+    return true;
+}
+
+bool AtomicFileWriter::write(const void* data, size_t size) {
+    const char* bytes = static_cast<const char*>(data);
+    while (opened && !failed && size > 0) {
+        ssize_t written = ::write(fileDescriptor, bytes, size);
+        if (written < 0 && errno == EINTR) {
+            continue;
+        }
+        if (written <= 0) {
+            failed = true;
+            break;
+        }
+        bytes += written;
+        size -= static_cast<size_t>(written);
+    }
+    return opened && !failed;
+}
+
+bool AtomicFileWriter::commit() {
+    if (!opened || failed || fsync(fileDescriptor) != 0) {
+        discard();
+        return false;
+    }
+    closeHandle();
+    if (std::rename(std::filesystem::path(temporaryPath).c_str(), std::filesystem::path(targetPath).c_str()) != 0) {
+        discard();
+        return false;
+    }
+    opened = false;
+    return true;
+}
+
+void AtomicFileWriter::discard() {
+    closeHandle();
+    if (opened) {
+        ::unlink(std::filesystem::path(temporaryPath).c_str());
+    }
+    opened = false;
+}
+
+void AtomicFileWriter::closeHandle() {
+    if (fileDescriptor >= 0) {
+        ::close(fileDescriptor);
+    }
+    fileDescriptor = -1;
+}
+
+#endif
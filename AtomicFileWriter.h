@@ -0,0 +1,41 @@
+#pragma once
+
+#include <string>
+#include <cstddef> // For size_t
+
+// Replaces a file all at once: everything is written to a temporary file next to the
+// target, which commit() flushes to disk and renames over the target. Until then, and
+// whenever anything fails, the target keeps its old contents; the temporary file is
+// removed if the writer goes away without committing.
+// Win32 uses CreateFile/WriteFile/MoveFileEx, other platforms open/write/rename.
+class AtomicFileWriter {
+public:
+    AtomicFileWriter() = default;
+    ~AtomicFileWriter();
+
+    AtomicFileWriter(const AtomicFileWriter&) = delete;
+    AtomicFileWriter& operator=(const AtomicFileWriter&) = delete;
+
+    // Creates the temporary file for replacing 'path'. Returns false if it cannot.
+    bool open(const std::wstring& path);
+    bool write(const void* data, size_t size);
+    // Makes the written contents the target's. Returns false (leaving the target as it
+    // was) if anything went wrong since open().
+    bool commit();
+    void discard();
+
+    bool isOpen() const { return opened; }
+
+private:
+    std::wstring targetPath;
+    std::wstring temporaryPath;
+    bool opened = false;
+    bool failed = false;
+#ifdef _WIN32
+    void* fileHandle = nullptr; // HANDLE
+#else
+    int fileDescriptor = -1;
+#endif
+
+    void closeHandle();
+};
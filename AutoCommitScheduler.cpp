@@ -0,0 +1,163 @@
+#include "AutoCommitScheduler.h"
+#include <algorithm>
+#include <cmath>
+
+namespace {
+    const double AVERAGE_WEIGHT = 0.2; // Of the newest sample in the running averages
+}
+
+AutoCommitScheduler::AutoCommitScheduler(const Policy& policy) : policy(policy) {}
+
+void AutoCommitScheduler::setPolicy(const Policy& newPolicy) {
+    policy = newPolicy;
+}
+
+const AutoCommitScheduler::Policy& AutoCommitScheduler::getPolicy() const {
+    return policy;
+}
+
+bool AutoCommitScheduler::noteEdit(DocumentId document, size_t editedChars, size_t documentLength, TimePoint now) {
+    DocumentState& state = documents[document];
+    if (state.hasEdit) {
+        // Only gaps within a burst of typing say how fast the user types; longer ones
+        // are pauses, which is what the idle delay is there to catch.
+        double gap = std::chrono::duration<double, std::milli>(now - state.lastEdit).count();
+        if (gap >= 0 && gap < policy.minIdleDelay.count()) {
+            state.gapMillis = state.gapMillis > 0 ? state.gapMillis + AVERAGE_WEIGHT * (gap - state.gapMillis) : gap;
+            state.charsPerEdit += AVERAGE_WEIGHT * (static_cast<double>(editedChars) - state.charsPerEdit);
+        }
+    }
+    state.hasEdit = true;
+    state.lastEdit = now;
+    state.documentLength = documentLength;
+    state.pendingChars += editedChars;
+
+    if (state.pendingChars >= thresholdFor(state)) {
+        return true;
+    }
+
+    state.deadline = now + idleDelayFor(state);
+    state.hasDeadline = true;
+    if (!state.queued || state.deadline < state.queuedTime) {
+        deadlines.push(QueuedDeadline{ state.deadline, document });
+        state.queued = true;
+        state.queuedTime = state.deadline;
+    }
+    return false;
+}
+
+void AutoCommitScheduler::noteCommit(DocumentId document, std::chrono::microseconds cost) {
+    DocumentState& state = documents[document];
+    if (cost.count() > 0) { // Zero: nothing was recorded, so nothing learned about cost
+        double micros = static_cast<double>(cost.count());
+        state.commitMicros = state.commitMicros > 0 ? state.commitMicros + AVERAGE_WEIGHT * (micros - state.commitMicros) : micros;
+    }
+    state.pendingChars = 0;
+    state.hasDeadline = false; // Its heap entry is dropped when it reaches the top
+}
+
+void AutoCommitScheduler::removeDocument(DocumentId document) {
+    documents.erase(document);
+}
+
+// Brings the top of the heap up to date: replaced entries and those of documents that
+// no longer have a deadline are dropped, and ones whose deadline moved later are requeued.
+void AutoCommitScheduler::settleTop() {
+    while (!deadlines.empty()) {
+        QueuedDeadline top = deadlines.top();
+        auto it = documents.find(top.document);
+        if (it == documents.end() || !it->second.queued || it->second.queuedTime != top.time) {
+            deadlines.pop();
+            continue;
+        }
+        DocumentState& state = it->second;
+        if (!state.hasDeadline) {
+            deadlines.pop();
+            state.queued = false;
+            continue;
+        }
+        if (state.deadline != top.time) {
+            deadlines.pop();
+            deadlines.push(QueuedDeadline{ state.deadline, top.document });
+            state.queuedTime = state.deadline;
+            continue;
+        }
+        return;
+    }
+}
+
+std::optional<AutoCommitScheduler::TimePoint> AutoCommitScheduler::nextDeadline() {
+    settleTop();
+    if (deadlines.empty()) {
+        return std::nullopt;
+    }
+    return deadlines.top().time;
+}
+
+std::vector<AutoCommitScheduler::DocumentId> AutoCommitScheduler::takeDue(TimePoint now) {
+    std::vector<DocumentId> due;
+    for (settleTop(); !deadlines.empty() && deadlines.top().time <= now; settleTop()) {
+        DocumentId document = deadlines.top().document;
+        deadlines.pop();
+        DocumentState& state = documents[document];
+        state.queued = false;
+        state.hasDeadline = false;
+        due.push_back(document);
+    }
+    return due;
+}
+
+size_t AutoCommitScheduler::thresholdFor(DocumentId document) const {
+    auto it = documents.find(document);
+    return it != documents.end() ? thresholdFor(it->second) : policy.baseThreshold;
+}
+
+std::chrono::milliseconds AutoCommitScheduler::idleDelayFor(DocumentId document) const {
+    auto it = documents.find(document);
+    return it != documents.end() ? idleDelayFor(it->second) : policy.baseIdleDelay;
+}
+
+size_t AutoCommitScheduler::pendingChars(DocumentId document) const {
+    auto it = documents.find(document);
+    return it != documents.end() ? it->second.pendingChars : 0;
+}
+
+// How much further apart commits should be for this document: grows with the log of
+// its size beyond largeDocumentChars and with how far its commits overrun the budget.
+double AutoCommitScheduler::slowdownFactor(const DocumentState& state) const {
+    double factor = 1.0;
+    if (policy.largeDocumentChars > 0 && state.documentLength > policy.largeDocumentChars) {
+        factor += std::log2(static_cast<double>(state.documentLength) / policy.largeDocumentChars);
+    }
+    if (policy.commitBudget.count() > 0 && state.commitMicros > policy.commitBudget.count()) {
+        factor *= std::min(state.commitMicros / policy.commitBudget.count(), 8.0);
+    }
+    return factor;
+}
+
+size_t AutoCommitScheduler::thresholdFor(const DocumentState& state) const {
+    if (!policy.adaptive) {
+        return policy.baseThreshold;
+    }
+    double threshold = static_cast<double>(policy.baseThreshold);
+    if (state.gapMillis > 0) {
+        // What this typist edits in minThresholdSpacing
+        double charsPerMilli = state.charsPerEdit / state.gapMillis;
+        threshold = std::max(threshold, charsPerMilli * policy.minThresholdSpacing.count());
+    }
+    threshold *= slowdownFactor(state);
+    return std::clamp(static_cast<size_t>(threshold), policy.baseThreshold, std::max(policy.baseThreshold, policy.maxThreshold));
+}
+
+std::chrono::milliseconds AutoCommitScheduler::idleDelayFor(const DocumentState& state) const {
+    if (!policy.adaptive) {
+        return policy.baseIdleDelay;
+    }
+    double delay = static_cast<double>(policy.baseIdleDelay.count());
+    if (state.gapMillis > 0) {
+        delay = state.gapMillis * policy.idlePauseFactor;
+    }
+    delay *= slowdownFactor(state);
+    delay = std::clamp(delay, static_cast<double>(policy.minIdleDelay.count()), static_cast<double>(policy.maxIdleDelay.count()));
+    return std::chrono::milliseconds(static_cast<long long>(delay));
+}
@@ -0,0 +1,105 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>    // For size_t
+#include <cstdint>
+#include <functional> // For std::greater
+#include <optional>
+#include <queue>
+#include <unordered_map>
+#include <vector>
+
+// Decides when typing becomes an automatic history point, for every open document at
+// once. A document is committed when the characters edited since its last commit reach
+// its threshold, or when it has been idle for its idle delay. Idle deadlines sit in one
+// min-heap, so the editor needs a single timer armed at nextDeadline() however many
+// documents are open.
+//
+// The policy adapts both numbers to each document: a fast typist gets a higher
+// threshold (so threshold commits don't come more often than every few seconds) and a
+// shorter idle delay (a pause is long relative to their usual gap between keystrokes);
+// large documents and commits that took long push both out. With 'adaptive' off it is
+// the fixed threshold and idle delay the editor used to have.
+//
+// Time is always passed in, never read from a clock, so the scheduler can be driven by
+// simulated time, e.g. the timestamps of a replayed editing trace (see TraceReplay.h).
+class AutoCommitScheduler {
+public:
+    using Clock = std::chrono::steady_clock;
+    using TimePoint = Clock::time_point;
+    using DocumentId = uint64_t; // Chosen by the caller; any stable per-document key
+
+    struct Policy {
+        bool adaptive = true;
+        size_t baseThreshold = 101;                          // Characters edited
+        size_t maxThreshold = 4096;
+        std::chrono::milliseconds baseIdleDelay{ 4000 };    // Until the typing rate is known
+        std::chrono::milliseconds minIdleDelay{ 1500 };
+        std::chrono::milliseconds maxIdleDelay{ 15000 };
+        double idlePauseFactor = 10.0;                       // Idle = this many usual gaps without an edit
+        std::chrono::milliseconds minThresholdSpacing{ 3000 }; // Fast typing: threshold commits at most this often
+        size_t largeDocumentChars = 1024 * 1024;             // Beyond this, both grow with the document
+        std::chrono::microseconds commitBudget{ 5000 };     // Commits slower than this space out
+    };
+
+    AutoCommitScheduler() = default;
+    explicit AutoCommitScheduler(const Policy& policy);
+
+    void setPolicy(const Policy& policy);
+    const Policy& getPolicy() const;
+
+    // Reports an edit of 'editedChars' characters (inserted plus deleted) to a document
+    // now 'documentLength' long, and moves its idle deadline. Returns true if the edits
+    // since its last commit reached the threshold: commit now.
+    bool noteEdit(DocumentId document, size_t editedChars, size_t documentLength, TimePoint now);
+    // Reports that the document was committed (for any reason) and what it cost; a zero
+    // cost (nothing was recorded) leaves its average alone. Its pending edits and idle
+    // deadline are cleared.
+    void noteCommit(DocumentId document, std::chrono::microseconds cost);
+    void removeDocument(DocumentId document);
+
+    // Earliest idle deadline of any document, if one has edits pending.
+    std::optional<TimePoint> nextDeadline();
+    // Documents whose idle deadline is at or before 'now'; they are taken off the
+    // schedule until their next edit. The caller commits them.
+    std::vector<DocumentId> takeDue(TimePoint now);
+
+    // The document's current numbers, for diagnostics.
+    size_t thresholdFor(DocumentId document) const;
+    std::chrono::milliseconds idleDelayFor(DocumentId document) const;
+    size_t pendingChars(DocumentId document) const;
+
+private:
+    struct DocumentState {
+        size_t pendingChars = 0;
+        size_t documentLength = 0;
+        bool hasEdit = false;          // lastEdit is valid
+        TimePoint lastEdit;
+        double gapMillis = 0;          // Running average gap between edits while typing; 0 = unknown
+        double charsPerEdit = 1;       // Running average
+        double commitMicros = 0;       // Running average cost of its commits
+        bool hasDeadline = false;
+        TimePoint deadline;
+        bool queued = false;           // Has a live entry in 'deadlines', at queuedTime
+        TimePoint queuedTime;          // At or before 'deadline'
+    };
+
+    struct QueuedDeadline {
+        TimePoint time;
+        DocumentId document;
+        bool operator>(const QueuedDeadline& other) const { return time > other.time; }
+    };
+
+    Policy policy;
+    std::unordered_map<DocumentId, DocumentState> documents;
+    // An entry per document with a deadline. Moving a deadline later (every keystroke)
+    // leaves the entry where it is; it is requeued when it reaches the top, so edits
+    // cost O(1). Only a deadline moving earlier (the idle delay shrank) adds an entry,
+    // and the one it replaces is dropped when it surfaces.
+    std::priority_queue<QueuedDeadline, std::vector<QueuedDeadline>, std::greater<QueuedDeadline>> deadlines;
+
+    size_t thresholdFor(const DocumentState& state) const;
+    std::chrono::milliseconds idleDelayFor(const DocumentState& state) const;
+    double slowdownFactor(const DocumentState& state) const;
+    void settleTop();
+};
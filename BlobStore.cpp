@@ -0,0 +1,194 @@
+#include "BlobStore.h"
+#include "Metrics.h"
+#include <algorithm>
+#include <cstring>    // For memcpy
+
+namespace {
+    uint64_t rotateLeft(uint64_t value, int bits) {
+        return (value << bits) | (value >> (64 - bits));
+    }
+
+    uint64_t finalMix(uint64_t value) {
+        value ^= value >> 33;
+        value *= 0xFF51AFD7ED558CCDull;
+        value ^= value >> 33;
+        value *= 0xC4CEB9FE1A85EC53ull;
+        value ^= value >> 33;
+        return value;
+    }
+
+    uint64_t readWord(const unsigned char* bytes) {
+        uint64_t word;
+        memcpy(&word, bytes, sizeof(word)); // Unaligned; digests never leave the process
+        return word;
+    }
+
+    // Levels the store publishes, for the diagnostics dialog and metrics exports.
+    void publishGauges(const BlobStore::Stats& counts) {
+        static MetricGauge& blobs = GaugeMetric("blobs.count");
+        static MetricGauge& uniqueBytes = GaugeMetric("blobs.unique_bytes");
+        static MetricGauge& referencedBytes = GaugeMetric("blobs.referenced_bytes");
+        static MetricGauge& dedupPercent = GaugeMetric("blobs.dedup_ratio_pct");
+        blobs.set(static_cast<int64_t>(counts.blobs));
+        uniqueBytes.set(static_cast<int64_t>(counts.uniqueBytes));
+        referencedBytes.set(static_cast<int64_t>(counts.referencedBytes));
+        dedupPercent.set(static_cast<int64_t>(counts.dedupRatio() * 100));
+    }
+}
+
+BlobStore& BlobStore::global() {
+    // Never destroyed: a history still alive during static destruction releases its
+    // texts into it.
+    static BlobStore* store = new BlobStore();
+    return *store;
+}
+
+BlobStore::Blob BlobStore::intern(const std::wstring& text) {
+    return intern(std::wstring(text));
+}
+
+BlobStore::Blob BlobStore::intern(std::wstring&& text) {
+    Digest key = digest(text.data(), text.length());
+    const std::wstring* stored;
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        Entry& entry = blobs[key];
+        if (!entry.text) {
+            entry.text = std::make_unique<const std::wstring>(std::move(text));
+            counts.blobs++;
+            counts.uniqueBytes += entry.text->length() * sizeof(wchar_t);
+            counts.misses++;
+        }
+        else if (*entry.text == text) {
+            counts.hits++;
+        }
+        else {
+            // Two texts with one digest: the newcomer is simply not shared.
+            counts.misses++;
+            return std::make_shared<const std::wstring>(std::move(text));
+        }
+        entry.references++;
+        counts.references++;
+        counts.referencedBytes += entry.text->length() * sizeof(wchar_t);
+        publishGauges(counts);
+        stored = entry.text.get();
+    }
+    // Made outside the lock: if this throws, the deleter runs (and takes the lock) to
+    // drop the reference just counted.
+    return Blob(stored, [this, key](const std::wstring*) { release(key); });
+}
+
+void BlobStore::release(const Digest& key) {
+    std::unique_ptr<const std::wstring> freed; // Deleted after the lock is let go
+    std::lock_guard<std::mutex> guard(lock);
+    auto it = blobs.find(key);
+    if (it == blobs.end()) {
+        return; // Not expected: every reference holds its entry
+    }
+    size_t bytes = it->second.text->length() * sizeof(wchar_t);
+    counts.references--;
+    counts.referencedBytes -= bytes;
+    if (--it->second.references == 0) {
+        freed = std::move(it->second.text);
+        blobs.erase(it);
+        counts.blobs--;
+        counts.uniqueBytes -= bytes;
+    }
+    publishGauges(counts);
+}
+
+BlobStore::Stats BlobStore::stats() const {
+    std::lock_guard<std::mutex> guard(lock);
+    return counts;
+}
+
+BlobStore::Digest BlobStore::digest(const wchar_t* data, size_t count) {
+    const unsigned char* bytes = reinterpret_cast<const unsigned char*>(data);
+    const size_t length = count * sizeof(wchar_t);
+    const uint64_t c1 = 0x87C37B91114253D5ull;
+    const uint64_t c2 = 0x4CF5AD432745937Full;
+    uint64_t h1 = 0;
+    uint64_t h2 = 0;
+
+    const size_t blocks = length / 16;
+    for (size_t i = 0; i < blocks; ++i) {
+        uint64_t k1 = readWord(bytes + i * 16);
+        uint64_t k2 = readWord(bytes + i * 16 + 8);
+        k1 *= c1; k1 = rotateLeft(k1, 31); k1 *= c2; h1 ^= k1;
+        h1 = rotateLeft(h1, 27); h1 += h2; h1 = h1 * 5 + 0x52DCE729;
+        k2 *= c2; k2 = rotateLeft(k2, 33); k2 *= c1; h2 ^= k2;
+        h2 = rotateLeft(h2, 31); h2 += h1; h2 = h2 * 5 + 0x38495AB5;
+    }
+
+    // The last 0-15 bytes
+    const unsigned char* tail = bytes + blocks * 16;
+    uint64_t k1 = 0;
+    uint64_t k2 = 0;
+    size_t rest = length & 15;
+    for (size_t i = rest; i > 8; --i) {
+        k2 ^= static_cast<uint64_t>(tail[i - 1]) << ((i - 9) * 8);
+    }
+    if (rest > 8) {
+        k2 *= c2; k2 = rotateLeft(k2, 33); k2 *= c1; h2 ^= k2;
+    }
+    for (size_t i = std::min<size_t>(rest, 8); i > 0; --i) {
+        k1 ^= static_cast<uint64_t>(tail[i - 1]) << ((i - 1) * 8);
+    }
+    if (rest > 0) {
+        k1 *= c1; k1 = rotateLeft(k1, 31); k1 *= c2; h1 ^= k1;
+    }
+
+    h1 ^= length;
+    h2 ^= length;
+    h1 += h2;
+    h2 += h1;
+    h1 = finalMix(h1);
+    h2 = finalMix(h2);
+    h1 += h2;
+    h2 += h1;
+    return Digest{ h1, h2 };
+}
+
+std::shared_ptr<const SharedChangeTexts> ShareChangeTexts(ChangeSet& change, size_t minChars, BlobStore& store) {
+    std::shared_ptr<SharedChangeTexts> texts;
+    for (size_t i = 0; i < change.hunks.size(); ++i) {
+        TextChange& hunk = change.hunks[i];
+        std::wstring* slots[2] = { &hunk.deletedText, &hunk.insertedText };
+        for (size_t slot = 0; slot < 2; ++slot) {
+            if (slots[slot]->length() < minChars) {
+                continue;
+            }
+            if (!texts) {
+                texts = std::make_shared<SharedChangeTexts>(change.hunks.size() * 2);
+            }
+            (*texts)[2 * i + slot] = store.intern(std::move(*slots[slot]));
+            slots[slot]->clear(); // Moved from, and the change's copy must read as empty
+            slots[slot]->shrink_to_fit();
+        }
+    }
+    return texts;
+}
+
+void RestoreChangeTexts(ChangeSet& change, const SharedChangeTexts& texts) {
+    if (texts.size() != change.hunks.size() * 2) {
+        return; // Not the change the texts were taken from
+    }
+    for (size_t i = 0; i < change.hunks.size(); ++i) {
+        if (texts[2 * i]) {
+            change.hunks[i].deletedText = *texts[2 * i];
+        }
+        if (texts[2 * i + 1]) {
+            change.hunks[i].insertedText = *texts[2 * i + 1];
+        }
+    }
+}
+
+size_t SharedChangeTextsSize(const SharedChangeTexts& texts) {
+    size_t size = texts.size() * sizeof(BlobStore::Blob);
+    for (const BlobStore::Blob& text : texts) {
+        if (text) {
+            size += text->length() * sizeof(wchar_t);
+        }
+    }
+    return size;
+}
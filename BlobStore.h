@@ -0,0 +1,82 @@
+#pragma once
+
+#include <cstddef>    // For size_t
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "TextChange.h"
+
+// One copy of each distinct text for the whole process, shared by every history that
+// holds it: the initial text of each tab (two tabs on the same file, or a tab and the
+// history restored for it) and the long payloads of recorded changes (a block pasted
+// over and over). Texts are looked up by a 128-bit digest of their characters and are
+// immutable once stored.
+//
+// intern() hands out a reference that keeps the text alive; the text leaves the store
+// when its last reference is released. Copies of a returned pointer are the same
+// reference, so the statistics count holders, not pointer copies. Safe from any thread.
+class BlobStore {
+public:
+    using Blob = std::shared_ptr<const std::wstring>;
+
+    struct Digest {
+        uint64_t low = 0;
+        uint64_t high = 0;
+        bool operator==(const Digest& other) const { return low == other.low && high == other.high; }
+    };
+
+    struct Stats {
+        size_t blobs = 0;           // Distinct texts stored
+        size_t references = 0;      // Live intern() results
+        size_t uniqueBytes = 0;     // Held by the store: each text once
+        size_t referencedBytes = 0; // What the references would hold as copies of their own
+        size_t hits = 0;            // intern() calls that found their text already stored
+        size_t misses = 0;
+        // Referenced bytes per stored byte; 1 when nothing is shared (or nothing stored).
+        double dedupRatio() const { return uniqueBytes > 0 ? static_cast<double>(referencedBytes) / uniqueBytes : 1.0; }
+    };
+
+    // The store the history engine and the editor share.
+    static BlobStore& global();
+
+    Blob intern(const std::wstring& text);
+    Blob intern(std::wstring&& text);
+
+    Stats stats() const;
+    // MurmurHash3 (x64, 128-bit) of the characters. Not cryptographic: a lookup also
+    // compares the texts, so a collision costs sharing, never correctness.
+    static Digest digest(const wchar_t* data, size_t count);
+
+private:
+    BlobStore() = default;
+
+    struct DigestHash {
+        size_t operator()(const Digest& digest) const { return static_cast<size_t>(digest.low); }
+    };
+
+    // A stored text and the number of intern() results pointing at it. Each result's
+    // deleter drops one (see release); the text goes with the last.
+    struct Entry {
+        std::unique_ptr<const std::wstring> text;
+        size_t references = 0;
+    };
+
+    mutable std::mutex lock; // Guards everything below
+    std::unordered_map<Digest, Entry, DigestHash> blobs;
+    Stats counts;
+
+    void release(const Digest& key);
+};
+
+// Moves the hunk texts of 'change' that are at least 'minChars' long into 'store',
+// leaving them empty in the change. The result holds two slots per hunk (deleted text,
+// then inserted text), null where the text stayed in the change; null if none moved.
+using SharedChangeTexts = std::vector<BlobStore::Blob>;
+std::shared_ptr<const SharedChangeTexts> ShareChangeTexts(ChangeSet& change, size_t minChars, BlobStore& store = BlobStore::global());
+// Puts moved texts back into a change decoded from what ShareChangeTexts left behind.
+void RestoreChangeTexts(ChangeSet& change, const SharedChangeTexts& texts);
+// Bytes of the texts the slots refer to.
+size_t SharedChangeTextsSize(const SharedChangeTexts& texts);
@@ -0,0 +1,170 @@
+#include "ChangeCapture.h"
+#include "TextDiff.h"
+#include "Metrics.h"
+#include "Timeline.h"
+
+bool DeriveEditSpan(size_t lengthBefore, const SelectionRange& selectionBefore,
+                    size_t lengthAfter, const SelectionRange& selectionAfter,
+                    EditSpan& outSpan) {
+    // After a user edit the caret is collapsed right behind the edited text. A remaining
+    // selection means something else happened (e.g. an undo that selected its text).
+    if (selectionAfter.start != selectionAfter.end) {
+        return false;
+    }
+    if (selectionBefore.start > selectionBefore.end || selectionBefore.end > lengthBefore) {
+        return false;
+    }
+
+    size_t selStart = selectionBefore.start;
+    size_t selEnd = selectionBefore.end;
+    size_t caret = selectionAfter.end;
+
+    EditSpan span;
+    if (caret >= selStart) {
+        // Text was inserted at the selection start, up to the caret; whatever the length
+        // change doesn't account for was deleted from the same position. This covers
+        // typing, pasting over a selection and the Delete key (nothing inserted).
+        span.position = selStart;
+        span.insertedLength = caret - selStart;
+        if (lengthBefore + span.insertedLength < lengthAfter) {
+            return false;
+        }
+        span.deletedLength = lengthBefore + span.insertedLength - lengthAfter;
+        // Deleting less than the selection would have left selected text behind.
+        if (span.deletedLength < selEnd - selStart || span.position + span.deletedLength > lengthBefore) {
+            return false;
+        }
+    }
+    else {
+        // The caret moved left: Backspace (or Ctrl+Backspace) removed the text between
+        // the new caret and the old selection end; nothing was inserted.
+        if (lengthAfter > lengthBefore || selStart != selEnd) {
+            return false;
+        }
+        span.position = caret;
+        span.insertedLength = 0;
+        span.deletedLength = lengthBefore - lengthAfter;
+        if (span.position + span.deletedLength != selEnd) {
+            return false;
+        }
+    }
+
+    // EN_CHANGE fired, so an empty span means the selections were taken at the wrong
+    // moment (e.g. a same-length overwrite). Let the caller diff instead.
+    if (span.deletedLength == 0 && span.insertedLength == 0) {
+        return false;
+    }
+
+    outSpan = span;
+    return true;
+}
+
+TextChange CaptureTextChange(const PieceTable& before, const EditSpan& span,
+                             const std::function<std::wstring(size_t, size_t)>& readInserted,
+                             size_t cursorPosAfter) {
+    // Every keystroke comes through here, so only one in KEYSTROKE_SAMPLE_INTERVAL is timed.
+    static LatencyHistogram& latency = LatencyMetric("edit.capture_change", KEYSTROKE_SAMPLE_INTERVAL);
+    ScopedLatency timing(latency);
+    std::wstring deletedText = before.substr(span.position, span.deletedLength);
+    std::wstring insertedText = (span.insertedLength > 0) ? readInserted(span.position, span.insertedLength) : L"";
+    return TextChange(span.position, insertedText, deletedText, cursorPosAfter);
+}
+
+ChangeSet CalculateTextChange(const PieceTable& before, const std::wstring& after, size_t cursorPosAfter) {
+    TIMELINE_SPAN("CalculateTextChange");
+    static LatencyHistogram& latency = LatencyMetric("edit.calculate_change");
+    ScopedLatency timing(latency);
+    // Diff the baseline against the editor text. The common prefix and suffix are
+    // trimmed on the piece table; the middle goes through the Myers diff engine, so
+    // separate edits (e.g. one at the top and one at the bottom) become separate
+    // hunks instead of one change spanning everything in between.
+    ChangeSet changes = ComputeChangeSet(before, after);
+
+    // The editor's caret is where the change as a whole leaves the cursor.
+    if (!changes.hunks.empty()) {
+        changes.hunks.back().cursorPositionAfter = cursorPosAfter;
+    }
+    return changes;
+}
+
+// --- EditCoalescer ---
+
+void EditCoalescer::append(const TextChange& edit) {
+    if (edit.insertedText.empty() && edit.deletedText.empty()) {
+        return;
+    }
+    edited += edit.insertedText.length() + edit.deletedText.length();
+
+    if (hasOpen) {
+        // Backspace in front of the open hunk once its own inserted text is gone: the
+        // deleted text goes before everything it already deleted.
+        if (edit.insertedText.empty() && open.insertedText.empty()
+            && edit.position + edit.deletedText.length() == open.position) {
+            backspaced.append(edit.deletedText.rbegin(), edit.deletedText.rend());
+            open.position = edit.position;
+            open.cursorPositionAfter = edit.cursorPositionAfter;
+            return;
+        }
+        if (open.canMergeWith(edit)) {
+            flushBackspaced(); // The general merge needs the whole deleted text
+            open.tryMerge(edit);
+            return;
+        }
+        closeOpenHunk();
+    }
+    open = edit;
+    hasOpen = true;
+}
+
+void EditCoalescer::append(const ChangeSet& edit) {
+    for (const TextChange& hunk : edit.hunks) {
+        append(hunk);
+    }
+}
+
+bool EditCoalescer::empty() const {
+    return !hasOpen && closed.hunks.empty();
+}
+
+size_t EditCoalescer::hunkCount() const {
+    return closed.hunks.size() + (hasOpen ? 1 : 0);
+}
+
+size_t EditCoalescer::editedLength() const {
+    return edited;
+}
+
+ChangeSet EditCoalescer::take() {
+    closeOpenHunk();
+    ChangeSet result = std::move(closed);
+    clear();
+    return result;
+}
+
+void EditCoalescer::clear() {
+    closed.hunks.clear();
+    open = TextChange();
+    hasOpen = false;
+    backspaced.clear();
+    edited = 0;
+}
+
+void EditCoalescer::flushBackspaced() {
+    if (!backspaced.empty()) {
+        open.deletedText.insert(open.deletedText.begin(), backspaced.rbegin(), backspaced.rend());
+        backspaced.clear();
+    }
+}
+
+void EditCoalescer::closeOpenHunk() {
+    if (!hasOpen) {
+        return;
+    }
+    flushBackspaced();
+    // Typing that was backspaced away again leaves nothing to record.
+    if (!open.insertedText.empty() || !open.deletedText.empty()) {
+        closed.hunks.push_back(std::move(open));
+    }
+    open = TextChange();
+    hasOpen = false;
+}
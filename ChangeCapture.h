@@ -0,0 +1,79 @@
+#pragma once
+
+#include <string>
+#include <cstddef>    // For size_t
+#include <functional>
+#include "TextChange.h"
+#include "PieceTable.h"
+
+// Portable helpers that turn a single user edit into a TextChange without reading
+// the whole document. The editor reports the selection before and after the edit
+// (plus the document lengths); from those we derive which span was replaced, take
+// the deleted text from the baseline and read back only the inserted span.
+
+// Selection in character positions, as reported by the edit control.
+struct SelectionRange {
+    size_t start = 0;
+    size_t end = 0;
+};
+
+// The span touched by one edit, in positions of the document before the edit.
+struct EditSpan {
+    size_t position = 0;
+    size_t deletedLength = 0;
+    size_t insertedLength = 0;
+};
+
+// Derives the edited span from the selections around one edit: typing or pasting
+// over the selection, Backspace/Delete, or undo/redo of a local edit. Returns false
+// when the selections cannot explain the length change (or the edit looks empty),
+// in which case the caller must fall back to a full diff.
+bool DeriveEditSpan(size_t lengthBefore, const SelectionRange& selectionBefore,
+                    size_t lengthAfter, const SelectionRange& selectionAfter,
+                    EditSpan& outSpan);
+
+// CaptureTextChange runs on every keystroke, so it times only one call in this many
+// into the edit.capture_change latency metric (see Metrics.h).
+const unsigned KEYSTROKE_SAMPLE_INTERVAL = 32;
+
+// Builds the TextChange for a derived span. The deleted text comes from the baseline
+// and 'readInserted(position, count)' fetches only the inserted text from the editor.
+TextChange CaptureTextChange(const PieceTable& before, const EditSpan& span,
+                             const std::function<std::wstring(size_t, size_t)>& readInserted,
+                             size_t cursorPosAfter);
+
+// Fallback when the edit can't be derived from the selections: diffs the baseline
+// against the editor's full text (see ComputeChangeSet). 'cursorPosAfter' is where the
+// change as a whole leaves the caret; it is stored on the last hunk.
+ChangeSet CalculateTextChange(const PieceTable& before, const std::wstring& after, size_t cursorPosAfter);
+
+// Collects the edits made since the last history point as one ChangeSet, so recording
+// a history point doesn't have to diff the whole document again. Each edit is folded
+// into the hunk before it when the two touch, which for typing, Backspace and Delete
+// costs amortized O(1) per character; an edit elsewhere starts a new hunk. Hunks apply
+// in order (see ChangeSet), so the result is exact whatever the edits were.
+class EditCoalescer {
+public:
+    void append(const TextChange& edit);
+    void append(const ChangeSet& edit);
+
+    bool empty() const;
+    size_t hunkCount() const;
+    size_t editedLength() const; // Characters inserted plus deleted by the appended edits
+
+    // The merged change, leaving the coalescer empty.
+    ChangeSet take();
+    void clear();
+
+private:
+    ChangeSet closed;     // Finished hunks
+    TextChange open;      // The hunk edits are currently folded into
+    bool hasOpen = false;
+    // Text backspaced away in front of 'open', last deleted first, so each Backspace is
+    // an append. It belongs before open.deletedText.
+    std::wstring backspaced;
+    size_t edited = 0;
+
+    void flushBackspaced();
+    void closeOpenHunk();
+};
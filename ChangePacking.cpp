@@ -0,0 +1,245 @@
+#include "ChangePacking.h"
+#include "Lz4Block.h"
+#include <cstdint>
+#include <cstring>    // For memcpy
+#include <vector>
+
+namespace {
+    enum TextForm : unsigned char {
+        TEXT_LATIN1 = 0,
+        TEXT_UTF8 = 1,
+        TEXT_WIDE = 2
+    };
+    constexpr unsigned char TEXT_FORM_MASK = 0x03;
+    constexpr unsigned char FLAG_COMPRESSED = 0x04;
+    constexpr uint32_t MAX_UTF8_UNIT = 0x1FFFFF; // Largest value a 4-byte sequence holds
+
+    void putVarint(std::string& out, uint64_t value) {
+        while (value >= 0x80) {
+            out.push_back(static_cast<char>((value & 0x7F) | 0x80));
+            value >>= 7;
+        }
+        out.push_back(static_cast<char>(value));
+    }
+
+    bool getVarint(const unsigned char*& in, const unsigned char* end, uint64_t& value) {
+        value = 0;
+        for (unsigned shift = 0; shift < 64; shift += 7) {
+            if (in >= end) {
+                return false;
+            }
+            unsigned char byte = *in++;
+            value |= static_cast<uint64_t>(byte & 0x7F) << shift;
+            if (!(byte & 0x80)) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    size_t utf8Length(uint32_t unit) {
+        return unit < 0x80 ? 1 : unit < 0x800 ? 2 : unit < 0x10000 ? 3 : 4;
+    }
+
+    // Each wchar_t unit is encoded on its own (surrogate halves included), so any
+    // string round-trips exactly, even one holding unpaired surrogates.
+    void putUtf8(std::string& out, uint32_t unit) {
+        if (unit < 0x80) {
+            out.push_back(static_cast<char>(unit));
+        }
+        else if (unit < 0x800) {
+            out.push_back(static_cast<char>(0xC0 | (unit >> 6)));
+            out.push_back(static_cast<char>(0x80 | (unit & 0x3F)));
+        }
+        else if (unit < 0x10000) {
+            out.push_back(static_cast<char>(0xE0 | (unit >> 12)));
+            out.push_back(static_cast<char>(0x80 | ((unit >> 6) & 0x3F)));
+            out.push_back(static_cast<char>(0x80 | (unit & 0x3F)));
+        }
+        else {
+            out.push_back(static_cast<char>(0xF0 | (unit >> 18)));
+            out.push_back(static_cast<char>(0x80 | ((unit >> 12) & 0x3F)));
+            out.push_back(static_cast<char>(0x80 | ((unit >> 6) & 0x3F)));
+            out.push_back(static_cast<char>(0x80 | (unit & 0x3F)));
+        }
+    }
+
+    bool getUtf8(const unsigned char*& in, const unsigned char* end, wchar_t& unit) {
+        if (in >= end) {
+            return false;
+        }
+        unsigned char lead = *in++;
+        size_t trailing;
+        uint32_t value;
+        if (lead < 0x80)      { trailing = 0; value = lead; }
+        else if (lead < 0xC0) { return false; }
+        else if (lead < 0xE0) { trailing = 1; value = lead & 0x1F; }
+        else if (lead < 0xF0) { trailing = 2; value = lead & 0x0F; }
+        else if (lead < 0xF8) { trailing = 3; value = lead & 0x07; }
+        else                  { return false; }
+        if (static_cast<size_t>(end - in) < trailing) {
+            return false;
+        }
+        for (size_t i = 0; i < trailing; ++i) {
+            value = (value << 6) | (*in++ & 0x3F);
+        }
+        unit = static_cast<wchar_t>(value);
+        return true;
+    }
+
+    // Picks the narrowest text form that holds every character of the change.
+    TextForm chooseTextForm(const ChangeSet& change) {
+        bool latin1 = true;
+        bool utf8 = true;
+        size_t utf8Bytes = 0;
+        size_t units = 0;
+        for (const TextChange& hunk : change.hunks) {
+            for (const std::wstring* text : { &hunk.deletedText, &hunk.insertedText }) {
+                for (wchar_t ch : *text) {
+                    uint32_t unit = static_cast<uint32_t>(ch);
+                    latin1 = latin1 && unit < 0x100;
+                    utf8 = utf8 && unit <= MAX_UTF8_UNIT;
+                    utf8Bytes += utf8Length(unit);
+                }
+                units += text->length();
+            }
+        }
+        if (latin1) {
+            return TEXT_LATIN1;
+        }
+        return utf8 && utf8Bytes < units * sizeof(wchar_t) ? TEXT_UTF8 : TEXT_WIDE;
+    }
+
+    void putText(std::string& out, const std::wstring& text, TextForm form) {
+        switch (form) {
+        case TEXT_LATIN1:
+            for (wchar_t ch : text) out.push_back(static_cast<char>(ch));
+            break;
+        case TEXT_UTF8:
+            for (wchar_t ch : text) putUtf8(out, static_cast<uint32_t>(ch));
+            break;
+        default:
+            out.append(reinterpret_cast<const char*>(text.data()), text.length() * sizeof(wchar_t));
+            break;
+        }
+    }
+
+    bool getText(const unsigned char*& in, const unsigned char* end, size_t length, TextForm form, std::wstring& text) {
+        size_t available = static_cast<size_t>(end - in);
+        switch (form) {
+        case TEXT_LATIN1:
+            if (length > available) return false;
+            text.assign(in, in + length);
+            in += length;
+            return true;
+        case TEXT_UTF8:
+            if (length > available) return false; // At least one byte per unit
+            text.resize(length);
+            for (size_t i = 0; i < length; ++i) {
+                if (!getUtf8(in, end, text[i])) return false;
+            }
+            return true;
+        case TEXT_WIDE:
+            if (length > available / sizeof(wchar_t)) return false;
+            text.resize(length);
+            if (length > 0) memcpy(&text[0], in, length * sizeof(wchar_t));
+            in += length * sizeof(wchar_t);
+            return true;
+        default:
+            return false;
+        }
+    }
+
+    bool decodeBody(const unsigned char* in, const unsigned char* end, TextForm form, ChangeSet& out) {
+        uint64_t hunkCount;
+        // Every hunk header takes at least four bytes, which bounds the allocation.
+        if (!getVarint(in, end, hunkCount) || hunkCount > static_cast<uint64_t>(end - in) / 4) {
+            return false;
+        }
+
+        ChangeSet change;
+        change.hunks.resize(static_cast<size_t>(hunkCount));
+        std::vector<uint64_t> lengths(change.hunks.size() * 2);
+        for (size_t i = 0; i < change.hunks.size(); ++i) {
+            uint64_t position, cursorAfterPlusOne;
+            if (!getVarint(in, end, position) || !getVarint(in, end, cursorAfterPlusOne)
+                || !getVarint(in, end, lengths[2 * i]) || !getVarint(in, end, lengths[2 * i + 1])) {
+                return false;
+            }
+            change.hunks[i].position = static_cast<size_t>(position);
+            change.hunks[i].cursorPositionAfter = static_cast<size_t>(cursorAfterPlusOne - 1);
+        }
+        for (size_t i = 0; i < change.hunks.size(); ++i) {
+            if (lengths[2 * i] > SIZE_MAX || lengths[2 * i + 1] > SIZE_MAX
+                || !getText(in, end, static_cast<size_t>(lengths[2 * i]), form, change.hunks[i].deletedText)
+                || !getText(in, end, static_cast<size_t>(lengths[2 * i + 1]), form, change.hunks[i].insertedText)) {
+                return false;
+            }
+        }
+        if (in != end) {
+            return false;
+        }
+        out = std::move(change);
+        return true;
+    }
+}
+
+std::string PackChangeSet(const ChangeSet& change, size_t compressionThreshold) {
+    TextForm form = chooseTextForm(change);
+
+    std::string body;
+    putVarint(body, change.hunks.size());
+    for (const TextChange& hunk : change.hunks) {
+        putVarint(body, hunk.position);
+        // Stored plus one so the "no cursor" value (size_t)-1 becomes a one-byte 0.
+        putVarint(body, static_cast<uint64_t>(static_cast<size_t>(hunk.cursorPositionAfter + 1)));
+        putVarint(body, hunk.deletedText.length());
+        putVarint(body, hunk.insertedText.length());
+    }
+    for (const TextChange& hunk : change.hunks) {
+        putText(body, hunk.deletedText, form);
+        putText(body, hunk.insertedText, form);
+    }
+
+    std::string packed(1, static_cast<char>(form));
+    if (body.size() > compressionThreshold) {
+        std::string compressed;
+        putVarint(compressed, body.size());
+        Lz4Compress(body.data(), body.size(), compressed);
+        if (compressed.size() < body.size()) {
+            packed[0] = static_cast<char>(form | FLAG_COMPRESSED);
+            packed += compressed;
+            packed.shrink_to_fit();
+            return packed;
+        }
+    }
+    packed += body;
+    packed.shrink_to_fit();
+    return packed;
+}
+
+bool UnpackChangeSet(const std::string& packed, ChangeSet& out) {
+    if (packed.empty()) {
+        return false;
+    }
+    const unsigned char* in = reinterpret_cast<const unsigned char*>(packed.data());
+    const unsigned char* end = in + packed.size();
+    unsigned char flags = *in++;
+    TextForm form = static_cast<TextForm>(flags & TEXT_FORM_MASK);
+
+    if (!(flags & FLAG_COMPRESSED)) {
+        return decodeBody(in, end, form, out);
+    }
+
+    uint64_t bodySize;
+    // LZ4 expands at most ~255x, which rejects absurd sizes before allocating.
+    if (!getVarint(in, end, bodySize) || bodySize > static_cast<uint64_t>(end - in) * 255) {
+        return false;
+    }
+    std::string body(static_cast<size_t>(bodySize), '\0');
+    if (!Lz4Decompress(reinterpret_cast<const char*>(in), static_cast<size_t>(end - in), &body[0], body.size())) {
+        return false;
+    }
+    const unsigned char* bodyData = reinterpret_cast<const unsigned char*>(body.data());
+    return decodeBody(bodyData, bodyData + body.size(), form, out);
+}
@@ -0,0 +1,26 @@
+#pragma once
+
+#include <string>
+#include <cstddef>    // For size_t
+#include "TextChange.h"
+
+// Compact byte encoding of a ChangeSet, used by the history to keep changes it is not
+// currently replaying small. Positions and lengths are varints, and the text of all
+// hunks is stored together in the narrowest form that holds it:
+//   - Latin-1 (one byte per unit) when every character is below U+0100,
+//   - otherwise UTF-8 style (1-4 bytes per unit) when that is shorter than
+//   - raw wchar_t units.
+// Encodings larger than 'compressionThreshold' bytes are additionally LZ4-compressed
+// when that saves space. The result lives in a std::string, so packings of up to 15
+// bytes (a typed word, a deleted character) stay inline without a heap block.
+//
+// Layout: u8 flags (bits 0-1 text form, bit 2 compressed), [varint unpacked size if
+// compressed], then (possibly compressed): varint hunk count, per hunk varint position,
+// cursor after + 1, deleted length and inserted length, then all deleted/inserted text.
+
+constexpr size_t DEFAULT_PACKING_COMPRESSION_THRESHOLD = 256;
+
+std::string PackChangeSet(const ChangeSet& change, size_t compressionThreshold = DEFAULT_PACKING_COMPRESSION_THRESHOLD);
+
+// Decodes a packing produced by PackChangeSet. Returns false if it is malformed.
+bool UnpackChangeSet(const std::string& packed, ChangeSet& out);
@@ -0,0 +1,46 @@
+#include "EditSink.h"
+
+void StringEditSink::replace(size_t position, size_t deleteCount, const std::wstring& inserted) {
+    // Clamp like the history's own apply does, so a stale position can't throw.
+    if (position > text.length()) {
+        position = text.length();
+    }
+    if (deleteCount > text.length() - position) {
+        deleteCount = text.length() - position;
+    }
+    text.replace(position, deleteCount, inserted);
+    replaceCount++;
+}
+
+void ApplyChangeSetToSink(const ChangeSet& change, EditSink& sink) {
+    if (change.hunks.empty()) {
+        return;
+    }
+
+    sink.beginEdits();
+    for (const TextChange& hunk : change.hunks) {
+        const std::wstring& inserted = hunk.insertedText;
+        const std::wstring& deleted = hunk.deletedText;
+
+        // Trim what the hunk keeps at both ends. The control then only relayouts (and
+        // moves markers and selection for) the characters that really change.
+        size_t common = inserted.length() < deleted.length() ? inserted.length() : deleted.length();
+        size_t prefix = 0;
+        while (prefix < common && inserted[prefix] == deleted[prefix]) {
+            prefix++;
+        }
+        size_t suffix = 0;
+        while (suffix < common - prefix
+            && inserted[inserted.length() - 1 - suffix] == deleted[deleted.length() - 1 - suffix]) {
+            suffix++;
+        }
+
+        size_t deleteCount = deleted.length() - prefix - suffix;
+        size_t insertCount = inserted.length() - prefix - suffix;
+        if (deleteCount == 0 && insertCount == 0) {
+            continue; // No net effect
+        }
+        sink.replace(hunk.position + prefix, deleteCount, inserted.substr(prefix, insertCount));
+    }
+    sink.endEdits();
+}
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <string>
+#include <cstddef>    // For size_t
+#include "TextChange.h"
+
+// Receiver for text patches: something holding a copy of a document (the editor
+// control, a plain string) that can replace a range of it. History navigation and
+// checkout hand their delta to a sink instead of pushing the whole new text, so the
+// cost follows the size of the change rather than the size of the file.
+//
+// Replaces arrive in the order they must be applied; each position refers to the text
+// as the previous replaces left it (the same convention as ChangeSet hunks).
+class EditSink {
+public:
+    virtual ~EditSink() = default;
+
+    // Bracket a group of replaces, e.g. to suspend redrawing until all have landed.
+    virtual void beginEdits() {}
+    virtual void endEdits() {}
+
+    // Replaces 'deleteCount' characters at 'position' with 'text'.
+    virtual void replace(size_t position, size_t deleteCount, const std::wstring& text) = 0;
+};
+
+// Headless sink patching a std::wstring, for tests, benchmarks and non-UI callers.
+class StringEditSink : public EditSink {
+public:
+    explicit StringEditSink(std::wstring& text) : text(text) {}
+
+    void replace(size_t position, size_t deleteCount, const std::wstring& inserted) override;
+
+    size_t getReplaceCount() const { return replaceCount; }
+
+private:
+    std::wstring& text;
+    size_t replaceCount = 0;
+};
+
+// Sends every hunk of 'change' to 'sink' as one batch of minimal replaces: text a hunk
+// deletes and re-inserts unchanged at either end is left out of the replace.
+void ApplyChangeSetToSink(const ChangeSet& change, EditSink& sink);
@@ -0,0 +1,334 @@
+#include "EditTrace.h"
+#include <algorithm>
+#include <filesystem>
+#include <iterator>
+
+namespace {
+    const char TRACE_MAGIC[4] = { 'T', 'E', 'T', 'R' };
+    constexpr unsigned char TRACE_VERSION = 1;
+    constexpr size_t HEADER_SIZE = 5;
+
+    void putVarint(std::string& out, uint64_t value) {
+        while (value >= 0x80) {
+            out.push_back(static_cast<char>((value & 0x7F) | 0x80));
+            value >>= 7;
+        }
+        out.push_back(static_cast<char>(value));
+    }
+
+    // One wchar_t unit per sequence (surrogate halves included), as in ChangePacking.
+    void putText(std::string& out, const std::wstring& text) {
+        putVarint(out, text.length());
+        for (wchar_t ch : text) {
+            uint32_t unit = static_cast<uint32_t>(ch);
+            if (unit < 0x80) {
+                out.push_back(static_cast<char>(unit));
+            }
+            else if (unit < 0x800) {
+                out.push_back(static_cast<char>(0xC0 | (unit >> 6)));
+                out.push_back(static_cast<char>(0x80 | (unit & 0x3F)));
+            }
+            else if (unit < 0x10000) {
+                out.push_back(static_cast<char>(0xE0 | (unit >> 12)));
+                out.push_back(static_cast<char>(0x80 | ((unit >> 6) & 0x3F)));
+                out.push_back(static_cast<char>(0x80 | (unit & 0x3F)));
+            }
+            else {
+                unit &= 0x1FFFFF; // wchar_t values past Unicode can't be represented
+                out.push_back(static_cast<char>(0xF0 | (unit >> 18)));
+                out.push_back(static_cast<char>(0x80 | ((unit >> 12) & 0x3F)));
+                out.push_back(static_cast<char>(0x80 | ((unit >> 6) & 0x3F)));
+                out.push_back(static_cast<char>(0x80 | (unit & 0x3F)));
+            }
+        }
+    }
+
+    void putChange(std::string& out, const ChangeSet& change) {
+        putVarint(out, change.hunks.size());
+        for (const TextChange& hunk : change.hunks) {
+            putVarint(out, hunk.position);
+            putVarint(out, static_cast<uint64_t>(static_cast<size_t>(hunk.cursorPositionAfter + 1)));
+            putText(out, hunk.deletedText);
+            putText(out, hunk.insertedText);
+        }
+    }
+
+    void putOutcome(std::string& out, const TraceOutcome& outcome) {
+        putVarint(out, outcome.currentNodeId);
+        putVarint(out, outcome.nodeCount);
+        putVarint(out, outcome.contentHash);
+        putVarint(out, outcome.contentLength);
+    }
+
+    // Bounds-checked decoding of one record's fields.
+    class RecordReader {
+    public:
+        RecordReader(const std::string& bytes, size_t offset)
+            : cursor(reinterpret_cast<const unsigned char*>(bytes.data()) + offset),
+              end(reinterpret_cast<const unsigned char*>(bytes.data()) + bytes.size()) {}
+
+        bool getVarint(uint64_t& value) {
+            value = 0;
+            for (unsigned shift = 0; shift < 64; shift += 7) {
+                if (cursor >= end) {
+                    return false;
+                }
+                unsigned char byte = *cursor++;
+                value |= static_cast<uint64_t>(byte & 0x7F) << shift;
+                if (!(byte & 0x80)) {
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        bool getSize(size_t& value) {
+            uint64_t raw;
+            if (!getVarint(raw) || raw > SIZE_MAX) {
+                return false;
+            }
+            value = static_cast<size_t>(raw);
+            return true;
+        }
+
+        bool getText(std::wstring& text) {
+            size_t length;
+            // Every unit takes at least one byte, which bounds the allocation.
+            if (!getSize(length) || length > static_cast<size_t>(end - cursor)) {
+                return false;
+            }
+            text.resize(length);
+            for (size_t i = 0; i < length; ++i) {
+                if (cursor >= end) return false;
+                unsigned char lead = *cursor++;
+                size_t trailing;
+                uint32_t value;
+                if (lead < 0x80)      { trailing = 0; value = lead; }
+                else if (lead < 0xC0) { return false; }
+                else if (lead < 0xE0) { trailing = 1; value = lead & 0x1F; }
+                else if (lead < 0xF0) { trailing = 2; value = lead & 0x0F; }
+                else if (lead < 0xF8) { trailing = 3; value = lead & 0x07; }
+                else                  { return false; }
+                if (static_cast<size_t>(end - cursor) < trailing) return false;
+                for (size_t t = 0; t < trailing; ++t) {
+                    value = (value << 6) | (*cursor++ & 0x3F);
+                }
+                text[i] = static_cast<wchar_t>(value);
+            }
+            return true;
+        }
+
+        bool getChange(ChangeSet& change) {
+            size_t hunkCount;
+            // Every hunk takes at least four bytes.
+            if (!getSize(hunkCount) || hunkCount > static_cast<size_t>(end - cursor) / 4) {
+                return false;
+            }
+            change.hunks.resize(hunkCount);
+            for (TextChange& hunk : change.hunks) {
+                size_t cursorAfterPlusOne;
+                if (!getSize(hunk.position) || !getSize(cursorAfterPlusOne)
+                    || !getText(hunk.deletedText) || !getText(hunk.insertedText)) {
+                    return false;
+                }
+                hunk.cursorPositionAfter = cursorAfterPlusOne - 1;
+            }
+            return true;
+        }
+
+        bool getOutcome(TraceOutcome& outcome) {
+            return getVarint(outcome.currentNodeId) && getSize(outcome.nodeCount)
+                && getVarint(outcome.contentHash) && getSize(outcome.contentLength);
+        }
+
+        size_t offsetIn(const std::string& bytes) const {
+            return static_cast<size_t>(cursor - reinterpret_cast<const unsigned char*>(bytes.data()));
+        }
+
+    private:
+        const unsigned char* cursor;
+        const unsigned char* end;
+    };
+}
+
+// --- Writing ---
+
+EditTraceWriter::EditTraceWriter(const std::wstring& path) : path(path) {}
+
+bool EditTraceWriter::open() {
+    out.open(std::filesystem::path(path), std::ios::binary | std::ios::trunc);
+    if (!out) {
+        return false;
+    }
+    out.write(TRACE_MAGIC, sizeof(TRACE_MAGIC));
+    out.put(static_cast<char>(TRACE_VERSION));
+    out.flush();
+    start = std::chrono::steady_clock::now();
+    lastMicros = 0;
+    return static_cast<bool>(out);
+}
+
+bool EditTraceWriter::isOpen() const {
+    return out.is_open() && static_cast<bool>(out);
+}
+
+const std::wstring& EditTraceWriter::getPath() const {
+    return path;
+}
+
+void EditTraceWriter::append(const TraceRecord& record) {
+    if (!isOpen()) {
+        return;
+    }
+    uint64_t now = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now() - start).count());
+    uint64_t delta = now > lastMicros ? now - lastMicros : 0;
+    lastMicros = std::max(lastMicros, now);
+
+    std::string bytes(1, static_cast<char>(record.type));
+    putVarint(bytes, delta);
+    switch (record.type) {
+    case TraceRecordType::Config:
+        putVarint(bytes, record.checkpointInterval);
+        putVarint(bytes, record.checkpointBudgetBytes);
+        putVarint(bytes, record.maxNodes);
+        putVarint(bytes, record.maxBytes);
+        putVarint(bytes, record.maxAgeSeconds);
+        putVarint(bytes, record.payloadCompression ? 1 : 0);
+        break;
+    case TraceRecordType::Root:
+        putVarint(bytes, record.nodeId);
+        putText(bytes, record.text);
+        break;
+    case TraceRecordType::Node:
+        putVarint(bytes, record.nodeId);
+        putVarint(bytes, record.parentId);
+        putText(bytes, record.text);
+        putChange(bytes, record.change);
+        break;
+    case TraceRecordType::Edit:
+        putChange(bytes, record.change);
+        break;
+    case TraceRecordType::Record:
+        putText(bytes, record.text);
+        putChange(bytes, record.change);
+        putOutcome(bytes, record.outcome);
+        break;
+    case TraceRecordType::Parent:
+        putOutcome(bytes, record.outcome);
+        break;
+    case TraceRecordType::Child:
+    case TraceRecordType::Compact:
+        putVarint(bytes, record.count);
+        putOutcome(bytes, record.outcome);
+        break;
+    case TraceRecordType::Checkout:
+    case TraceRecordType::SetCurrent:
+    case TraceRecordType::Delete:
+        putVarint(bytes, record.nodeId);
+        putOutcome(bytes, record.outcome);
+        break;
+    }
+
+    // Flushed per record, so a trace of a session that crashed still holds all of it.
+    out.write(bytes.data(), static_cast<std::streamsize>(bytes.size()));
+    out.flush();
+}
+
+void EditTraceWriter::appendEdit(const ChangeSet& change) {
+    TraceRecord record;
+    record.type = TraceRecordType::Edit;
+    record.change = change;
+    append(record);
+}
+
+void EditTraceWriter::appendOperation(TraceRecordType type, uint64_t nodeId, uint64_t count, const TraceOutcome& outcome) {
+    TraceRecord record;
+    record.type = type;
+    record.nodeId = nodeId;
+    record.count = count;
+    record.outcome = outcome;
+    append(record);
+}
+
+// --- Reading ---
+
+bool EditTraceReader::open(const std::wstring& path) {
+    std::ifstream in(std::filesystem::path(path), std::ios::binary);
+    if (!in) {
+        return false;
+    }
+    bytes.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+    offset = HEADER_SIZE;
+    elapsedMicros = 0;
+    truncated = false;
+    return bytes.size() >= HEADER_SIZE && bytes.compare(0, sizeof(TRACE_MAGIC), TRACE_MAGIC, sizeof(TRACE_MAGIC)) == 0
+        && static_cast<unsigned char>(bytes[4]) == TRACE_VERSION;
+}
+
+bool EditTraceReader::next(TraceRecord& record) {
+    if (offset >= bytes.size()) {
+        return false;
+    }
+
+    record = TraceRecord();
+    record.type = static_cast<TraceRecordType>(bytes[offset]);
+    RecordReader reader(bytes, offset + 1);
+    uint64_t delta;
+    bool ok = reader.getVarint(delta);
+    if (ok) {
+        switch (record.type) {
+        case TraceRecordType::Config: {
+            uint64_t maxAge = 0, compression = 0;
+            ok = reader.getSize(record.checkpointInterval) && reader.getSize(record.checkpointBudgetBytes)
+                && reader.getSize(record.maxNodes) && reader.getSize(record.maxBytes)
+                && reader.getVarint(maxAge) && reader.getVarint(compression);
+            record.maxAgeSeconds = maxAge;
+            record.payloadCompression = compression != 0;
+            break;
+        }
+        case TraceRecordType::Root:
+            ok = reader.getVarint(record.nodeId) && reader.getText(record.text);
+            break;
+        case TraceRecordType::Node:
+            ok = reader.getVarint(record.nodeId) && reader.getVarint(record.parentId)
+                && reader.getText(record.text) && reader.getChange(record.change);
+            break;
+        case TraceRecordType::Edit:
+            ok = reader.getChange(record.change);
+            break;
+        case TraceRecordType::Record:
+            ok = reader.getText(record.text) && reader.getChange(record.change) && reader.getOutcome(record.outcome);
+            break;
+        case TraceRecordType::Parent:
+            ok = reader.getOutcome(record.outcome);
+            break;
+        case TraceRecordType::Child:
+        case TraceRecordType::Compact:
+            ok = reader.getVarint(record.count) && reader.getOutcome(record.outcome);
+            break;
+        case TraceRecordType::Checkout:
+        case TraceRecordType::SetCurrent:
+        case TraceRecordType::Delete:
+            ok = reader.getVarint(record.nodeId) && reader.getOutcome(record.outcome);
+            break;
+        default:
+            ok = false; // Unknown record: stop, as for a torn one
+            break;
+        }
+    }
+
+    if (!ok) {
+        truncated = true;
+        offset = bytes.size();
+        return false;
+    }
+    elapsedMicros += delta;
+    record.elapsedMicros = elapsedMicros;
+    offset = reader.offsetIn(bytes);
+    return true;
+}
+
+bool EditTraceReader::isTruncated() const {
+    return truncated;
+}
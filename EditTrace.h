@@ -0,0 +1,119 @@
+#pragma once
+
+#include <string>
+#include <fstream>
+#include <chrono>
+#include <cstddef>    // For size_t
+#include <cstdint>
+#include "TextChange.h"
+
+// Binary trace of an editing session, for reproducing performance problems offline.
+// The editor appends every edit it captures and the history manager every operation
+// it performs; a replayer (see TraceReplay.h) then drives a headless history through
+// the same sequence. Each operation carries the node it ended on and the resulting
+// document's hash, so a replay can verify it stayed in step with the session.
+//
+// Layout: header "TETR", u8 version, then records: u8 type, varint microseconds since
+// the previous record, payload. Integers are LEB128 varints; text is a varint unit
+// count followed by each wchar_t unit UTF-8 encoded on its own, so a trace recorded
+// with 16-bit wchar_t replays with 32-bit wchar_t (and the other way) unit for unit.
+// Changes are a varint hunk count, then per hunk position, cursor after + 1, deleted
+// text and inserted text. A torn record at the end (a crash) is dropped by the reader.
+//
+// Record payloads:
+//   Config:   checkpoint interval, checkpoint budget, max nodes, max bytes, max age
+//             (seconds), payload compression (0/1)
+//   Root:     root node id, root text (the snapshot of the tree starts here)
+//   Node:     id, parent id, message, change (snapshot, parents first)
+//   Edit:     change captured from the editor control
+//   Record:   message, change passed to recordChange, then the outcome*
+//   Parent:   outcome*
+//   Child:    child index, outcome*
+//   Checkout: target id, outcome*
+//   SetCurrent: target id, outcome* (also closes the snapshot)
+//   Delete:   target id, outcome*
+//   Compact:  nodes to visit, outcome*
+// *outcome: current node id, node count, content hash, content length
+// Operations are traced when they take effect; calls that change nothing are left out.
+enum class TraceRecordType : uint8_t {
+    Config = 1,
+    Root = 2,
+    Node = 3,
+    Edit = 4,
+    Record = 5,
+    Parent = 6,
+    Child = 7,
+    Checkout = 8,
+    SetCurrent = 9,
+    Delete = 10,
+    Compact = 11
+};
+
+// What a history operation left behind, for checking a replay against the session.
+struct TraceOutcome {
+    uint64_t currentNodeId = 0;
+    size_t nodeCount = 0;
+    uint64_t contentHash = 0;
+    size_t contentLength = 0;
+};
+
+struct TraceRecord {
+    TraceRecordType type = TraceRecordType::Edit;
+    uint64_t elapsedMicros = 0; // Since the start of the trace
+    uint64_t nodeId = 0;        // Root, Node, Checkout, SetCurrent, Delete
+    uint64_t parentId = 0;      // Node
+    uint64_t count = 0;         // Child: child index, Compact: nodes to visit
+    std::wstring text;          // Root: root text, Node/Record: message
+    ChangeSet change;           // Node, Edit, Record
+    TraceOutcome outcome;       // History operations
+
+    // Config
+    size_t checkpointInterval = 0;
+    size_t checkpointBudgetBytes = 0;
+    size_t maxNodes = 0;
+    size_t maxBytes = 0;
+    uint64_t maxAgeSeconds = 0;
+    bool payloadCompression = false;
+};
+
+class EditTraceWriter {
+public:
+    explicit EditTraceWriter(const std::wstring& path);
+
+    // Creates the file (replacing any existing one) and writes the header.
+    bool open();
+    bool isOpen() const;
+    const std::wstring& getPath() const;
+
+    // Writes 'record'; its elapsed time is taken from the clock, not the record.
+    void append(const TraceRecord& record);
+
+    // Shorthands for the editor and the history manager.
+    void appendEdit(const ChangeSet& change);
+    void appendOperation(TraceRecordType type, uint64_t nodeId, uint64_t count, const TraceOutcome& outcome);
+
+private:
+    std::wstring path;
+    std::ofstream out;
+    std::chrono::steady_clock::time_point start;
+    uint64_t lastMicros = 0;
+};
+
+// Reads a trace written by EditTraceWriter, one record at a time.
+class EditTraceReader {
+public:
+    // Reads the whole file. Returns false if it is missing or not a trace.
+    bool open(const std::wstring& path);
+
+    // Returns false at the end of the trace (or at a torn or unknown record).
+    bool next(TraceRecord& record);
+
+    // True if reading stopped before the end of the file.
+    bool isTruncated() const;
+
+private:
+    std::string bytes;
+    size_t offset = 0;
+    uint64_t elapsedMicros = 0;
+    bool truncated = false;
+};
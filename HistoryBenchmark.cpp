@@ -0,0 +1,1746 @@
+// Benchmarks for the history engine (history_core). Builds synthetic histories with
+// a seeded generator, so runs are comparable between commits and machines.
+//
+// Usage: history_bench [--quick] [--json <file>] [--filter <substring>]
+//   --quick   smaller sizes, for a fast sanity run
+//   --json    also write the results as JSON, for regression tracking
+//   --filter  only run benchmarks whose name contains the substring
+
+#include "VersionHistoryManager.h"
+#include "BlobStore.h"
+#include "ChangeCapture.h"
+#include "EditSink.h"
+#include "HistoryTreeModel.h"
+#include "HistorySnapshot.h"
+#include "HistoryWorker.h"
+#include "TextFile.h"
+#include "Metrics.h"
+#include "Timeline.h"
+#include "TraceReplay.h"
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <mutex>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace {
+    using Clock = std::chrono::steady_clock;
+
+    double elapsedMs(Clock::time_point start) {
+        return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+    }
+
+    // One benchmark run: its name plus named numbers (parameters and measurements),
+    // kept in insertion order so the table and the JSON read the same way.
+    struct BenchmarkResult {
+        std::string name;
+        std::vector<std::pair<std::string, double>> values;
+
+        BenchmarkResult& add(const std::string& key, double value) {
+            values.emplace_back(key, value);
+            return *this;
+        }
+    };
+
+    std::vector<BenchmarkResult> results;
+    size_t failedChecks = 0; // Benchmarks that verify results count mismatches here
+
+    BenchmarkResult& addResult(const std::string& name) {
+        results.push_back(BenchmarkResult{ name, {} });
+        return results.back();
+    }
+
+    void printResult(const BenchmarkResult& result) {
+        printf("%-24s", result.name.c_str());
+        for (const auto& value : result.values) {
+            printf("  %s=%.6g", value.first.c_str(), value.second);
+        }
+        printf("\n");
+        fflush(stdout);
+    }
+
+    std::string jsonEscape(const std::string& text) {
+        std::string escaped;
+        for (char ch : text) {
+            if (ch == '"' || ch == '\\') escaped.push_back('\\');
+            escaped.push_back(ch);
+        }
+        return escaped;
+    }
+
+    bool writeJson(const std::string& path, bool quick) {
+        std::ofstream out(path, std::ios::binary | std::ios::trunc);
+        if (!out) {
+            return false;
+        }
+        out << "{\n  \"suite\": \"history_core\",\n  \"quick\": " << (quick ? "true" : "false")
+            << ",\n  \"benchmarks\": [\n";
+        for (size_t i = 0; i < results.size(); ++i) {
+            out << "    { \"name\": \"" << jsonEscape(results[i].name) << "\"";
+            for (const auto& value : results[i].values) {
+                char number[64];
+                snprintf(number, sizeof(number), "%.9g", value.second);
+                out << ", \"" << jsonEscape(value.first) << "\": " << number;
+            }
+            out << " }" << (i + 1 < results.size() ? "," : "") << "\n";
+        }
+        out << "  ]\n}\n";
+        return static_cast<bool>(out);
+    }
+
+    // --- Synthetic editing ---
+
+    // Produces typing-like edits: mostly short insertions, some deletions and the odd
+    // replacement, at random positions of a document whose length it tracks.
+    class EditGenerator {
+    public:
+        explicit EditGenerator(uint64_t seed) : rng(seed) {}
+
+        ChangeSet next(size_t documentLength) {
+            TextChange change;
+            change.position = pick(documentLength + 1);
+            unsigned kind = static_cast<unsigned>(pick(10));
+            if (kind < 7 || documentLength == 0) {
+                change.insertedText = word(1 + pick(8));
+            }
+            else {
+                size_t available = documentLength - std::min(change.position, documentLength);
+                if (available == 0) {
+                    change.position = documentLength > 0 ? documentLength - 1 : 0;
+                    available = documentLength - change.position;
+                }
+                // recordChange takes the deleted text from the document; only the length matters.
+                change.deletedText.assign(std::min<size_t>(available, 1 + pick(6)), L'?');
+                if (kind == 9) {
+                    change.insertedText = word(1 + pick(6));
+                }
+            }
+            change.cursorPositionAfter = change.position + change.insertedText.length();
+            return ChangeSet(std::move(change));
+        }
+
+        size_t pick(size_t bound) {
+            return bound == 0 ? 0 : static_cast<size_t>(rng() % bound);
+        }
+
+        std::wstring word(size_t length) {
+            static const wchar_t alphabet[] = L"etaoinshrdlu cmfwypvbgkqjxz\r";
+            std::wstring text(length, L' ');
+            for (wchar_t& ch : text) {
+                ch = alphabet[pick(sizeof(alphabet) / sizeof(alphabet[0]) - 1)];
+            }
+            return text;
+        }
+
+    private:
+        std::mt19937_64 rng;
+    };
+
+    void recordEdits(VersionHistoryManager& history, EditGenerator& edits, size_t count) {
+        for (size_t i = 0; i < count; ++i) {
+            history.recordChange(edits.next(history.getCurrentDocument().length()));
+        }
+    }
+
+    // Every node of the tree, root first.
+    std::vector<std::shared_ptr<HistoryNode>> collectNodes(const VersionHistoryManager& history) {
+        std::vector<std::shared_ptr<HistoryNode>> nodes;
+        nodes.push_back(std::const_pointer_cast<HistoryNode>(history.getHistoryTreeRoot()));
+        for (size_t i = 0; i < nodes.size(); ++i) {
+            for (const auto& child : nodes[i]->children) {
+                nodes.push_back(child);
+            }
+        }
+        return nodes;
+    }
+
+    // A tree of 'nodeCount' versions: mostly linear runs of edits, but every so often
+    // the writer goes back a few versions and branches off, like exploring alternatives.
+    void buildBranchyHistory(VersionHistoryManager& history, EditGenerator& edits, size_t nodeCount) {
+        for (size_t i = 0; i < nodeCount; ++i) {
+            if (edits.pick(16) == 0) {
+                size_t back = 1 + edits.pick(24);
+                while (back-- > 0 && history.moveCurrentNodeToParent()) {
+                }
+            }
+            history.recordChange(edits.next(history.getCurrentDocument().length()));
+        }
+    }
+
+    // --- Benchmarks ---
+
+    void benchRecordChange(size_t nodeCount, bool compressed) {
+        VersionHistoryManager history(L"");
+        history.setPayloadCompression(compressed);
+        EditGenerator edits(1);
+
+        Clock::time_point start = Clock::now();
+        recordEdits(history, edits, nodeCount);
+        double ms = elapsedMs(start);
+
+        printResult(addResult("record_change")
+            .add("nodes", static_cast<double>(nodeCount))
+            .add("compressed", compressed ? 1 : 0)
+            .add("total_ms", ms)
+            .add("us_per_op", ms * 1000.0 / nodeCount)
+            .add("ops_per_sec", nodeCount / (ms / 1000.0))
+            .add("history_bytes_per_node", static_cast<double>(history.getHistoryBytes()) / history.getNodeCount()));
+    }
+
+    // Cost of producing the text of a version 'depth' edits below the root, with and
+    // without checkpoints. Targets are spread over the deepest quarter of the chain.
+    void benchReconstruction(size_t depth, size_t checkpointInterval, size_t samples) {
+        VersionHistoryManager history(L"");
+        history.setCheckpointPolicy(checkpointInterval, VersionHistoryManager::DEFAULT_CHECKPOINT_BUDGET_BYTES);
+        history.setStateCacheBudget(0); // Every sample pays for a full reconstruction
+        EditGenerator edits(2);
+        recordEdits(history, edits, depth);
+
+        std::vector<std::shared_ptr<const HistoryNode>> chain;
+        for (auto node = history.getCurrentNode(); node; node = node->parent ? node->parent->shared_from_this() : nullptr) {
+            chain.push_back(node);
+        }
+
+        size_t characters = 0;
+        Clock::time_point start = Clock::now();
+        for (size_t i = 0; i < samples; ++i) {
+            const auto& target = chain[edits.pick(chain.size() / 4 + 1)];
+            characters += history.reconstructStateToNode(target).length();
+        }
+        double ms = elapsedMs(start);
+
+        printResult(addResult("reconstruct_vs_depth")
+            .add("depth", static_cast<double>(depth))
+            .add("checkpoint_interval", static_cast<double>(checkpointInterval))
+            .add("samples", static_cast<double>(samples))
+            .add("avg_chars", static_cast<double>(characters) / samples)
+            .add("us_per_op", ms * 1000.0 / samples));
+    }
+
+    // Going back and forth between a few versions of a long chain, as in the history
+    // dialog: with the state cache off, then on. A quarter of the lookups go a few
+    // versions below one of them instead, which starts from the cached ancestor.
+    void benchStateCache(size_t depth, size_t workingSet, size_t samples) {
+        EditGenerator edits(10);
+        std::wstring initial;
+        while (initial.length() < 64 * 1024) {
+            initial += edits.word(2 + edits.pick(8)) + L' ';
+        }
+        VersionHistoryManager history(initial);
+        recordEdits(history, edits, depth);
+
+        std::vector<std::shared_ptr<const HistoryNode>> chain;
+        for (auto node = history.getCurrentNode(); node; node = node->parent ? node->parent->shared_from_this() : nullptr) {
+            chain.push_back(node);
+        }
+        std::vector<size_t> favourites;
+        for (size_t i = 0; i < workingSet; ++i) {
+            favourites.push_back(16 + edits.pick(chain.size() - 16)); // Room for nodes below
+        }
+        std::vector<std::shared_ptr<const HistoryNode>> targets;
+        for (size_t i = 0; i < samples; ++i) {
+            size_t position = favourites[edits.pick(workingSet)];
+            if (edits.pick(4) == 0) {
+                position -= 1 + edits.pick(8); // Towards the current node, i.e. deeper
+            }
+            targets.push_back(chain[position]);
+        }
+
+        std::vector<uint64_t> expected; // Hashes, so the results are not all kept around
+        double uncachedMs = 0;
+        double cachedMs = 0;
+        for (size_t budget : { size_t(0), VersionHistoryManager::DEFAULT_STATE_CACHE_BUDGET_BYTES }) {
+            history.clearStateCache();
+            history.setStateCacheBudget(budget);
+            VersionHistoryManager::StateCacheStats before = history.getStateCacheStats();
+            std::vector<uint64_t> texts;
+            Clock::time_point start = Clock::now();
+            for (const auto& target : targets) {
+                texts.push_back(PieceTable::hashText(history.reconstructStateToNode(target)));
+            }
+            double ms = elapsedMs(start);
+            if (budget == 0) {
+                uncachedMs = ms;
+                expected = std::move(texts);
+                continue;
+            }
+            cachedMs = ms;
+            if (texts != expected) {
+                failedChecks++;
+            }
+
+            VersionHistoryManager::StateCacheStats stats = history.getStateCacheStats();
+            uint64_t lookups = (stats.hits + stats.ancestorHits + stats.misses) - (before.hits + before.ancestorHits + before.misses);
+            printResult(addResult("state_cache")
+                .add("depth", static_cast<double>(depth))
+                .add("working_set", static_cast<double>(workingSet))
+                .add("samples", static_cast<double>(samples))
+                .add("hit_rate", static_cast<double>((stats.hits - before.hits) + (stats.ancestorHits - before.ancestorHits)) / lookups)
+                .add("ancestor_hits", static_cast<double>(stats.ancestorHits - before.ancestorHits))
+                .add("cached_bytes", static_cast<double>(stats.bytes))
+                .add("uncached_us_per_op", uncachedMs * 1000.0 / samples)
+                .add("cached_us_per_op", cachedMs * 1000.0 / samples)
+                .add("speedup", uncachedMs / cachedMs));
+        }
+    }
+
+    // Looking a text up in the state index, for texts that are in the tree and one
+    // that is not. The texts are reconstructed up front and not timed.
+    void benchFindMatchingState(size_t nodeCount, size_t samples) {
+        VersionHistoryManager history(L"");
+        EditGenerator edits(3);
+        buildBranchyHistory(history, edits, nodeCount);
+        std::vector<std::shared_ptr<HistoryNode>> nodes = collectNodes(history);
+
+        std::vector<std::wstring> states;
+        for (size_t i = 0; i < samples; ++i) {
+            states.push_back(history.reconstructStateToNode(nodes[edits.pick(nodes.size())]));
+        }
+        std::wstring missing = states.front() + L"\rnot in the history";
+
+        size_t found = 0;
+        Clock::time_point start = Clock::now();
+        for (const std::wstring& state : states) {
+            found += history.findNodeMatchingState(state) ? 1 : 0;
+        }
+        double hitMs = elapsedMs(start);
+
+        start = Clock::now();
+        for (size_t i = 0; i < samples; ++i) {
+            found += history.findNodeMatchingState(missing) ? 1 : 0;
+        }
+        double missMs = elapsedMs(start);
+
+        printResult(addResult("find_matching_state")
+            .add("nodes", static_cast<double>(history.getNodeCount()))
+            .add("samples", static_cast<double>(samples))
+            .add("found", static_cast<double>(found))
+            .add("hit_us_per_op", hitMs * 1000.0 / samples)
+            .add("miss_us_per_op", missMs * 1000.0 / samples));
+    }
+
+    // The node tree itself at scale: recording 'nodeCount' versions with some branching,
+    // walking from the deepest leaf to the root through the parent links, and deleting
+    // the root's whole subtree. Recording is split into the same edits applied to a bare
+    // piece table (the live document) and the rest (the node, its payload and indexes).
+    void benchNodeTree(size_t nodeCount) {
+        VersionHistoryManager history(L"");
+        EditGenerator edits(13);
+        Clock::time_point start = Clock::now();
+        buildBranchyHistory(history, edits, nodeCount);
+        double insertMs = elapsedMs(start);
+
+        PieceTable document;
+        EditGenerator documentEdits(13);
+        start = Clock::now();
+        for (size_t i = 0; i < nodeCount; ++i) {
+            document.applyChange(documentEdits.next(document.length()));
+        }
+        double documentMs = elapsedMs(start);
+
+        const HistoryNode* leaf = history.getCurrentNode().get();
+        for (const auto& node : collectNodes(history)) {
+            if (node->depth > leaf->depth) {
+                leaf = node.get();
+            }
+        }
+        const size_t walks = 10;
+        size_t steps = 0;
+        start = Clock::now();
+        for (size_t i = 0; i < walks; ++i) {
+            for (const HistoryNode* node = leaf; node->parent; node = node->parent) {
+                steps++;
+            }
+        }
+        double walkMs = elapsedMs(start);
+        if (steps != walks * leaf->depth) { // No compaction ran, so depth is exact
+            failedChecks++;
+        }
+
+        auto root = std::const_pointer_cast<HistoryNode>(history.getHistoryTreeRoot());
+        history.setCurrentNode(root);
+        size_t nodesBefore = history.getNodeCount();
+        std::vector<std::shared_ptr<HistoryNode>> subtrees = root->children;
+        start = Clock::now();
+        for (auto& subtree : subtrees) {
+            if (!history.deleteNode(subtree)) {
+                failedChecks++;
+            }
+            subtree.reset();
+        }
+        double deleteMs = elapsedMs(start);
+        if (history.getNodeCount() != 1) {
+            failedChecks++;
+        }
+
+        printResult(addResult("node_tree")
+            .add("nodes", static_cast<double>(nodesBefore))
+            .add("insert_us_per_node", insertMs * 1000.0 / nodeCount)
+            .add("document_us_per_edit", documentMs * 1000.0 / nodeCount)
+            .add("depth", static_cast<double>(leaf->depth))
+            .add("walk_ns_per_node", walkMs * 1e6 / steps)
+            .add("delete_ms", deleteMs)
+            .add("delete_ns_per_node", deleteMs * 1e6 / (nodesBefore - 1)));
+    }
+
+    // Deleting a branch that is one long chain, including freeing its nodes.
+    void benchDeleteDeepBranch(size_t depth) {
+        VersionHistoryManager history(L"");
+        history.setCheckpointPolicy(0, 0);
+        EditGenerator edits(4);
+
+        Clock::time_point start = Clock::now();
+        recordEdits(history, edits, depth);
+        double buildMs = elapsedMs(start);
+
+        auto root = std::const_pointer_cast<HistoryNode>(history.getHistoryTreeRoot());
+        history.setCurrentNode(root);
+        std::shared_ptr<HistoryNode> branch = root->children.front();
+
+        start = Clock::now();
+        bool deleted = history.deleteNode(branch);
+        branch.reset();
+        double deleteMs = elapsedMs(start);
+
+        printResult(addResult("delete_deep_branch")
+            .add("depth", static_cast<double>(depth))
+            .add("deleted", deleted ? 1 : 0)
+            .add("build_ms", buildMs)
+            .add("delete_ms", deleteMs)
+            .add("ns_per_node", deleteMs * 1e6 / depth));
+    }
+
+    // Walking the history one version at a time: with the delta patched into a text
+    // held by the caller, versus flattening the whole document after every step.
+    void benchNavigation(size_t depth) {
+        VersionHistoryManager history(L"");
+        EditGenerator edits(5);
+        recordEdits(history, edits, depth);
+
+        std::wstring text = history.getCurrentState();
+        StringEditSink sink(text);
+        Clock::time_point start = Clock::now();
+        size_t steps = 0;
+        while (history.stepToParent(sink)) {
+            steps++;
+        }
+        while (history.stepToChild(sink)) {
+            steps++;
+        }
+        double patchMs = elapsedMs(start);
+        bool consistent = history.currentStateEquals(text);
+
+        size_t flattened = 0;
+        start = Clock::now();
+        for (size_t i = 0; i < depth && history.moveCurrentNodeToParent(); ++i) {
+            flattened += history.getCurrentState().length();
+        }
+        double flattenMs = elapsedMs(start);
+
+        printResult(addResult("navigate_step")
+            .add("depth", static_cast<double>(depth))
+            .add("steps", static_cast<double>(steps))
+            .add("consistent", consistent ? 1 : 0)
+            .add("patch_us_per_step", patchMs * 1000.0 / steps)
+            .add("flatten_us_per_step", flattenMs * 1000.0 / depth)
+            .add("avg_chars", static_cast<double>(flattened) / depth));
+    }
+
+    // A chain of single-keystroke changes: runs of typing (and the odd backspace) at one
+    // spot, then a jump elsewhere, as replay sees them between two checkpoints.
+    std::vector<TextChange> typingChain(EditGenerator& edits, size_t documentLength, size_t count) {
+        std::vector<TextChange> chain;
+        chain.reserve(count);
+        size_t cursor = edits.pick(documentLength + 1);
+        size_t runLeft = 0;
+        for (size_t i = 0; i < count; ++i) {
+            if (runLeft == 0) {
+                cursor = edits.pick(documentLength + 1);
+                runLeft = 1 + edits.pick(40);
+            }
+            runLeft--;
+            TextChange change;
+            if (cursor > 0 && edits.pick(8) == 0) {
+                change.position = cursor - 1;
+                change.deletedText = L"?"; // Applying only needs the length
+                documentLength--;
+                cursor--;
+            }
+            else {
+                change.position = cursor;
+                change.insertedText = edits.word(1);
+                documentLength++;
+                cursor++;
+            }
+            change.cursorPositionAfter = cursor;
+            chain.push_back(std::move(change));
+        }
+        return chain;
+    }
+
+    // Replaying a chain of 'chainLength' changes onto a 'megabytes' document three ways:
+    // copying the text for every change (applyChangeToString), patching one buffer change
+    // by change, and applyChangesInPlace folding runs of typing into one shift each. The
+    // per-change paths move the whole document every step, so past 'budgetBytes' they
+    // are timed on a prefix of the chain and projected to the whole of it.
+    void benchApplyChanges(size_t megabytes, size_t chainLength, double budgetBytes) {
+        EditGenerator edits(11);
+        std::wstring document = edits.word(megabytes * 1024 * 1024 / sizeof(wchar_t));
+        std::vector<TextChange> chain = typingChain(edits, document.length(), chainLength);
+        double documentBytes = static_cast<double>(document.length() * sizeof(wchar_t));
+        size_t prefix = std::min(chainLength, std::max<size_t>(10, static_cast<size_t>(budgetBytes / documentBytes)));
+
+        std::wstring copied = document;
+        Clock::time_point start = Clock::now();
+        for (size_t i = 0; i < prefix; ++i) {
+            copied = VersionHistoryManager::applyChangeToString(copied, ChangeSet(chain[i]));
+        }
+        double copyMs = elapsedMs(start);
+
+        std::wstring patched = document;
+        start = Clock::now();
+        for (size_t i = 0; i < prefix; ++i) {
+            VersionHistoryManager::applyChangeInPlace(patched, chain[i]);
+        }
+        double patchMs = elapsedMs(start);
+
+        std::vector<const TextChange*> changes;
+        for (const TextChange& change : chain) {
+            changes.push_back(&change);
+        }
+        std::wstring batched = document;
+        VersionHistoryManager::applyChangesInPlace(batched, std::vector<const TextChange*>(changes.begin(), changes.begin() + prefix));
+        if (PieceTable::hashText(batched) != PieceTable::hashText(copied) || batched != patched) {
+            failedChecks++;
+        }
+        batched = document;
+        start = Clock::now();
+        VersionHistoryManager::applyChangesInPlace(batched, changes);
+        double batchMs = elapsedMs(start);
+
+        double projection = static_cast<double>(chainLength) / prefix;
+        printResult(addResult("apply_changes")
+            .add("document_mb", documentBytes / (1024 * 1024))
+            .add("changes", static_cast<double>(chainLength))
+            .add("timed_prefix", static_cast<double>(prefix))
+            .add("copy_ms", copyMs * projection)
+            .add("in_place_ms", patchMs * projection)
+            .add("batched_ms", batchMs)
+            .add("speedup_vs_copy", copyMs * projection / batchMs));
+    }
+
+    // A journal of 'entryCount' edits: writing it out, opening it again (record headers
+    // only, changes are decoded on demand), stepping through the history, which should
+    // not touch the file, and compaction rewriting it down to the tree that is left.
+    // Parent, then child ids, of every node in breadth-first order: equal for two trees
+    // exactly when they have the same nodes with children in the same order.
+    std::vector<uint64_t> describeTreeOrder(const VersionHistoryManager& history) {
+        std::vector<uint64_t> order;
+        for (const auto& node : collectNodes(history)) {
+            order.push_back(node->id);
+            for (const auto& child : node->children) {
+                order.push_back(child->id);
+            }
+        }
+        return order;
+    }
+
+    // A squashed run of automatic commits must come back from the journal where it was
+    // among its parent's children, not moved after its siblings. The run is squashed by
+    // appended records (a few removed nodes don't make the journal worth rewriting), so
+    // the reload replays them.
+    void checkJournalSquashOrder() {
+        std::filesystem::path path = std::filesystem::temp_directory_path() / "history_bench_squash.txt.history";
+        std::filesystem::remove(path);
+        std::vector<uint64_t> expected;
+        {
+            VersionHistoryManager history(L"");
+            for (int i = 0; i < 20; ++i) {
+                history.recordChange(TextChange(0, L"s", L""), L"Step " + std::to_wstring(i));
+            }
+            std::shared_ptr<HistoryNode> branchPoint = history.getMutableCurrentNode();
+            history.recordChange(TextChange(0, L"x", L""), L"Left");
+            history.setCurrentNode(branchPoint);
+            for (int i = 0; i < 4; ++i) {
+                history.recordChange(TextChange(0, L"a", L"")); // Auto commits: squashable
+            }
+            history.recordChange(TextChange(0, L"t", L""), L"Tip");
+            history.setCurrentNode(branchPoint);
+            history.recordChange(TextChange(0, L"y", L""), L"Right");
+            if (!history.attachJournal(path.wstring())) {
+                failedChecks++;
+                return;
+            }
+
+            VersionHistoryManager::RetentionPolicy policy;
+            policy.maxNodes = 1;
+            history.setRetentionPolicy(policy);
+            while (!history.compactHistory().finished) {
+            }
+            expected = describeTreeOrder(history);
+            if (branchPoint->children.size() != 3 || branchPoint->children[1]->children.size() != 1) {
+                failedChecks++; // The run wasn't squashed into one node between its siblings
+            }
+        }
+        std::unique_ptr<VersionHistoryManager> reloaded = VersionHistoryManager::loadFromJournal(path.wstring());
+        if (!reloaded || describeTreeOrder(*reloaded) != expected) {
+            failedChecks++;
+        }
+        reloaded.reset();
+        std::filesystem::remove(path);
+    }
+
+    // A change whose journal record fails its checksum (found only when it is first
+    // read) must never be replayed as an empty change: loading stops above it, and
+    // moves and checkouts through it are refused without touching the text.
+    void checkDamagedJournalChange() {
+        std::filesystem::path path = std::filesystem::temp_directory_path() / "history_bench_damaged.txt.history";
+        std::filesystem::remove(path);
+        std::vector<uint64_t> ids;
+        {
+            VersionHistoryManager history(L"");
+            history.recordChange(TextChange(0, L"alpha ", L""), L"First");
+            history.recordChange(TextChange(6, L"[damaged part]", L""), L"Second");
+            history.recordChange(TextChange(20, L" gamma", L""), L"Third");
+            for (const auto& node : collectNodes(history)) {
+                ids.push_back(node->id);
+            }
+            if (!history.attachJournal(path.wstring())) {
+                failedChecks++;
+                return;
+            }
+        }
+
+        // Flip one character of the second change's inserted text.
+        std::string bytes;
+        {
+            std::ifstream in(path, std::ios::binary);
+            bytes.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+        }
+        const std::wstring marker = L"damaged";
+        std::string markerBytes(reinterpret_cast<const char*>(marker.data()), marker.size() * sizeof(wchar_t));
+        size_t at = bytes.find(markerBytes);
+        if (at == std::string::npos) {
+            failedChecks++;
+            std::filesystem::remove(path);
+            return;
+        }
+        bytes[at] ^= 0x01;
+        {
+            std::ofstream out(path, std::ios::binary | std::ios::trunc);
+            out.write(bytes.data(), bytes.size());
+        }
+
+        std::unique_ptr<VersionHistoryManager> loaded = VersionHistoryManager::loadFromJournal(path.wstring());
+        if (!loaded || loaded->getCurrentNode()->id != ids[1] || !loaded->currentStateEquals(L"alpha ")) {
+            failedChecks++;
+            std::filesystem::remove(path);
+            return;
+        }
+        std::vector<std::shared_ptr<HistoryNode>> nodes = collectNodes(*loaded);
+        std::vector<std::wstring> branches = loaded->getRedoBranchDescriptions();
+        if (loaded->moveCurrentNodeToChild(0) || loaded->checkoutNode(nodes.back())
+            || loaded->setCurrentNode(nodes.back()) || loaded->findNodeMatchingState(L"alpha [damaged part] gamma")
+            || loaded->getCurrentNode()->id != ids[1] || !loaded->currentStateEquals(L"alpha ")
+            || branches.size() != 1 || branches[0].find(L"(damaged)") == std::wstring::npos) {
+            failedChecks++;
+        }
+        // The snapshot path refuses the same way.
+        std::shared_ptr<const HistorySnapshot> snapshot = loaded->getSnapshot();
+        try {
+            snapshot->reconstructDocument(snapshot->size() - 1);
+            failedChecks++;
+        }
+        catch (const DamagedHistoryError&) {
+        }
+        loaded.reset();
+        std::filesystem::remove(path);
+    }
+
+    // Two tabs on one document: the first journals, the second (loading the journal
+    // while the first writes it) keeps its history in memory, however it spells the
+    // path and even after the first is closed, so the file holds one tree only.
+    void checkJournalOpenInTwoTabs() {
+        std::filesystem::path directory = std::filesystem::temp_directory_path();
+        std::filesystem::path path = directory / "history_bench_tabs.txt.history";
+        std::filesystem::path otherSpelling = directory / "." / "history_bench_tabs.txt.history";
+        std::filesystem::remove(path);
+        std::wstring firstText;
+        size_t firstNodes;
+        {
+            auto first = std::make_unique<VersionHistoryManager>(L"");
+            EditGenerator edits(21);
+            recordEdits(*first, edits, 50);
+            if (!first->attachJournal(path.wstring())) {
+                failedChecks++;
+                return;
+            }
+            std::unique_ptr<VersionHistoryManager> second = VersionHistoryManager::loadFromJournal(path.wstring());
+            VersionHistoryManager third(L"");
+            if (!second || second->attachJournal(path.wstring()) || second->attachJournal(otherSpelling.wstring())
+                || third.attachJournal(otherSpelling.wstring())) {
+                failedChecks++;
+            }
+            recordEdits(*first, edits, 50);
+            if (second) {
+                recordEdits(*second, edits, 50);
+            }
+            firstText = first->getCurrentState();
+            firstNodes = first->getNodeCount();
+            first.reset();
+            if (second && second->attachJournal(path.wstring())) {
+                failedChecks++; // Its tree lacks the first tab's later nodes
+            }
+        }
+        std::unique_ptr<VersionHistoryManager> reloaded = VersionHistoryManager::loadFromJournal(path.wstring());
+        if (!reloaded || reloaded->getNodeCount() != firstNodes || !reloaded->currentStateEquals(firstText)) {
+            failedChecks++;
+        }
+        reloaded.reset();
+        std::filesystem::remove(path);
+    }
+
+    void benchJournal(size_t entryCount) {
+        std::filesystem::path path = std::filesystem::temp_directory_path() / "history_bench.txt.history";
+        std::filesystem::remove(path);
+        std::wstring finalText;
+        size_t nodeCount;
+        Clock::time_point start;
+        double writeMs;
+        {
+            VersionHistoryManager history(L"");
+            EditGenerator edits(12);
+            recordEdits(history, edits, entryCount);
+            finalText = history.getCurrentState();
+            nodeCount = history.getNodeCount();
+            start = Clock::now();
+            if (!history.attachJournal(path.wstring())) {
+                failedChecks++;
+            }
+            writeMs = elapsedMs(start);
+        }
+        double fileBytes = static_cast<double>(std::filesystem::file_size(path));
+
+        start = Clock::now();
+        std::unique_ptr<VersionHistoryManager> loaded = VersionHistoryManager::loadFromJournal(path.wstring());
+        double loadMs = elapsedMs(start);
+        if (!loaded || loaded->getNodeCount() != nodeCount || !loaded->currentStateEquals(finalText)) {
+            failedChecks++;
+            std::filesystem::remove(path);
+            return;
+        }
+
+        // Undo and redo through a stretch of history and back to where it started.
+        loaded->attachJournal(path.wstring());
+        const size_t steps = std::min<size_t>(1000, entryCount);
+        start = Clock::now();
+        for (size_t i = 0; i < steps; ++i) {
+            loaded->moveCurrentNodeToParent();
+        }
+        for (size_t i = 0; i < steps; ++i) {
+            loaded->moveCurrentNodeToChild();
+        }
+        double stepMs = elapsedMs(start);
+        loaded->detachJournal();
+        double navigationBytes = static_cast<double>(std::filesystem::file_size(path)) - fileBytes;
+        if (navigationBytes != 0) {
+            failedChecks++;
+        }
+
+        // Squash the history down to a quarter; once the pass finishes the journal is
+        // rewritten with only what is left.
+        VersionHistoryManager::RetentionPolicy policy;
+        policy.maxNodes = nodeCount / 4;
+        loaded->setRetentionPolicy(policy);
+        loaded->attachJournal(path.wstring());
+        start = Clock::now();
+        while (!loaded->compactHistory(4096).finished) {
+        }
+        double compactMs = elapsedMs(start);
+        size_t compactedNodes = loaded->getNodeCount();
+        loaded.reset();
+        double compactedBytes = static_cast<double>(std::filesystem::file_size(path));
+        std::unique_ptr<VersionHistoryManager> reloaded = VersionHistoryManager::loadFromJournal(path.wstring());
+        if (!reloaded || reloaded->getNodeCount() != compactedNodes || !reloaded->currentStateEquals(finalText)
+            || compactedBytes >= fileBytes) {
+            failedChecks++;
+        }
+        reloaded.reset();
+        std::filesystem::remove(path);
+        checkJournalSquashOrder();
+        checkDamagedJournalChange();
+        checkJournalOpenInTwoTabs();
+
+        printResult(addResult("journal_load")
+            .add("entries", static_cast<double>(entryCount))
+            .add("file_mb", fileBytes / (1024 * 1024))
+            .add("write_ms", writeMs)
+            .add("load_ms", loadMs)
+            .add("load_us_per_entry", loadMs * 1000.0 / entryCount)
+            .add("step_us", stepMs * 1000.0 / (2 * steps))
+            .add("navigation_bytes", navigationBytes)
+            .add("compact_ms", compactMs)
+            .add("compacted_nodes", static_cast<double>(compactedNodes))
+            .add("compacted_file_pct", 100.0 * compactedBytes / fileBytes));
+    }
+
+    // Checking out random versions of a branchy tree, which goes through their lowest
+    // common ancestor when that is shorter than rebuilding from a checkpoint.
+    void benchCheckout(size_t nodeCount, size_t samples) {
+        VersionHistoryManager history(L"");
+        EditGenerator edits(6);
+        buildBranchyHistory(history, edits, nodeCount);
+        std::vector<std::shared_ptr<HistoryNode>> nodes = collectNodes(history);
+
+        // Nearby targets (a few edges away) are the common case in the history dialog.
+        Clock::time_point start = Clock::now();
+        for (size_t i = 0; i < samples; ++i) {
+            std::shared_ptr<HistoryNode> target = history.getMutableCurrentNode();
+            for (size_t up = edits.pick(4); up > 0 && target->parent; --up) {
+                target = target->parent->shared_from_this();
+            }
+            while (!target->children.empty() && edits.pick(3) != 0) {
+                target = target->children[edits.pick(target->children.size())];
+            }
+            history.checkoutNode(target);
+        }
+        double nearMs = elapsedMs(start);
+
+        start = Clock::now();
+        for (size_t i = 0; i < samples; ++i) {
+            history.checkoutNode(nodes[edits.pick(nodes.size())]);
+        }
+        double randomMs = elapsedMs(start);
+
+        printResult(addResult("checkout")
+            .add("nodes", static_cast<double>(nodes.size()))
+            .add("samples", static_cast<double>(samples))
+            .add("near_us_per_op", nearMs * 1000.0 / samples)
+            .add("random_us_per_op", randomMs * 1000.0 / samples));
+    }
+
+    // Diffing the editor text against the last recorded version (the fallback path
+    // when an edit can't be derived from the selection).
+    void benchCalculateTextChange(size_t documentLength, size_t samples) {
+        EditGenerator edits(7);
+        VersionHistoryManager history(L"");
+        while (history.getCurrentDocument().length() < documentLength) {
+            TextChange append(history.getCurrentDocument().length(), std::wstring(64, L'a' + static_cast<wchar_t>(edits.pick(26))), L"");
+            history.recordChange(ChangeSet(append));
+        }
+        const PieceTable& before = history.getCurrentDocument();
+        std::wstring baseline = before.toString();
+
+        size_t hunks = 0;
+        Clock::time_point start = Clock::now();
+        for (size_t i = 0; i < samples; ++i) {
+            std::wstring after = baseline;
+            for (size_t edit = 0; edit < 3; ++edit) {
+                after.insert(edits.pick(after.length() + 1), L"edit");
+            }
+            hunks += CalculateTextChange(before, after, 0).hunks.size();
+        }
+        double ms = elapsedMs(start);
+
+        printResult(addResult("calculate_text_change")
+            .add("chars", static_cast<double>(baseline.length()))
+            .add("samples", static_cast<double>(samples))
+            .add("avg_hunks", static_cast<double>(hunks) / samples)
+            .add("us_per_op", ms * 1000.0 / samples));
+    }
+
+    // Committing typing as a history point, the way the editor does it: a burst of
+    // keystrokes (with the odd Backspace, Delete or caret jump) per commit. The old way
+    // read the whole document back at commit time and diffed it against the last
+    // point; now every keystroke is folded into an EditCoalescer and the merged change
+    // is taken as is. Both changes are applied and must give the same text.
+    void benchCoalesceTyping(size_t documentLength, size_t keystrokesPerCommit, size_t commits) {
+        EditGenerator edits(11);
+        std::wstring initial;
+        while (initial.length() < documentLength) {
+            initial += edits.word(2 + edits.pick(8)) + L' ';
+        }
+        PieceTable lastPoint(initial); // textAtLastHistoryPoint
+        PieceTable document = lastPoint; // What the edit control holds
+
+        double diffMs = 0;
+        double coalesceMs = 0;
+        size_t hunks = 0;
+        for (size_t commit = 0; commit < commits; ++commit) {
+            // The keystrokes, captured the way EN_CHANGE captures them.
+            std::vector<TextChange> keystrokes;
+            size_t caret = edits.pick(document.length() + 1);
+            for (size_t i = 0; i < keystrokesPerCommit; ++i) {
+                TextChange keystroke;
+                unsigned kind = static_cast<unsigned>(edits.pick(20));
+                if (kind == 0) {
+                    caret = edits.pick(document.length() + 1); // Click elsewhere
+                    continue;
+                }
+                if (kind < 4 && caret > 0) {
+                    keystroke = TextChange(caret - 1, L"", document.substr(caret - 1, 1), caret - 1);
+                    caret--;
+                }
+                else if (kind == 4 && caret < document.length()) {
+                    keystroke = TextChange(caret, L"", document.substr(caret, 1), caret);
+                }
+                else {
+                    keystroke = TextChange(caret, edits.word(1), L"", caret + 1);
+                    caret++;
+                }
+                document.applyChange(keystroke);
+                keystrokes.push_back(std::move(keystroke));
+            }
+
+            Clock::time_point start = Clock::now();
+            EditCoalescer coalescer;
+            for (const TextChange& keystroke : keystrokes) {
+                coalescer.append(keystroke);
+            }
+            ChangeSet coalesced = coalescer.take();
+            coalesceMs += elapsedMs(start);
+
+            start = Clock::now();
+            ChangeSet diffed = CalculateTextChange(lastPoint, document.toString(), caret);
+            diffMs += elapsedMs(start);
+
+            PieceTable viaCoalesced = lastPoint;
+            viaCoalesced.applyChange(coalesced);
+            PieceTable viaDiff = lastPoint;
+            viaDiff.applyChange(diffed);
+            if (viaCoalesced.contentHash() != document.contentHash() || viaDiff.contentHash() != document.contentHash()
+                || viaCoalesced.length() != document.length()) {
+                failedChecks++;
+            }
+            hunks += coalesced.hunks.size();
+            lastPoint = document;
+        }
+
+        printResult(addResult("coalesce_typing")
+            .add("chars", static_cast<double>(lastPoint.length()))
+            .add("keystrokes_per_commit", static_cast<double>(keystrokesPerCommit))
+            .add("commits", static_cast<double>(commits))
+            .add("avg_hunks", static_cast<double>(hunks) / commits)
+            .add("coalesce_us_per_commit", coalesceMs * 1000.0 / commits)
+            .add("diff_us_per_commit", diffMs * 1000.0 / commits)
+            .add("speedup", diffMs / coalesceMs));
+    }
+
+    // What the always-on metrics cost on the keystroke path: the part of EN_CHANGE that
+    // doesn't talk to the edit control (deriving the span, capturing the edit, which is
+    // timed into edit.capture_change, coalescing it and applying it to the baseline),
+    // with timing enabled and disabled, best of several alternating rounds. Also times
+    // the probe on its own, sampling as CaptureTextChange does; its share of a keystroke
+    // (budget: under 1%) is the number to track, since the difference between two timed
+    // runs is mostly noise at this size. The real handler also makes several edit
+    // control calls per keystroke, so the share there is smaller still. Both are timings
+    // of a few tens of nanoseconds, so only the counts and hashes are checked.
+    void benchMetricsOverhead(size_t documentLength, size_t keystrokes, int rounds) {
+        EditGenerator edits(13);
+        std::wstring initial;
+        while (initial.length() < documentLength) {
+            initial += edits.word(2 + edits.pick(8)) + L' ';
+        }
+        // The script: a character to type, or 0 for Backspace, and the odd caret move.
+        std::vector<std::pair<size_t, wchar_t>> script; // (caret jump or SIZE_MAX, key)
+        for (size_t i = 0; i < keystrokes; ++i) {
+            size_t jump = edits.pick(50) == 0 ? edits.pick(documentLength) : SIZE_MAX;
+            wchar_t key = edits.pick(8) == 0 ? 0 : edits.word(1)[0];
+            script.emplace_back(jump, key);
+        }
+
+        const PieceTable start(initial);
+        auto type = [&]() {
+            PieceTable document = start;
+            EditCoalescer pending;
+            size_t caret = documentLength / 2;
+            Clock::time_point begin = Clock::now();
+            for (const auto& step : script) {
+                if (step.first != SIZE_MAX) {
+                    caret = std::min(step.first, document.length());
+                }
+                wchar_t key = step.second;
+                if (key == 0 && caret == 0) {
+                    continue;
+                }
+                SelectionRange before{ caret, caret };
+                size_t lengthAfter = key ? document.length() + 1 : document.length() - 1;
+                size_t caretAfter = key ? caret + 1 : caret - 1;
+                SelectionRange after{ caretAfter, caretAfter };
+                EditSpan span;
+                if (!DeriveEditSpan(document.length(), before, lengthAfter, after, span)) {
+                    continue;
+                }
+                TextChange keystroke = CaptureTextChange(document, span,
+                    [key](size_t, size_t count) { return std::wstring(count, key); }, caretAfter);
+                pending.append(keystroke);
+                document.applyChange(keystroke);
+                caret = caretAfter;
+                if (pending.editedLength() >= 101) {
+                    pending.take();
+                }
+            }
+            double ms = elapsedMs(begin);
+            return std::make_pair(ms, document.contentHash());
+        };
+
+        MetricsRegistry& metrics = MetricsRegistry::global();
+        bool wasEnabled = metrics.isEnabled();
+        double bestEnabledMs = 1e300;
+        double bestDisabledMs = 1e300;
+        uint64_t enabledHash = 0;
+        uint64_t disabledHash = 0;
+        type(); // Warm up
+        for (int round = 0; round < rounds; ++round) {
+            for (bool enabled : { round % 2 == 0, round % 2 != 0 }) {
+                metrics.setEnabled(enabled);
+                auto run = type();
+                (enabled ? bestEnabledMs : bestDisabledMs) = std::min(enabled ? bestEnabledMs : bestDisabledMs, run.first);
+                (enabled ? enabledHash : disabledHash) = run.second;
+            }
+        }
+
+        metrics.setEnabled(true);
+        auto probes = std::make_unique<LatencyHistogram>(KEYSTROKE_SAMPLE_INTERVAL); // As CaptureTextChange's
+        const size_t probeCount = 1000000;
+        Clock::time_point begin = Clock::now();
+        for (size_t i = 0; i < probeCount; ++i) {
+            ScopedLatency timing(*probes);
+        }
+        double probeNanos = elapsedMs(begin) * 1e6 / probeCount;
+        metrics.setEnabled(wasEnabled);
+
+        double keystrokeNanos = bestDisabledMs * 1e6 / keystrokes;
+        double probeShare = 100.0 * probeNanos / keystrokeNanos;
+        LatencySummary probed = probes->summarize();
+        if (enabledHash != disabledHash || probed.count != probeCount
+            || probed.timed != probeCount / KEYSTROKE_SAMPLE_INTERVAL) {
+            failedChecks++;
+        }
+        printResult(addResult("metrics_overhead")
+            .add("chars", static_cast<double>(documentLength))
+            .add("keystrokes", static_cast<double>(keystrokes))
+            .add("keystroke_ns", keystrokeNanos)
+            .add("keystroke_timed_ns", bestEnabledMs * 1e6 / keystrokes)
+            .add("measured_overhead_pct", 100.0 * (bestEnabledMs - bestDisabledMs) / bestDisabledMs)
+            .add("probe_ns", probeNanos)
+            .add("probe_share_pct", probeShare));
+    }
+
+    // Cost of a TIMELINE_SPAN while the timeline is off and while it records, and of
+    // exporting, with several threads recording into small ring buffers while the main
+    // thread exports. Checks that each export holds whole spans only, and that the
+    // final one has exactly what the ring buffers kept.
+    void benchTimelineSpans(size_t spans, size_t threads, size_t eventsPerThread) {
+        Timeline& timeline = Timeline::global();
+        timeline.stop();
+        auto spanLoop = [](size_t count) {
+            for (size_t i = 0; i < count; ++i) {
+                TIMELINE_SPAN("bench span");
+            }
+        };
+        Clock::time_point start = Clock::now();
+        spanLoop(spans);
+        double offNanos = elapsedMs(start) * 1e6 / spans;
+
+        timeline.start(eventsPerThread);
+        start = Clock::now();
+        spanLoop(spans);
+        double onNanos = elapsedMs(start) * 1e6 / spans;
+
+        timeline.start(eventsPerThread);
+        std::vector<std::thread> recorders;
+        for (size_t t = 0; t < threads; ++t) {
+            recorders.emplace_back([&] { spanLoop(spans); });
+        }
+        const size_t exports = 20; // Most while the recorders run
+        double exportMs = 0;
+        size_t malformed = 0;
+        for (size_t i = 0; i < exports; ++i) {
+            start = Clock::now();
+            std::string json = timeline.toChromeTraceJson();
+            exportMs += elapsedMs(start);
+            // Every span event is complete: named, with a start and a duration.
+            size_t events = 0;
+            for (size_t at = json.find("\"ph\":\"X\""); at != std::string::npos; at = json.find("\"ph\":\"X\"", at + 1)) {
+                events++;
+            }
+            size_t named = 0;
+            for (size_t at = json.find("\"name\":\"bench span\""); at != std::string::npos; at = json.find("\"name\":\"bench span\"", at + 1)) {
+                named++;
+            }
+            if (named != events) {
+                malformed++;
+            }
+        }
+        for (std::thread& recorder : recorders) {
+            recorder.join();
+        }
+        timeline.stop();
+        size_t kept = timeline.eventCount();
+        size_t dropped = timeline.droppedCount();
+        size_t expectedKept = threads * std::min(spans, eventsPerThread);
+        if (malformed > 0 || kept != expectedKept || kept + dropped != threads * spans) {
+            failedChecks++;
+        }
+        printResult(addResult("timeline_spans")
+            .add("spans", static_cast<double>(spans))
+            .add("threads", static_cast<double>(threads))
+            .add("off_ns_per_span", offNanos)
+            .add("on_ns_per_span", onNanos)
+            .add("exports", static_cast<double>(exports))
+            .add("export_ms", exportMs / exports)
+            .add("kept", static_cast<double>(kept))
+            .add("dropped", static_cast<double>(dropped)));
+    }
+
+    // The same file open in two tabs, each pasting the same block over and over between
+    // bouts of typing, with text sharing off and then on. Checks that every version
+    // reads the same either way, that sharing stores the file and the block exactly
+    // once, and that closing the tabs empties the store again.
+    void benchBlobStore(size_t documentLength, size_t blockLength, size_t pastes) {
+        EditGenerator textEdits(11);
+        std::wstring initial;
+        while (initial.length() < documentLength) {
+            initial += textEdits.word(2 + textEdits.pick(8)) + L' ';
+        }
+        std::wstring block = textEdits.word(blockLength);
+        const size_t tabs = 2;
+        const size_t typingPerPaste = 8;
+
+        BlobStore& store = BlobStore::global();
+        BlobStore::Stats before = store.stats();
+        std::vector<uint64_t> expected; // Hashes of every version of every tab, sharing off
+        double pasteMs[2] = { 0, 0 };
+        size_t historyBytes[2] = { 0, 0 };
+        BlobStore::Stats shared;
+        for (bool sharing : { false, true }) {
+            std::vector<std::unique_ptr<VersionHistoryManager>> histories;
+            for (size_t tab = 0; tab < tabs; ++tab) {
+                histories.push_back(std::make_unique<VersionHistoryManager>(initial));
+                histories.back()->setTextSharing(sharing);
+            }
+            EditGenerator edits(12);
+            for (size_t i = 0; i < pastes; ++i) {
+                for (auto& history : histories) {
+                    for (size_t t = 0; t < typingPerPaste; ++t) {
+                        history->recordChange(edits.next(history->getCurrentDocument().length()));
+                    }
+                    size_t position = edits.pick(history->getCurrentDocument().length() + 1);
+                    Clock::time_point start = Clock::now();
+                    history->recordChange(TextChange(position, block, L"", position + block.length()));
+                    pasteMs[sharing] += elapsedMs(start);
+                }
+            }
+
+            std::vector<uint64_t> hashes;
+            for (auto& history : histories) {
+                historyBytes[sharing] += history->getHistoryBytes();
+                for (auto node = history->getCurrentNode(); node; node = node->parent ? node->parent->shared_from_this() : nullptr) {
+                    hashes.push_back(PieceTable::hashText(history->reconstructStateToNode(node)));
+                }
+            }
+            if (!sharing) {
+                expected = std::move(hashes);
+                continue;
+            }
+            if (hashes != expected) {
+                failedChecks++;
+            }
+            shared = store.stats();
+        }
+        BlobStore::Stats after = store.stats();
+
+        // The file and the block once each, referenced by every tab's root and every paste.
+        size_t uniqueBytes = shared.uniqueBytes - before.uniqueBytes;
+        size_t referencedBytes = shared.referencedBytes - before.referencedBytes;
+        if (uniqueBytes != (initial.length() + block.length()) * sizeof(wchar_t)
+            || referencedBytes != tabs * (initial.length() + pastes * block.length()) * sizeof(wchar_t)
+            || after.blobs != before.blobs || after.uniqueBytes != before.uniqueBytes) {
+            failedChecks++;
+        }
+        printResult(addResult("blob_store")
+            .add("chars", static_cast<double>(documentLength))
+            .add("block_chars", static_cast<double>(blockLength))
+            .add("pastes", static_cast<double>(tabs * pastes))
+            .add("unshared_paste_us", pasteMs[0] * 1000.0 / (tabs * pastes))
+            .add("shared_paste_us", pasteMs[1] * 1000.0 / (tabs * pastes))
+            .add("history_bytes", static_cast<double>(historyBytes[1]))
+            .add("unique_bytes", static_cast<double>(uniqueBytes))
+            .add("referenced_bytes", static_cast<double>(referencedBytes))
+            .add("dedup_ratio", static_cast<double>(referencedBytes) / uniqueBytes));
+    }
+
+    // Auto-commit policies on simulated typing: bursts of keystrokes a typist-specific
+    // gap apart, pauses of a second to half a minute between bursts, the caret moving
+    // now and then. The fixed policy is the editor's old 101 characters / 4 seconds.
+    void benchAutoCommit(size_t documentLength, double gapMillis, size_t keystrokes) {
+        EditGenerator edits(12);
+        std::wstring initial;
+        while (initial.length() < documentLength) {
+            initial += edits.word(2 + edits.pick(8)) + L' ';
+        }
+
+        std::vector<TimedEdit> typing;
+        size_t length = initial.length();
+        size_t caret = edits.pick(length + 1);
+        double clockMillis = 0;
+        size_t burstLeft = 0;
+        while (typing.size() < keystrokes) {
+            if (burstLeft == 0) {
+                clockMillis += 1000 + edits.pick(30000);
+                burstLeft = 5 + edits.pick(120);
+                if (edits.pick(3) == 0) {
+                    caret = edits.pick(length + 1);
+                }
+            }
+            clockMillis += gapMillis * (0.5 + edits.pick(100) / 100.0);
+            burstLeft--;
+            TimedEdit keystroke;
+            keystroke.elapsedMicros = static_cast<uint64_t>(clockMillis * 1000);
+            if (edits.pick(8) == 0 && caret > 0) {
+                keystroke.change = TextChange(caret - 1, L"", L"?", caret - 1); // Backspace
+                caret--;
+                length--;
+            }
+            else {
+                keystroke.change = TextChange(caret, edits.word(1), L"", caret + 1);
+                caret++;
+                length++;
+            }
+            typing.push_back(std::move(keystroke));
+        }
+
+        for (bool adaptive : { false, true }) {
+            AutoCommitScheduler::Policy policy;
+            policy.adaptive = adaptive;
+            AutoCommitSimulation simulation = SimulateAutoCommits(initial, typing, policy);
+            if (!simulation.consistent) {
+                failedChecks++;
+            }
+            printResult(addResult("auto_commit")
+                .add("chars", static_cast<double>(documentLength))
+                .add("gap_ms", gapMillis)
+                .add("adaptive", adaptive ? 1 : 0)
+                .add("keystrokes", static_cast<double>(simulation.edits))
+                .add("threshold_commits", static_cast<double>(simulation.thresholdCommits))
+                .add("idle_commits", static_cast<double>(simulation.idleCommits))
+                .add("commit_total_ms", simulation.commits.totalMicros / 1000.0)
+                .add("commit_p99_us", simulation.commits.p99Micros)
+                .add("max_pending_chars", static_cast<double>(simulation.maxPendingChars))
+                .add("chars_per_commit", simulation.meanCommittedChars));
+        }
+    }
+
+    // Opening the History dialog on a large tree: creating the rows down to the current
+    // version and labelling one screenful of them, against the old approach of
+    // formatting a label for every node up front. Also times expanding everything.
+    void benchHistoryTreeModel(size_t nodeCount, bool branchy) {
+        VersionHistoryManager history(L"");
+        history.setCheckpointPolicy(0, 0);
+        EditGenerator edits(8);
+        if (branchy) {
+            buildBranchyHistory(history, edits, nodeCount);
+        }
+        else {
+            recordEdits(history, edits, nodeCount);
+        }
+        auto root = std::const_pointer_cast<HistoryNode>(history.getHistoryTreeRoot());
+        std::shared_ptr<const HistoryNode> current = history.getCurrentNode();
+        const size_t visibleRows = 40;
+
+        // What WM_INITDIALOG does: expand the path to the current version, paging where needed.
+        Clock::time_point start = Clock::now();
+        HistoryTreeModel model(root, current);
+        std::vector<HistoryTreeModel::RowId> path = { model.getRootRow() };
+        std::vector<const HistoryNode*> nodes = HistoryTreeModel::pathFromRoot(current.get());
+        for (size_t i = 1; i < nodes.size(); ++i) {
+            HistoryTreeModel::RowId row = path.back();
+            model.expand(row);
+            HistoryTreeModel::RowId child = model.findChildRow(row, nodes[i]);
+            while (child == HistoryTreeModel::NO_ROW && model.getMoreRow(row) != HistoryTreeModel::NO_ROW) {
+                model.expandMore(model.getMoreRow(row));
+                child = model.findChildRow(row, nodes[i]);
+            }
+            path.push_back(child);
+        }
+        // Then the tree paints the rows around the selection.
+        for (size_t i = path.size() > visibleRows ? path.size() - visibleRows : 0; i < path.size(); ++i) {
+            model.getLabel(path[i]);
+        }
+        double openMs = elapsedMs(start);
+        size_t openRows = model.getRowCount();
+
+        // Expanding every row (and every "more" row), without painting.
+        start = Clock::now();
+        std::vector<HistoryTreeModel::RowId> pending = { model.getRootRow() };
+        while (!pending.empty()) {
+            HistoryTreeModel::RowId row = pending.back();
+            pending.pop_back();
+            if (model.isMoreRow(row)) {
+                std::vector<HistoryTreeModel::RowId> added = model.expandMore(row);
+                pending.insert(pending.end(), added.begin(), added.end());
+            }
+            else {
+                model.expand(row); // No-op for rows already expanded on the way down
+                const std::vector<HistoryTreeModel::RowId>& children = model.getChildRows(row);
+                pending.insert(pending.end(), children.begin(), children.end());
+            }
+        }
+        double expandAllMs = elapsedMs(start);
+        size_t allRows = model.getRowCount();
+
+        size_t characters = 0;
+        start = Clock::now();
+        for (const auto& node : collectNodes(history)) {
+            characters += HistoryTreeModel::formatNodeLabel(*node).length();
+        }
+        double eagerMs = elapsedMs(start);
+
+        printResult(addResult("history_tree_model")
+            .add("nodes", static_cast<double>(history.getNodeCount()))
+            .add("branchy", branchy ? 1 : 0)
+            .add("depth", static_cast<double>(nodes.size()))
+            .add("open_rows", static_cast<double>(openRows))
+            .add("open_ms", openMs)
+            .add("expand_all_rows", static_cast<double>(allRows))
+            .add("expand_all_ms", expandAllMs)
+            .add("eager_labels_ms", eagerMs)
+            .add("avg_label_chars", static_cast<double>(characters) / history.getNodeCount()));
+    }
+
+    // Stress run for background readers: worker threads keep rebuilding versions,
+    // searching states and diffing against the latest snapshot while this thread, like
+    // the UI thread, records edits, moves around, deletes branches and compacts. Every
+    // read is verified against the content hash stored for its version.
+    void benchConcurrentReads(size_t edits, size_t readers) {
+        VersionHistoryManager history(L"");
+        history.setPayloadCompression(true);
+        VersionHistoryManager::RetentionPolicy retention;
+        retention.maxNodes = edits / 2;
+        history.setRetentionPolicy(retention);
+        EditGenerator generator(9);
+        buildBranchyHistory(history, generator, edits / 4);
+
+        std::mutex publishLock;
+        std::shared_ptr<const HistorySnapshot> published = history.getSnapshot();
+        auto latest = [&] {
+            std::lock_guard<std::mutex> guard(publishLock);
+            return published;
+        };
+
+        std::atomic<size_t> reads{ 0 }, searches{ 0 }, diffs{ 0 }, mismatches{ 0 };
+        HistoryWorkerPool pool(readers + 1); // One worker left over for checkouts
+        CancellationToken stopReaders;
+        std::vector<std::future<void>> running;
+        for (size_t reader = 0; reader < readers; ++reader) {
+            running.push_back(pool.submit([&, reader](const CancellationToken& token) {
+                std::mt19937_64 rng(100 + reader);
+                while (!token.isCancelled()) {
+                    std::shared_ptr<const HistorySnapshot> snapshot = latest();
+                    HistorySnapshot::Index index = static_cast<HistorySnapshot::Index>(rng() % snapshot->size());
+                    const HistorySnapshot::Entry& entry = snapshot->getEntry(index);
+                    PieceTable document = snapshot->reconstructDocument(index);
+                    if (document.contentHash() != entry.contentHash || document.length() != entry.contentLength) {
+                        mismatches++;
+                    }
+                    reads++;
+
+                    if (rng() % 4 == 0) {
+                        std::wstring text = document.toString();
+                        HistorySnapshot::Index found = snapshot->findMatchingState(text);
+                        if (found == HistorySnapshot::NO_ENTRY || snapshot->getEntry(found).contentHash != entry.contentHash) {
+                            mismatches++;
+                        }
+                        searches++;
+
+                        if (rng() % 2 == 0) {
+                            PieceTable patched = snapshot->getCurrentDocument().withPrivateBuffer();
+                            patched.applyChange(CalculateTextChange(patched, text, 0));
+                            if (!patched.equals(text)) {
+                                mismatches++;
+                            }
+                            diffs++;
+                        }
+                    }
+                }
+            }, stopReaders));
+        }
+
+        // The "UI thread": edits, with a snapshot published every few, plus the odd
+        // checkout, branch deletion and compaction slice.
+        size_t snapshots = 0, deletions = 0, checkouts = 0;
+        std::vector<double> recordMicros;
+        recordMicros.reserve(edits);
+        Clock::time_point start = Clock::now();
+        for (size_t i = 0; i < edits; ++i) {
+            if (generator.pick(16) == 0) {
+                for (size_t back = 1 + generator.pick(8); back > 0 && history.moveCurrentNodeToParent(); --back) {
+                }
+            }
+            Clock::time_point recordStart = Clock::now();
+            history.recordChange(generator.next(history.getCurrentDocument().length()));
+            recordMicros.push_back(std::chrono::duration<double, std::micro>(Clock::now() - recordStart).count());
+
+            if (i % 8 == 0) {
+                std::shared_ptr<const HistorySnapshot> snapshot = history.getSnapshot();
+                {
+                    std::lock_guard<std::mutex> guard(publishLock);
+                    published = snapshot;
+                }
+                snapshots++;
+
+                // A checkout finished by a worker: rebuild there, adopt here.
+                HistorySnapshot::Index target = generator.pick(snapshot->size());
+                CancellationToken checkoutToken;
+                std::future<PieceTable> rebuilt = pool.submit([snapshot, target](const CancellationToken& token) {
+                    return snapshot->reconstructDocument(target, token);
+                }, checkoutToken);
+                // On a machine with fewer cores than workers it may not have run yet;
+                // then give up on it and rebuild here.
+                PieceTable document;
+                if (rebuilt.wait_for(std::chrono::milliseconds(5)) == std::future_status::ready) {
+                    document = rebuilt.get();
+                }
+                else {
+                    checkoutToken.cancel();
+                    document = snapshot->reconstructDocument(target);
+                }
+                std::shared_ptr<HistoryNode> node = history.findNodeForEntry(snapshot->getEntry(target));
+                if (node && history.adoptCheckout(node, std::move(document))) {
+                    checkouts++;
+                }
+            }
+            if (i % 64 == 0) {
+                auto root = std::const_pointer_cast<HistoryNode>(history.getHistoryTreeRoot());
+                if (root->children.size() > 1 && history.deleteNode(root->children.front())) {
+                    deletions++;
+                }
+                history.compactHistory(256);
+            }
+        }
+        double writerMs = elapsedMs(start);
+
+        stopReaders.cancel();
+        size_t cancelled = 0;
+        for (std::future<void>& reader : running) {
+            try {
+                reader.get();
+            }
+            catch (const OperationCancelled&) {
+                cancelled++; // Never started: the pool was busy
+            }
+        }
+        failedChecks += mismatches;
+
+        std::sort(recordMicros.begin(), recordMicros.end());
+        printResult(addResult("concurrent_reads")
+            .add("edits", static_cast<double>(edits))
+            .add("readers", static_cast<double>(readers))
+            .add("final_nodes", static_cast<double>(history.getNodeCount()))
+            .add("snapshots", static_cast<double>(snapshots))
+            .add("checkouts", static_cast<double>(checkouts))
+            .add("deletions", static_cast<double>(deletions))
+            .add("reads_per_sec", reads / (writerMs / 1000.0))
+            .add("searches", static_cast<double>(searches))
+            .add("diffs", static_cast<double>(diffs))
+            .add("record_p50_us", recordMicros[recordMicros.size() / 2])
+            .add("record_p99_us", recordMicros[recordMicros.size() * 99 / 100])
+            .add("mismatches", static_cast<double>(mismatches)));
+    }
+
+    // Editor text (CR line breaks) of about 'megabytes' million characters: lines of
+    // words, 'nonAsciiPercent' of them starting with an accented or CJK letter.
+    std::wstring makeFileText(size_t megabytes, unsigned nonAsciiPercent) {
+        static const wchar_t letters[] = { L'\u00E9', L'\u00FC', L'\u6771', L'\u4EAC', L'\u0416' };
+        EditGenerator words(9);
+        std::wstring text;
+        size_t lineLength = 0;
+        while (text.size() < megabytes * 1024 * 1024) {
+            if (lineLength > 60 + words.pick(40)) {
+                text += L'\r';
+                lineLength = 0;
+                continue;
+            }
+            std::wstring word = words.word(2 + words.pick(8)) + L' ';
+            if (words.pick(100) < nonAsciiPercent) {
+                word[0] = letters[words.pick(5)];
+            }
+            text += word;
+            lineLength += word.length();
+        }
+        return text;
+    }
+
+    // Opening a file: the mapped, transcoding loader against the stream-based reading it
+    // replaced (wifstream into a wstringstream, then a line ending pass), on a file with
+    // CRLF line endings. The old path only handles ASCII, so it is timed on ASCII only.
+    void benchLoadTextFile(size_t megabytes, unsigned nonAsciiPercent, bool utf16, size_t samples) {
+        std::wstring expected = makeFileText(megabytes, nonAsciiPercent); // What the editor should get
+
+        std::string bytes = utf16 ? "\xFF\xFE" : "";
+        for (wchar_t unit : expected) {
+            for (char32_t ch : unit == L'\r' ? std::u32string(U"\r\n") : std::u32string(1, static_cast<char32_t>(unit))) {
+                if (utf16) { // All in the BMP
+                    bytes.push_back(static_cast<char>(ch & 0xFF));
+                    bytes.push_back(static_cast<char>(ch >> 8));
+                }
+                else if (ch < 0x80) {
+                    bytes.push_back(static_cast<char>(ch));
+                }
+                else if (ch < 0x800) {
+                    bytes.push_back(static_cast<char>(0xC0 | (ch >> 6)));
+                    bytes.push_back(static_cast<char>(0x80 | (ch & 0x3F)));
+                }
+                else {
+                    bytes.push_back(static_cast<char>(0xE0 | (ch >> 12)));
+                    bytes.push_back(static_cast<char>(0x80 | ((ch >> 6) & 0x3F)));
+                    bytes.push_back(static_cast<char>(0x80 | (ch & 0x3F)));
+                }
+            }
+        }
+        std::filesystem::path path = std::filesystem::temp_directory_path() / "history_bench_load.txt";
+        {
+            std::ofstream out(path, std::ios::binary | std::ios::trunc);
+            out.write(bytes.data(), static_cast<std::streamsize>(bytes.size()));
+        }
+        double fileMb = bytes.size() / (1024.0 * 1024.0);
+
+        double bestMs = 0;
+        for (size_t i = 0; i < samples; ++i) {
+            std::wstring loaded;
+            Clock::time_point start = Clock::now();
+            bool ok = LoadTextFile(path.wstring(), loaded);
+            double ms = elapsedMs(start);
+            bestMs = i == 0 ? ms : std::min(bestMs, ms);
+            if (!ok || loaded != expected) {
+                failedChecks++;
+            }
+        }
+
+        double bestLegacyMs = 0;
+        bool timeLegacy = nonAsciiPercent == 0 && !utf16;
+        for (size_t i = 0; timeLegacy && i < samples; ++i) {
+            Clock::time_point start = Clock::now();
+            std::wifstream in(path);
+            std::wstringstream buffer;
+            buffer << in.rdbuf();
+            std::wstring read = buffer.str();
+            std::wstring loaded;
+            loaded.reserve(read.length());
+            for (size_t at = 0; at < read.length(); ++at) {
+                if (read[at] == L'\r' && at + 1 < read.length() && read[at + 1] == L'\n') {
+                    continue;
+                }
+                loaded.push_back(read[at] == L'\n' ? L'\r' : read[at]);
+            }
+            double ms = elapsedMs(start);
+            bestLegacyMs = i == 0 ? ms : std::min(bestLegacyMs, ms);
+            if (loaded != expected) {
+                failedChecks++;
+            }
+        }
+        std::filesystem::remove(path);
+
+        BenchmarkResult& result = addResult("load_text_file")
+            .add("file_mb", fileMb)
+            .add("non_ascii_pct", nonAsciiPercent)
+            .add("utf16", utf16 ? 1 : 0)
+            .add("mb_per_sec", fileMb / (bestMs / 1000.0));
+        if (timeLegacy) {
+            result.add("legacy_mb_per_sec", fileMb / (bestLegacyMs / 1000.0))
+                .add("speedup", bestLegacyMs / bestMs);
+        }
+        printResult(result);
+    }
+
+    // Saving a file: SaveTextFile (encoding in slices, temporary file, flush, rename)
+    // against the stream-based writing it replaced (a CRLF copy of the text through a
+    // wofstream, no flush to disk). Every save is read back and compared. The old path
+    // only handles ASCII, so it is timed on ASCII only.
+    void benchSaveTextFile(size_t megabytes, unsigned nonAsciiPercent, TextEncoding encoding, size_t samples) {
+        std::wstring text = makeFileText(megabytes, nonAsciiPercent);
+        std::filesystem::path path = std::filesystem::temp_directory_path() / "history_bench_save.txt";
+        double textMb = text.size() / (1024.0 * 1024.0); // Millions of characters, so encodings compare
+
+        double bestMs = 0;
+        for (size_t i = 0; i < samples; ++i) {
+            Clock::time_point start = Clock::now();
+            bool ok = SaveTextFile(path.wstring(), text, encoding);
+            double ms = elapsedMs(start);
+            bestMs = i == 0 ? ms : std::min(bestMs, ms);
+            std::wstring loaded;
+            if (!ok || !LoadTextFile(path.wstring(), loaded) || loaded != text) {
+                failedChecks++;
+            }
+        }
+
+        double bestLegacyMs = 0;
+        bool timeLegacy = nonAsciiPercent == 0 && encoding == TextEncoding::Utf8;
+        for (size_t i = 0; timeLegacy && i < samples; ++i) {
+            Clock::time_point start = Clock::now();
+            std::wstring withCrLf;
+            withCrLf.reserve(text.length() + text.length() / 32);
+            for (wchar_t ch : text) {
+                if (ch == L'\r') {
+                    withCrLf += L"\r\n";
+                }
+                else {
+                    withCrLf.push_back(ch);
+                }
+            }
+            std::wofstream out(path);
+            out << withCrLf;
+            out.close();
+            double ms = elapsedMs(start);
+            bestLegacyMs = i == 0 ? ms : std::min(bestLegacyMs, ms);
+        }
+        std::filesystem::remove(path);
+
+        BenchmarkResult& result = addResult("save_text_file")
+            .add("million_chars", textMb)
+            .add("non_ascii_pct", nonAsciiPercent)
+            .add("utf16", encoding == TextEncoding::Utf16LE ? 1 : 0)
+            .add("mchars_per_sec", textMb / (bestMs / 1000.0));
+        if (timeLegacy) {
+            result.add("legacy_mchars_per_sec", textMb / (bestLegacyMs / 1000.0))
+                .add("speedup", bestLegacyMs / bestMs);
+        }
+        printResult(result);
+    }
+
+    bool selected(const char* filter, const char* name) {
+        return !filter || strstr(name, filter) != nullptr;
+    }
+}
+
+int main(int argc, char** argv) {
+    bool quick = false;
+    const char* jsonPath = nullptr;
+    const char* filter = nullptr;
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--quick") == 0) {
+            quick = true;
+        }
+        else if (strcmp(argv[i], "--json") == 0 && i + 1 < argc) {
+            jsonPath = argv[++i];
+        }
+        else if (strcmp(argv[i], "--filter") == 0 && i + 1 < argc) {
+            filter = argv[++i];
+        }
+        else {
+            fprintf(stderr, "usage: %s [--quick] [--json <file>] [--filter <substring>]\n", argv[0]);
+            return 2;
+        }
+    }
+
+    if (selected(filter, "record_change")) {
+        for (size_t nodes : quick ? std::vector<size_t>{ 10000 } : std::vector<size_t>{ 10000, 100000, 1000000 }) {
+            benchRecordChange(nodes, false);
+            benchRecordChange(nodes, true);
+        }
+    }
+    if (selected(filter, "reconstruct_vs_depth")) {
+        for (size_t depth : quick ? std::vector<size_t>{ 100, 1000, 10000 } : std::vector<size_t>{ 100, 1000, 10000, 100000 }) {
+            benchReconstruction(depth, VersionHistoryManager::DEFAULT_CHECKPOINT_INTERVAL, quick ? 50 : 200);
+            benchReconstruction(depth, 0, quick ? 10 : 20);
+        }
+    }
+    if (selected(filter, "state_cache")) {
+        benchStateCache(quick ? 2000 : 20000, 8, quick ? 400 : 2000);
+        benchStateCache(quick ? 2000 : 20000, 64, quick ? 400 : 2000);
+    }
+    if (selected(filter, "find_matching_state")) {
+        for (size_t nodes : quick ? std::vector<size_t>{ 1000, 10000 } : std::vector<size_t>{ 1000, 10000, 100000 }) {
+            benchFindMatchingState(nodes, quick ? 64 : 256);
+        }
+    }
+    if (selected(filter, "node_tree")) {
+        benchNodeTree(quick ? 100000 : 1000000);
+    }
+    if (selected(filter, "delete_deep_branch")) {
+        for (size_t depth : quick ? std::vector<size_t>{ 1000, 100000 } : std::vector<size_t>{ 1000, 100000, 1000000 }) {
+            benchDeleteDeepBranch(depth);
+        }
+    }
+    if (selected(filter, "navigate_step")) {
+        benchNavigation(quick ? 2000 : 10000);
+    }
+    if (selected(filter, "apply_changes")) {
+        for (size_t megabytes : quick ? std::vector<size_t>{ 1, 10 } : std::vector<size_t>{ 1, 10, 100 }) {
+            benchApplyChanges(megabytes, 10000, quick ? 1e9 : 4e9);
+        }
+    }
+    if (selected(filter, "journal_load")) {
+        benchJournal(quick ? 10000 : 100000);
+    }
+    if (selected(filter, "checkout")) {
+        benchCheckout(quick ? 10000 : 100000, quick ? 500 : 2000);
+    }
+    if (selected(filter, "calculate_text_change")) {
+        for (size_t length : quick ? std::vector<size_t>{ 100000 } : std::vector<size_t>{ 100000, 1000000 }) {
+            benchCalculateTextChange(length, quick ? 20 : 50);
+        }
+    }
+    if (selected(filter, "coalesce_typing")) {
+        for (size_t length : quick ? std::vector<size_t>{ 100000 } : std::vector<size_t>{ 100000, 1000000 }) {
+            benchCoalesceTyping(length, 101, quick ? 50 : 200);
+        }
+    }
+    if (selected(filter, "auto_commit")) {
+        size_t keystrokes = quick ? 5000 : 50000;
+        for (size_t length : quick ? std::vector<size_t>{ 10000, 4000000 } : std::vector<size_t>{ 10000, 1000000, 8000000 }) {
+            benchAutoCommit(length, 60, keystrokes);  // Fast typist
+            benchAutoCommit(length, 250, keystrokes); // Slow typist
+        }
+    }
+    if (selected(filter, "metrics_overhead")) {
+        for (size_t length : quick ? std::vector<size_t>{ 100000 } : std::vector<size_t>{ 100000, 4000000 }) {
+            benchMetricsOverhead(length, quick ? 100000 : 500000, quick ? 3 : 7);
+        }
+    }
+    if (TEXTEDITOR_TIMELINE && selected(filter, "timeline_spans")) { // Nothing to measure without spans
+        benchTimelineSpans(quick ? 200000 : 2000000, 3, 16 * 1024);
+    }
+    if (selected(filter, "blob_store")) {
+        benchBlobStore(quick ? 100000 : 1000000, 4096, quick ? 50 : 200);
+    }
+    if (selected(filter, "history_tree_model")) {
+        size_t nodes = quick ? 10000 : 100000;
+        benchHistoryTreeModel(nodes, false);
+        benchHistoryTreeModel(nodes, true);
+    }
+    if (selected(filter, "load_text_file")) {
+        size_t megabytes = quick ? 8 : 64;
+        benchLoadTextFile(megabytes, 0, false, quick ? 3 : 5);
+        benchLoadTextFile(megabytes, 5, false, quick ? 3 : 5);
+        benchLoadTextFile(megabytes, 0, true, quick ? 3 : 5);
+    }
+    if (selected(filter, "save_text_file")) {
+        size_t megabytes = quick ? 8 : 64;
+        benchSaveTextFile(megabytes, 0, TextEncoding::Utf8, quick ? 3 : 5);
+        benchSaveTextFile(megabytes, 5, TextEncoding::Utf8, quick ? 3 : 5);
+        benchSaveTextFile(megabytes, 0, TextEncoding::Utf16LE, quick ? 3 : 5);
+    }
+    if (selected(filter, "concurrent_reads")) {
+        benchConcurrentReads(quick ? 5000 : 50000, std::max<size_t>(HistoryWorkerPool::defaultThreadCount(), 2));
+    }
+
+    if (jsonPath && !writeJson(jsonPath, quick)) {
+        fprintf(stderr, "could not write %s\n", jsonPath);
+        return 1;
+    }
+    if (failedChecks > 0) {
+        fprintf(stderr, "%zu result checks failed\n", failedChecks);
+        return 3;
+    }
+    return 0;
+}
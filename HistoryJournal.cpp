@@ -0,0 +1,415 @@
+#include "HistoryJournal.h"
+#include "HistoryNode.h"
+#include <cstring>    // For memcpy
+#include <cwctype>   // For towlower
+#include <chrono>
+#include <filesystem>
+#include <mutex>
+#include <set>
+
+namespace {
+    const char JOURNAL_MAGIC[4] = { 'T', 'E', 'H', 'J' };
+    constexpr size_t HEADER_SIZE = 8;
+    constexpr size_t RECORD_HEADER_SIZE = 12; // u32 type + u64 payload length
+    constexpr size_t RECORD_TRAILER_SIZE = 4; // u32 checksum
+
+    uint32_t checksumOf(const unsigned char* data, size_t count) {
+        uint32_t hash = 2166136261u; // FNV-1a
+        for (size_t i = 0; i < count; ++i) {
+            hash ^= data[i];
+            hash *= 16777619u;
+        }
+        return hash;
+    }
+
+    // Appends fixed-width values and texts to a record payload.
+    class PayloadWriter {
+    public:
+        std::string bytes;
+
+        void putU32(uint32_t value) { putRaw(&value, sizeof(value)); }
+        void putU64(uint64_t value) { putRaw(&value, sizeof(value)); }
+        void putI64(int64_t value) { putRaw(&value, sizeof(value)); }
+
+        void putText(const std::wstring& text) {
+            putU64(text.length());
+            putRaw(text.data(), text.length() * sizeof(wchar_t));
+        }
+
+        void putText(const PieceTable& text) {
+            putU64(text.length());
+            text.forEachChunk([this](const wchar_t* data, size_t count) {
+                putRaw(data, count * sizeof(wchar_t));
+                return true;
+            });
+        }
+
+    private:
+        void putRaw(const void* data, size_t count) {
+            bytes.append(static_cast<const char*>(data), count);
+        }
+    };
+
+    // Reads fixed-width values and texts from a mapped record, with bounds checks.
+    class PayloadReader {
+    public:
+        PayloadReader(const unsigned char* data, size_t count) : cursor(data), end(data + count) {}
+
+        bool getU16(uint16_t& value) { return getRaw(&value, sizeof(value)); }
+        bool getU32(uint32_t& value) { return getRaw(&value, sizeof(value)); }
+        bool getU64(uint64_t& value) { return getRaw(&value, sizeof(value)); }
+        bool getI64(int64_t& value) { return getRaw(&value, sizeof(value)); }
+
+        bool getText(std::wstring& text) {
+            uint64_t length;
+            if (!getU64(length) || length > remaining() / sizeof(wchar_t)) {
+                return false;
+            }
+            text.resize(static_cast<size_t>(length));
+            return getRaw(&text[0], static_cast<size_t>(length) * sizeof(wchar_t));
+        }
+
+        bool skip(size_t count) {
+            if (count > remaining()) return false;
+            cursor += count;
+            return true;
+        }
+
+        size_t remaining() const { return static_cast<size_t>(end - cursor); }
+
+    private:
+        const unsigned char* cursor;
+        const unsigned char* end;
+
+        bool getRaw(void* out, size_t count) {
+            if (count > remaining()) return false;
+            if (count > 0) memcpy(out, cursor, count);
+            cursor += count;
+            return true;
+        }
+    };
+
+    // Locates the payload of the record at 'offset'.
+    bool recordPayload(const MappedFile& file, size_t offset, uint32_t& type, const unsigned char*& payload, size_t& payloadLength) {
+        if (offset > file.size() || file.size() - offset < RECORD_HEADER_SIZE + RECORD_TRAILER_SIZE) {
+            return false;
+        }
+        PayloadReader header(file.data() + offset, RECORD_HEADER_SIZE);
+        uint64_t length;
+        header.getU32(type);
+        header.getU64(length);
+        if (length > file.size() - offset - RECORD_HEADER_SIZE - RECORD_TRAILER_SIZE) {
+            return false; // Torn record: the payload runs past the end of the file
+        }
+        payload = file.data() + offset + RECORD_HEADER_SIZE;
+        payloadLength = static_cast<size_t>(length);
+        return true;
+    }
+
+    bool checksumMatches(const unsigned char* payload, size_t payloadLength) {
+        uint32_t stored;
+        memcpy(&stored, payload + payloadLength, sizeof(stored));
+        return stored == checksumOf(payload, payloadLength);
+    }
+
+    // Files held by a journal for writing, by canonical path (see HistoryJournal::claim).
+    struct JournalClaims {
+        std::mutex mutex;
+        std::set<std::wstring> paths;
+    };
+
+    JournalClaims& journalClaims() {
+        static JournalClaims claims;
+        return claims;
+    }
+
+    // The same file reached through another spelling, a relative path or a link gives
+    // the same key. The file itself need not exist yet.
+    std::wstring claimKeyFor(const std::wstring& path) {
+        std::error_code error;
+        std::filesystem::path canonical = std::filesystem::weakly_canonical(std::filesystem::path(path), error);
+        std::wstring key = error ? std::filesystem::path(path).lexically_normal().wstring() : canonical.wstring();
+#ifdef _WIN32
+        for (wchar_t& c : key) {
+            c = towlower(c); // NTFS names are case-insensitive
+        }
+#endif
+        return key;
+    }
+}
+
+std::wstring HistoryJournal::journalPathFor(const std::wstring& documentPath) {
+    return documentPath + L".history";
+}
+
+// --- Writing ---
+
+HistoryJournal::HistoryJournal(const std::wstring& path)
+    : path(path) {
+}
+
+HistoryJournal::~HistoryJournal() {
+    out.close(); // Flushed before another journal can claim the file
+    if (!claimedKey.empty()) {
+        JournalClaims& claims = journalClaims();
+        std::lock_guard<std::mutex> lock(claims.mutex);
+        claims.paths.erase(claimedKey);
+    }
+}
+
+// Takes the file for this journal, unless another journal already has it.
+bool HistoryJournal::claim() {
+    if (!claimedKey.empty()) {
+        return true;
+    }
+    std::wstring key = claimKeyFor(path);
+    JournalClaims& claims = journalClaims();
+    std::lock_guard<std::mutex> lock(claims.mutex);
+    if (!claims.paths.insert(key).second) {
+        return false;
+    }
+    claimedKey = std::move(key);
+    return true;
+}
+
+bool HistoryJournal::isClaimed(const std::wstring& path) {
+    std::wstring key = claimKeyFor(path);
+    JournalClaims& claims = journalClaims();
+    std::lock_guard<std::mutex> lock(claims.mutex);
+    return claims.paths.count(key) != 0;
+}
+
+bool HistoryJournal::create(const PieceTable& rootText) {
+    if (!claim()) {
+        return false;
+    }
+    out.close();
+    out.open(std::filesystem::path(path), std::ios::binary | std::ios::trunc);
+    if (!out) {
+        return false;
+    }
+
+    uint16_t version = FORMAT_VERSION;
+    uint16_t charSize = sizeof(wchar_t);
+    out.write(JOURNAL_MAGIC, sizeof(JOURNAL_MAGIC));
+    out.write(reinterpret_cast<const char*>(&version), sizeof(version));
+    out.write(reinterpret_cast<const char*>(&charSize), sizeof(charSize));
+    fileLength = HEADER_SIZE;
+
+    PayloadWriter payload;
+    payload.putText(rootText);
+    return writeRecord(RECORD_ROOT, payload.bytes);
+}
+
+bool HistoryJournal::openForAppend() {
+    if (!claim()) {
+        return false;
+    }
+    out.close();
+    out.open(std::filesystem::path(path), std::ios::binary | std::ios::app);
+    std::error_code error;
+    fileLength = static_cast<size_t>(std::filesystem::file_size(std::filesystem::path(path), error));
+    return static_cast<bool>(out) && !error;
+}
+
+bool HistoryJournal::appendNode(const HistoryNode& node) {
+    const HistoryNode* parent = node.parent;
+
+    PayloadWriter payload;
+    payload.putU64(node.id);
+    payload.putU64(parent ? parent->id : 0);
+    payload.putI64(std::chrono::duration_cast<std::chrono::milliseconds>(node.timestamp.time_since_epoch()).count());
+    payload.putU64(node.contentHash);
+    payload.putU64(node.contentLength);
+    payload.putText(node.commitMessage);
+
+    ChangeSet buffer;
+    const ChangeSet* change = node.tryGetChange(buffer);
+    if (!change) {
+        return false; // Damaged; an empty change in its place would be read back as real
+    }
+    payload.putU32(static_cast<uint32_t>(change->hunks.size()));
+    for (const TextChange& hunk : change->hunks) {
+        payload.putU64(hunk.position);
+        payload.putU64(hunk.cursorPositionAfter);
+        payload.putText(hunk.deletedText);
+        payload.putText(hunk.insertedText);
+    }
+    return writeRecord(RECORD_NODE, payload.bytes);
+}
+
+bool HistoryJournal::appendCheckpoint(uint64_t nodeId, const PieceTable& text) {
+    PayloadWriter payload;
+    payload.putU64(nodeId);
+    payload.putText(text);
+    return writeRecord(RECORD_CHECKPOINT, payload.bytes);
+}
+
+bool HistoryJournal::appendDelete(uint64_t nodeId) {
+    PayloadWriter payload;
+    payload.putU64(nodeId);
+    return writeRecord(RECORD_DELETE, payload.bytes);
+}
+
+bool HistoryJournal::appendCurrent(uint64_t nodeId) {
+    PayloadWriter payload;
+    payload.putU64(nodeId);
+    return writeRecord(RECORD_CURRENT, payload.bytes);
+}
+
+bool HistoryJournal::isOpen() const {
+    return out.is_open() && static_cast<bool>(out);
+}
+
+const std::wstring& HistoryJournal::getPath() const {
+    return path;
+}
+
+size_t HistoryJournal::getLength() const {
+    return fileLength;
+}
+
+bool HistoryJournal::writeRecord(RecordType type, const std::string& payload) {
+    if (!isOpen()) {
+        return false;
+    }
+
+    uint32_t recordType = type;
+    uint64_t length = payload.size();
+    uint32_t checksum = checksumOf(reinterpret_cast<const unsigned char*>(payload.data()), payload.size());
+    out.write(reinterpret_cast<const char*>(&recordType), sizeof(recordType));
+    out.write(reinterpret_cast<const char*>(&length), sizeof(length));
+    out.write(payload.data(), payload.size());
+    out.write(reinterpret_cast<const char*>(&checksum), sizeof(checksum));
+    fileLength += RECORD_HEADER_SIZE + payload.size() + RECORD_TRAILER_SIZE;
+    // Hand every record to the OS right away; a crash then loses at most this one.
+    out.flush();
+    return static_cast<bool>(out);
+}
+
+// --- Reading ---
+
+bool HistoryJournal::read(const MappedFile& file, Contents& out) {
+    out = Contents();
+    if (!file.isOpen() || file.size() < HEADER_SIZE || memcmp(file.data(), JOURNAL_MAGIC, sizeof(JOURNAL_MAGIC)) != 0) {
+        return false;
+    }
+    PayloadReader header(file.data() + sizeof(JOURNAL_MAGIC), HEADER_SIZE - sizeof(JOURNAL_MAGIC));
+    uint16_t version, charSize;
+    header.getU16(version);
+    header.getU16(charSize);
+    if (version != FORMAT_VERSION || charSize != sizeof(wchar_t)) {
+        return false;
+    }
+
+    bool haveRoot = false;
+    size_t offset = HEADER_SIZE;
+    while (offset < file.size()) {
+        uint32_t type;
+        const unsigned char* payload;
+        size_t payloadLength;
+        if (!recordPayload(file, offset, type, payload, payloadLength)) {
+            break; // Torn tail
+        }
+        // Node changes and checkpoint texts are most of the file, and are verified when
+        // they are decoded (so opening a long history reads only record headers). The
+        // last record is checked now: a torn tail has to be found and cut before anything
+        // is appended after it.
+        size_t recordEnd = offset + RECORD_HEADER_SIZE + payloadLength + RECORD_TRAILER_SIZE;
+        bool deferred = (type == RECORD_NODE || type == RECORD_CHECKPOINT) && recordEnd < file.size();
+        if (!deferred && !checksumMatches(payload, payloadLength)) {
+            break;
+        }
+
+        PayloadReader reader(payload, payloadLength);
+        bool valid = true;
+        if (!haveRoot) {
+            // The root has to come first; without it nothing else can be rebuilt.
+            if (type != RECORD_ROOT || !reader.getText(out.rootText)) {
+                return false;
+            }
+            haveRoot = true;
+        }
+        else if (type == RECORD_NODE) {
+            NodeEntry entry;
+            uint64_t contentLength;
+            valid = reader.getU64(entry.id) && reader.getU64(entry.parentId) && reader.getI64(entry.timestampMs)
+                && reader.getU64(entry.contentHash) && reader.getU64(contentLength) && reader.getText(entry.message);
+            entry.contentLength = static_cast<size_t>(contentLength);
+            entry.changeBytes = reader.remaining();
+            entry.recordOffset = offset;
+            if (valid) out.nodes.push_back(std::move(entry));
+        }
+        else if (type == RECORD_CHECKPOINT) {
+            CheckpointEntry entry;
+            valid = reader.getU64(entry.nodeId);
+            entry.recordOffset = offset;
+            if (valid) out.checkpoints.push_back(entry);
+        }
+        else if (type == RECORD_DELETE) {
+            uint64_t id;
+            valid = reader.getU64(id);
+            if (valid) out.deletedNodes.push_back(id);
+        }
+        else if (type == RECORD_CURRENT) {
+            valid = reader.getU64(out.currentNodeId);
+        }
+        // Unknown record types are skipped, so newer writers stay readable.
+
+        if (!valid) {
+            break;
+        }
+        offset = recordEnd;
+        out.validLength = offset;
+        if (type == RECORD_NODE) {
+            out.currentNodeId = out.nodes.back().id; // Recording a change moves to it
+        }
+    }
+    return haveRoot;
+}
+
+bool HistoryJournal::decodeChange(const MappedFile& file, size_t recordOffset, ChangeSet& out) {
+    uint32_t type;
+    const unsigned char* payload;
+    size_t payloadLength;
+    if (!recordPayload(file, recordOffset, type, payload, payloadLength) || type != RECORD_NODE
+        || !checksumMatches(payload, payloadLength)) {
+        return false;
+    }
+
+    PayloadReader reader(payload, payloadLength);
+    std::wstring message;
+    uint32_t hunkCount;
+    // Skip id, parent id, timestamp, hash and length; the scan already read them.
+    if (!reader.skip(5 * sizeof(uint64_t)) || !reader.getText(message) || !reader.getU32(hunkCount)) {
+        return false;
+    }
+
+    ChangeSet change;
+    change.hunks.resize(hunkCount);
+    for (TextChange& hunk : change.hunks) {
+        uint64_t position, cursorAfter;
+        if (!reader.getU64(position) || !reader.getU64(cursorAfter)
+            || !reader.getText(hunk.deletedText) || !reader.getText(hunk.insertedText)) {
+            return false;
+        }
+        hunk.position = static_cast<size_t>(position);
+        hunk.cursorPositionAfter = static_cast<size_t>(cursorAfter);
+    }
+    out = std::move(change);
+    return true;
+}
+
+bool HistoryJournal::decodeText(const MappedFile& file, size_t recordOffset, std::wstring& out) {
+    uint32_t type;
+    const unsigned char* payload;
+    size_t payloadLength;
+    if (!recordPayload(file, recordOffset, type, payload, payloadLength) || type != RECORD_CHECKPOINT
+        || !checksumMatches(payload, payloadLength)) {
+        return false;
+    }
+
+    PayloadReader reader(payload, payloadLength);
+    uint64_t nodeId;
+    return reader.getU64(nodeId) && reader.getText(out);
+}
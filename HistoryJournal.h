@@ -0,0 +1,123 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <fstream>
+#include <cstddef>    // For size_t
+#include <cstdint>
+#include "TextChange.h"
+#include "PieceTable.h"
+#include "MappedFile.h"
+
+class HistoryNode;
+
+// Append-only binary journal holding a document's history tree, stored next to the
+// document as "<file>.history". Records are only ever appended, so a crash can at
+// worst leave a torn record at the end, which the reader detects and drops. (The
+// manager rewrites the whole file, through a temporary one, once compaction has
+// removed nodes; see VersionHistoryManager::rewriteJournal.)
+//
+// Layout (little-endian):
+//   header: "TEHJ", u16 version, u16 sizeof(wchar_t)
+//   record: u32 type, u64 payload length, payload, u32 FNV-1a checksum of the payload
+// Text is stored as raw wchar_t units with a u64 length, so positions stay valid;
+// a journal is only read back on a platform with the same wchar_t size.
+//
+// Record payloads:
+//   Root:       initial text (always the first record)
+//   Node:       (a node id seen before redefines that node: compaction squashed its
+//               parent into it, so it moves up and gets a combined change)
+//               u64 id, u64 parent id, i64 timestamp (ms since epoch), u64 content hash,
+//               u64 content length, message text, u32 hunk count, then per hunk
+//               u64 position, u64 cursor after, deleted text, inserted text
+//   Checkpoint: u64 node id, full text at that node
+//   Delete:     u64 id of a removed subtree
+//   Current:    u64 id of the node the editor moved to
+class HistoryJournal {
+public:
+    static constexpr uint16_t FORMAT_VERSION = 1;
+
+    // "C:\docs\notes.txt" -> "C:\docs\notes.txt.history"
+    static std::wstring journalPathFor(const std::wstring& documentPath);
+
+    // --- Writing ---
+    // A file is written by one HistoryJournal at a time in this process (two tabs on the
+    // same document would otherwise interleave their records): create and openForAppend
+    // claim it by canonical path and fail while another journal holds it. The claim is
+    // released when the journal is destroyed.
+    explicit HistoryJournal(const std::wstring& path);
+    ~HistoryJournal();
+    HistoryJournal(const HistoryJournal&) = delete;
+    HistoryJournal& operator=(const HistoryJournal&) = delete;
+
+    // Starts a new journal, replacing any existing file, and writes the root record.
+    bool create(const PieceTable& rootText);
+    // Appends to an existing journal. Any torn tail must have been cut off already.
+    bool openForAppend();
+    // Whether some journal in this process holds the file at 'path' for writing.
+    static bool isClaimed(const std::wstring& path);
+
+    bool appendNode(const HistoryNode& node);
+    bool appendCheckpoint(uint64_t nodeId, const PieceTable& text);
+    bool appendDelete(uint64_t nodeId);
+    bool appendCurrent(uint64_t nodeId);
+
+    bool isOpen() const;
+    const std::wstring& getPath() const;
+    size_t getLength() const; // Bytes in the file so far: where the next record starts
+
+    // --- Reading ---
+    struct NodeEntry {
+        uint64_t id = 0;
+        uint64_t parentId = 0;
+        int64_t timestampMs = 0;
+        uint64_t contentHash = 0;
+        size_t contentLength = 0;
+        std::wstring message;
+        size_t changeBytes = 0;  // Size of the encoded hunks
+        size_t recordOffset = 0; // For decodeChange
+    };
+
+    struct CheckpointEntry {
+        uint64_t nodeId = 0;
+        size_t recordOffset = 0; // For decodeText
+    };
+
+    struct Contents {
+        std::wstring rootText;
+        std::vector<NodeEntry> nodes;             // In creation order, parents first
+        std::vector<CheckpointEntry> checkpoints;
+        std::vector<uint64_t> deletedNodes;
+        uint64_t currentNodeId = 0;
+        size_t validLength = 0; // Bytes up to the end of the last intact record
+    };
+
+    // Scans the record headers of a mapped journal. Node records have their fixed fields
+    // read; change payloads and checkpoint text are left in the mapping. Their checksums
+    // cover the whole payload, so they are verified when decoded, not here, except for
+    // the last record, the one a crash can tear. Returns false if the file is not a
+    // readable journal.
+    static bool read(const MappedFile& file, Contents& out);
+
+    // Decodes (and verifies) the change stored in a node record.
+    static bool decodeChange(const MappedFile& file, size_t recordOffset, ChangeSet& out);
+    // Decodes (and verifies) the text stored in a checkpoint record.
+    static bool decodeText(const MappedFile& file, size_t recordOffset, std::wstring& out);
+
+private:
+    enum RecordType : uint32_t {
+        RECORD_ROOT = 1,
+        RECORD_NODE = 2,
+        RECORD_CHECKPOINT = 3,
+        RECORD_DELETE = 4,
+        RECORD_CURRENT = 5
+    };
+
+    std::wstring path;
+    std::wstring claimedKey; // Canonical path while this journal holds the claim
+    std::ofstream out;
+    size_t fileLength = 0;
+
+    bool claim();
+    bool writeRecord(RecordType type, const std::string& payload);
+};
@@ -1,31 +1,117 @@
 #include "HistoryNode.h"
+#include "HistoryJournal.h"
+#include "ChangePacking.h"
+#include "Metrics.h"
 
 // Constructor for the root node
 HistoryNode::HistoryNode()
     : timestamp(std::chrono::system_clock::now()),
 	commitMessage(L"Initial State") // Default commit message for the root node
     // Root node's 'changeFromParent' is default initialized (empty).
-    // 'parent' weak_ptr is default initialized (expired).
+    // 'parent' is default initialized (nullptr).
     // 'children' vector is default initialized (empty).
 {
 }
 
 // Constructor for subsequent nodes
-HistoryNode::HistoryNode(std::weak_ptr<HistoryNode> parentNode, const TextChange& change, const std::wstring& message)
+HistoryNode::HistoryNode(HistoryNode* parentNode, const ChangeSet& change, const std::wstring& message)
     : parent(parentNode),
-    changeFromParent(change),
     timestamp(std::chrono::system_clock::now()),
-	commitMessage(message) 
+	commitMessage(message),
+    changeFromParent(change.isEmpty() ? nullptr : std::make_shared<const ChangeSet>(change))
 {
+    if (parentNode) {
+        depth = parentNode->depth + 1;
+    }
+}
+
+// Destroying a node would normally destroy its children recursively, one stack frame per
+// level. Instead, children this node solely owns hand their own children over to a local
+// list before they go, so each one is destroyed with an empty child vector.
+HistoryNode::~HistoryNode() {
+    std::vector<std::shared_ptr<HistoryNode>> pending = std::move(children);
+    while (!pending.empty()) {
+        std::shared_ptr<HistoryNode> child = std::move(pending.back());
+        pending.pop_back();
+        child->parent = nullptr; // Its parent is gone (or about to be)
+        if (child.use_count() == 1) {
+            for (auto& grandchild : child->children) {
+                pending.push_back(std::move(grandchild));
+            }
+            child->children.clear();
+        }
+        // Someone else still holding 'child' keeps it (and its subtree) alive as a detached tree.
+    }
 }
 
 // Checks if this node is the root (has no parent)
 bool HistoryNode::isRoot() const {
-    return parent.expired(); // If the weak_ptr to the parent has expired, it's the root.
+    return parent == nullptr; // Detached nodes have no parent either
+}
+
+// Returns the change leading to this node, decoding it from the journal (once) or from
+// its packed form (every time, into the caller's buffer) if needed
+const ChangeSet* HistoryNode::tryGetChange(ChangeSet& decodeBuffer) const {
+    static const ChangeSet noChange;
+    if (journalChangeOffset != 0) {
+        auto decoded = std::make_shared<ChangeSet>();
+        if (journalFile && HistoryJournal::decodeChange(*journalFile, journalChangeOffset, *decoded)) {
+            changeFromParent = std::move(decoded);
+        }
+        else {
+            markChangeDamaged(); // Fails its checksum (checked here, not on load)
+        }
+        journalChangeOffset = 0;
+    }
+    if (changeDamaged) {
+        return nullptr;
+    }
+    if (changeFromParent || !packedChange) {
+        return changeFromParent ? changeFromParent.get() : &noChange;
+    }
+    if (!UnpackChangeSet(*packedChange, decodeBuffer)) {
+        markChangeDamaged(); // Packed by us in memory; can't fail short of corruption
+        return nullptr;
+    }
+    if (sharedTexts) {
+        RestoreChangeTexts(decodeBuffer, *sharedTexts);
+    }
+    return &decodeBuffer;
+}
+
+const ChangeSet& HistoryNode::getChange(ChangeSet& decodeBuffer) const {
+    const ChangeSet* change = tryGetChange(decodeBuffer);
+    if (!change) {
+        throw DamagedHistoryError(id);
+    }
+    return *change;
+}
+
+bool HistoryNode::isChangeDamaged() const {
+    return changeDamaged;
+}
+
+// Counted, so a damaged journal shows up in the metrics even if nobody navigates through it.
+void HistoryNode::markChangeDamaged() const {
+    if (!changeDamaged) {
+        changeDamaged = true;
+        static MetricCounter& damaged = CounterMetric("history.damaged_changes");
+        damaged.add();
+    }
+}
+
+bool HistoryNode::isChangePacked() const {
+    return packedChange != nullptr;
 }
 
 // Helper to get the inverse change (for conceptual undo)
-TextChange HistoryNode::getReverseChange() const {
-    // Delegate to the TextChange object's method
-    return changeFromParent.getReverseChange();
+ChangeSet HistoryNode::getReverseChange() const {
+    // Delegate to the ChangeSet's method
+    ChangeSet buffer;
+    return getChange(buffer).getReverseChange();
+}
+
+// Checks if this node carries a full-text checkpoint
+bool HistoryNode::hasCheckpoint() const {
+    return checkpointState != nullptr;
 }
\ No newline at end of file
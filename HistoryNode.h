@@ -1,36 +1,113 @@
 #pragma once
 
 #include <vector>
-#include <memory>   // For std::shared_ptr, std::weak_ptr
+#include <memory>   // For std::shared_ptr, std::enable_shared_from_this
 #include <chrono>   // For std::chrono::system_clock::time_point
 #include <string>
+#include <cstdint>
+#include <stdexcept>
 #include "TextChange.h" // Include our change definition
+#include "PieceTable.h"
+#include "BlobStore.h"
 
 // Forward declaration to avoid circular dependency if VersionHistoryManager needs it
 class VersionHistoryManager;
+class MappedFile;
 
-class HistoryNode {
+// Thrown when a node's change can't be read back: its journal record fails the checksum
+// (which is only checked on first use) or its packed form doesn't decode. Anything built
+// from that change would be the wrong text, so the operation is refused instead.
+class DamagedHistoryError : public std::runtime_error {
+public:
+    explicit DamagedHistoryError(uint64_t nodeId)
+        : std::runtime_error("The change leading to history node " + std::to_string(nodeId) + " is damaged."),
+        nodeId(nodeId) {
+    }
+    uint64_t nodeId;
+};
+
+class HistoryNode : public std::enable_shared_from_this<HistoryNode> {
 public:
     // --- Data ---
-    TextChange changeFromParent; // The change that led *to* this node *from* its parent
-    std::weak_ptr<HistoryNode> parent; // Use weak_ptr to avoid ownership cycles
+    uint64_t id = 0; // Stable identity within the tree (root is 0), used by the history journal
+    // Non-owning: a parent owns its children, so it outlives them while they are in the
+    // tree. Walking towards the root is then a plain pointer chase with no refcounting.
+    // Cleared when the node is detached or its parent is destroyed.
+    HistoryNode* parent = nullptr;
     std::vector<std::shared_ptr<HistoryNode>> children; // Owns the child nodes
     std::chrono::system_clock::time_point timestamp;
     std::wstring commitMessage;
-    // Note: Full text state is not stored here to save memory.
+    // Number of edges between this node and the root when it was recorded. History
+    // compaction can squash ancestors away, so it may overstate the distance, but it
+    // always grows strictly from parent to child.
+    size_t depth = 0;
+    // Identity of the text at this node, maintained incrementally when the node is
+    // recorded (see PieceTable::contentHash). Used to look states up without replaying.
+    uint64_t contentHash = 0;
+    size_t contentLength = 0;
+    // Approximate memory held by the change, known even before a journal node is decoded.
+    size_t changeBytes = 0;
+    // Note: Full text state is normally not stored here to save memory.
+    // Selected nodes carry a checkpoint so reconstruction can start from them
+    // instead of replaying every change from the root. Checkpoints are piece-table
+    // snapshots, so they share unchanged text with each other and the root.
+    std::shared_ptr<const PieceTable> checkpointState;
+    // Nodes loaded from a history journal leave their change (and any checkpoint stored
+    // there) in the memory-mapped file until first use. An offset of 0 means none.
+    std::shared_ptr<const MappedFile> journalFile;
+    size_t journalCheckpointOffset = 0;
 
     // --- Constructors ---
     // Constructor for the root node (no parent, represents initial state)
     HistoryNode();
 
     // Constructor for subsequent nodes based on a change from a parent
-    HistoryNode(std::weak_ptr<HistoryNode> parentNode, const TextChange& change, const std::wstring& message = L"");
+    HistoryNode(HistoryNode* parentNode, const ChangeSet& change, const std::wstring& message = L"");
+
+    // Releases the subtree iteratively, so a long chain of descendants cannot overflow the stack
+    ~HistoryNode();
+
+    HistoryNode(const HistoryNode&) = delete;
+    HistoryNode& operator=(const HistoryNode&) = delete;
 
     // --- Methods ---
     bool isRoot() const; // Checks if this node is the root
-    TextChange getReverseChange() const; // Gets the reverse of the change leading to this node
+    // The change (one or more hunks) that led *to* this node *from* its parent. A packed
+    // one is decoded into 'decodeBuffer' and never cached on the node, so whatever the UI
+    // or a replay touches stays packed; the result is valid while the buffer is.
+    // Throws DamagedHistoryError if the change is damaged.
+    const ChangeSet& getChange(ChangeSet& decodeBuffer) const;
+    // Same, but null instead of throwing, for callers that can do without the change.
+    const ChangeSet* tryGetChange(ChangeSet& decodeBuffer) const;
+    bool isChangeDamaged() const; // True once reading the change has failed
+    bool isChangePacked() const; // True if the change is held in compact form (see ChangePacking.h)
+    ChangeSet getReverseChange() const; // Gets the reverse of the change leading to this node (throws like getChange)
+    bool hasCheckpoint() const; // Checks if the full text at this node is stored
 
 private:
+    // The payloads are immutable once stored and held through shared pointers, so a
+    // HistorySnapshot can share them with the tree instead of copying them.
+    // Decoded from 'journalFile' on first access when 'journalChangeOffset' is set.
+    // Null means no change (the root).
+    mutable std::shared_ptr<const ChangeSet> changeFromParent;
+    mutable size_t journalChangeOffset = 0;
+    mutable bool changeDamaged = false; // Set instead of ever standing in an empty change
+    void markChangeDamaged() const;
+    // Compact encoding of the change when the manager packs payloads. 'changeFromParent'
+    // then stays null: it only ever holds changes that were never packed.
+    std::shared_ptr<const std::string> packedChange;
+    // Long texts of the change, kept once for the whole process in the BlobStore. The
+    // packed change then has those texts empty (see ShareChangeTexts).
+    std::shared_ptr<const SharedChangeTexts> sharedTexts;
+
+    // Ancestor index, maintained lazily by VersionHistoryManager (see refreshAncestorIndex):
+    // the exact number of edges to the root and a skew-binary jump pointer to a farther
+    // ancestor. Only meaningful while 'ancestorEpoch' matches the manager's epoch.
+    mutable const HistoryNode* jump = nullptr;
+    mutable size_t level = 0;
+    mutable uint64_t ancestorEpoch = 0;
+
     // Friend declaration allows VersionHistoryManager access if needed for future optimizations
     friend class VersionHistoryManager;
+    friend class HistorySnapshot;
 };
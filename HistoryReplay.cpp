@@ -0,0 +1,217 @@
+// Replays an editing trace recorded by the editor (see EditTrace.h) against a headless
+// history and reports the latency of every kind of operation and the peak memory, then
+// how the trace's typing would have been auto-committed under the fixed and the adaptive
+// policy (see AutoCommitScheduler.h).
+//
+// Usage: history_replay <trace file> [--json <file>] [--timeline <file>]
+//   --timeline  also record the replay's spans (see Timeline.h) as a Chrome trace
+
+#include "TraceReplay.h"
+#include "Timeline.h"
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <Windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+
+namespace {
+    // Peak resident set size of this process, in bytes.
+    size_t peakResidentBytes() {
+#ifdef _WIN32
+        PROCESS_MEMORY_COUNTERS counters;
+        if (GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) {
+            return counters.PeakWorkingSetSize;
+        }
+        return 0;
+#else
+        struct rusage usage;
+        if (getrusage(RUSAGE_SELF, &usage) != 0) {
+            return 0;
+        }
+#ifdef __APPLE__
+        return static_cast<size_t>(usage.ru_maxrss); // Already bytes
+#else
+        return static_cast<size_t>(usage.ru_maxrss) * 1024;
+#endif
+#endif
+    }
+
+    std::string narrow(const std::wstring& text) {
+        std::string result;
+        for (wchar_t ch : text) {
+            result.push_back(ch < 0x80 ? static_cast<char>(ch) : '?');
+        }
+        return result;
+    }
+
+    std::string jsonEscape(const std::string& text) {
+        std::string escaped;
+        for (char ch : text) {
+            if (ch == '"' || ch == '\\') escaped.push_back('\\');
+            escaped.push_back(ch);
+        }
+        return escaped;
+    }
+
+    // The trace's typing under the editor's old fixed auto-commit policy and the adaptive one.
+    struct ScheduleComparison {
+        bool available = false;
+        AutoCommitSimulation fixed;
+        AutoCommitSimulation adaptive;
+    };
+
+    ScheduleComparison compareSchedules(const std::wstring& tracePath) {
+        ScheduleComparison comparison;
+        std::wstring initialText;
+        std::vector<TimedEdit> edits;
+        if (!ReadTracedEdits(tracePath, initialText, edits) || edits.empty()) {
+            return comparison;
+        }
+        AutoCommitScheduler::Policy policy;
+        comparison.adaptive = SimulateAutoCommits(initialText, edits, policy);
+        policy.adaptive = false;
+        comparison.fixed = SimulateAutoCommits(initialText, edits, policy);
+        comparison.available = true;
+        return comparison;
+    }
+
+    void writeScheduleJson(std::ofstream& out, const char* name, const AutoCommitSimulation& simulation, bool last) {
+        out << "    \"" << name << "\": { \"threshold_commits\": " << simulation.thresholdCommits
+            << ", \"idle_commits\": " << simulation.idleCommits
+            << ", \"commit_total_us\": " << simulation.commits.totalMicros
+            << ", \"commit_p99_us\": " << simulation.commits.p99Micros
+            << ", \"max_pending_chars\": " << simulation.maxPendingChars
+            << ", \"mean_committed_chars\": " << simulation.meanCommittedChars << " }"
+            << (last ? "" : ",") << "\n";
+    }
+
+    bool writeJson(const std::string& path, const std::string& tracePath, const TraceReplayResult& result, size_t peakRss,
+                   const ScheduleComparison& schedules) {
+        std::ofstream out(path, std::ios::binary | std::ios::trunc);
+        if (!out) {
+            return false;
+        }
+        out << "{\n"
+            << "  \"trace\": \"" << jsonEscape(tracePath) << "\",\n"
+            << "  \"records\": " << result.records << ",\n"
+            << "  \"snapshot_nodes\": " << result.snapshotNodes << ",\n"
+            << "  \"truncated\": " << (result.truncated ? "true" : "false") << ",\n"
+            << "  \"session_seconds\": " << result.sessionMicros / 1e6 << ",\n"
+            << "  \"setup_ms\": " << result.setupMillis << ",\n"
+            << "  \"divergences\": " << result.divergences << ",\n"
+            << "  \"first_divergence\": \"" << jsonEscape(narrow(result.firstDivergence)) << "\",\n"
+            << "  \"final_nodes\": " << result.finalNodeCount << ",\n"
+            << "  \"peak_history_bytes\": " << result.peakHistoryBytes << ",\n"
+            << "  \"peak_rss_bytes\": " << peakRss << ",\n"
+            << "  \"operations\": {\n";
+        size_t index = 0;
+        for (const auto& entry : result.operations) {
+            const TraceOperationStats& stats = entry.second;
+            out << "    \"" << entry.first << "\": { \"count\": " << stats.count
+                << ", \"total_us\": " << stats.totalMicros
+                << ", \"p50_us\": " << stats.p50Micros
+                << ", \"p99_us\": " << stats.p99Micros
+                << ", \"max_us\": " << stats.maxMicros << " }"
+                << (++index < result.operations.size() ? "," : "") << "\n";
+        }
+        out << "  }";
+        if (schedules.available) {
+            out << ",\n  \"auto_commit\": {\n";
+            writeScheduleJson(out, "fixed", schedules.fixed, false);
+            writeScheduleJson(out, "adaptive", schedules.adaptive, true);
+            out << "  }";
+        }
+        out << "\n}\n";
+        return static_cast<bool>(out);
+    }
+}
+
+int main(int argc, char** argv) {
+    const char* tracePath = nullptr;
+    const char* jsonPath = nullptr;
+    const char* timelinePath = nullptr;
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--json") == 0 && i + 1 < argc) {
+            jsonPath = argv[++i];
+        }
+        else if (strcmp(argv[i], "--timeline") == 0 && i + 1 < argc) {
+            timelinePath = argv[++i];
+        }
+        else if (!tracePath && argv[i][0] != '-') {
+            tracePath = argv[i];
+        }
+        else {
+            tracePath = nullptr;
+            break;
+        }
+    }
+    if (!tracePath) {
+        fprintf(stderr, "usage: %s <trace file> [--json <file>] [--timeline <file>]\n", argv[0]);
+        return 2;
+    }
+    if (timelinePath) {
+        Timeline::global().setThreadName("replay");
+        Timeline::global().start();
+    }
+
+    TraceReplayResult result;
+    if (!ReplayTrace(std::filesystem::path(tracePath).wstring(), result)) {
+        fprintf(stderr, "%s is not a readable trace\n", tracePath);
+        return 1;
+    }
+    Timeline::global().stop(); // The auto-commit simulations aren't part of the replay
+    ScheduleComparison schedules = compareSchedules(std::filesystem::path(tracePath).wstring());
+    size_t peakRss = peakResidentBytes();
+
+    printf("trace               %s%s\n", tracePath, result.truncated ? " (truncated)" : "");
+    printf("records             %zu (%zu snapshot nodes, rebuilt in %.1f ms)\n",
+        result.records, result.snapshotNodes, result.setupMillis);
+    printf("session             %.1f s\n", result.sessionMicros / 1e6);
+    printf("nodes at end        %zu\n", result.finalNodeCount);
+    printf("peak history bytes  %zu\n", result.peakHistoryBytes);
+    printf("peak RSS            %.1f MiB\n", peakRss / (1024.0 * 1024.0));
+    printf("divergences         %zu%s%s\n", result.divergences,
+        result.divergences ? ", first: " : "", narrow(result.firstDivergence).c_str());
+    printf("\n%-12s %10s %12s %10s %10s %10s\n", "operation", "count", "total ms", "p50 us", "p99 us", "max us");
+    for (const auto& entry : result.operations) {
+        const TraceOperationStats& stats = entry.second;
+        printf("%-12s %10zu %12.2f %10.2f %10.2f %10.2f\n", entry.first.c_str(), stats.count,
+            stats.totalMicros / 1000.0, stats.p50Micros, stats.p99Micros, stats.maxMicros);
+    }
+
+    if (schedules.available) {
+        printf("\n%-12s %10s %10s %12s %10s %12s %12s\n", "auto-commit", "threshold", "idle", "total ms", "p99 us", "max pending", "chars/commit");
+        for (const auto& entry : { std::make_pair("fixed", &schedules.fixed), std::make_pair("adaptive", &schedules.adaptive) }) {
+            const AutoCommitSimulation& simulation = *entry.second;
+            printf("%-12s %10zu %10zu %12.2f %10.2f %12zu %12.1f%s\n", entry.first, simulation.thresholdCommits,
+                simulation.idleCommits, simulation.commits.totalMicros / 1000.0, simulation.commits.p99Micros,
+                simulation.maxPendingChars, simulation.meanCommittedChars, simulation.consistent ? "" : "  (inconsistent)");
+        }
+    }
+
+    if (jsonPath && !writeJson(jsonPath, tracePath, result, peakRss, schedules)) {
+        fprintf(stderr, "could not write %s\n", jsonPath);
+        return 1;
+    }
+    if (timelinePath) {
+        if (!Timeline::global().writeChromeTrace(std::filesystem::path(timelinePath).wstring())) {
+            fprintf(stderr, "could not write %s\n", timelinePath);
+            return 1;
+        }
+        printf("\ntimeline            %zu spans (%zu dropped) in %s\n", Timeline::global().eventCount(),
+            Timeline::global().droppedCount(), timelinePath);
+    }
+    return result.divergences == 0 ? 0 : 3;
+}
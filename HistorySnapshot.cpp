@@ -0,0 +1,186 @@
+#include "HistorySnapshot.h"
+#include "HistoryNode.h"
+#include "HistoryJournal.h"
+#include "ChangePacking.h"
+#include "Timeline.h"
+#include <algorithm>
+#include <utility>
+
+HistorySnapshot::HistorySnapshot(const HistoryNode& root, const HistoryNode& current,
+    const PieceTable& rootDocument, const PieceTable& currentDocument)
+    : tree(std::make_shared<Tree>()), currentDocument(currentDocument) {
+    tree->rootDocument = rootDocument;
+
+    // Depth-first, children in order; iterative so any depth of history is fine.
+    std::vector<std::pair<const HistoryNode*, Index>> pending = { { &root, NO_ENTRY } };
+    while (!pending.empty()) {
+        const HistoryNode* node = pending.back().first;
+        Index parent = pending.back().second;
+        pending.pop_back();
+
+        Index index = tree->entries.size();
+        Entry entry;
+        entry.id = node->id;
+        entry.parent = parent;
+        entry.depth = node->depth;
+        entry.contentHash = node->contentHash;
+        entry.contentLength = node->contentLength;
+        entry.timestamp = node->timestamp;
+        entry.commitMessage = node->commitMessage;
+        tree->entries.push_back(std::move(entry));
+
+        Payload payload;
+        payload.change = node->changeFromParent;
+        payload.packedChange = node->packedChange;
+        payload.sharedTexts = node->sharedTexts;
+        payload.journalChangeOffset = node->journalChangeOffset;
+        payload.changeDamaged = node->changeDamaged;
+        payload.checkpoint = node->checkpointState;
+        payload.journalCheckpointOffset = node->journalCheckpointOffset;
+        payload.journalFile = node->journalFile;
+        tree->payloads.push_back(std::move(payload));
+
+        if (node == &current) {
+            currentIndex = index;
+        }
+        for (auto it = node->children.rbegin(); it != node->children.rend(); ++it) {
+            pending.emplace_back(it->get(), index);
+        }
+    }
+}
+
+HistorySnapshot::HistorySnapshot(const HistorySnapshot& other, const HistoryNode& current, const PieceTable& currentDocument)
+    : tree(other.tree), currentDocument(currentDocument) {
+    currentIndex = findEntry(current.id);
+    if (currentIndex == NO_ENTRY) {
+        currentIndex = getRootIndex(); // Not expected: the current node is always in the tree
+    }
+}
+
+size_t HistorySnapshot::size() const {
+    return tree->entries.size();
+}
+
+const HistorySnapshot::Entry& HistorySnapshot::getEntry(Index index) const {
+    return tree->entries.at(index);
+}
+
+HistorySnapshot::Index HistorySnapshot::findEntry(uint64_t nodeId) const {
+    std::call_once(tree->idIndexBuilt, [this] {
+        tree->idIndex.reserve(tree->entries.size());
+        for (Index i = 0; i < tree->entries.size(); ++i) {
+            tree->idIndex.emplace(tree->entries[i].id, i);
+        }
+    });
+    auto it = tree->idIndex.find(nodeId);
+    return it != tree->idIndex.end() ? it->second : NO_ENTRY;
+}
+
+// Same payload precedence as HistoryNode::getChange, without caching anything. A damaged
+// change throws DamagedHistoryError, as it does there.
+const ChangeSet& HistorySnapshot::getChange(Index index, ChangeSet& decodeBuffer) const {
+    static const ChangeSet noChange;
+    const Payload& payload = tree->payloads[index];
+    if (payload.changeDamaged) {
+        throw DamagedHistoryError(tree->entries[index].id);
+    }
+    if (payload.journalChangeOffset != 0) {
+        if (!payload.journalFile || !HistoryJournal::decodeChange(*payload.journalFile, payload.journalChangeOffset, decodeBuffer)) {
+            throw DamagedHistoryError(tree->entries[index].id);
+        }
+        return decodeBuffer;
+    }
+    if (payload.change) {
+        return *payload.change;
+    }
+    if (payload.packedChange) {
+        if (!UnpackChangeSet(*payload.packedChange, decodeBuffer)) {
+            throw DamagedHistoryError(tree->entries[index].id);
+        }
+        if (payload.sharedTexts) {
+            RestoreChangeTexts(decodeBuffer, *payload.sharedTexts);
+        }
+        return decodeBuffer;
+    }
+    return noChange;
+}
+
+PieceTable HistorySnapshot::reconstructDocument(Index index, const CancellationToken& token) const {
+    TIMELINE_SPAN("HistorySnapshot::reconstructDocument");
+    if (index >= size()) {
+        throw std::out_of_range("No such snapshot entry.");
+    }
+    if (index == currentIndex) {
+        return currentDocument;
+    }
+
+    // Walk up to the nearest checkpoint (in memory or in the journal), then replay down.
+    std::vector<Index> entriesToApply;
+    PieceTable document = tree->rootDocument;
+    std::wstring journalText;
+    for (Index walker = index; walker != getRootIndex(); walker = tree->entries[walker].parent) {
+        const Payload& payload = tree->payloads[walker];
+        if (payload.checkpoint) {
+            document = *payload.checkpoint;
+            break;
+        }
+        if (payload.journalCheckpointOffset != 0 && payload.journalFile
+            && HistoryJournal::decodeText(*payload.journalFile, payload.journalCheckpointOffset, journalText)) {
+            document = PieceTable(std::move(journalText));
+            break;
+        }
+        entriesToApply.push_back(walker);
+    }
+
+    document = document.withPrivateBuffer(); // Replayed text is freed with the result
+
+    ChangeSet buffer;
+    for (auto it = entriesToApply.rbegin(); it != entriesToApply.rend(); ++it) {
+        token.throwIfCancelled();
+        document.applyChange(getChange(*it, buffer));
+    }
+    return document;
+}
+
+uint64_t HistorySnapshot::stateKey(uint64_t contentHash, size_t contentLength) {
+    // Same key as VersionHistoryManager's state index
+    return contentHash ^ (static_cast<uint64_t>(contentLength) * 0x9E3779B97F4A7C15ull);
+}
+
+HistorySnapshot::Index HistorySnapshot::findMatchingState(const std::wstring& text, const CancellationToken& token) const {
+    TIMELINE_SPAN("HistorySnapshot::findMatchingState");
+    std::call_once(tree->stateIndexBuilt, [this] {
+        tree->stateIndex.reserve(tree->entries.size());
+        for (Index i = 0; i < tree->entries.size(); ++i) {
+            tree->stateIndex.emplace(stateKey(tree->entries[i].contentHash, tree->entries[i].contentLength), i);
+        }
+    });
+
+    uint64_t targetHash = PieceTable::hashText(text);
+    token.throwIfCancelled();
+    std::vector<Index> candidates;
+    auto range = tree->stateIndex.equal_range(stateKey(targetHash, text.length()));
+    for (auto it = range.first; it != range.second; ++it) {
+        const Entry& entry = tree->entries[it->second];
+        if (entry.contentHash == targetHash && entry.contentLength == text.length()) {
+            candidates.push_back(it->second);
+        }
+    }
+
+    if (candidates.empty()) {
+        return NO_ENTRY;
+    }
+
+    // Identical texts reached on different paths, or colliding ones (the hash is not
+    // collision-resistant, so a lone candidate is no proof either): compare the full
+    // text, shallowest first.
+    std::sort(candidates.begin(), candidates.end(), [this](Index a, Index b) {
+        return tree->entries[a].depth < tree->entries[b].depth;
+    });
+    for (Index candidate : candidates) {
+        if (reconstructDocument(candidate, token).equals(text)) {
+            return candidate;
+        }
+    }
+    return NO_ENTRY;
+}
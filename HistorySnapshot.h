@@ -0,0 +1,98 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>    // For size_t
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "BlobStore.h"
+#include "PieceTable.h"
+#include "TextChange.h"
+#include "HistoryWorker.h"
+
+class HistoryNode;
+class MappedFile;
+
+// A read-only copy of a history tree for background readers. It is taken on the
+// thread that owns the VersionHistoryManager (see getSnapshot) and from then on may be
+// used from any number of threads at once, while the manager keeps recording, moving
+// and compacting. Changes, checkpoints and documents are shared with the tree rather
+// than copied (they are immutable once stored); only the per-node bookkeeping is.
+//
+// Entries are numbered depth-first from the root (index 0) and refer to each other by
+// index. Node ids identify the same versions in the live tree.
+class HistorySnapshot {
+public:
+    using Index = size_t;
+    static constexpr Index NO_ENTRY = std::numeric_limits<Index>::max();
+
+    struct Entry {
+        uint64_t id = 0;
+        Index parent = NO_ENTRY;
+        size_t depth = 0;
+        uint64_t contentHash = 0;
+        size_t contentLength = 0;
+        std::chrono::system_clock::time_point timestamp;
+        std::wstring commitMessage;
+    };
+
+    // Copies the tree under 'root'. 'rootDocument' is the text at the root and
+    // 'currentDocument' the text at 'current'.
+    HistorySnapshot(const HistoryNode& root, const HistoryNode& current,
+        const PieceTable& rootDocument, const PieceTable& currentDocument);
+    // Shares the tree of 'other' with a different current node (the tree itself has not
+    // changed since 'other' was taken).
+    HistorySnapshot(const HistorySnapshot& other, const HistoryNode& current, const PieceTable& currentDocument);
+
+    size_t size() const;
+    const Entry& getEntry(Index index) const;
+    Index getRootIndex() const { return 0; }
+    Index getCurrentIndex() const { return currentIndex; }
+    Index findEntry(uint64_t nodeId) const; // NO_ENTRY if the version was not in the tree
+    const PieceTable& getCurrentDocument() const { return currentDocument; }
+
+    // The text of a version, rebuilt from its nearest checkpoint. Throws
+    // OperationCancelled if 'token' is cancelled on the way, and DamagedHistoryError
+    // if a change it needs can't be read.
+    PieceTable reconstructDocument(Index index, const CancellationToken& token = CancellationToken()) const;
+    // The shallowest version whose text is 'text' (as VersionHistoryManager's
+    // findNodeMatchingState), or NO_ENTRY.
+    Index findMatchingState(const std::wstring& text, const CancellationToken& token = CancellationToken()) const;
+
+private:
+    struct Payload {
+        std::shared_ptr<const ChangeSet> change;        // Decoded change, if any
+        std::shared_ptr<const std::string> packedChange;
+        std::shared_ptr<const SharedChangeTexts> sharedTexts;
+        size_t journalChangeOffset = 0;
+        bool changeDamaged = false; // The node's change already failed to read
+        std::shared_ptr<const PieceTable> checkpoint;
+        size_t journalCheckpointOffset = 0;
+        std::shared_ptr<const MappedFile> journalFile;
+    };
+
+    // Everything that depends on the tree only, shared by snapshots that differ just in
+    // their current node. Lookup tables are built on first use, by whichever thread
+    // needs them first.
+    struct Tree {
+        std::vector<Entry> entries;
+        std::vector<Payload> payloads;
+        PieceTable rootDocument;
+
+        std::once_flag idIndexBuilt;
+        std::unordered_map<uint64_t, Index> idIndex;
+        std::once_flag stateIndexBuilt;
+        std::unordered_multimap<uint64_t, Index> stateIndex; // (hash, length) key -> entries
+    };
+
+    std::shared_ptr<Tree> tree;
+    Index currentIndex = 0;
+    PieceTable currentDocument;
+
+    static uint64_t stateKey(uint64_t contentHash, size_t contentLength);
+    const ChangeSet& getChange(Index index, ChangeSet& decodeBuffer) const;
+};
@@ -0,0 +1,237 @@
+#include "HistoryTreeModel.h"
+#include "Timeline.h"
+#include <algorithm>
+#include <ctime>
+#include <cwchar>    // For wcsftime
+
+namespace {
+    // localtime_s is the MSVC spelling; POSIX has localtime_r with swapped arguments.
+    void toLocalTime(time_t time, tm& local) {
+#ifdef _WIN32
+        localtime_s(&local, &time);
+#else
+        localtime_r(&time, &local);
+#endif
+    }
+}
+
+HistoryTreeModel::HistoryTreeModel(std::shared_ptr<HistoryNode> root, std::shared_ptr<const HistoryNode> currentNode, size_t pageSize)
+    : currentNode(std::move(currentNode)), pageSize(pageSize > 0 ? pageSize : 1) {
+    addRow(std::move(root), NO_ROW);
+}
+
+HistoryTreeModel::RowId HistoryTreeModel::addRow(std::shared_ptr<HistoryNode> node, RowId parent) {
+    Row row;
+    row.node = std::move(node);
+    row.parent = parent;
+    rows.push_back(std::move(row));
+    liveRows++;
+    RowId id = rows.size() - 1;
+    if (parent != NO_ROW) {
+        rows[parent].children.push_back(id);
+    }
+    return id;
+}
+
+std::vector<HistoryTreeModel::RowId> HistoryTreeModel::loadPage(RowId row) {
+    TIMELINE_SPAN("HistoryTreeModel::loadPage");
+    std::vector<RowId> added;
+    std::shared_ptr<HistoryNode> node = rows[row].node;
+    if (!node) {
+        return added;
+    }
+
+    size_t first = rows[row].childrenLoaded;
+    size_t last = std::min(node->children.size(), first + pageSize);
+    added.reserve(last - first + 1);
+    for (size_t i = first; i < last; ++i) {
+        added.push_back(addRow(node->children[i], row)); // May reallocate 'rows'
+    }
+    rows[row].childrenLoaded = last;
+
+    if (last < node->children.size()) {
+        RowId more = addRow(nullptr, row);
+        rows[row].moreRow = more;
+        added.push_back(more);
+    }
+    return added;
+}
+
+std::vector<HistoryTreeModel::RowId> HistoryTreeModel::expand(RowId row) {
+    if (!isValidRow(row) || isMoreRow(row) || rows[row].expanded) {
+        return {};
+    }
+    rows[row].expanded = true;
+    return loadPage(row);
+}
+
+std::vector<HistoryTreeModel::RowId> HistoryTreeModel::expandMore(RowId moreRow) {
+    if (!isValidRow(moreRow) || !isMoreRow(moreRow)) {
+        return {};
+    }
+    RowId parent = rows[moreRow].parent;
+    removeRow(moreRow);
+    return loadPage(parent);
+}
+
+HistoryTreeModel::RowId HistoryTreeModel::findChildRow(RowId parentRow, const HistoryNode* node) const {
+    if (!isValidRow(parentRow)) {
+        return NO_ROW;
+    }
+    for (RowId child : rows[parentRow].children) {
+        if (rows[child].node.get() == node) {
+            return child;
+        }
+    }
+    return NO_ROW;
+}
+
+HistoryTreeModel::RowId HistoryTreeModel::getMoreRow(RowId parentRow) const {
+    return isValidRow(parentRow) ? rows[parentRow].moreRow : NO_ROW;
+}
+
+std::vector<const HistoryNode*> HistoryTreeModel::pathFromRoot(const HistoryNode* node) {
+    std::vector<const HistoryNode*> path;
+    for (; node; node = node->parent) {
+        path.push_back(node);
+    }
+    std::reverse(path.begin(), path.end());
+    return path;
+}
+
+void HistoryTreeModel::removeRow(RowId row) {
+    if (!isValidRow(row) || row == getRootRow()) {
+        return;
+    }
+
+    // Detach from the parent row. A node row stood for one of the parent's loaded
+    // children, which the caller has just deleted from the history.
+    RowId parent = rows[row].parent;
+    std::vector<RowId>& siblings = rows[parent].children;
+    siblings.erase(std::remove(siblings.begin(), siblings.end(), row), siblings.end());
+    if (rows[parent].moreRow == row) {
+        rows[parent].moreRow = NO_ROW;
+    }
+    else if (rows[parent].childrenLoaded > 0) {
+        rows[parent].childrenLoaded--;
+    }
+
+    std::vector<RowId> pending = { row };
+    while (!pending.empty()) {
+        Row& current = rows[pending.back()];
+        pending.pop_back();
+        pending.insert(pending.end(), current.children.begin(), current.children.end());
+        current.children.clear();
+        current.node.reset();
+        current.label.clear();
+        current.removed = true;
+        liveRows--;
+    }
+}
+
+bool HistoryTreeModel::isValidRow(RowId row) const {
+    return row < rows.size() && !rows[row].removed;
+}
+
+bool HistoryTreeModel::isMoreRow(RowId row) const {
+    return isValidRow(row) && !rows[row].node;
+}
+
+bool HistoryTreeModel::isCurrentRow(RowId row) const {
+    return isValidRow(row) && rows[row].node && rows[row].node == currentNode;
+}
+
+bool HistoryTreeModel::isExpanded(RowId row) const {
+    return isValidRow(row) && rows[row].expanded;
+}
+
+bool HistoryTreeModel::hasChildren(RowId row) const {
+    return isValidRow(row) && rows[row].node && !rows[row].node->children.empty();
+}
+
+std::shared_ptr<HistoryNode> HistoryTreeModel::getNode(RowId row) const {
+    return isValidRow(row) ? rows[row].node : nullptr;
+}
+
+HistoryTreeModel::RowId HistoryTreeModel::getParentRow(RowId row) const {
+    return isValidRow(row) ? rows[row].parent : NO_ROW;
+}
+
+const std::vector<HistoryTreeModel::RowId>& HistoryTreeModel::getChildRows(RowId row) const {
+    static const std::vector<RowId> none;
+    return isValidRow(row) ? rows[row].children : none;
+}
+
+const std::wstring& HistoryTreeModel::getLabel(RowId row) {
+    static const std::wstring empty;
+    if (!isValidRow(row)) {
+        return empty;
+    }
+
+    Row& entry = rows[row];
+    if (!entry.node) {
+        // Not cached: deleting a loaded sibling changes the count.
+        const Row& parent = rows[entry.parent];
+        size_t remaining = parent.node ? parent.node->children.size() - parent.childrenLoaded : 0;
+        entry.label = L"(" + std::to_wstring(remaining) + L" more versions...)";
+        return entry.label;
+    }
+    if (!entry.labelReady) {
+        entry.label = formatNodeLabel(*entry.node);
+        if (entry.node == currentNode) {
+            entry.label += L" (Current)";
+        }
+        entry.labelReady = true;
+        labelsFormatted++;
+    }
+    return entry.label;
+}
+
+void HistoryTreeModel::setViewItem(RowId row, void* item) {
+    if (isValidRow(row)) {
+        rows[row].viewItem = item;
+    }
+}
+
+void* HistoryTreeModel::getViewItem(RowId row) const {
+    return isValidRow(row) ? rows[row].viewItem : nullptr;
+}
+
+size_t HistoryTreeModel::getRowCount() const {
+    return liveRows;
+}
+
+size_t HistoryTreeModel::getLabelsFormatted() const {
+    return labelsFormatted;
+}
+
+std::wstring HistoryTreeModel::formatNodeLabel(const HistoryNode& node) {
+    time_t tt = std::chrono::system_clock::to_time_t(node.timestamp);
+    tm local_tm;
+    toLocalTime(tt, local_tm);
+    wchar_t timeBuffer[32];
+    wcsftime(timeBuffer, sizeof(timeBuffer) / sizeof(timeBuffer[0]), L"%H:%M:%S", &local_tm);
+
+    std::wstring description = L"[";
+    description += timeBuffer;
+    description += L"]";
+    if (node.isRoot()) {
+        return description + L" " + node.commitMessage + L" (Root)"; // Indicate Root
+    }
+
+    if (!node.commitMessage.empty()) {
+        description += L" " + node.commitMessage;
+    }
+    else {
+        description += L" (Auto)";
+    }
+    ChangeSet changeBuffer; // Packed changes are decoded here, not cached on the node
+    const ChangeSet* change = node.tryGetChange(changeBuffer);
+    if (!change) {
+        return description + L" (damaged)";
+    }
+    description += L" (+" + std::to_wstring(change->insertedLength())
+        + L" / -" + std::to_wstring(change->deletedLength())
+        + L")";
+    return description;
+}
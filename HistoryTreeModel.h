@@ -0,0 +1,92 @@
+#pragma once
+
+#include <memory>
+#include <string>
+#include <vector>
+#include <limits>
+#include <cstddef>    // For size_t
+#include <cstdint>
+#include "HistoryNode.h"
+
+// View model behind the History dialog's tree. Rows are created only when the view
+// shows them: a node's children become rows when it is expanded, a page at a time,
+// with a trailing "more" row standing for the rest. Labels are formatted when first
+// asked for (the view requests them for visible items only) and then cached.
+// Nothing here recurses, so a history of any depth is safe to show.
+//
+// Rows keep their node alive while the dialog is open; each row also carries an
+// opaque handle of the view's item for it (an HTREEITEM in the editor).
+class HistoryTreeModel {
+public:
+    using RowId = size_t;
+    static constexpr RowId NO_ROW = std::numeric_limits<RowId>::max();
+    static constexpr size_t DEFAULT_PAGE_SIZE = 256;
+
+    // 'currentNode' is the version the editor shows; its row gets the "(Current)" mark.
+    HistoryTreeModel(std::shared_ptr<HistoryNode> root, std::shared_ptr<const HistoryNode> currentNode,
+        size_t pageSize = DEFAULT_PAGE_SIZE);
+
+    RowId getRootRow() const { return 0; }
+
+    // Creates rows for the first page of the row's children (plus a "more" row if
+    // there are further children) and returns them in display order. Empty if the row
+    // was already expanded or has no children.
+    std::vector<RowId> expand(RowId row);
+    // Turns a "more" row into the next page: returns the new rows, again followed by a
+    // new "more" row if children remain. The "more" row itself is removed.
+    std::vector<RowId> expandMore(RowId moreRow);
+
+    // Row of 'node' among the rows already created under 'parentRow', or NO_ROW.
+    RowId findChildRow(RowId parentRow, const HistoryNode* node) const;
+    // The "more" row currently under 'parentRow', or NO_ROW.
+    RowId getMoreRow(RowId parentRow) const;
+
+    // Nodes from the root down to 'node', inclusive (for revealing it).
+    static std::vector<const HistoryNode*> pathFromRoot(const HistoryNode* node);
+
+    // Forgets the rows of 'row' and everything created under it, e.g. once its node
+    // was deleted from the history.
+    void removeRow(RowId row);
+
+    bool isValidRow(RowId row) const;
+    bool isMoreRow(RowId row) const;
+    bool isCurrentRow(RowId row) const;
+    bool isExpanded(RowId row) const;
+    bool hasChildren(RowId row) const; // Whether the row can be expanded
+    std::shared_ptr<HistoryNode> getNode(RowId row) const; // Null for "more" rows
+    RowId getParentRow(RowId row) const;
+    const std::vector<RowId>& getChildRows(RowId row) const; // Rows created under it so far
+    const std::wstring& getLabel(RowId row); // Formatted on first use
+
+    void setViewItem(RowId row, void* item);
+    void* getViewItem(RowId row) const;
+
+    size_t getRowCount() const;      // Live rows created so far
+    size_t getLabelsFormatted() const;
+
+    // "[14:35:10] message (+3 / -1)" as shown for 'node' (without the current marker).
+    static std::wstring formatNodeLabel(const HistoryNode& node);
+
+private:
+    struct Row {
+        std::shared_ptr<HistoryNode> node; // Null for a "more" row (and once removed)
+        RowId parent = NO_ROW;
+        std::vector<RowId> children;       // Rows created under this one, in order
+        size_t childrenLoaded = 0;         // Children of the node that have rows
+        RowId moreRow = NO_ROW;
+        bool expanded = false;
+        bool removed = false;
+        bool labelReady = false;
+        std::wstring label;
+        void* viewItem = nullptr;
+    };
+
+    std::vector<Row> rows; // Indexed by RowId; removed rows stay as tombstones
+    std::shared_ptr<const HistoryNode> currentNode;
+    size_t pageSize;
+    size_t liveRows = 0;
+    size_t labelsFormatted = 0;
+
+    RowId addRow(std::shared_ptr<HistoryNode> node, RowId parent);
+    std::vector<RowId> loadPage(RowId row);
+};
@@ -0,0 +1,92 @@
+#include "HistoryWorker.h"
+#include "Timeline.h"
+#include <algorithm>
+
+HistoryWorkerPool::HistoryWorkerPool(size_t threadCount) {
+    threadCount = std::max<size_t>(threadCount, 1);
+    threads.reserve(threadCount);
+    for (size_t i = 0; i < threadCount; ++i) {
+        threads.emplace_back(&HistoryWorkerPool::workerLoop, this);
+    }
+}
+
+HistoryWorkerPool::~HistoryWorkerPool() {
+    std::deque<QueuedTask> abandoned;
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        stopping = true;
+        abandoned.swap(queue);
+    }
+    wake.notify_all();
+
+    // Jobs that never started still complete their futures (as cancelled), so nobody
+    // waits on them forever.
+    for (QueuedTask& queued : abandoned) {
+        queued.task(false);
+    }
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+}
+
+size_t HistoryWorkerPool::defaultThreadCount() {
+    size_t hardware = std::thread::hardware_concurrency();
+    return std::min<size_t>(std::max<size_t>(hardware, 2) - 1, 4);
+}
+
+size_t HistoryWorkerPool::getThreadCount() const {
+    return threads.size();
+}
+
+size_t HistoryWorkerPool::getPendingCount() const {
+    std::lock_guard<std::mutex> guard(lock);
+    return queue.size();
+}
+
+void HistoryWorkerPool::enqueue(CancellationToken token, Task task) {
+    std::vector<Task> dropped;
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        // Jobs cancelled while waiting would only be skipped once a worker got to them;
+        // finish them now instead of holding on to their captures until then.
+        for (auto it = queue.begin(); it != queue.end();) {
+            if (it->token.isCancelled()) {
+                dropped.push_back(std::move(it->task));
+                it = queue.erase(it);
+            }
+            else {
+                ++it;
+            }
+        }
+        if (!stopping) {
+            queue.push_back(QueuedTask{ std::move(token), std::move(task) });
+            task = nullptr;
+        }
+    }
+    for (Task& cancelled : dropped) {
+        cancelled(true); // Sees its cancelled token and completes as cancelled
+    }
+    if (task) {
+        task(false); // Submitted during shutdown
+        return;
+    }
+    wake.notify_one();
+}
+
+void HistoryWorkerPool::workerLoop() {
+    Timeline::global().setThreadName("HistoryWorkerPool");
+    for (;;) {
+        Task task;
+        {
+            std::unique_lock<std::mutex> guard(lock);
+            wake.wait(guard, [this] { return stopping || !queue.empty(); });
+            if (queue.empty()) {
+                return; // Stopping, and the destructor took what was left
+            }
+            task = std::move(queue.front().task);
+            queue.pop_front();
+        }
+        TIMELINE_SPAN("HistoryWorkerPool job");
+        task(true);
+    }
+}
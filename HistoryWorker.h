@@ -0,0 +1,120 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>    // For size_t
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+// Background execution for history operations that can take long on big documents
+// (rebuilding a version, searching the tree, diffing), so the UI thread only starts
+// them and picks up the result. Jobs work on a HistorySnapshot, never on the live
+// VersionHistoryManager, which stays owned by the UI thread.
+
+// Thrown (through the future) by a job that was cancelled, including one cancelled
+// before it started.
+class OperationCancelled : public std::runtime_error {
+public:
+    OperationCancelled() : std::runtime_error("Operation cancelled") {}
+};
+
+// Cooperative cancellation: whoever started a job keeps a copy and calls cancel(), the
+// job checks it between steps. Copies share the flag; a new token is not cancelled.
+class CancellationToken {
+public:
+    CancellationToken() : cancelled(std::make_shared<std::atomic<bool>>(false)) {}
+
+    void cancel() const { cancelled->store(true, std::memory_order_relaxed); }
+    bool isCancelled() const { return cancelled->load(std::memory_order_relaxed); }
+    void throwIfCancelled() const {
+        if (isCancelled()) {
+            throw OperationCancelled();
+        }
+    }
+
+private:
+    std::shared_ptr<std::atomic<bool>> cancelled;
+};
+
+// A fixed set of worker threads taking jobs in submission order. A job is any callable
+// taking the job's CancellationToken; its result (or exception) arrives through the
+// returned future. A job cancelled while still queued is dropped at the next
+// submission, so whatever it captured (typically a whole snapshot) is released early.
+// Destroying the pool cancels jobs that have not started and waits for running ones.
+class HistoryWorkerPool {
+public:
+    explicit HistoryWorkerPool(size_t threadCount = defaultThreadCount());
+    ~HistoryWorkerPool();
+
+    HistoryWorkerPool(const HistoryWorkerPool&) = delete;
+    HistoryWorkerPool& operator=(const HistoryWorkerPool&) = delete;
+
+    // One less than the hardware threads (the UI keeps one), between 1 and 4.
+    static size_t defaultThreadCount();
+
+    template <typename Job>
+    auto submit(Job job, CancellationToken token = CancellationToken())
+        -> std::future<std::invoke_result_t<Job&, const CancellationToken&>> {
+        return submit(std::move(job), std::move(token), [] {});
+    }
+
+    // Same, and 'onDone' runs on the worker thread once the future is ready, whatever
+    // the outcome. The editor uses it to post a message back to the UI thread.
+    template <typename Job, typename Done>
+    auto submit(Job job, CancellationToken token, Done onDone)
+        -> std::future<std::invoke_result_t<Job&, const CancellationToken&>> {
+        using Result = std::invoke_result_t<Job&, const CancellationToken&>;
+        auto promise = std::make_shared<std::promise<Result>>();
+        std::future<Result> future = promise->get_future();
+
+        CancellationToken queuedToken = token;
+        enqueue(std::move(queuedToken), [promise, job = std::move(job), token = std::move(token), onDone = std::move(onDone)](bool run) mutable {
+            try {
+                if (!run) {
+                    throw OperationCancelled(); // Pool shutting down
+                }
+                token.throwIfCancelled();
+                if constexpr (std::is_void_v<Result>) {
+                    job(token);
+                    promise->set_value();
+                }
+                else {
+                    promise->set_value(job(token));
+                }
+            }
+            catch (...) {
+                promise->set_exception(std::current_exception());
+            }
+            onDone();
+        });
+        return future;
+    }
+
+    size_t getThreadCount() const;
+    size_t getPendingCount() const; // Jobs queued and not yet started
+
+private:
+    // Called with true to run the job, or false when the pool shuts down first.
+    using Task = std::function<void(bool run)>;
+
+    struct QueuedTask {
+        CancellationToken token;
+        Task task;
+    };
+
+    void enqueue(CancellationToken token, Task task);
+    void workerLoop();
+
+    mutable std::mutex lock;
+    std::condition_variable wake;
+    std::deque<QueuedTask> queue;
+    bool stopping = false;
+    std::vector<std::thread> threads;
+};
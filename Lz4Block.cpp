@@ -0,0 +1,148 @@
+#include "Lz4Block.h"
+#include <vector>
+#include <cstdint>
+#include <cstring>    // For memcpy
+
+namespace {
+    constexpr size_t MIN_MATCH = 4;
+    constexpr size_t LAST_LITERALS = 5;  // The block always ends with at least this many literals
+    constexpr size_t MATCH_FIND_LIMIT = 12; // No match may start closer than this to the end
+    constexpr size_t MAX_OFFSET = 65535;
+    constexpr unsigned HASH_BITS = 12;
+
+    uint32_t read32(const char* p) {
+        uint32_t value;
+        memcpy(&value, p, sizeof(value));
+        return value;
+    }
+
+    uint32_t hashOf(uint32_t sequence) {
+        return (sequence * 2654435761u) >> (32 - HASH_BITS);
+    }
+
+    // Lengths of 15 or more spill into extra bytes: 255 each, then the remainder.
+    void writeExtraLength(std::string& out, size_t length) {
+        while (length >= 255) {
+            out.push_back(static_cast<char>(255));
+            length -= 255;
+        }
+        out.push_back(static_cast<char>(length));
+    }
+
+    void writeLiterals(std::string& out, const char* literals, size_t count, unsigned matchNibble) {
+        unsigned literalNibble = count < 15 ? static_cast<unsigned>(count) : 15;
+        out.push_back(static_cast<char>((literalNibble << 4) | matchNibble));
+        if (count >= 15) {
+            writeExtraLength(out, count - 15);
+        }
+        out.append(literals, count);
+    }
+
+    bool readExtraLength(const unsigned char*& in, const unsigned char* end, size_t& length) {
+        unsigned char byte;
+        do {
+            if (in >= end) {
+                return false;
+            }
+            byte = *in++;
+            length += byte;
+        } while (byte == 255);
+        return true;
+    }
+}
+
+void Lz4Compress(const char* data, size_t length, std::string& out) {
+    size_t anchor = 0; // Start of the literals not emitted yet
+
+    if (length > MATCH_FIND_LIMIT) {
+        std::vector<uint32_t> table(size_t(1) << HASH_BITS, 0);
+        const size_t matchEnd = length - LAST_LITERALS;
+        const size_t lastMatchStart = length - MATCH_FIND_LIMIT;
+
+        size_t pos = 0;
+        while (pos <= lastMatchStart) {
+            uint32_t sequence = read32(data + pos);
+            uint32_t& slot = table[hashOf(sequence)];
+            size_t candidate = slot;
+            slot = static_cast<uint32_t>(pos);
+
+            if (candidate >= pos || pos - candidate > MAX_OFFSET || read32(data + candidate) != sequence) {
+                ++pos;
+                continue;
+            }
+
+            size_t matchLength = MIN_MATCH;
+            while (pos + matchLength < matchEnd && data[candidate + matchLength] == data[pos + matchLength]) {
+                ++matchLength;
+            }
+
+            size_t extraMatch = matchLength - MIN_MATCH;
+            writeLiterals(out, data + anchor, pos - anchor, extraMatch < 15 ? static_cast<unsigned>(extraMatch) : 15);
+            size_t offset = pos - candidate;
+            out.push_back(static_cast<char>(offset & 0xFF));
+            out.push_back(static_cast<char>(offset >> 8));
+            if (extraMatch >= 15) {
+                writeExtraLength(out, extraMatch - 15);
+            }
+
+            pos += matchLength;
+            anchor = pos;
+        }
+    }
+
+    // Final sequence: literals only.
+    writeLiterals(out, data + anchor, length - anchor, 0);
+}
+
+bool Lz4Decompress(const char* data, size_t length, char* out, size_t outLength) {
+    const unsigned char* in = reinterpret_cast<const unsigned char*>(data);
+    const unsigned char* end = in + length;
+    size_t written = 0;
+
+    while (true) {
+        if (in >= end) {
+            return false;
+        }
+        unsigned token = *in++;
+
+        size_t literalCount = token >> 4;
+        if (literalCount == 15 && !readExtraLength(in, end, literalCount)) {
+            return false;
+        }
+        if (literalCount > static_cast<size_t>(end - in) || literalCount > outLength - written) {
+            return false;
+        }
+        memcpy(out + written, in, literalCount);
+        in += literalCount;
+        written += literalCount;
+
+        if (in == end) {
+            break; // The last sequence has no match
+        }
+
+        if (end - in < 2) {
+            return false;
+        }
+        size_t offset = in[0] | (static_cast<size_t>(in[1]) << 8);
+        in += 2;
+        if (offset == 0 || offset > written) {
+            return false;
+        }
+
+        size_t matchLength = token & 15;
+        if (matchLength == 15 && !readExtraLength(in, end, matchLength)) {
+            return false;
+        }
+        matchLength += MIN_MATCH;
+        if (matchLength > outLength - written) {
+            return false;
+        }
+        // Byte by byte: the source may overlap what is being written (runs).
+        const char* source = out + written - offset;
+        for (size_t i = 0; i < matchLength; ++i) {
+            out[written + i] = source[i];
+        }
+        written += matchLength;
+    }
+    return written == outLength;
+}
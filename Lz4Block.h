@@ -0,0 +1,17 @@
+#pragma once
+
+#include <string>
+#include <cstddef>    // For size_t
+
+// Self-contained compressor for the LZ4 block format (no frame header, no checksums):
+// a sequence of tokens, each followed by literals and a back-reference of at least
+// four bytes within the previous 64 KB. Compression is a single greedy pass with a
+// small hash table, which is fast and good at the repeats typical of source text.
+// Output is readable by any LZ4 block decoder, and vice versa.
+
+// Appends the compressed form of 'data' to 'out'.
+void Lz4Compress(const char* data, size_t length, std::string& out);
+
+// Decompresses a block whose uncompressed size is known to be exactly 'outLength'.
+// Returns false if the input is malformed or does not decode to that size.
+bool Lz4Decompress(const char* data, size_t length, char* out, size_t outLength);
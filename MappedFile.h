@@ -0,0 +1,36 @@
+#pragma once
+
+#include <string>
+#include <cstddef> // For size_t
+
+// Read-only memory mapping of a whole file. Readers get a pointer to the bytes
+// without copying or parsing anything up front; pages are only touched when used.
+// Win32 uses CreateFileMapping/MapViewOfFile, other platforms mmap.
+class MappedFile {
+public:
+    MappedFile() = default;
+    ~MappedFile();
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    // Maps 'path'. Returns false if it cannot be opened. An empty file maps
+    // successfully with size() == 0 and data() == nullptr.
+    bool open(const std::wstring& path);
+    void close();
+
+    bool isOpen() const { return opened; }
+    const unsigned char* data() const { return bytes; }
+    size_t size() const { return length; }
+
+private:
+    const unsigned char* bytes = nullptr;
+    size_t length = 0;
+    bool opened = false;
+#ifdef _WIN32
+    void* fileHandle = nullptr;    // HANDLE
+    void* mappingHandle = nullptr; // HANDLE
+#else
+    int fileDescriptor = -1;
+#endif
+};
@@ -0,0 +1,268 @@
+#include "Metrics.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>     // For snprintf
+#include <cwchar>     // For swprintf
+#include <filesystem>
+#include <fstream>
+#ifdef _MSC_VER
+#include <intrin.h>    // For _BitScanReverse64
+#endif
+
+namespace {
+    const uint64_t MAX_RECORDED_NANOS = (uint64_t(1) << LatencyHistogram::MAX_VALUE_BITS) - 1;
+
+    unsigned highestSetBit(uint64_t value) {
+#ifdef _MSC_VER
+        unsigned long index;
+        _BitScanReverse64(&index, value);
+        return static_cast<unsigned>(index);
+#else
+        return 63 - static_cast<unsigned>(__builtin_clzll(value));
+#endif
+    }
+
+    unsigned roundUpToPowerOfTwo(unsigned value) {
+        unsigned power = 1;
+        while (power < value && power < (1u << 31)) {
+            power <<= 1;
+        }
+        return power;
+    }
+
+    uint64_t bucketWidth(size_t index) {
+        return index < 2 * LatencyHistogram::SUB_BUCKETS ? 1 : uint64_t(1) << (index / LatencyHistogram::SUB_BUCKETS - 1);
+    }
+
+    std::string jsonEscape(const std::string& text) {
+        std::string escaped;
+        for (char ch : text) {
+            if (ch == '"' || ch == '\\') escaped.push_back('\\');
+            escaped.push_back(ch);
+        }
+        return escaped;
+    }
+
+    std::string formatNumber(double value) {
+        char number[64];
+        snprintf(number, sizeof(number), "%.9g", value);
+        return number;
+    }
+}
+
+// --- LatencyHistogram ---
+
+// Values below 2 * SUB_BUCKETS get a bucket each. Above that, a value whose highest
+// bit is bit b is shifted right by (b - SUB_BUCKET_BITS), leaving SUB_BUCKET_BITS + 1
+// significant bits; the shift selects the power of two and the remaining bits the
+// bucket within it. Indices run on without gaps: shift * SUB_BUCKETS + (value >> shift).
+size_t LatencyHistogram::bucketIndex(uint64_t nanos) {
+    uint64_t value = std::min(nanos, MAX_RECORDED_NANOS);
+    if (value < 2 * SUB_BUCKETS) {
+        return static_cast<size_t>(value);
+    }
+    unsigned shift = highestSetBit(value) - SUB_BUCKET_BITS;
+    return static_cast<size_t>(shift * SUB_BUCKETS + (value >> shift));
+}
+
+uint64_t LatencyHistogram::bucketLowerBound(size_t index) {
+    if (index < 2 * SUB_BUCKETS) {
+        return index;
+    }
+    uint64_t shift = index / SUB_BUCKETS - 1;
+    return (index - shift * SUB_BUCKETS) << shift;
+}
+
+LatencyHistogram::LatencyHistogram(unsigned sampleInterval) : sampleInterval(roundUpToPowerOfTwo(sampleInterval)) {}
+
+void LatencyHistogram::record(std::chrono::nanoseconds duration) {
+    recordNanos(duration.count() > 0 ? static_cast<uint64_t>(duration.count()) : 0);
+}
+
+void LatencyHistogram::recordNanos(uint64_t nanos) {
+    buckets[bucketIndex(nanos)].fetch_add(1, std::memory_order_relaxed);
+    totalNanos.fetch_add(nanos, std::memory_order_relaxed);
+}
+
+// Percentiles are the midpoint of the bucket holding that rank; the maximum is the top
+// of the highest bucket in use.
+LatencySummary LatencyHistogram::summarize() const {
+    std::vector<uint64_t> counts(BUCKET_COUNT);
+    LatencySummary summary;
+    for (size_t i = 0; i < BUCKET_COUNT; ++i) {
+        counts[i] = buckets[i].load(std::memory_order_relaxed);
+        summary.timed += counts[i];
+    }
+    summary.count = sampleInterval == 1 ? summary.timed : std::max(calls.load(std::memory_order_relaxed), summary.timed);
+    if (summary.timed == 0) {
+        return summary;
+    }
+    summary.meanMicros = totalNanos.load(std::memory_order_relaxed) / 1000.0 / summary.timed;
+    summary.totalMicros = summary.meanMicros * summary.count;
+
+    const double fractions[] = { 0.50, 0.90, 0.99, 0.999 };
+    double* targets[] = { &summary.p50Micros, &summary.p90Micros, &summary.p99Micros, &summary.p999Micros };
+    size_t next = 0;
+    uint64_t seen = 0;
+    for (size_t i = 0; i < BUCKET_COUNT; ++i) {
+        if (counts[i] == 0) {
+            continue;
+        }
+        seen += counts[i];
+        double midpoint = (bucketLowerBound(i) + (bucketWidth(i) - 1) / 2.0) / 1000.0;
+        while (next < 4 && seen >= static_cast<uint64_t>(std::ceil(fractions[next] * summary.timed))) {
+            *targets[next++] = midpoint;
+        }
+        summary.maxMicros = (bucketLowerBound(i) + bucketWidth(i) - 1) / 1000.0;
+    }
+    return summary;
+}
+
+void LatencyHistogram::reset() {
+    for (std::atomic<uint64_t>& bucket : buckets) {
+        bucket.store(0, std::memory_order_relaxed);
+    }
+    totalNanos.store(0, std::memory_order_relaxed);
+    calls.store(0, std::memory_order_relaxed);
+}
+
+// --- MetricsRegistry ---
+
+MetricsRegistry& MetricsRegistry::global() {
+    static MetricsRegistry registry;
+    return registry;
+}
+
+MetricCounter& MetricsRegistry::counter(const std::string& name) {
+    std::lock_guard<std::mutex> guard(lock);
+    std::unique_ptr<MetricCounter>& metric = counters[name];
+    if (!metric) {
+        metric = std::make_unique<MetricCounter>();
+    }
+    return *metric;
+}
+
+MetricGauge& MetricsRegistry::gauge(const std::string& name) {
+    std::lock_guard<std::mutex> guard(lock);
+    std::unique_ptr<MetricGauge>& metric = gauges[name];
+    if (!metric) {
+        metric = std::make_unique<MetricGauge>();
+    }
+    return *metric;
+}
+
+LatencyHistogram& MetricsRegistry::histogram(const std::string& name, unsigned sampleInterval) {
+    std::lock_guard<std::mutex> guard(lock);
+    std::unique_ptr<LatencyHistogram>& metric = histograms[name];
+    if (!metric) {
+        metric = std::make_unique<LatencyHistogram>(sampleInterval);
+    }
+    return *metric;
+}
+
+void MetricsRegistry::removeGauges(const std::string& prefix) {
+    std::lock_guard<std::mutex> guard(lock);
+    auto it = gauges.lower_bound(prefix);
+    while (it != gauges.end() && it->first.compare(0, prefix.length(), prefix) == 0) {
+        it = gauges.erase(it);
+    }
+}
+
+void MetricsRegistry::setEnabled(bool enable) {
+    enabled.store(enable, std::memory_order_relaxed);
+}
+
+MetricsSnapshot MetricsRegistry::snapshot() const {
+    std::lock_guard<std::mutex> guard(lock);
+    MetricsSnapshot result;
+    for (const auto& entry : counters) {
+        result.counters[entry.first] = entry.second->get();
+    }
+    for (const auto& entry : gauges) {
+        result.gauges[entry.first] = entry.second->get();
+    }
+    for (const auto& entry : histograms) {
+        result.latencies[entry.first] = entry.second->summarize();
+    }
+    return result;
+}
+
+void MetricsRegistry::reset() {
+    std::lock_guard<std::mutex> guard(lock);
+    for (const auto& entry : counters) {
+        entry.second->reset();
+    }
+    for (const auto& entry : histograms) {
+        entry.second->reset();
+    }
+}
+
+std::string MetricsRegistry::toJson() const {
+    MetricsSnapshot metrics = snapshot();
+    std::string json = "{\n  \"counters\": {";
+    const char* separator = "\n";
+    for (const auto& entry : metrics.counters) {
+        json += separator + std::string("    \"") + jsonEscape(entry.first) + "\": " + std::to_string(entry.second);
+        separator = ",\n";
+    }
+    json += "\n  },\n  \"gauges\": {";
+    separator = "\n";
+    for (const auto& entry : metrics.gauges) {
+        json += separator + std::string("    \"") + jsonEscape(entry.first) + "\": " + std::to_string(entry.second);
+        separator = ",\n";
+    }
+    json += "\n  },\n  \"latencies_us\": {";
+    separator = "\n";
+    for (const auto& entry : metrics.latencies) {
+        const LatencySummary& latency = entry.second;
+        json += separator + std::string("    \"") + jsonEscape(entry.first) + "\": { \"count\": " + std::to_string(latency.count)
+            + ", \"timed\": " + std::to_string(latency.timed)
+            + ", \"total\": " + formatNumber(latency.totalMicros)
+            + ", \"mean\": " + formatNumber(latency.meanMicros)
+            + ", \"p50\": " + formatNumber(latency.p50Micros)
+            + ", \"p90\": " + formatNumber(latency.p90Micros)
+            + ", \"p99\": " + formatNumber(latency.p99Micros)
+            + ", \"p999\": " + formatNumber(latency.p999Micros)
+            + ", \"max\": " + formatNumber(latency.maxMicros) + " }";
+        separator = ",\n";
+    }
+    json += "\n  }\n}\n";
+    return json;
+}
+
+bool MetricsRegistry::writeJson(const std::wstring& path) const {
+    std::ofstream out(std::filesystem::path(path), std::ios::binary | std::ios::trunc);
+    if (!out) {
+        return false;
+    }
+    out << toJson();
+    return static_cast<bool>(out);
+}
+
+// --- Report ---
+
+std::wstring FormatMetricsReport(const MetricsSnapshot& snapshot) {
+    auto widen = [](const std::string& text) { return std::wstring(text.begin(), text.end()); };
+    wchar_t line[256];
+    std::wstring report = L"Latencies (microseconds)\r\n";
+    swprintf(line, 256, L"  %-28ls %9ls %10ls %9ls %9ls %9ls %10ls\r\n", L"", L"count", L"mean", L"p50", L"p99", L"p99.9", L"max");
+    report += line;
+    for (const auto& entry : snapshot.latencies) {
+        const LatencySummary& latency = entry.second;
+        swprintf(line, 256, L"  %-28ls %9llu %10.1f %9.1f %9.1f %9.1f %10.1f\r\n", widen(entry.first).c_str(),
+            static_cast<unsigned long long>(latency.count), latency.meanMicros, latency.p50Micros,
+            latency.p99Micros, latency.p999Micros, latency.maxMicros);
+        report += line;
+    }
+    report += L"\r\nCounters\r\n";
+    for (const auto& entry : snapshot.counters) {
+        swprintf(line, 256, L"  %-28ls %12llu\r\n", widen(entry.first).c_str(), static_cast<unsigned long long>(entry.second));
+        report += line;
+    }
+    report += L"\r\nGauges\r\n";
+    for (const auto& entry : snapshot.gauges) {
+        swprintf(line, 256, L"  %-28ls %12lld\r\n", widen(entry.first).c_str(), static_cast<long long>(entry.second));
+        report += line;
+    }
+    return report;
+}
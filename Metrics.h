@@ -0,0 +1,175 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>    // For size_t
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Always-on instrumentation for the history engine and the editor's I/O: counters,
+// gauges and latency histograms, registered by name in one process-wide registry.
+//
+// Updating a metric is a couple of relaxed atomic adds, with no lock and no
+// allocation, so they can sit on the keystroke path. Only looking a metric up by name
+// takes the registry's lock, so call sites look theirs up once and keep the reference
+// (a function-local static does this); metrics are never destroyed, except gauges
+// explicitly removed. Reading (snapshot(), toJson()) is safe at any time from any
+// thread and sees each value as of some moment during the read.
+
+class MetricCounter {
+public:
+    void add(uint64_t amount = 1) { value.fetch_add(amount, std::memory_order_relaxed); }
+    uint64_t get() const { return value.load(std::memory_order_relaxed); }
+    void reset() { value.store(0, std::memory_order_relaxed); }
+
+private:
+    std::atomic<uint64_t> value{ 0 };
+};
+
+// A current level, e.g. bytes held by a tab's history.
+class MetricGauge {
+public:
+    void set(int64_t newValue) { value.store(newValue, std::memory_order_relaxed); }
+    void add(int64_t amount) { value.fetch_add(amount, std::memory_order_relaxed); }
+    int64_t get() const { return value.load(std::memory_order_relaxed); }
+
+private:
+    std::atomic<int64_t> value{ 0 };
+};
+
+struct LatencySummary {
+    uint64_t count = 0;         // Calls
+    uint64_t timed = 0;         // Calls the distribution is taken from; fewer when sampling
+    double totalMicros = 0;     // Estimated from the timed calls when sampling
+    double meanMicros = 0;
+    double p50Micros = 0;
+    double p90Micros = 0;
+    double p99Micros = 0;
+    double p999Micros = 0;
+    double maxMicros = 0;
+};
+
+// Durations in log-linear buckets, as HDR histograms do: every power of two is split
+// into SUB_BUCKETS equal buckets, so any recorded value is known to within 1/32 (about
+// 3%) whatever its magnitude, in fixed memory. Recording is two relaxed atomic adds:
+// the bucket and the running total. The count, percentiles and maximum are worked out
+// from the buckets when read, and are accurate to a bucket.
+//
+// Reading the clock twice costs more than the atomics, so a histogram on a path as
+// hot as a keystroke can time only every 'sampleInterval'-th call (see ScopedLatency).
+// Its calls are still counted exactly; the distribution comes from the timed ones. The
+// interval is rounded up to a power of two, so picking a call is a mask, not a divide.
+class LatencyHistogram {
+public:
+    static const int SUB_BUCKET_BITS = 5;
+    static const uint64_t SUB_BUCKETS = uint64_t(1) << SUB_BUCKET_BITS;
+    static const int MAX_VALUE_BITS = 40;  // Nanoseconds; longer durations (~18 min) count as the longest
+    static const size_t BUCKET_COUNT = (MAX_VALUE_BITS - SUB_BUCKET_BITS + 1) * SUB_BUCKETS;
+
+    explicit LatencyHistogram(unsigned sampleInterval = 1);
+
+    void record(std::chrono::nanoseconds duration);
+    void recordNanos(uint64_t nanos);
+
+    // Counts a call; true if it is one to time.
+    bool sampleNext() {
+        return sampleInterval == 1 || (calls.fetch_add(1, std::memory_order_relaxed) & (sampleInterval - 1)) == 0;
+    }
+    unsigned getSampleInterval() const { return sampleInterval; }
+
+    LatencySummary summarize() const;
+    void reset();
+
+    // Bucket a value falls in, and the smallest value of a bucket.
+    static size_t bucketIndex(uint64_t nanos);
+    static uint64_t bucketLowerBound(size_t index);
+
+private:
+    std::atomic<uint64_t> buckets[BUCKET_COUNT] = {};
+    std::atomic<uint64_t> totalNanos{ 0 };
+    const unsigned sampleInterval;
+    std::atomic<uint64_t> calls{ 0 }; // Only counted when sampling
+};
+
+// Times the enclosing scope into a histogram, unless metrics are disabled (see
+// MetricsRegistry::setEnabled) or the histogram skips this call, in which case it
+// doesn't read the clock at all. Inline (below MetricsRegistry): a skipped call costs
+// a flag test and a counter bump, which on a keystroke path is worth keeping out of a call.
+class ScopedLatency {
+public:
+    explicit ScopedLatency(LatencyHistogram& histogram);
+    ~ScopedLatency();
+    ScopedLatency(const ScopedLatency&) = delete;
+    ScopedLatency& operator=(const ScopedLatency&) = delete;
+
+private:
+    LatencyHistogram* histogram; // Null when disabled
+    std::chrono::steady_clock::time_point start;
+};
+
+struct MetricsSnapshot {
+    std::map<std::string, uint64_t> counters;
+    std::map<std::string, int64_t> gauges;
+    std::map<std::string, LatencySummary> latencies;
+};
+
+class MetricsRegistry {
+public:
+    // The registry the editor and history_core report to.
+    static MetricsRegistry& global();
+
+    // Finds or creates the named metric. The reference stays valid for the life of the
+    // registry (for gauges: until removeGauges). Names are dotted, "area.operation".
+    // A histogram's sample interval is set by whoever creates it.
+    MetricCounter& counter(const std::string& name);
+    MetricGauge& gauge(const std::string& name);
+    LatencyHistogram& histogram(const std::string& name, unsigned sampleInterval = 1);
+    // Drops gauges whose names start with 'prefix', e.g. those of a closed tab. Nobody
+    // may still hold a reference to them.
+    void removeGauges(const std::string& prefix);
+
+    // Turns timing (ScopedLatency) off or on, for measuring its own overhead. Counters
+    // and gauges keep counting.
+    void setEnabled(bool enabled);
+    bool isEnabled() const { return enabled.load(std::memory_order_relaxed); }
+
+    MetricsSnapshot snapshot() const;
+    // Zeroes counters and histograms; gauges are levels, so they keep their values.
+    void reset();
+
+    // The snapshot as a JSON object; latencies in microseconds.
+    std::string toJson() const;
+    bool writeJson(const std::wstring& path) const;
+
+private:
+    mutable std::mutex lock; // Guards the maps, not the metrics in them
+    std::map<std::string, std::unique_ptr<MetricCounter>> counters;
+    std::map<std::string, std::unique_ptr<MetricGauge>> gauges;
+    std::map<std::string, std::unique_ptr<LatencyHistogram>> histograms;
+    std::atomic<bool> enabled{ true };
+};
+
+// Shorthand for MetricsRegistry::global().histogram(name), etc.
+inline LatencyHistogram& LatencyMetric(const std::string& name, unsigned sampleInterval = 1) { return MetricsRegistry::global().histogram(name, sampleInterval); }
+inline MetricCounter& CounterMetric(const std::string& name) { return MetricsRegistry::global().counter(name); }
+inline MetricGauge& GaugeMetric(const std::string& name) { return MetricsRegistry::global().gauge(name); }
+
+inline ScopedLatency::ScopedLatency(LatencyHistogram& histogram)
+    : histogram(MetricsRegistry::global().isEnabled() && histogram.sampleNext() ? &histogram : nullptr) {
+    if (this->histogram) {
+        start = std::chrono::steady_clock::now();
+    }
+}
+
+inline ScopedLatency::~ScopedLatency() {
+    if (histogram) {
+        histogram->record(std::chrono::steady_clock::now() - start);
+    }
+}
+
+// A fixed-width table of the snapshot, one metric per line, for the diagnostics dialog.
+std::wstring FormatMetricsReport(const MetricsSnapshot& snapshot);
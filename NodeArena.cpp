@@ -0,0 +1,50 @@
+#include "NodeArena.h"
+#include <new>      // For operator new/delete
+
+NodeArena::NodeArena(size_t blocksPerChunk)
+    : blocksPerChunk(blocksPerChunk > 0 ? blocksPerChunk : 1) {
+}
+
+void* NodeArena::allocate(size_t size) {
+    if (blockSize == 0) {
+        // Round up so every block stays aligned for any ordinary type and can hold a free-list link.
+        const size_t alignment = alignof(std::max_align_t);
+        size_t rounded = size < sizeof(FreeBlock) ? sizeof(FreeBlock) : size;
+        blockSize = (rounded + alignment - 1) / alignment * alignment;
+        requestedSize = size;
+        usedInLastChunk = blocksPerChunk; // Forces the first chunk
+    }
+    if (size != requestedSize) {
+        return ::operator new(size);
+    }
+
+    ++blocksInUse;
+    if (freeList) {
+        FreeBlock* block = freeList;
+        freeList = block->next;
+        return block;
+    }
+    if (usedInLastChunk == blocksPerChunk) {
+        // operator new[] of unsigned char is aligned for max_align_t.
+        chunks.emplace_back(new unsigned char[blocksPerChunk * blockSize]);
+        usedInLastChunk = 0;
+    }
+    return chunks.back().get() + blockSize * usedInLastChunk++;
+}
+
+void NodeArena::deallocate(void* block, size_t size) {
+    if (!block) {
+        return;
+    }
+    if (size != requestedSize) {
+        ::operator delete(block);
+        return;
+    }
+
+    // Freed blocks are reused before the last chunk grows further; chunks themselves
+    // are only returned when the arena goes away.
+    FreeBlock* freed = static_cast<FreeBlock*>(block);
+    freed->next = freeList;
+    freeList = freed;
+    --blocksInUse;
+}
@@ -0,0 +1,77 @@
+#pragma once
+
+#include <memory>   // For std::shared_ptr
+#include <vector>
+#include <cstddef>  // For size_t, std::max_align_t
+
+// Pool of equally sized blocks carved out of large chunks. History nodes are allocated
+// from it (through ArenaAllocator and std::allocate_shared), so a tree of a million
+// nodes sits in a few hundred contiguous chunks instead of a million scattered heap
+// blocks, and creating or freeing a node is a free-list push/pop.
+//
+// The block size is fixed by the first allocation; requests of any other size fall
+// back to operator new. Not thread-safe: the history tree is only mutated (and its
+// nodes only released) on the UI thread.
+class NodeArena {
+public:
+    explicit NodeArena(size_t blocksPerChunk = 4096);
+    ~NodeArena() = default;
+
+    NodeArena(const NodeArena&) = delete;
+    NodeArena& operator=(const NodeArena&) = delete;
+
+    void* allocate(size_t size);
+    void deallocate(void* block, size_t size);
+
+    size_t getBlocksInUse() const { return blocksInUse; }
+    size_t getReservedBytes() const { return chunks.size() * blocksPerChunk * blockSize; }
+
+private:
+    struct FreeBlock {
+        FreeBlock* next;
+    };
+
+    size_t blocksPerChunk;
+    size_t blockSize = 0;      // 0 until the first allocation
+    size_t requestedSize = 0;  // Size the pool serves
+    std::vector<std::unique_ptr<unsigned char[]>> chunks;
+    size_t usedInLastChunk = 0;
+    FreeBlock* freeList = nullptr;
+    size_t blocksInUse = 0;
+};
+
+// Standard allocator handing out single objects from a NodeArena. It keeps the arena
+// alive, so nodes released after their VersionHistoryManager (e.g. still held by a
+// dialog) free into a valid pool.
+template <typename T>
+class ArenaAllocator {
+public:
+    using value_type = T;
+
+    explicit ArenaAllocator(std::shared_ptr<NodeArena> arena) : arena(std::move(arena)) {}
+
+    template <typename U>
+    ArenaAllocator(const ArenaAllocator<U>& other) : arena(other.arena) {}
+
+    T* allocate(size_t count) {
+        if (count != 1 || alignof(T) > alignof(std::max_align_t)) {
+            return std::allocator<T>().allocate(count);
+        }
+        return static_cast<T*>(arena->allocate(sizeof(T)));
+    }
+
+    void deallocate(T* object, size_t count) {
+        if (count != 1 || alignof(T) > alignof(std::max_align_t)) {
+            std::allocator<T>().deallocate(object, count);
+            return;
+        }
+        arena->deallocate(object, sizeof(T));
+    }
+
+    template <typename U>
+    bool operator==(const ArenaAllocator<U>& other) const { return arena == other.arena; }
+    template <typename U>
+    bool operator!=(const ArenaAllocator<U>& other) const { return arena != other.arena; }
+
+    std::shared_ptr<NodeArena> arena;
+};
@@ -0,0 +1,438 @@
+#include "PieceTable.h"
+#include <algorithm>
+#include <mutex>
+#include <vector>
+
+namespace {
+    // Hash arithmetic is mod 2^64 (plain unsigned overflow), which keeps it portable.
+    // The base is odd, so it is invertible and a piece hash can be split either way.
+    constexpr uint64_t HASH_BASE = 0x100000001B3ull;
+
+    uint64_t powMod64(uint64_t base, size_t exponent) {
+        uint64_t result = 1;
+        while (exponent > 0) {
+            if (exponent & 1) result *= base;
+            base *= base;
+            exponent >>= 1;
+        }
+        return result;
+    }
+
+    // Multiplicative inverse of an odd number mod 2^64 (Newton's iteration).
+    constexpr uint64_t inverseMod64(uint64_t value) {
+        uint64_t inverse = value; // Correct to 3 bits for odd values
+        for (int i = 0; i < 5; ++i) {
+            inverse *= 2 - value * inverse; // Each step doubles the correct bits
+        }
+        return inverse;
+    }
+
+    constexpr uint64_t HASH_BASE_INVERSE = inverseMod64(HASH_BASE);
+
+    // Add-buffer chunks start small (most tables see few inserts) and double up to a cap.
+    constexpr size_t MIN_CHUNK_CHARS = 256;
+    constexpr size_t MAX_CHUNK_CHARS = 64 * 1024;
+}
+
+// Inserted text goes into fixed-size chunks that are never reallocated, so a piece can
+// point straight at its characters. A copy of the table on another thread only reads
+// characters written before it was copied; appends from every copy are serialized.
+struct PieceTable::AddBuffer {
+    std::mutex lock;
+    std::vector<std::unique_ptr<wchar_t[]>> chunks;
+    size_t chunkCapacity = 0; // Of chunks.back()
+    size_t chunkUsed = 0;
+    // Buffers of the table this one was split off from (see withPrivateBuffer): the
+    // pieces it started with still point into them. Fixed once the buffer is created.
+    std::vector<std::shared_ptr<AddBuffer>> inherited;
+
+    const wchar_t* append(const std::wstring& text) {
+        std::lock_guard<std::mutex> guard(lock);
+        if (chunks.empty() || chunkCapacity - chunkUsed < text.length()) {
+            size_t capacity = std::min(std::max(MIN_CHUNK_CHARS, chunkCapacity * 2), MAX_CHUNK_CHARS);
+            chunkCapacity = std::max(capacity, text.length()); // A long insert gets a chunk of its own
+            chunks.emplace_back(new wchar_t[chunkCapacity]);
+            chunkUsed = 0;
+        }
+        wchar_t* destination = chunks.back().get() + chunkUsed;
+        std::copy(text.begin(), text.end(), destination);
+        chunkUsed += text.length();
+        return destination;
+    }
+};
+
+// --- Constructors ---
+
+PieceTable::PieceTable()
+    : PieceTable(std::wstring()) {
+}
+
+PieceTable::PieceTable(const std::wstring& original)
+    : PieceTable(std::wstring(original)) {
+}
+
+PieceTable::PieceTable(std::wstring&& original)
+    : PieceTable(std::make_shared<const std::wstring>(std::move(original))) {
+}
+
+PieceTable::PieceTable(std::shared_ptr<const std::wstring> original) {
+    buffers.original = original ? std::move(original) : std::make_shared<const std::wstring>();
+    buffers.added = std::make_shared<AddBuffer>();
+
+    // The whole original text starts out as a single piece.
+    if (!buffers.original->empty()) {
+        Piece piece;
+        piece.data = buffers.original->data();
+        piece.length = buffers.original->length();
+        piece.hash = hashText(buffers.original->data(), piece.length);
+        piece.power = basePower(piece.length);
+        root = makeNode(piece, nextPriority(), nullptr, nullptr);
+    }
+}
+
+// --- Tree Helpers ---
+
+size_t PieceTable::lengthOf(const NodePtr& node) {
+    return node ? node->subtreeLength : 0;
+}
+
+size_t PieceTable::countOf(const NodePtr& node) {
+    return node ? node->subtreeCount : 0;
+}
+
+uint64_t PieceTable::hashOf(const NodePtr& node) {
+    return node ? node->subtreeHash : 0;
+}
+
+uint64_t PieceTable::powerOf(const NodePtr& node) {
+    return node ? node->subtreePower : 1;
+}
+
+uint64_t PieceTable::basePower(size_t exponent) {
+    return powMod64(HASH_BASE, exponent);
+}
+
+uint64_t PieceTable::inverseBasePower(size_t exponent) {
+    return powMod64(HASH_BASE_INVERSE, exponent);
+}
+
+uint32_t PieceTable::nextPriority() {
+    // xorshift32: cheap, deterministic per thread, good enough to keep the treap balanced.
+    thread_local uint32_t state = 2463534242u;
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+    return state;
+}
+
+PieceTable::NodePtr PieceTable::makeNode(const Piece& piece, uint32_t priority, NodePtr left, NodePtr right) {
+    auto node = std::make_shared<Node>();
+    node->piece = piece;
+    node->priority = priority;
+    node->subtreeLength = lengthOf(left) + piece.length + lengthOf(right);
+    node->subtreeCount = countOf(left) + 1 + countOf(right);
+    // hash(L + P + R) = (hash(L) * B^|P| + hash(P)) * B^|R| + hash(R)
+    // The powers of B are carried along with the lengths, so this is a few multiplies
+    // rather than two exponentiations for every node an edit copies.
+    node->subtreeHash = (hashOf(left) * piece.power + piece.hash) * powerOf(right) + hashOf(right);
+    node->subtreePower = powerOf(left) * piece.power * powerOf(right);
+    node->left = std::move(left);
+    node->right = std::move(right);
+    return node;
+}
+
+// Concatenates two trees. Nodes are never modified, only the merge path is copied.
+PieceTable::NodePtr PieceTable::merge(const NodePtr& a, const NodePtr& b) {
+    if (!a) return b;
+    if (!b) return a;
+
+    if (a->priority > b->priority) {
+        return makeNode(a->piece, a->priority, a->left, merge(a->right, b));
+    }
+    return makeNode(b->piece, b->priority, merge(a, b->left), b->right);
+}
+
+// Splits a tree into the first 'pos' characters and the rest, cutting a piece in two if needed.
+void PieceTable::split(const NodePtr& node, size_t pos, NodePtr& outLeft, NodePtr& outRight) const {
+    if (!node) {
+        outLeft = nullptr;
+        outRight = nullptr;
+        return;
+    }
+
+    size_t leftLength = lengthOf(node->left);
+    if (pos <= leftLength) {
+        NodePtr subLeft, subRight;
+        split(node->left, pos, subLeft, subRight);
+        outLeft = subLeft;
+        outRight = makeNode(node->piece, node->priority, subRight, node->right);
+    }
+    else if (pos >= leftLength + node->piece.length) {
+        NodePtr subLeft, subRight;
+        split(node->right, pos - leftLength - node->piece.length, subLeft, subRight);
+        outLeft = makeNode(node->piece, node->priority, node->left, subLeft);
+        outRight = subRight;
+    }
+    else {
+        // The cut falls inside this piece. Both halves keep the node's priority,
+        // which preserves the heap order with the existing subtrees.
+        size_t offset = pos - leftLength;
+        Piece head = node->piece;
+        head.length = offset;
+        Piece tail = node->piece;
+        tail.data += offset;
+        tail.length -= offset;
+
+        // Only the shorter half is rehashed; the other is derived from the piece hash,
+        // using hash(piece) = hash(head) * B^|tail| + hash(tail).
+        const wchar_t* data = pieceData(node->piece);
+        head.power = basePower(head.length);
+        tail.power = basePower(tail.length);
+        if (head.length <= tail.length) {
+            head.hash = hashText(data, head.length);
+            tail.hash = node->piece.hash - head.hash * tail.power;
+        }
+        else {
+            tail.hash = hashText(data + offset, tail.length);
+            head.hash = (node->piece.hash - tail.hash) * inverseBasePower(tail.length);
+        }
+
+        outLeft = makeNode(head, node->priority, node->left, nullptr);
+        outRight = makeNode(tail, node->priority, nullptr, node->right);
+    }
+}
+
+// Inserts a single piece at 'pos' along one path: down to where its priority belongs in
+// the heap order, where the subtree is split around it. Copies about half as many nodes
+// as splitting the whole tree and merging the three parts back.
+PieceTable::NodePtr PieceTable::insertNode(const NodePtr& node, size_t pos, const Piece& piece, uint32_t priority) const {
+    if (!node || priority > node->priority) {
+        NodePtr left, right;
+        split(node, pos, left, right);
+        return makeNode(piece, priority, std::move(left), std::move(right));
+    }
+
+    size_t leftLength = lengthOf(node->left);
+    if (pos <= leftLength) {
+        return makeNode(node->piece, node->priority, insertNode(node->left, pos, piece, priority), node->right);
+    }
+    if (pos >= leftLength + node->piece.length) {
+        return makeNode(node->piece, node->priority, node->left, insertNode(node->right, pos - leftLength - node->piece.length, piece, priority));
+    }
+
+    // The new piece goes inside this node's piece. Cut it in two (as split does), with
+    // the tail under the head and the new piece under the tail: both halves keep the
+    // node's priority, which is above the new one.
+    NodePtr head, tail;
+    split(makeNode(node->piece, node->priority, nullptr, nullptr), pos - leftLength, head, tail);
+    NodePtr inserted = makeNode(piece, priority, nullptr, nullptr);
+    NodePtr rest = makeNode(tail->piece, tail->priority, std::move(inserted), node->right);
+    return makeNode(head->piece, head->priority, node->left, std::move(rest));
+}
+
+const wchar_t* PieceTable::pieceData(const Piece& piece) const {
+    return piece.data; // Kept alive by 'buffers'
+}
+
+bool PieceTable::visitForward(const NodePtr& node, const std::function<bool(const wchar_t*, size_t)>& visitor) const {
+    if (!node) return true;
+    if (!visitForward(node->left, visitor)) return false;
+    if (!visitor(pieceData(node->piece), node->piece.length)) return false;
+    return visitForward(node->right, visitor);
+}
+
+bool PieceTable::visitBackward(const NodePtr& node, const std::function<bool(const wchar_t*, size_t)>& visitor) const {
+    if (!node) return true;
+    if (!visitBackward(node->right, visitor)) return false;
+    if (!visitor(pieceData(node->piece), node->piece.length)) return false;
+    return visitBackward(node->left, visitor);
+}
+
+void PieceTable::visitRange(const NodePtr& node, size_t pos, size_t count, std::wstring& out) const {
+    if (!node || count == 0) return;
+
+    size_t leftLength = lengthOf(node->left);
+    if (pos < leftLength) {
+        visitRange(node->left, pos, count, out);
+    }
+
+    size_t pieceBegin = leftLength;
+    size_t pieceEnd = leftLength + node->piece.length;
+    size_t rangeEnd = pos + count;
+    if (pos < pieceEnd && rangeEnd > pieceBegin) {
+        size_t from = std::max(pos, pieceBegin);
+        size_t to = std::min(rangeEnd, pieceEnd);
+        out.append(pieceData(node->piece) + (from - pieceBegin), to - from);
+    }
+
+    if (rangeEnd > pieceEnd) {
+        size_t rightPos = (pos > pieceEnd) ? pos - pieceEnd : 0;
+        visitRange(node->right, rightPos, rangeEnd - std::max(pos, pieceEnd), out);
+    }
+}
+
+// --- Queries ---
+
+size_t PieceTable::length() const {
+    return lengthOf(root);
+}
+
+bool PieceTable::empty() const {
+    return !root;
+}
+
+size_t PieceTable::pieceCount() const {
+    return countOf(root);
+}
+
+wchar_t PieceTable::charAt(size_t pos) const {
+    const Node* node = root.get();
+    while (node) {
+        size_t leftLength = lengthOf(node->left);
+        if (pos < leftLength) {
+            node = node->left.get();
+        }
+        else if (pos < leftLength + node->piece.length) {
+            return pieceData(node->piece)[pos - leftLength];
+        }
+        else {
+            pos -= leftLength + node->piece.length;
+            node = node->right.get();
+        }
+    }
+    return L'\0'; // Out of range
+}
+
+std::wstring PieceTable::substr(size_t pos, size_t count) const {
+    std::wstring result;
+    size_t total = length();
+    if (pos >= total) return result;
+    count = std::min(count, total - pos);
+    result.reserve(count);
+    visitRange(root, pos, count, result);
+    return result;
+}
+
+std::wstring PieceTable::toString() const {
+    std::wstring result;
+    result.reserve(length());
+    visitForward(root, [&result](const wchar_t* data, size_t count) {
+        result.append(data, count);
+        return true;
+    });
+    return result;
+}
+
+bool PieceTable::equals(const std::wstring& text) const {
+    return text.length() == length() && commonPrefixLength(text) == text.length();
+}
+
+size_t PieceTable::commonPrefixLength(const std::wstring& text) const {
+    size_t matched = 0;
+    visitForward(root, [&](const wchar_t* data, size_t count) {
+        size_t limit = std::min(count, text.length() - matched);
+        size_t i = 0;
+        while (i < limit && data[i] == text[matched + i]) {
+            ++i;
+        }
+        matched += i;
+        return i == count && matched < text.length(); // Continue only if the whole chunk matched
+    });
+    return matched;
+}
+
+size_t PieceTable::commonSuffixLength(const std::wstring& text, size_t minPos) const {
+    size_t ownLength = length();
+    if (ownLength <= minPos || text.length() <= minPos) return 0;
+
+    size_t maxMatch = std::min(ownLength, text.length()) - minPos;
+    size_t matched = 0;
+    visitBackward(root, [&](const wchar_t* data, size_t count) {
+        size_t i = 0;
+        while (i < count && matched < maxMatch && data[count - 1 - i] == text[text.length() - 1 - matched]) {
+            ++i;
+            ++matched;
+        }
+        return i == count && matched < maxMatch;
+    });
+    return matched;
+}
+
+uint64_t PieceTable::contentHash() const {
+    return hashOf(root);
+}
+
+uint64_t PieceTable::hashText(const wchar_t* data, size_t count) {
+    uint64_t hash = 0;
+    for (size_t i = 0; i < count; ++i) {
+        hash = hash * HASH_BASE + static_cast<uint64_t>(data[i]) + 1;
+    }
+    return hash;
+}
+
+uint64_t PieceTable::hashText(const std::wstring& text) {
+    return hashText(text.data(), text.length());
+}
+
+void PieceTable::forEachChunk(const std::function<bool(const wchar_t*, size_t)>& visitor) const {
+    visitForward(root, visitor);
+}
+
+size_t PieceTable::memoryFootprint() const {
+    return pieceCount() * sizeof(Node);
+}
+
+// --- Edits ---
+
+void PieceTable::insert(size_t pos, const std::wstring& text) {
+    if (text.empty()) return;
+    pos = std::min(pos, length());
+
+    Piece piece;
+    piece.data = buffers.added->append(text);
+    piece.length = text.length();
+    piece.hash = hashText(text);
+    piece.power = basePower(piece.length);
+
+    root = insertNode(root, pos, piece, nextPriority());
+}
+
+PieceTable PieceTable::withPrivateBuffer() const {
+    PieceTable copy = *this;
+    auto buffer = std::make_shared<AddBuffer>();
+    bool hasText;
+    {
+        std::lock_guard<std::mutex> guard(buffers.added->lock);
+        hasText = !buffers.added->chunks.empty();
+    }
+    // Flat rather than chained, so releasing a buffer never recurses.
+    buffer->inherited = buffers.added->inherited;
+    if (hasText) {
+        buffer->inherited.push_back(buffers.added);
+    }
+    copy.buffers.added = std::move(buffer);
+    return copy;
+}
+
+void PieceTable::erase(size_t pos, size_t count) {
+    size_t total = length();
+    if (pos >= total || count == 0) return;
+    count = std::min(count, total - pos);
+
+    NodePtr left, rest, middle, right;
+    split(root, pos, left, rest);
+    split(rest, count, middle, right);
+    root = merge(left, right);
+}
+
+void PieceTable::applyChange(const TextChange& change) {
+    size_t pos = std::min(change.position, length());
+    erase(pos, change.deletedText.length());
+    insert(pos, change.insertedText);
+}
+
+void PieceTable::applyChange(const ChangeSet& changes) {
+    for (const TextChange& hunk : changes.hunks) {
+        applyChange(hunk);
+    }
+}
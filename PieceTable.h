@@ -0,0 +1,119 @@
+#pragma once
+
+#include <memory>     // For std::shared_ptr
+#include <string>
+#include <cstddef>    // For size_t
+#include <cstdint>
+#include <functional>
+#include "TextChange.h"
+
+// A document stored as a list of pieces pointing into two buffers: the original
+// text (never modified) and an append-only buffer holding every inserted run.
+// The piece list is an immutable balanced tree (a treap ordered by position), so
+// edits are O(log n) and copying a PieceTable is O(1): the copy shares every piece
+// and both buffers, and later edits only allocate the tree path they touch.
+// Every tree node also carries the polynomial hash of its subtree's text, so the
+// content hash of any snapshot is available in O(1) and maintained in O(log n).
+//
+// Inserted text is never moved once written, so a copy handed to another thread can
+// be read (and edited) there while the original keeps being edited: the only state
+// the two share that still changes is the add buffer, whose appends take a lock.
+class PieceTable {
+public:
+    // --- Constructors ---
+    PieceTable();
+    explicit PieceTable(const std::wstring& original);
+    explicit PieceTable(std::wstring&& original);
+    // Reads the original text from 'original' in place, e.g. a text shared through the
+    // BlobStore, instead of taking a copy of its own.
+    explicit PieceTable(std::shared_ptr<const std::wstring> original);
+
+    // --- Queries ---
+    size_t length() const;
+    bool empty() const;
+    size_t pieceCount() const;
+    wchar_t charAt(size_t pos) const;
+    std::wstring substr(size_t pos, size_t count) const;
+    std::wstring toString() const;
+    bool equals(const std::wstring& text) const;
+
+    // Length of the common prefix/suffix with 'text', for cheap diffing against the editor.
+    // The suffix search never reaches below 'minPos' in either string.
+    size_t commonPrefixLength(const std::wstring& text) const;
+    size_t commonSuffixLength(const std::wstring& text, size_t minPos = 0) const;
+
+    // Polynomial hash of the whole text (mod 2^64). Equal texts always hash equally,
+    // and contentHash() == hashText(toString()) for every table.
+    uint64_t contentHash() const;
+    static uint64_t hashText(const wchar_t* data, size_t count);
+    static uint64_t hashText(const std::wstring& text);
+
+    // Visits the document as contiguous chunks, in order. Return false to stop early.
+    void forEachChunk(const std::function<bool(const wchar_t*, size_t)>& visitor) const;
+
+    // Approximate bytes owned by the piece tree. Buffers are shared between copies
+    // and are not counted, which is what makes snapshots cost only their deltas.
+    size_t memoryFootprint() const;
+
+    // --- Edits ---
+    void insert(size_t pos, const std::wstring& text);
+    void erase(size_t pos, size_t count);
+    // A copy whose own edits go to a buffer of its own. Text inserted into a short-lived
+    // copy (replaying history to rebuild a version, say) is then freed with it, instead
+    // of growing the buffer shared by every snapshot of this document for good.
+    PieceTable withPrivateBuffer() const;
+
+    // Same clamping semantics as VersionHistoryManager::applyChangeInPlace.
+    void applyChange(const TextChange& change);
+    void applyChange(const ChangeSet& changes); // Hunks in order
+
+private:
+    struct Piece {
+        const wchar_t* data = nullptr; // Into the original text or an add-buffer chunk
+        size_t length = 0;
+        uint64_t hash = 0; // hashText() of this piece's characters
+        uint64_t power = 1; // B^length, so combining hashes never exponentiates
+    };
+
+    struct Node;
+    using NodePtr = std::shared_ptr<const Node>;
+
+    struct Node {
+        Piece piece;
+        uint32_t priority;
+        size_t subtreeLength;
+        size_t subtreeCount;
+        uint64_t subtreeHash;
+        uint64_t subtreePower; // B^subtreeLength
+        NodePtr left;
+        NodePtr right;
+    };
+
+    struct AddBuffer; // Append-only chunks of inserted text (see PieceTable.cpp)
+
+    struct Buffers {
+        std::shared_ptr<const std::wstring> original;
+        std::shared_ptr<AddBuffer> added; // Shared by every copy
+    };
+
+    Buffers buffers;
+    NodePtr root;
+
+    const wchar_t* pieceData(const Piece& piece) const;
+
+    static size_t lengthOf(const NodePtr& node);
+    static size_t countOf(const NodePtr& node);
+    static uint64_t hashOf(const NodePtr& node);
+    static uint64_t powerOf(const NodePtr& node);
+    static uint64_t basePower(size_t exponent);
+    static uint64_t inverseBasePower(size_t exponent);
+    static uint32_t nextPriority();
+    static NodePtr makeNode(const Piece& piece, uint32_t priority, NodePtr left, NodePtr right);
+    static NodePtr merge(const NodePtr& a, const NodePtr& b);
+    void split(const NodePtr& node, size_t pos, NodePtr& outLeft, NodePtr& outRight) const;
+    NodePtr insertNode(const NodePtr& node, size_t pos, const Piece& piece, uint32_t priority) const;
+
+    bool visitForward(const NodePtr& node, const std::function<bool(const wchar_t*, size_t)>& visitor) const;
+    bool visitBackward(const NodePtr& node, const std::function<bool(const wchar_t*, size_t)>& visitor) const;
+    void visitRange(const NodePtr& node, size_t pos, size_t count, std::wstring& out) const;
+};
@@ -38,6 +38,11 @@
 #define IDD_CHOOSE_CHILD_COMMIT         404   // Or next available unique dialog ID
 #define IDC_CHILD_COMMIT_LIST           405   // List box ID within the new dialog
 #define IDC_CHILD_COMMIT_STATIC         406   // Optional static text prompt
+#define IDD_DIAGNOSTICS                 407   // Metrics dialog
+#define IDC_DIAGNOSTICS_TEXT            408   // Read-only report
+#define IDC_DIAGNOSTICS_REFRESH         409
+#define IDC_DIAGNOSTICS_RESET           410
+#define IDC_DIAGNOSTICS_SAVE            411
 
 
 //History Dialog Resources
@@ -48,6 +53,8 @@
 #define ID_HISTORY_PREVIOUS             32775 
 #define ID_HISTORY_NEXT_CHILD           32776
 #define ID_HELP_SHORTCUTS              32777
+#define ID_HELP_DIAGNOSTICS            32778
+#define ID_HELP_TIMELINE               32779
 
 // Next default values for new objects
 // 
@@ -2,6 +2,8 @@
 
 #include <string>
 #include <cstddef> // For size_t
+#include <utility> // For std::move
+#include <vector>
 
 // Represents a single atomic change in the document.
 // Designed to work with the Rich Edit control.
@@ -28,6 +30,123 @@ struct TextChange {
         size_t reverseCursorPos = position;
         return TextChange(position, deletedText, insertedText, reverseCursorPos);
     }
+
+    // Checks if 'next', applied right after this change, touches the range this change
+    // produced. Only then can the two be folded into a single change.
+    bool canMergeWith(const TextChange& next) const {
+        size_t producedEnd = position + insertedText.length();
+        return next.position <= producedEnd && next.position + next.deletedText.length() >= position;
+    }
+
+    // Folds 'next' (applied right after this change) into this change, so applying the
+    // result once equals applying both in order. Returns false if the ranges don't touch.
+    bool tryMerge(const TextChange& next) {
+        if (!canMergeWith(next)) {
+            return false;
+        }
+
+        size_t producedEnd = position + insertedText.length();
+        size_t nextDeletedEnd = next.position + next.deletedText.length();
+
+        // Fast paths for typing: appending right after our text, or backspacing into it.
+        if (next.deletedText.empty() && next.position == producedEnd) {
+            insertedText += next.insertedText;
+            cursorPositionAfter = next.cursorPositionAfter;
+            return true;
+        }
+        if (next.insertedText.empty() && next.position >= position && nextDeletedEnd == producedEnd) {
+            insertedText.erase(next.position - position);
+            cursorPositionAfter = next.cursorPositionAfter;
+            return true;
+        }
+        // And the Delete key eating the original text after it.
+        if (next.insertedText.empty() && next.position == producedEnd) {
+            deletedText += next.deletedText;
+            cursorPositionAfter = next.cursorPositionAfter;
+            return true;
+        }
+
+        // General case. Parts of next's deletion outside our produced range were
+        // original text, so they extend what we deleted.
+        std::wstring mergedDeleted;
+        if (next.position < position) {
+            mergedDeleted.append(next.deletedText, 0, position - next.position);
+        }
+        mergedDeleted += deletedText;
+        if (nextDeletedEnd > producedEnd) {
+            size_t overhang = nextDeletedEnd - producedEnd;
+            mergedDeleted.append(next.deletedText, next.deletedText.length() - overhang, overhang);
+        }
+
+        // Our inserted text that survives on either side of next's edit.
+        std::wstring mergedInserted;
+        if (next.position > position) {
+            mergedInserted.append(insertedText, 0, next.position - position);
+        }
+        mergedInserted += next.insertedText;
+        if (nextDeletedEnd < producedEnd) {
+            mergedInserted.append(insertedText, nextDeletedEnd - position, producedEnd - nextDeletedEnd);
+        }
+
+        position = (next.position < position) ? next.position : position;
+        insertedText = std::move(mergedInserted);
+        deletedText = std::move(mergedDeleted);
+        cursorPositionAfter = next.cursorPositionAfter;
+        return true;
+    }
+};
+
+// A change made of several independent hunks, e.g. one edit at the top of the file and
+// another at the bottom. Storing them separately keeps the payload to the text that
+// actually changed instead of everything in between.
+// Hunks are applied in order, and each hunk's position refers to the text produced by
+// the hunks before it. The diff engine emits them in ascending order, so in practice
+// every position is also the hunk's position in the final text.
+struct ChangeSet {
+    std::vector<TextChange> hunks;
+
+    ChangeSet() {}
+
+    // A single change is a one-hunk set, so callers can keep passing a TextChange.
+    ChangeSet(const TextChange& change) : hunks{ change } {}
+    ChangeSet(TextChange&& change) { hunks.push_back(std::move(change)); }
+
+    bool isEmpty() const {
+        for (const TextChange& hunk : hunks) {
+            if (!hunk.insertedText.empty() || !hunk.deletedText.empty()) return false;
+        }
+        return true;
+    }
+
+    // Totals over all hunks, for the history UI.
+    size_t insertedLength() const {
+        size_t total = 0;
+        for (const TextChange& hunk : hunks) total += hunk.insertedText.length();
+        return total;
+    }
+
+    size_t deletedLength() const {
+        size_t total = 0;
+        for (const TextChange& hunk : hunks) total += hunk.deletedText.length();
+        return total;
+    }
+
+    // The cursor ends up where the last hunk left it.
+    size_t cursorPositionAfter() const {
+        return hunks.empty() ? 0 : hunks.back().cursorPositionAfter;
+    }
+
+    // Undoing the set undoes each hunk, last hunk first. Every hunk's text sits at the
+    // same position before and after the hunks that follow it are undone, so the
+    // positions carry over unchanged.
+    ChangeSet getReverseChange() const {
+        ChangeSet reverse;
+        reverse.hunks.reserve(hunks.size());
+        for (auto it = hunks.rbegin(); it != hunks.rend(); ++it) {
+            reverse.hunks.push_back(it->getReverseChange());
+        }
+        return reverse;
+    }
 };
 
 //#endif // TEXT_CHANGE_H
\ No newline at end of file
@@ -0,0 +1,356 @@
+#include "TextDiff.h"
+#include <vector>
+#include <algorithm>
+#include <unordered_map>
+#include <string_view>
+#include <cstdint>    // For SIZE_MAX
+
+namespace {
+    // Patience recursion gets this deep at most; below that the gaps go to Myers.
+    constexpr int MAX_PATIENCE_DEPTH = 32;
+
+    // a[aBegin, aEnd) was replaced by b[bBegin, bEnd).
+    struct DiffRegion {
+        size_t aBegin;
+        size_t aEnd;
+        size_t bBegin;
+        size_t bEnd;
+    };
+
+    // Diffs two character ranges into a list of replaced regions, in ascending order.
+    class DiffEngine {
+    public:
+        DiffEngine(const wchar_t* a, const wchar_t* b, const DiffOptions& options)
+            : a(a), b(b), options(options) {
+        }
+
+        std::vector<DiffRegion> run(size_t aLength, size_t bLength) {
+            regions.clear();
+            work = 0;
+            // A few linear passes are always affordable (every split re-trims its halves),
+            // so they come on top of the search budget.
+            budget = options.maxWork + 8 * (aLength + bLength);
+            if (options.algorithm == DiffAlgorithm::Patience) {
+                patience(0, aLength, 0, bLength, 0);
+            }
+            else {
+                myers(0, aLength, 0, bLength);
+            }
+            return regions;
+        }
+
+    private:
+        const wchar_t* a;
+        const wchar_t* b;
+        DiffOptions options;
+        size_t work = 0;
+        size_t budget = 0;
+        std::vector<DiffRegion> regions;
+        std::vector<ptrdiff_t> forward;
+        std::vector<ptrdiff_t> backward;
+
+        bool budgetExhausted() const {
+            return work >= budget;
+        }
+
+        // Strips the equal characters at both ends of the ranges.
+        void trim(size_t& aBegin, size_t& aEnd, size_t& bBegin, size_t& bEnd) {
+            size_t start = aBegin;
+            while (aBegin < aEnd && bBegin < bEnd && a[aBegin] == b[bBegin]) {
+                ++aBegin;
+                ++bBegin;
+            }
+            size_t end = aEnd;
+            while (aEnd > aBegin && bEnd > bBegin && a[aEnd - 1] == b[bEnd - 1]) {
+                --aEnd;
+                --bEnd;
+            }
+            work += (aBegin - start) + (end - aEnd);
+        }
+
+        // Appends a region, joining it with the previous one across a short equal gap.
+        void emit(size_t aBegin, size_t aEnd, size_t bBegin, size_t bEnd) {
+            if (aBegin == aEnd && bBegin == bEnd) {
+                return;
+            }
+            if (!regions.empty() && aBegin - regions.back().aEnd < options.minGap) {
+                regions.back().aEnd = aEnd;
+                regions.back().bEnd = bEnd;
+                return;
+            }
+            regions.push_back({ aBegin, aEnd, bBegin, bEnd });
+        }
+
+        // Linear-space Myers: find a point on an optimal edit path with the forward and
+        // backward searches meeting in the middle, then solve both halves the same way.
+        void myers(size_t aBegin, size_t aEnd, size_t bBegin, size_t bEnd) {
+            trim(aBegin, aEnd, bBegin, bEnd);
+            if (aBegin == aEnd || bBegin == bEnd || budgetExhausted()) {
+                emit(aBegin, aEnd, bBegin, bEnd); // Pure insert/delete, or out of budget
+                return;
+            }
+
+            size_t aSplit, bSplit;
+            if (!bisect(aBegin, aEnd, bBegin, bEnd, aSplit, bSplit)) {
+                emit(aBegin, aEnd, bBegin, bEnd);
+                return;
+            }
+            myers(aBegin, aSplit, bBegin, bSplit);
+            myers(aSplit, aEnd, bSplit, bEnd);
+        }
+
+        // Finds the middle of an optimal path between the (trimmed, non-empty) ranges.
+        // Returns false if the work budget runs out first.
+        bool bisect(size_t aBegin, size_t aEnd, size_t bBegin, size_t bEnd, size_t& aSplit, size_t& bSplit) {
+            const wchar_t* textA = a + aBegin;
+            const wchar_t* textB = b + bBegin;
+            const ptrdiff_t lengthA = static_cast<ptrdiff_t>(aEnd - aBegin);
+            const ptrdiff_t lengthB = static_cast<ptrdiff_t>(bEnd - bBegin);
+
+            // Visiting the diagonals alone costs about d^2 steps for edit distance d,
+            // so the budget also bounds how many diagonals we ever need to store.
+            ptrdiff_t maxD = (lengthA + lengthB + 1) / 2;
+            ptrdiff_t budgetD = 2;
+            while (budgetD < maxD && static_cast<size_t>(budgetD) * static_cast<size_t>(budgetD) < options.maxWork) {
+                budgetD *= 2;
+            }
+            maxD = std::min(maxD, budgetD);
+
+            const ptrdiff_t offset = maxD + 1;
+            const ptrdiff_t size = 2 * maxD + 3;
+            forward.assign(size, -1);
+            backward.assign(size, -1);
+            forward[offset + 1] = 0;
+            backward[offset + 1] = 0;
+
+            const ptrdiff_t delta = lengthA - lengthB;
+            // With an odd delta the forward search is the one that can complete an overlap.
+            const bool checkOnForward = (delta % 2 != 0);
+
+            // Bounds of the diagonals still inside the grid, per direction.
+            ptrdiff_t forwardStart = 0, forwardEnd = 0, backwardStart = 0, backwardEnd = 0;
+
+            for (ptrdiff_t d = 0; d < maxD; ++d) {
+                if (budgetExhausted()) {
+                    return false;
+                }
+
+                for (ptrdiff_t k = -d + forwardStart; k <= d - forwardEnd; k += 2) {
+                    ptrdiff_t index = offset + k;
+                    ptrdiff_t x = (k == -d || (k != d && forward[index - 1] < forward[index + 1]))
+                        ? forward[index + 1]
+                        : forward[index - 1] + 1;
+                    ptrdiff_t y = x - k;
+                    ptrdiff_t snakeStart = x;
+                    while (x < lengthA && y < lengthB && textA[x] == textB[y]) {
+                        ++x;
+                        ++y;
+                    }
+                    work += 1 + static_cast<size_t>(x - snakeStart);
+                    forward[index] = x;
+
+                    if (x > lengthA) {
+                        forwardEnd += 2; // Ran off the right edge
+                    }
+                    else if (y > lengthB) {
+                        forwardStart += 2; // Ran off the bottom edge
+                    }
+                    else if (checkOnForward) {
+                        ptrdiff_t backwardIndex = offset + delta - k;
+                        if (backwardIndex >= 0 && backwardIndex < size && backward[backwardIndex] != -1) {
+                            // The backward search measures x from the end.
+                            if (x >= lengthA - backward[backwardIndex]) {
+                                aSplit = aBegin + static_cast<size_t>(x);
+                                bSplit = bBegin + static_cast<size_t>(y);
+                                return true;
+                            }
+                        }
+                    }
+                }
+
+                for (ptrdiff_t k = -d + backwardStart; k <= d - backwardEnd; k += 2) {
+                    ptrdiff_t index = offset + k;
+                    ptrdiff_t x = (k == -d || (k != d && backward[index - 1] < backward[index + 1]))
+                        ? backward[index + 1]
+                        : backward[index - 1] + 1;
+                    ptrdiff_t y = x - k;
+                    ptrdiff_t snakeStart = x;
+                    while (x < lengthA && y < lengthB && textA[lengthA - x - 1] == textB[lengthB - y - 1]) {
+                        ++x;
+                        ++y;
+                    }
+                    work += 1 + static_cast<size_t>(x - snakeStart);
+                    backward[index] = x;
+
+                    if (x > lengthA) {
+                        backwardEnd += 2;
+                    }
+                    else if (y > lengthB) {
+                        backwardStart += 2;
+                    }
+                    else if (!checkOnForward) {
+                        ptrdiff_t forwardIndex = offset + delta - k;
+                        if (forwardIndex >= 0 && forwardIndex < size && forward[forwardIndex] != -1) {
+                            ptrdiff_t forwardX = forward[forwardIndex];
+                            ptrdiff_t forwardY = forwardX - (forwardIndex - offset);
+                            if (forwardX >= lengthA - x) {
+                                aSplit = aBegin + static_cast<size_t>(forwardX);
+                                bSplit = bBegin + static_cast<size_t>(forwardY);
+                                return true;
+                            }
+                        }
+                    }
+                }
+            }
+            return false;
+        }
+
+        struct Line {
+            size_t begin;
+            size_t end;
+        };
+
+        // Splits a range into lines, each including its line break ('\r' or '\n').
+        static void splitLines(const wchar_t* text, size_t begin, size_t end, std::vector<Line>& lines) {
+            size_t lineStart = begin;
+            for (size_t i = begin; i < end; ++i) {
+                if (text[i] == L'\r' || text[i] == L'\n') {
+                    lines.push_back({ lineStart, i + 1 });
+                    lineStart = i + 1;
+                }
+            }
+            if (lineStart < end) {
+                lines.push_back({ lineStart, end });
+            }
+        }
+
+        // Patience diff: lines that occur exactly once on each side are matched in order
+        // (longest increasing subsequence), then the gaps between them are diffed again.
+        void patience(size_t aBegin, size_t aEnd, size_t bBegin, size_t bEnd, int depth) {
+            trim(aBegin, aEnd, bBegin, bEnd);
+            if (aBegin == aEnd || bBegin == bEnd || budgetExhausted()) {
+                emit(aBegin, aEnd, bBegin, bEnd);
+                return;
+            }
+            if (depth >= MAX_PATIENCE_DEPTH) {
+                myers(aBegin, aEnd, bBegin, bEnd);
+                return;
+            }
+
+            std::vector<Line> linesA, linesB;
+            splitLines(a, aBegin, aEnd, linesA);
+            splitLines(b, bBegin, bEnd, linesB);
+            work += (aEnd - aBegin) + (bEnd - bBegin);
+
+            struct Occurrence {
+                size_t countA = 0;
+                size_t countB = 0;
+                size_t lineA = 0;
+                size_t lineB = 0;
+            };
+            std::unordered_map<std::wstring_view, Occurrence> occurrences;
+            occurrences.reserve(linesA.size() + linesB.size());
+            for (size_t i = 0; i < linesA.size(); ++i) {
+                Occurrence& occurrence = occurrences[std::wstring_view(a + linesA[i].begin, linesA[i].end - linesA[i].begin)];
+                ++occurrence.countA;
+                occurrence.lineA = i;
+            }
+            for (size_t i = 0; i < linesB.size(); ++i) {
+                auto it = occurrences.find(std::wstring_view(b + linesB[i].begin, linesB[i].end - linesB[i].begin));
+                if (it != occurrences.end()) {
+                    ++it->second.countB;
+                    it->second.lineB = i;
+                }
+            }
+
+            // Unique common lines, ordered by their position in A.
+            std::vector<std::pair<size_t, size_t>> unique; // (line in A, line in B)
+            for (size_t i = 0; i < linesA.size(); ++i) {
+                auto it = occurrences.find(std::wstring_view(a + linesA[i].begin, linesA[i].end - linesA[i].begin));
+                if (it->second.countA == 1 && it->second.countB == 1) {
+                    unique.emplace_back(i, it->second.lineB);
+                }
+            }
+            if (unique.empty()) {
+                myers(aBegin, aEnd, bBegin, bEnd);
+                return;
+            }
+
+            // Longest run of unique lines that is increasing in B as well (patience sorting).
+            std::vector<size_t> pileTops; // Index into 'unique' of each pile's top card
+            std::vector<size_t> previous(unique.size(), SIZE_MAX);
+            for (size_t i = 0; i < unique.size(); ++i) {
+                auto pile = std::lower_bound(pileTops.begin(), pileTops.end(), unique[i].second,
+                    [&unique](size_t top, size_t lineB) { return unique[top].second < lineB; });
+                if (pile != pileTops.begin()) {
+                    previous[i] = *(pile - 1);
+                }
+                if (pile == pileTops.end()) {
+                    pileTops.push_back(i);
+                }
+                else {
+                    *pile = i;
+                }
+            }
+            std::vector<size_t> anchors;
+            for (size_t i = pileTops.back(); i != SIZE_MAX; i = previous[i]) {
+                anchors.push_back(i);
+            }
+            std::reverse(anchors.begin(), anchors.end());
+
+            // Diff the gaps between consecutive anchors; the anchors themselves are equal.
+            size_t gapA = aBegin;
+            size_t gapB = bBegin;
+            for (size_t anchor : anchors) {
+                const Line& lineA = linesA[unique[anchor].first];
+                const Line& lineB = linesB[unique[anchor].second];
+                patience(gapA, lineA.begin, gapB, lineB.begin, depth + 1);
+                gapA = lineA.end;
+                gapB = lineB.end;
+            }
+            patience(gapA, aEnd, gapB, bEnd, depth + 1);
+        }
+    };
+
+    // Diffs a[0, aLength) against b[0, bLength); hunk positions are shifted by 'offset'.
+    ChangeSet BuildChangeSet(const wchar_t* a, size_t aLength, const wchar_t* b, size_t bLength,
+                             size_t offset, const DiffOptions& options) {
+        ChangeSet changes;
+        if (aLength == 0 && bLength == 0) {
+            return changes;
+        }
+
+        DiffEngine engine(a, b, options);
+        std::vector<DiffRegion> regions = engine.run(aLength, bLength);
+
+        // Regions are ascending and disjoint, so a region's start in B is exactly where
+        // its hunk applies once the hunks before it have been applied.
+        changes.hunks.reserve(regions.size());
+        for (const DiffRegion& region : regions) {
+            TextChange hunk;
+            hunk.position = offset + region.bBegin;
+            hunk.deletedText.assign(a + region.aBegin, region.aEnd - region.aBegin);
+            hunk.insertedText.assign(b + region.bBegin, region.bEnd - region.bBegin);
+            hunk.cursorPositionAfter = hunk.position + hunk.insertedText.length();
+            changes.hunks.push_back(std::move(hunk));
+        }
+        return changes;
+    }
+}
+
+ChangeSet ComputeChangeSet(const std::wstring& before, const std::wstring& after, const DiffOptions& options) {
+    return BuildChangeSet(before.data(), before.length(), after.data(), after.length(), 0, options);
+}
+
+ChangeSet ComputeChangeSet(const PieceTable& before, const std::wstring& after, const DiffOptions& options) {
+    // Trim on the piece table first, so only the differing middle is copied out.
+    size_t prefix = before.commonPrefixLength(after);
+    size_t suffix = before.commonSuffixLength(after, prefix);
+    if (prefix + suffix == before.length() && prefix + suffix == after.length()) {
+        return ChangeSet(); // Identical
+    }
+
+    std::wstring middleBefore = before.substr(prefix, before.length() - prefix - suffix);
+    return BuildChangeSet(middleBefore.data(), middleBefore.length(),
+                          after.data() + prefix, after.length() - prefix - suffix, prefix, options);
+}
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <string>
+#include <cstddef>    // For size_t
+#include "TextChange.h"
+#include "PieceTable.h"
+
+// Portable diff engine used to turn "text before" / "text after" into a compact
+// ChangeSet. The common prefix and suffix are trimmed first (cheap, and enough for a
+// single local edit); only the differing middle is diffed, character by character,
+// with Myers' O(ND) algorithm in linear space. Patience mode first matches lines that
+// occur exactly once on both sides and runs Myers between those anchors, which keeps
+// hunks aligned with the document structure when blocks of text were moved or rewritten.
+
+enum class DiffAlgorithm {
+    Myers,
+    Patience
+};
+
+struct DiffOptions {
+    DiffAlgorithm algorithm = DiffAlgorithm::Myers;
+
+    // Bound on the work (diagonal steps plus compared characters) spent searching for
+    // a minimal diff, on top of a few linear passes over the input. Once exceeded,
+    // whatever region is still unresolved becomes a single replace hunk, so
+    // pathological inputs cost at most this much plus a copy.
+    size_t maxWork = 20 * 1000 * 1000;
+
+    // Hunks separated by fewer equal characters than this are joined into one. A few
+    // repeated characters are cheaper to store than another hunk.
+    size_t minGap = 8;
+};
+
+// Computes the hunks turning 'before' into 'after', in ascending order (see ChangeSet).
+// Every hunk's cursorPositionAfter is the end of its inserted text. Returns an empty
+// set when the texts are equal.
+ChangeSet ComputeChangeSet(const std::wstring& before, const std::wstring& after,
+                           const DiffOptions& options = DiffOptions());
+
+// Same, diffing a piece-table baseline against the editor's text. Only the region
+// between the common prefix and suffix is materialized from the baseline.
+ChangeSet ComputeChangeSet(const PieceTable& before, const std::wstring& after,
+                           const DiffOptions& options = DiffOptions());
@@ -7,20 +7,42 @@
 #include <richedit.h>
 #include <vector>
 #include <string>
-#include <fstream>  // Added for file operations
-#include <sstream>  // Added for reading file to string
 #include <map>
 #include "VersionHistoryManager.h"
 #include "TextChange.h"
+#include "PieceTable.h"
+#include "ChangeCapture.h"
+#include "AutoCommitScheduler.h"
+#include "BlobStore.h"
+#include "TextDiff.h"
+#include "EditSink.h"
+#include "EditTrace.h"
+#include "HistoryTreeModel.h"
+#include "HistorySnapshot.h"
+#include "HistoryWorker.h"
+#include "TextFile.h"
+#include "Metrics.h"
+#include "Timeline.h"
 #include <Windows.h>
 #include <algorithm>
+#include <future>
 
 #pragma comment(lib, "shlwapi.lib")
 #pragma comment(lib, "comctl32.lib")
 
 #define WM_POST_APPLY_CHANGE (WM_USER + 100)
-#define IDLE_HISTORY_TIMEOUT_MS 4000
-#define SIGNIFICANT_CHANGE_THRESHOLD 101
+#define WM_HISTORY_CHECKOUT_READY (WM_APP + 1) // To the history dialog, from a worker thread
+#define WM_FILE_SAVED (WM_USER + 101) // From the file writer thread; lParam is a FileSaveResult*
+#define AUTO_COMMIT_TIMER_ID 1 // The one timer behind every tab's idle commits (see AutoCommitScheduler)
+// History retention: beyond these limits automatic commits get squashed, and dead
+// branches of automatic commits older than the age limit are dropped.
+#define HISTORY_MAX_NODES 20000
+#define HISTORY_MAX_BYTES (256 * 1024 * 1024)
+#define HISTORY_MAX_AGE_HOURS (30 * 24)
+#define HISTORY_COMPACTION_SLICE 256 // Nodes visited per compaction step
+#define HISTORY_COMPRESS_PAYLOADS true // Keep recorded changes packed (see ChangePacking.h)
+#define HISTORY_PATCH_MAX_HUNKS 512 // Larger history jumps reload the whole text
+#define HISTORY_TRACE_DIRECTORY_VARIABLE L"TEXTEDITOR_TRACE_DIR" // Folder for editing traces, if set
 
 
 // Global Variables:
@@ -36,31 +58,70 @@ struct EditorTabInfo {
     std::wstring fileName = L"Untitled";
     std::unique_ptr<VersionHistoryManager> historyManager = nullptr;
     bool isModified = false; // Track modification status
-    // Store the text state *before* the current change for diffing
-    std::wstring textBeforeChange = L"";
+    // Store the text state *before* the current change for diffing.
+    // Piece tables: copies share text, edits only cost the size of the change.
+    PieceTable textBeforeChange;
     //bool processingChange = false; // Flag to prevent re-entrancy during change handling
 
-	UINT_PTR idleTimerId = 0; // Timer ID for idle state
     bool changesSinceLastHistoryPoint = false; //Tracks if modification occurred
     //Optimization: Store the text state of the *last recorded history point*
     //This avoids reconstructing from root to calculate the next diff.
-	std::wstring textAtLastHistoryPoint = L"";
+	PieceTable textAtLastHistoryPoint;
      bool processingHistoryAction = false; // 
-	 size_t totalChangeSize = 0; // total size of changes since last history point
+	 // Edits since the last history point, merged as they come in (see EditCoalescer), so
+	 // recording the next point doesn't diff the whole document. Always the change from
+	 // textAtLastHistoryPoint to textBeforeChange.
+	 EditCoalescer pendingEdits;
+    // Selection right before the next edit, used to capture the edit without reading
+    // the whole document. Only valid while it was taken against textBeforeChange.
+    SelectionRange selectionBeforeChange;
+    bool selectionBeforeChangeValid = false;
+    // Editing trace of this tab, when tracing is enabled (see StartEditTrace)
+    std::shared_ptr<EditTraceWriter> trace;
+    TextEncoding fileEncoding = TextEncoding::Utf8; // As the file was read; saves write it back the same way
+    std::string metricsPrefix; // "tab<n>.", names this tab's gauges (see UpdateTabGauges)
 };
 std::vector<EditorTabInfo> openTabs;
 int currentTab = -1;
 
+// Decides when each tab's typing is committed automatically. Its earliest idle deadline
+// is what AUTO_COMMIT_TIMER_ID is armed for (see ArmAutoCommitTimer).
+AutoCommitScheduler autoCommits;
+bool autoCommitTimerArmed = false;
+AutoCommitScheduler::TimePoint autoCommitTimerDue;
+
+// Identifies a tab to the auto-commit scheduler: its edit control is unique while it is open.
+AutoCommitScheduler::DocumentId AutoCommitKey(const EditorTabInfo& tab) {
+    return static_cast<AutoCommitScheduler::DocumentId>(reinterpret_cast<uintptr_t>(tab.hEdit));
+}
+
+// Publishes what the tab holds in memory as gauges. All of it is kept up to date by the
+// history manager and the piece table, so this is cheap enough for every commit.
+void UpdateTabGauges(const EditorTabInfo& tab) {
+    if (!tab.historyManager || tab.metricsPrefix.empty()) {
+        return;
+    }
+    GaugeMetric(tab.metricsPrefix + "text_bytes").set(static_cast<int64_t>(tab.textAtLastHistoryPoint.length() * sizeof(wchar_t)));
+    GaugeMetric(tab.metricsPrefix + "history_bytes").set(static_cast<int64_t>(tab.historyManager->getHistoryBytes()));
+    GaugeMetric(tab.metricsPrefix + "checkpoint_bytes").set(static_cast<int64_t>(tab.historyManager->getCheckpointMemoryUsage()));
+    GaugeMetric(tab.metricsPrefix + "state_cache_bytes").set(static_cast<int64_t>(tab.historyManager->getStateCacheStats().bytes));
+}
+
 // Structure to pass data to the History Dialog Procedure
 struct HistoryDialogParams {
     VersionHistoryManager* historyManager = nullptr;
     int tabIndex = -1; // To access openTabs[tabIndex] if needed
     HWND hParent = NULL; // Main window handle
-    // Map to associate TreeView items with their corresponding HistoryNode shared_ptrs
-    // This is safer than storing pointers directly in lParam.
-    std::map<HTREEITEM, std::shared_ptr<HistoryNode>> treeItemNodeMap;
+    // Rows of the TreeView, created as items are expanded (see HistoryTreeModel). Each
+    // item's lParam is its row, and the row keeps the item's HistoryNode alive.
+    std::unique_ptr<HistoryTreeModel> treeModel;
     // Store the node that corresponds to the state currently shown in the editor when the dialog opened
     std::shared_ptr<const HistoryNode> nodeAtEditorState = nullptr;
+    // A distant version being rebuilt on a worker (see StartHistoryCheckout). The worker
+    // posts WM_HISTORY_CHECKOUT_READY when the future is ready.
+    std::shared_ptr<HistoryNode> pendingCheckoutNode;
+    std::future<PieceTable> pendingCheckout;
+    CancellationToken pendingCheckoutToken;
 };
 
 struct ChooseChildDialogParams {
@@ -70,6 +131,15 @@ struct ChooseChildDialogParams {
 };
 
 
+// Outcome of writing a file on the file writer thread (see SaveEditorContent)
+struct FileSaveResult {
+    HWND hEdit = NULL; // Identifies the tab, which may have been closed meanwhile
+    std::wstring path;
+    TextEncoding encoding = TextEncoding::Utf8; // As written
+    bool succeeded = false;
+};
+std::vector<std::future<FileSaveResult>> pendingFileSaves; // Waited for before exiting
+
 // Structure to pass data to/from Commit Message Dialog
 struct CommitMessageParams {
     std::wstring* pCommitMessage = nullptr; // Pointer to store the result
@@ -84,6 +154,8 @@ INT_PTR CALLBACK    CommandPaletteProc(HWND, UINT, WPARAM, LPARAM);
 INT_PTR CALLBACK    CommitMessageDlgProc(HWND, UINT, WPARAM, LPARAM);
 INT_PTR CALLBACK    HistoryDlgProc(HWND, UINT, WPARAM, LPARAM);
 INT_PTR CALLBACK    ChooseChildCommitDlgProc(HWND hDlg, UINT message, WPARAM wParam, LPARAM lParam);
+INT_PTR CALLBACK    DiagnosticsDlgProc(HWND, UINT, WPARAM, LPARAM);
+void                ToggleTimelineRecording(HWND hWnd);
 void                CreateTab(HWND hWnd, const WCHAR* title, const WCHAR* filePath);
 void                SwitchToTab(int index);
 void                CloseTab(int index);
@@ -92,10 +164,14 @@ HWND                CreateRichEdit(HWND hWnd);
 void                ResizeControls(HWND hWnd);
 void                ShowCommandPalette(HWND hWnd);
 bool                LoadFileIntoEditor(HWND hEdit, const WCHAR* filePath, std::wstring&);
-bool                SaveEditorContent(int tabIndex, bool saveAs);
+bool                SaveEditorContent(int tabIndex, bool saveAs, bool waitForWrite = false);
+void                FinishFileSave(const FileSaveResult& result);
+std::unique_ptr<VersionHistoryManager> OpenHistoryForFile(const std::wstring& filePath, const std::wstring& content);
 void                UpdateTabTitle(int index);
 std::wstring        GetRichEditText(HWND hEdit); 
-TextChange          CalculateTextChange(const std::wstring& before, const std::wstring& after, HWND hEdit); 
+size_t              GetRichEditTextLength(HWND hEdit);
+std::wstring        GetRichEditTextRange(HWND hEdit, size_t position, size_t count);
+ChangeSet           CalculateTextChange(const PieceTable& before, const std::wstring& after, HWND hEdit); 
 void                UpdateWindowTitle(HWND hWnd); 
 void                ShowHistoryTree(HWND hWnd); // history UI 
 
@@ -123,7 +199,8 @@ int APIENTRY wWinMain(_In_ HINSTANCE hInstance,
     InitCommonControlsEx(&icc);
 
     // Load Rich Edit library
-    LoadLibrary(TEXT("Msftedit.dll")); 
+    LoadLibrary(TEXT("Msftedit.dll"));
+    Timeline::global().setThreadName("UI"); 
 
     LoadStringW(hInstance, IDS_APP_TITLE, szTitle, MAX_LOADSTRING);
     LoadStringW(hInstance, IDC_TEXTEDITOR, szWindowClass, MAX_LOADSTRING);
@@ -236,49 +313,60 @@ HWND CreateRichEdit(HWND hWnd)
 }
 
 
+// Text is read in the control's native form (paragraphs end in a single CR), so string
+// indices always equal Rich Edit character positions (selections, EM_GETTEXTRANGE).
+// File I/O converts to and from CRLF.
 std::wstring GetRichEditText(HWND hEdit) {
     if (!hEdit) return L"";
-    int textLen = GetWindowTextLengthW(hEdit);
-    if (textLen <= 0) return L""; // Handle 0 length or error
+    size_t textLen = GetRichEditTextLength(hEdit);
+    if (textLen == 0) return L""; // Handle 0 length or error
 
     std::wstring buffer;
     buffer.resize(textLen + 1); // +1 for null terminator safety
-    GetWindowTextW(hEdit, &buffer[0], textLen + 1);
-    buffer.resize(textLen); // Remove trailing null GetWindowText adds
+    GETTEXTEX gt = { 0 };
+    gt.cb = (DWORD)((textLen + 1) * sizeof(WCHAR));
+    gt.flags = GT_DEFAULT;
+    gt.codepage = 1200; // UTF-16
+    LRESULT copied = SendMessageW(hEdit, EM_GETTEXTEX, (WPARAM)&gt, (LPARAM)&buffer[0]);
+    buffer.resize(copied > 0 ? (size_t)copied : 0); // Remove trailing null
     return buffer;
 }
 
+size_t GetRichEditTextLength(HWND hEdit) {
+    if (!hEdit) return 0;
+    GETTEXTLENGTHEX gtl = { GTL_NUMCHARS | GTL_PRECISE, 1200 };
+    LRESULT textLen = SendMessageW(hEdit, EM_GETTEXTLENGTHEX, (WPARAM)&gtl, 0);
+    return textLen > 0 ? (size_t)textLen : 0;
+}
 
-TextChange CalculateTextChange(const std::wstring& before, const std::wstring& after, HWND hEdit) {
-    // This is a VERY basic diff implementation. For a real editor,
-    // use a proper diff algorithm (e.g., Myers diff).
-    // This basic version finds the first and last differing characters.
-
-    size_t firstDiff = 0;
-    while (firstDiff < before.length() && firstDiff < after.length() && before[firstDiff] == after[firstDiff]) {
-        firstDiff++;
-    }
+// Reads only [position, position + count) from the control.
+std::wstring GetRichEditTextRange(HWND hEdit, size_t position, size_t count) {
+    if (!hEdit || count == 0) return L"";
 
-    size_t lastDiffBefore = before.length();
-    size_t lastDiffAfter = after.length();
-    while (lastDiffBefore > firstDiff && lastDiffAfter > firstDiff && before[lastDiffBefore - 1] == after[lastDiffAfter - 1]) {
-        lastDiffBefore--;
-        lastDiffAfter--;
-    }
-
-    std::wstring deletedText = (lastDiffBefore > firstDiff) ? before.substr(firstDiff, lastDiffBefore - firstDiff) : L"";
-    std::wstring insertedText = (lastDiffAfter > firstDiff) ? after.substr(firstDiff, lastDiffAfter - firstDiff) : L"";
+    std::wstring buffer;
+    buffer.resize(count + 1); // +1 for the null terminator
+    TEXTRANGEW tr = { 0 };
+    tr.chrg.cpMin = (LONG)position;
+    tr.chrg.cpMax = (LONG)(position + count);
+    tr.lpstrText = &buffer[0];
+    LRESULT copied = SendMessageW(hEdit, EM_GETTEXTRANGE, 0, (LPARAM)&tr);
+    buffer.resize(copied > 0 ? (size_t)copied : 0);
+    return buffer;
+}
 
+ChangeSet CalculateTextChange(const PieceTable& before, const std::wstring& after, HWND hEdit) {
     // Get cursor position AFTER the change
     CHARRANGE cr;
     SendMessage(hEdit, EM_EXGETSEL, 0, (LPARAM)&cr);
     size_t cursorPosAfter = cr.cpMax; // Use end of selection as cursor pos
 
-    return TextChange(firstDiff, insertedText, deletedText, cursorPosAfter);
+    // The diffing itself lives in the portable history core (ChangeCapture).
+    return CalculateTextChange(before, after, cursorPosAfter);
 }
 
 // Finds the corresponding tab and updates its state after text is set programmatically
-void UpdateTabStateAfterHistoryAction(HWND hEdit, const std::wstring& newText, std::shared_ptr<const HistoryNode> targetNode) {
+void UpdateTabStateAfterHistoryAction(HWND hEdit, const PieceTable& newText, std::shared_ptr<const HistoryNode> targetNode) {
+    TIMELINE_SPAN("UpdateTabStateAfterHistoryAction");
     int tabIndex = -1;
     for (int i = 0; i < openTabs.size(); ++i) {
         if (openTabs[i].hEdit == hEdit) {
@@ -291,10 +379,13 @@ void UpdateTabStateAfterHistoryAction(HWND hEdit, const std::wstring& newText, s
     auto& tab = openTabs[tabIndex];
 
     // Update baseline text *critical*
-    tab.textAtLastHistoryPoint = newText;
-    tab.textBeforeChange = newText; // Keep this in sync too
+    tab.textAtLastHistoryPoint = newText; // Piece-table copy, O(1)
+    tab.textBeforeChange = tab.textAtLastHistoryPoint; // Keep this in sync too (shares the text)
     tab.changesSinceLastHistoryPoint = false; // State now matches a specific history point
-    tab.totalChangeSize = 0; // Reset accumulated size
+    tab.pendingEdits.clear(); // They applied to the text the history action replaced
+    autoCommits.noteCommit(AutoCommitKey(tab), std::chrono::microseconds(0)); // Nothing left to commit
+    UpdateTabGauges(tab);
+    tab.selectionBeforeChangeValid = false; // Next edit is diffed until the selection is known again
 
     // TODO: Update modification status - compare newText to saved state if tracked,
     // otherwise, assume jumping in history makes it potentially "unsaved"
@@ -318,8 +409,38 @@ void UpdateTabStateAfterHistoryAction(HWND hEdit, const std::wstring& newText, s
 
 
 
+// Restore cursor position based on the target node's info
+void RestoreHistoryCursor(HWND hEdit, std::shared_ptr<const HistoryNode> targetNode) {
+    CHARRANGE newSel = { 0, 0 }; // Default to start
+    ChangeSet changeBuffer;
+    const ChangeSet* change = targetNode ? targetNode->tryGetChange(changeBuffer) : nullptr;
+    size_t cursorAfter = change ? change->cursorPositionAfter() : (size_t)-1;
+    if (targetNode && !targetNode->isRoot() && cursorAfter != (size_t)-1) {
+        // Use the position stored *after* the change that LED to this node was applied
+        newSel.cpMin = newSel.cpMax = (LONG)cursorAfter;
+
+        // Boundary check: ensure cursor position is within the new text length
+        GETTEXTLENGTHEX gtl = { GTL_DEFAULT, CP_ACP }; // Use default code page
+        LRESULT textLen = SendMessageW(hEdit, EM_GETTEXTLENGTHEX, (WPARAM)&gtl, 0);
+        if (textLen >= 0 && newSel.cpMin > textLen) {
+            newSel.cpMin = newSel.cpMax = (LONG)textLen; // Move to end if out of bounds
+        }
+        else if (textLen < 0) {
+            // Error getting length, default to 0,0
+            newSel.cpMin = newSel.cpMax = 0;
+        }
+
+    }
+    else {
+        // Root node or no cursor info, default to start of document
+        newSel.cpMin = newSel.cpMax = 0;
+    }
+    SendMessage(hEdit, EM_EXSETSEL, 0, (LPARAM)&newSel);
+}
+
 //Helper to set text, clear RichEdit undo, and manage flags Pass the targetNode to restore cursor position accurately.
 void SetRichEditText(HWND hEdit, const std::wstring& text, std::shared_ptr<const HistoryNode> targetNode = nullptr) {
+    TIMELINE_SPAN("SetRichEditText");
     if (!hEdit) return;
 
     // Find the tab associated with this hEdit
@@ -344,36 +465,89 @@ void SetRichEditText(HWND hEdit, const std::wstring& text, std::shared_ptr<const
     // This prevents conflicts when jumping to an arbitrary history state.
     SendMessage(hEdit, EM_EMPTYUNDOBUFFER, 0, 0);
 
-    // Restore cursor position based on the target node's info
-    CHARRANGE newSel = { 0, 0 }; // Default to start
-    if (targetNode && !targetNode->isRoot() && targetNode->changeFromParent.cursorPositionAfter != (size_t)-1) {
-        // Use the position stored *after* the change that LED to this node was applied
-        newSel.cpMin = newSel.cpMax = (LONG)targetNode->changeFromParent.cursorPositionAfter;
+    RestoreHistoryCursor(hEdit, targetNode);
+
+    UpdateTabStateAfterHistoryAction(hEdit, PieceTable(text), targetNode);
+    //// Mark control as unmodified (since it now matches a specific history state)
+    //// Note: tab.isModified should be updated based on whether this state matches the saved state on disk.
+    //SendMessage(hEdit, EM_SETMODIFY, FALSE, 0);
+
+}
 
-        // Boundary check: ensure cursor position is within the new text length
-        GETTEXTLENGTHEX gtl = { GTL_DEFAULT, CP_ACP }; // Use default code page
-        LRESULT textLen = SendMessageW(hEdit, EM_GETTEXTLENGTHEX, (WPARAM)&gtl, 0);
-        if (textLen >= 0 && newSel.cpMin > textLen) {
-            newSel.cpMin = newSel.cpMax = (LONG)textLen; // Move to end if out of bounds
-        }
-        else if (textLen < 0) {
-            // Error getting length, default to 0,0
-            newSel.cpMin = newSel.cpMax = 0;
-        }
 
+// Edit sink writing into a Rich Edit control with selection-plus-replace. While a
+// batch is applied, redrawing and change notifications are suspended and the scroll
+// position is kept, so the view doesn't jump and no EN_CHANGE is raised per replace.
+class RichEditSink : public EditSink {
+public:
+    explicit RichEditSink(HWND hEdit) : hEdit(hEdit) {}
+
+    void beginEdits() override {
+        SendMessage(hEdit, EM_GETSCROLLPOS, 0, (LPARAM)&scrollPos);
+        eventMask = SendMessage(hEdit, EM_SETEVENTMASK, 0, 0); // Returns the previous mask
+        SendMessage(hEdit, WM_SETREDRAW, FALSE, 0);
     }
-    else {
-        // Root node or no cursor info, default to start of document
-        newSel.cpMin = newSel.cpMax = 0;
+
+    void replace(size_t position, size_t deleteCount, const std::wstring& text) override {
+        SendMessageW(hEdit, EM_SETSEL, (WPARAM)position, (LPARAM)(position + deleteCount));
+        SendMessageW(hEdit, EM_REPLACESEL, FALSE, (LPARAM)text.c_str()); // FALSE: not undoable
     }
-    SendMessage(hEdit, EM_EXSETSEL, 0, (LPARAM)&newSel);
 
+    void endEdits() override {
+        SendMessage(hEdit, EM_SETSCROLLPOS, 0, (LPARAM)&scrollPos);
+        SendMessage(hEdit, WM_SETREDRAW, TRUE, 0);
+        SendMessage(hEdit, EM_SETEVENTMASK, 0, eventMask);
+        InvalidateRect(hEdit, NULL, TRUE);
+    }
 
-    UpdateTabStateAfterHistoryAction(hEdit, text, targetNode);
-    //// Mark control as unmodified (since it now matches a specific history state)
-    //// Note: tab.isModified should be updated based on whether this state matches the saved state on disk.
-    //SendMessage(hEdit, EM_SETMODIFY, FALSE, 0);
+private:
+    HWND hEdit;
+    POINT scrollPos = { 0, 0 };
+    LRESULT eventMask = 0;
+};
+
+// Counterpart of SetRichEditText for moves through the history: patches only the
+// replaces of 'delta' (old text -> new text) into the control, so the cost follows the
+// size of the change rather than of the document.
+void ApplyHistoryStepToRichEdit(HWND hEdit, const ChangeSet& delta, const PieceTable& newText, std::shared_ptr<const HistoryNode> targetNode) {
+    TIMELINE_SPAN("ApplyHistoryStepToRichEdit");
+    if (!hEdit) return;
+
+    int tabIndex = -1;
+    for (int i = 0; i < openTabs.size(); ++i) {
+        if (openTabs[i].hEdit == hEdit) {
+            tabIndex = i;
+            break;
+        }
+    }
+    if (tabIndex == -1) return;
+    openTabs[tabIndex].processingHistoryAction = true; // Set flag BEFORE changing text
+
+    // Hunks apply in order, each at a position in the text the previous ones produced,
+    // which is exactly how successive EM_REPLACESEL calls behave.
+    RichEditSink sink(hEdit);
+    ApplyChangeSetToSink(delta, sink);
+
+    // Same as a full jump: the control's own undo must not reach across history moves.
+    SendMessage(hEdit, EM_EMPTYUNDOBUFFER, 0, 0);
+    RestoreHistoryCursor(hEdit, targetNode);
 
+    UpdateTabStateAfterHistoryAction(hEdit, newText, targetNode);
+}
+
+
+// Shows the tab's history manager after it moved to another node, 'delta' being the
+// change from the old node's text to the new one. The control is patched in place when
+// it still holds the text of the node we left; if it has edits not yet recorded, or
+// the delta is too scattered to be worth patching, the new state replaces its text.
+void ShowHistoryStep(EditorTabInfo& tab, const ChangeSet& delta) {
+    std::shared_ptr<const HistoryNode> newNode = tab.historyManager->getCurrentNode();
+    if (tab.changesSinceLastHistoryPoint || delta.hunks.size() > HISTORY_PATCH_MAX_HUNKS) {
+        SetRichEditText(tab.hEdit, tab.historyManager->getCurrentState(), newNode);
+    }
+    else {
+        ApplyHistoryStepToRichEdit(tab.hEdit, delta, tab.historyManager->getCurrentDocument(), newNode);
+    }
 }
 
 
@@ -388,7 +562,34 @@ void UpdateWindowTitle(HWND hWnd) {
     SetWindowTextW(hWnd, title.c_str());
 }
 
+// When the TEXTEDITOR_TRACE_DIR environment variable names a folder, every tab records
+// its editing session there (see EditTrace.h), so it can be replayed headless with
+// history_replay and attached to bug reports.
+void StartEditTrace(EditorTabInfo& tab) {
+    WCHAR directory[MAX_PATH];
+    DWORD length = GetEnvironmentVariableW(HISTORY_TRACE_DIRECTORY_VARIABLE, directory, MAX_PATH);
+    if (length == 0 || length >= MAX_PATH || !tab.historyManager) {
+        return;
+    }
+
+    static unsigned traceCount = 0;
+    SYSTEMTIME now;
+    GetLocalTime(&now);
+    WCHAR fileName[96];
+    swprintf_s(fileName, L"%04u%02u%02u-%02u%02u%02u-%lu-%u.tetrace", now.wYear, now.wMonth, now.wDay,
+        now.wHour, now.wMinute, now.wSecond, GetCurrentProcessId(), ++traceCount);
+
+    auto writer = std::make_shared<EditTraceWriter>(std::wstring(directory) + L"\\" + fileName);
+    if (!writer->open()) {
+        OutputDebugStringW((L"Could not create trace " + writer->getPath() + L"\n").c_str());
+        return;
+    }
+    tab.trace = writer;
+    tab.historyManager->attachTrace(writer); // Writes the starting tree, then each operation
+}
+
 void CreateTab(HWND hWnd, const WCHAR* title, const WCHAR* filePath ) {
+    TIMELINE_SPAN("CreateTab");
     HWND hEdit = CreateRichEdit(hWnd);
     if (!hEdit) return;
 
@@ -425,21 +626,23 @@ void CreateTab(HWND hWnd, const WCHAR* title, const WCHAR* filePath ) {
     }
 
     // --- Create and store VersionHistoryManager ---
-    newTab.historyManager = std::make_unique<VersionHistoryManager>(initialContent);
-    // Initialize the baseline text for the *first* diff calculation
-    newTab.textAtLastHistoryPoint = initialContent;
-    newTab.textBeforeChange = initialContent; // Also init this
-    newTab.changesSinceLastHistoryPoint = false; // No changes initially
-    newTab.processingHistoryAction = false; // Not processing initially
-    // --- End HistoryManager creation ---
-
-    newTab.historyManager = std::make_unique<VersionHistoryManager>(initialContent);
-    newTab.textAtLastHistoryPoint = initialContent;
-    newTab.textBeforeChange = initialContent; // Initialize for first EN_CHANGE
-    newTab.totalChangeSize = 0; // Initialize cumulative size
+    newTab.historyManager = newTab.filePath.empty()
+        ? std::make_unique<VersionHistoryManager>(initialContent)
+        : OpenHistoryForFile(newTab.filePath, initialContent); // Restores history saved next to the file
+    VersionHistoryManager::RetentionPolicy retention;
+    retention.maxNodes = HISTORY_MAX_NODES;
+    retention.maxBytes = HISTORY_MAX_BYTES;
+    retention.maxAge = std::chrono::hours(HISTORY_MAX_AGE_HOURS);
+    newTab.historyManager->setRetentionPolicy(retention);
+    newTab.historyManager->setPayloadCompression(HISTORY_COMPRESS_PAYLOADS);
+    StartEditTrace(newTab);
+    newTab.textAtLastHistoryPoint = PieceTable(BlobStore::global().intern(initialContent)); // The same copy as the history's root
+    newTab.textBeforeChange = newTab.textAtLastHistoryPoint; // Initialize for first EN_CHANGE
+    newTab.pendingEdits.clear(); // Nothing typed yet
     newTab.changesSinceLastHistoryPoint = false;
     newTab.processingHistoryAction = false;
-    newTab.idleTimerId = 0;
+    static unsigned tabCount = 0;
+    newTab.metricsPrefix = "tab" + std::to_string(++tabCount) + ".";
 
 
 
@@ -461,6 +664,7 @@ void CreateTab(HWND hWnd, const WCHAR* title, const WCHAR* filePath ) {
     SendMessage(hEdit, EM_EMPTYUNDOBUFFER, 0, 0); // Clear default buffer after setting tex
 
     openTabs.push_back(std::move(newTab)); // Add the info struct
+    UpdateTabGauges(openTabs.back());
 
     SwitchToTab(index);
     ResizeControls(hWnd);
@@ -500,7 +704,7 @@ void CloseTab(int index)
             return; // User cancelled closing
         }
         else if (result == IDYES) {
-            if (!SaveEditorContent(index, false)) { // Try saving
+            if (!SaveEditorContent(index, false, true)) { // Try saving, and wait for the file to be written
                 MessageBoxW(GetParent(hTabCtrl), L"Failed to save. Close cancelled.", L"Save Error", MB_OK | MB_ICONERROR);
                 return; // Save failed, cancel close
             }
@@ -508,12 +712,8 @@ void CloseTab(int index)
         }
         // If IDNO, continue closing without saving
     }
-    // --- Add Timer Cleanup ---
-    if (openTabs[index].idleTimerId != 0) {
-        KillTimer(GetParent(hTabCtrl), reinterpret_cast<UINT_PTR>(openTabs[index].hEdit));
-        openTabs[index].idleTimerId = 0;
-    }
-    // --- End Timer Cleanup ---
+    autoCommits.removeDocument(AutoCommitKey(openTabs[index])); // Its idle deadline goes too
+    MetricsRegistry::global().removeGauges(openTabs[index].metricsPrefix);
 
     // HistoryManager unique_ptr cleans itself up when struct is erased
     DestroyWindow(openTabs[index].hEdit);
@@ -641,15 +841,16 @@ void UpdateTabTitle(int index) {
 
 // Helper function to load file content into the editor
 bool LoadFileIntoEditor(HWND hEdit, const WCHAR* filePath, std::wstring& outContent) {
+    TIMELINE_SPAN("LoadFileIntoEditor");
     if (!hEdit || !filePath) return false;
+    static LatencyHistogram& latency = LatencyMetric("file.load"); // Reading, decoding and filling the control
+    ScopedLatency timing(latency);
 
-    std::wifstream inFile(filePath);
-    if (!inFile) return false;
-
-    std::wstringstream buffer;
-    buffer << inFile.rdbuf();
-    outContent = buffer.str();
-    inFile.close();
+    // Mapped and transcoded in one pass, whatever the encoding (see TextFile.h); line
+    // endings come out as the control's CR paragraph marks.
+    TextEncoding encoding;
+    if (!LoadTextFile(filePath, outContent, &encoding)) return false;
+    CounterMetric("file.chars_loaded").add(outContent.length());
 
     // Set text in Rich Edit control
     // Set flag to ignore EN_CHANGE during programmatic text setting
@@ -673,10 +874,12 @@ bool LoadFileIntoEditor(HWND hEdit, const WCHAR* filePath, std::wstring& outCont
 
     // Update tab state after loading
     if (tabIndex != -1) {
-        openTabs[tabIndex].textAtLastHistoryPoint = outContent;
-        openTabs[tabIndex].textBeforeChange = outContent;
-        openTabs[tabIndex].totalChangeSize = 0;
+        openTabs[tabIndex].fileEncoding = encoding;
+        openTabs[tabIndex].textAtLastHistoryPoint = PieceTable(outContent);
+        openTabs[tabIndex].textBeforeChange = openTabs[tabIndex].textAtLastHistoryPoint;
+        openTabs[tabIndex].pendingEdits.clear();
         openTabs[tabIndex].changesSinceLastHistoryPoint = false;
+        openTabs[tabIndex].selectionBeforeChangeValid = false;
         // Post message to clear the processing flag *after* potential EN_CHANGE
         PostMessage(hParentWnd, WM_POST_APPLY_CHANGE, (WPARAM)hEdit, 0);
     }
@@ -684,62 +887,162 @@ bool LoadFileIntoEditor(HWND hEdit, const WCHAR* filePath, std::wstring& outCont
     return true;
 }
 
-// Function to record a history point
-void RecordHistoryPoint(HWND hWnd, int tabIndex, const std::wstring& description) { 
-    if (tabIndex < 0 || tabIndex >= openTabs.size() || !openTabs[tabIndex].historyManager) {
+// Sets AUTO_COMMIT_TIMER_ID to fire at the scheduler's earliest idle deadline, unless it
+// is already due to fire by then (firing early only means looking again).
+void ArmAutoCommitTimer(HWND hWnd) {
+    std::optional<AutoCommitScheduler::TimePoint> deadline = autoCommits.nextDeadline();
+    if (!deadline || (autoCommitTimerArmed && autoCommitTimerDue <= *deadline)) {
         return;
     }
-
-    auto& tab = openTabs[tabIndex];
-
-    // Prevent recording if editor is currently being updated by history action
-    if (tab.processingHistoryAction) {
-        return;
+    auto delay = std::chrono::duration_cast<std::chrono::milliseconds>(*deadline - AutoCommitScheduler::Clock::now()).count() + 1;
+    if (SetTimer(hWnd, AUTO_COMMIT_TIMER_ID, static_cast<UINT>(std::max<long long>(delay, USER_TIMER_MINIMUM)), nullptr)) {
+        autoCommitTimerArmed = true;
+        autoCommitTimerDue = *deadline;
     }
+}
 
-    std::wstring currentState = GetRichEditText(tab.hEdit);
-
-
-    // Avoid recording if text hasn't actually changed from last *recorded history point*
-    if (currentState == tab.textAtLastHistoryPoint) {
-        tab.changesSinceLastHistoryPoint = false; // Reset flag even if no change recorded
-		tab.totalChangeSize = 0; // Reset total change size
-        return;
+// Takes the change since the last history point out of the tab's pending edit log, for
+// an editor holding 'editorLength' characters. Returns false, leaving the log alone, if
+// the log can't account for the editor's text (a missed or misread edit would show up
+// as a length mismatch); the caller then diffs the whole document instead. A change
+// that came back to the recorded text (typing something and deleting it again) is
+// returned empty.
+bool TakePendingEdits(EditorTabInfo& tab, size_t editorLength, ChangeSet& change) {
+    if (editorLength != tab.textBeforeChange.length()) {
+        return false;
     }
+    change = tab.pendingEdits.take();
+    // Content hashes are kept by the piece tables, so ruling a round trip out costs
+    // nothing. Equal hashes don't prove one (different texts can collide), so the texts
+    // are compared before the edits are dropped; that pass only happens when they match.
+    if (tab.textBeforeChange.length() == tab.textAtLastHistoryPoint.length()
+        && tab.textBeforeChange.contentHash() == tab.textAtLastHistoryPoint.contentHash()
+        && tab.textBeforeChange.equals(tab.textAtLastHistoryPoint.toString())) {
+        change.hunks.clear();
+    }
+    return true;
+}
 
+// Records 'change' (from textAtLastHistoryPoint to the editor's text) as a history
+// point and moves the baselines past it. An empty change only resets the baselines.
+void CommitHistoryChange(EditorTabInfo& tab, const ChangeSet& change, const std::wstring& description) {
+    TIMELINE_SPAN("CommitHistoryChange");
     // --- Synchronization Note ---
-    // We calculate the diff between the *actual current editor state* and the
-    // *state of the last recorded history point*.
+    // The change is relative to the *state of the last recorded history point*.
     // The new node will be added as a child of the *manager's internal currentNode*.
     // If the user used RichEdit undo/redo, currentNode might not represent textAtLastHistoryPoint.
     // This leads to branches in the history tree, reflecting the divergence. This is acceptable.
+    AutoCommitScheduler::TimePoint start = AutoCommitScheduler::Clock::now();
+    if (!change.isEmpty()) {
+        // Record the change. This implicitly moves the history manager's 'currentNode' forward.
+        tab.historyManager->recordChange(change, description);
+
+        // Update the baseline for the next diff calculation to the *current* state.
+        // Applying the change to the piece table avoids storing another full copy.
+        tab.textAtLastHistoryPoint.applyChange(change);
+
+        // One bounded compaction step per history point keeps the tree within the
+        // retention policy without ever walking all of it at once.
+        tab.historyManager->compactHistory(HISTORY_COMPACTION_SLICE);
+    }
+    // Rebase the per-edit baseline on the recorded text too, so any drift in
+    // incrementally captured edits ends at every history point.
+    tab.textBeforeChange = tab.textAtLastHistoryPoint;
+    tab.pendingEdits.clear();
+    tab.changesSinceLastHistoryPoint = false; // Reset flag, changes up to now are recorded
+    // Whatever triggered it, this commit resets the tab's auto-commit schedule, and its
+    // cost tells the scheduler how far apart commits should be.
+    autoCommits.noteCommit(AutoCommitKey(tab), change.isEmpty() ? std::chrono::microseconds(0)
+        : std::chrono::duration_cast<std::chrono::microseconds>(AutoCommitScheduler::Clock::now() - start));
+    UpdateTabGauges(tab);
 
-    // Calculate the change from the *last recorded history state*
-    TextChange change = CalculateTextChange(tab.textAtLastHistoryPoint, currentState, tab.hEdit);
+    // TODO: Update status bar or log history event
+}
 
-    // --- Check if the change is non-empty ---
-    if (change.insertedText.empty() && change.deletedText.empty()) {
-        tab.changesSinceLastHistoryPoint = false; // Reset flag
-        return; // Don't record no-op changes
+// Function to record a history point
+// Records 'currentState', the text the editor holds now, as a history point.
+void RecordHistoryPoint(HWND hWnd, int tabIndex, const std::wstring& description, const std::wstring& currentState) {
+    TIMELINE_SPAN("RecordHistoryPoint");
+    if (tabIndex < 0 || tabIndex >= openTabs.size() || !openTabs[tabIndex].historyManager) {
+        return;
     }
 
+    auto& tab = openTabs[tabIndex];
 
-    // Record the change. This implicitly moves the history manager's 'currentNode' forward.
-    tab.historyManager->recordChange(change, description);
+    // Prevent recording if editor is currently being updated by history action
+    if (tab.processingHistoryAction) {
+        return;
+    }
 
+    // The edits typed since the last point are normally all in the pending log already.
+    ChangeSet change;
+    if (!TakePendingEdits(tab, currentState.length(), change)) {
+        // Avoid recording if text hasn't actually changed from last *recorded history point*
+        if (tab.textAtLastHistoryPoint.equals(currentState)) {
+            CommitHistoryChange(tab, ChangeSet(), description);
+            return;
+        }
+        // Calculate the change from the *last recorded history state*
+        change = CalculateTextChange(tab.textAtLastHistoryPoint, currentState, tab.hEdit);
+    }
+    CommitHistoryChange(tab, change, description);
+}
 
-    // Update the baseline for the next diff calculation to the *current* state
-    tab.textAtLastHistoryPoint = currentState;
-    tab.changesSinceLastHistoryPoint = false; // Reset flag, changes up to now are recorded
-	tab.totalChangeSize = 0; // Reset total change size
+void RecordHistoryPoint(HWND hWnd, int tabIndex, const std::wstring& description) {
+    TIMELINE_SPAN("RecordHistoryPoint");
+    if (tabIndex < 0 || tabIndex >= openTabs.size() || !openTabs[tabIndex].historyManager
+        || openTabs[tabIndex].processingHistoryAction) {
+        return; // Don't read the text for nothing
+    }
+    auto& tab = openTabs[tabIndex];
+    // Only the length is read back when the pending edits account for the text.
+    ChangeSet change;
+    if (TakePendingEdits(tab, GetRichEditTextLength(tab.hEdit), change)) {
+        CommitHistoryChange(tab, change, description);
+        return;
+    }
+    RecordHistoryPoint(hWnd, tabIndex, description, GetRichEditText(tab.hEdit));
+}
+
+// Loads the history journal stored next to 'filePath' (or starts a new history) and
+// keeps journaling to it, so branching history survives closing the editor.
+std::unique_ptr<VersionHistoryManager> OpenHistoryForFile(const std::wstring& filePath, const std::wstring& content) {
+    std::wstring journalPath = HistoryJournal::journalPathFor(filePath);
+    std::unique_ptr<VersionHistoryManager> manager = VersionHistoryManager::loadFromJournal(journalPath);
+
+    if (manager) {
+        // The file may have been saved at any node of the history, or changed outside
+        // the editor since. Move to the matching node, or record the difference.
+        if (!manager->currentStateEquals(content)) {
+            // A matching node whose text can't be rebuilt (damaged journal) counts as no
+            // match: the file's text is recorded on top of wherever loading ended up.
+            std::shared_ptr<HistoryNode> matchingNode = manager->findNodeMatchingState(content);
+            if (!matchingNode || !manager->setCurrentNode(matchingNode)) {
+                manager->recordChange(ComputeChangeSet(manager->getCurrentState(), content), L"External Changes");
+            }
+        }
+    }
+    else {
+        manager = std::make_unique<VersionHistoryManager>(content);
+    }
 
+    // Journaling is best effort: if the file can't be written, or another tab already
+    // has this document open and journals to it, history stays in memory.
+    manager->attachJournal(journalPath);
+    return manager;
+}
 
-    // TODO: Update status bar or log history event
-    // Optional: Could prune very old history here if needed
+// Saving runs on its own single thread, so saves of a file reach the disk in order.
+HistoryWorkerPool& GetFileWriter() {
+    static HistoryWorkerPool writer(1);
+    return writer;
 }
 
 // Helper function to save editor content to a file
-bool SaveEditorContent(int tabIndex, bool saveAs) {
+// Saves the tab's text to its file (asking for one if needed, or always with 'saveAs').
+// The file is encoded and written on the file writer thread; unless 'waitForWrite',
+// this returns once the write is queued and WM_FILE_SAVED reports how it went.
+bool SaveEditorContent(int tabIndex, bool saveAs, bool waitForWrite) {
     if (tabIndex < 0 || tabIndex >= static_cast<int>(openTabs.size())) return false;
 
     std::wstring currentFilePath = openTabs[tabIndex].filePath;
@@ -770,41 +1073,118 @@ bool SaveEditorContent(int tabIndex, bool saveAs) {
         }
     }
 
-    // Get text from editor
-    std::wstring contentToSave = GetRichEditText(openTabs[tabIndex].hEdit);
+    auto& tab = openTabs[tabIndex];
+    HWND hMainWnd = GetParent(hTabCtrl);
+    // The time the UI waits for a save, from here on (the file dialog isn't counted).
+    // Writing the file is timed separately as file.write, on the writer thread.
+    static LatencyHistogram& latency = LatencyMetric("file.save");
+    ScopedLatency timing(latency);
+    TIMELINE_SPAN("SaveEditorContent");
+
+    // Read the text once. The writer thread encodes the file from this snapshot while
+    // the history point below is recorded from the same text.
+    auto snapshot = std::make_shared<const std::wstring>(GetRichEditText(tab.hEdit));
+
+    HWND hEdit = tab.hEdit;
+    TextEncoding encoding = tab.fileEncoding;
+    bool notify = !waitForWrite;
+    std::future<FileSaveResult> written = GetFileWriter().submit(
+        [snapshot, currentFilePath, encoding, hEdit, hMainWnd, notify](const CancellationToken&) {
+            FileSaveResult result;
+            result.hEdit = hEdit;
+            result.path = currentFilePath;
+            {
+                static LatencyHistogram& writeLatency = LatencyMetric("file.write");
+                ScopedLatency writeTiming(writeLatency);
+                result.succeeded = SaveTextFile(currentFilePath, *snapshot, encoding, &result.encoding);
+            }
+            CounterMetric("file.chars_saved").add(snapshot->length());
+            if (notify) {
+                FileSaveResult* posted = new FileSaveResult(result); // WM_FILE_SAVED takes ownership
+                if (!PostMessage(hMainWnd, WM_FILE_SAVED, 0, (LPARAM)posted)) {
+                    delete posted;
+                }
+            }
+            return result;
+        });
+
+    // --- Update tab info ---
+    // As if saved already; FinishFileSave marks the tab modified again if writing fails.
+    tab.filePath = currentFilePath;
+    // Update file name from path (use PathFindFileName for robustness)
+    tab.fileName = PathFindFileNameW(currentFilePath.c_str());
+    tab.isModified = false;
+    // TODO: Store the current history node as the "saved" state marker
+    UpdateTabTitle(tabIndex);
+    UpdateWindowTitle(hMainWnd); // Update main window title
+    // --- End update tab info ---
+
+    RecordHistoryPoint(hMainWnd, tabIndex, L"File Saved", *snapshot); // Record history point
+    // Mark editor control as unmodified (might be redundant but safe)
+    SendMessage(tab.hEdit, EM_SETMODIFY, FALSE, 0);
+
+    if (!waitForWrite) {
+        // Finished saves are dropped here; the rest are waited for on exit.
+        pendingFileSaves.erase(std::remove_if(pendingFileSaves.begin(), pendingFileSaves.end(),
+            [](const std::future<FileSaveResult>& save) { return save.wait_for(std::chrono::seconds(0)) == std::future_status::ready; }),
+            pendingFileSaves.end());
+        pendingFileSaves.push_back(std::move(written));
+        return true;
+    }
 
-    // Save to file
-    std::wofstream outFile(currentFilePath);
-    if (outFile) {
-        outFile << contentToSave;
-        outFile.close();
+    FileSaveResult result;
+    try {
+        result = written.get();
+    }
+    catch (const std::exception&) {
+        result.hEdit = hEdit;
+        result.path = currentFilePath;
+        result.succeeded = false;
+    }
+    FinishFileSave(result);
+    return result.succeeded;
+}
 
-        // --- Update tab info ---
-        openTabs[tabIndex].filePath = currentFilePath;
-        // Update file name from path (use PathFindFileName for robustness)
-        openTabs[tabIndex].fileName = PathFindFileNameW(currentFilePath.c_str());
-        openTabs[tabIndex].isModified = false; // Mark as unmodified *after* successful save
-        // TODO: Store the current history node as the "saved" state marker
-        UpdateTabTitle(tabIndex);
-        UpdateWindowTitle(GetParent(hTabCtrl)); // Update main window title
-        // --- End update tab info ---
 
-		RecordHistoryPoint(GetParent(hTabCtrl), tabIndex, L"File Saved"); // Record history point
-        // Mark editor control as unmodified (might be redundant but safe)
+// Finishes a save once its file has been written (or not): on success the history
+// journal moves next to the file, on failure the tab is marked modified again.
+void FinishFileSave(const FileSaveResult& result) {
+    TIMELINE_SPAN("FinishFileSave");
+    int tabIndex = -1;
+    for (int i = 0; i < openTabs.size(); ++i) {
+        if (openTabs[i].hEdit == result.hEdit) {
+            tabIndex = i;
+            break;
+        }
+    }
 
-        SendMessage(openTabs[tabIndex].hEdit, EM_SETMODIFY, FALSE, 0);
-        return true;
+    if (!result.succeeded) {
+        std::wstring message = L"Failed to save the file " + result.path + L".";
+        MessageBox(GetParent(hTabCtrl), message.c_str(), L"Save Error", MB_OK | MB_ICONERROR);
+        if (tabIndex != -1) {
+            openTabs[tabIndex].isModified = true;
+            UpdateTabTitle(tabIndex);
+            UpdateWindowTitle(GetParent(hTabCtrl));
+        }
+        return;
     }
-    else {
-        MessageBox(GetParent(hTabCtrl), L"Failed to save the file.", L"Save Error", MB_OK | MB_ICONERROR);
-        return false;
+    if (tabIndex == -1) {
+        return; // Tab closed while its file was being written
     }
-}
 
+    auto& tab = openTabs[tabIndex];
+    tab.fileEncoding = result.encoding; // Latin-1 text that no longer fits is now UTF-8
+    // Start (or move) the history journal next to the file. A new location gets the
+    // whole tree written out; the current location is already up to date.
+    if (tab.historyManager && tab.filePath == result.path) {
+        tab.historyManager->attachJournal(HistoryJournal::journalPathFor(result.path));
+    }
+}
 
 // Finds the node in history matching the current editor text and updates
 // the history manager's internal pointer. Essential before showing History UI.
 void SyncHistoryManagerToEditor(HWND hWnd, int tabIndex) {
+    TIMELINE_SPAN("SyncHistoryManagerToEditor");
     if (tabIndex < 0 || tabIndex >= openTabs.size() || !openTabs[tabIndex].historyManager) {
         return;
     }
@@ -814,10 +1194,7 @@ void SyncHistoryManagerToEditor(HWND hWnd, int tabIndex) {
     std::wstring currentState = GetRichEditText(tab.hEdit);
 
     // Check if current node *already* matches (optimization)
-    std::shared_ptr<const HistoryNode> internalCurrentNode = historyManager->getCurrentNode();
-    std::wstring stateAtInternalCurrent = historyManager->reconstructStateToNode(internalCurrentNode);
-
-    if (stateAtInternalCurrent == currentState) {
+    if (historyManager->currentStateEquals(currentState)) {
         // Already in sync, nothing to do.
         // Update baseline text just in case it drifted? Usually not needed here.
          // tab.textAtLastHistoryPoint = currentState;
@@ -827,12 +1204,14 @@ void SyncHistoryManagerToEditor(HWND hWnd, int tabIndex) {
     // If not in sync, perform the search
     std::shared_ptr<HistoryNode> foundNode = historyManager->findNodeMatchingState(currentState);
 
-    if (foundNode) {
+    if (foundNode && historyManager->setCurrentNode(foundNode)) {
         // Found the node matching the editor's current state.
         // Update the internal pointer *without* changing editor text.
-        historyManager->setCurrentNode(foundNode); // Use the new method (see Step III)
+        // (A node whose text can't be rebuilt is treated as not found.)
         // Update the baseline text to match the newly synced state
-        tab.textAtLastHistoryPoint = currentState;
+        tab.textAtLastHistoryPoint = PieceTable(std::move(currentState));
+        tab.textBeforeChange = tab.textAtLastHistoryPoint;
+        tab.pendingEdits.clear();
     }
     else {
         // Editor state does not match ANY known state in the history tree!
@@ -844,113 +1223,134 @@ void SyncHistoryManagerToEditor(HWND hWnd, int tabIndex) {
         //    - Record this as a new node off internalCurrentNode.
         //    - Then set internalCurrentNode to this new node.
         // 3. For simplicity now: Just log and potentially reset baseline.
-        tab.textAtLastHistoryPoint = currentState; // Reset baseline to current unknown state
+        tab.textAtLastHistoryPoint = PieceTable(std::move(currentState)); // Reset baseline to current unknown state
+        tab.textBeforeChange = tab.textAtLastHistoryPoint;
+        tab.pendingEdits.clear();
         // The history tree UI might show the old internalCurrentNode highlighted, which is technically correct
         // but doesn't reflect the editor. The user switching would fix it.
     }
 }
 
+// Worker threads for history operations that would stall the UI on big documents.
+// Created on first use; jobs only ever see HistorySnapshots, never a live manager.
+HistoryWorkerPool& GetHistoryWorkers() {
+    static HistoryWorkerPool workers;
+    return workers;
+}
 
-// Recursive helper to populate the history TreeView
-void PopulateHistoryTreeRecursive(HWND hTree, HistoryDialogParams* params, std::shared_ptr<HistoryNode> node, HTREEITEM hParentItem,HTREEITEM& hCurrentItemTree) // Pass by ref to store the HTREEITEM for the current node
-{
-    if (!node || !params) return;
-
-    // 1. Create description string
-    std::wstring description;
-    std::wstring commitMsg = node->commitMessage;
-    time_t tt = std::chrono::system_clock::to_time_t(node->timestamp);
-    tm local_tm;
-    localtime_s(&local_tm, &tt);
-    char timeBuffer[80];
-    strftime(timeBuffer, sizeof(timeBuffer), "%H:%M:%S", &local_tm);
-    std::string timestampStr(timeBuffer);
-    std::wstring wTimestampStr(timestampStr.begin(), timestampStr.end());
-
-    if (node->isRoot()) {
-        description = L"[" + wTimestampStr + L"] " + commitMsg + L" (Root)"; // Indicate Root
-    }
-    else {
-        description = L"[" + wTimestampStr + L"]";
-        if (!commitMsg.empty()) {
-            description += L" " + commitMsg;
-        }
-        else {
-            description += L" (Auto)";
-        }
-        description += L" (+" + std::to_wstring(node->changeFromParent.insertedText.length())
-            + L" / -" + std::to_wstring(node->changeFromParent.deletedText.length())
-            + L")";
-    }
-    // Add indicator if it's the currently active node
-    if (node == params->nodeAtEditorState) {
-        description += L" (Current)";
-    }
-
+// True for the node shown in the editor and every version it derives from; deleting
+// any of them would cut the editor's version off the history tree.
+bool IsOnPathToEditorState(const HistoryDialogParams* params, const std::shared_ptr<HistoryNode>& node) {
+    return params->historyManager->findCommonAncestor(node, params->nodeAtEditorState) == node;
+}
 
-    // 2. Prepare TreeView item struct
-    TVINSERTSTRUCT tvis = { 0 };
-    tvis.hParent = hParentItem;
-    tvis.hInsertAfter = TVI_LAST;
-    tvis.item.mask = TVIF_TEXT | TVIF_PARAM | TVIF_STATE;
-    std::vector<wchar_t> textBuffer(description.begin(), description.end());
-    textBuffer.push_back(L'\0');
-    tvis.item.pszText = textBuffer.data();
-    tvis.item.lParam = (LPARAM)node.get(); // use raw pointer for lParam if needed, but map uses shared_ptr
-    tvis.item.state = 0;
-    tvis.item.stateMask = TVIS_SELECTED | TVIS_EXPANDED | TVIS_BOLD; 
 
-    // Highlight the node corresponding to the editor's state
-    if (node == params->nodeAtEditorState) {
-        tvis.item.state |= TVIS_SELECTED | TVIS_EXPANDED | TVIS_BOLD; // Make current bold
-        hCurrentItemTree = NULL; // Will be set below after insertion
-    }
-    else if (hParentItem == TVI_ROOT) {
-        tvis.item.state |= TVIS_EXPANDED; // Always expand root's children maybe?
+// Inserts items for the given model rows under 'hParentItem', in order. Text and the
+// expand button are supplied on demand (TVN_GETDISPINFO), so only items the tree
+// actually paints get a label formatted.
+void InsertHistoryRows(HWND hTree, HistoryDialogParams* params, HTREEITEM hParentItem, const std::vector<HistoryTreeModel::RowId>& rows) {
+    TIMELINE_SPAN("InsertHistoryRows");
+    for (HistoryTreeModel::RowId row : rows) {
+        TVINSERTSTRUCT tvis = { 0 };
+        tvis.hParent = hParentItem;
+        tvis.hInsertAfter = TVI_LAST;
+        tvis.item.mask = TVIF_TEXT | TVIF_PARAM | TVIF_CHILDREN | TVIF_STATE;
+        tvis.item.pszText = LPSTR_TEXTCALLBACK;
+        tvis.item.cChildren = I_CHILDRENCALLBACK;
+        tvis.item.lParam = (LPARAM)row; // Row of the dialog's HistoryTreeModel
+        tvis.item.stateMask = TVIS_BOLD;
+        tvis.item.state = params->treeModel->isCurrentRow(row) ? TVIS_BOLD : 0; // Make current bold
+
+        HTREEITEM hNewItem = TreeView_InsertItem(hTree, &tvis);
+        params->treeModel->setViewItem(row, hNewItem);
     }
+}
 
-    // 3. Insert item into TreeView
-    HTREEITEM hNewItem = TreeView_InsertItem(hTree, &tvis);
+HistoryTreeModel::RowId GetHistoryItemRow(HWND hTree, HTREEITEM hItem) {
+    if (!hItem) return HistoryTreeModel::NO_ROW;
+    TVITEM item = { 0 };
+    item.mask = TVIF_PARAM | TVIF_HANDLE;
+    item.hItem = hItem;
+    if (!TreeView_GetItem(hTree, &item)) return HistoryTreeModel::NO_ROW;
+    return (HistoryTreeModel::RowId)item.lParam;
+}
 
-    // 4. Store mapping from HTREEITEM to shared_ptr
-    if (hNewItem) {
-        params->treeItemNodeMap[hNewItem] = node; // Store the NON-CONST shared_ptr
-        if (node == params->nodeAtEditorState) {
-            hCurrentItemTree = hNewItem; // Store the HTREEITEM for the current node
-        }
-    }
+// The history node shown by 'hItem', or null for a "more" item.
+std::shared_ptr<HistoryNode> GetHistoryItemNode(HWND hTree, HistoryDialogParams* params, HTREEITEM hItem) {
+    return params->treeModel->getNode(GetHistoryItemRow(hTree, hItem));
+}
 
-    // 5. Recursively add children
-    // Important: Iterate over a *copy* if the children vector might be modified
-    // during recursion (not the case here), or use indices carefully.
-    // Creating a temporary copy of children shared_ptrs before iterating is safest
-    // if recursive calls could potentially modify the parent's children list.
-    // However, PopulateHistoryTreeRecursive doesn't modify, so direct iteration is fine.
-    for (const auto& child : node->children) {
-        PopulateHistoryTreeRecursive(hTree, params, child, hNewItem, hCurrentItemTree);
-    }
+// Replaces a "more versions" item with the next page of its parent's children.
+// Returns the item of the first new child.
+HTREEITEM ExpandMoreHistoryItem(HWND hTree, HistoryDialogParams* params, HistoryTreeModel::RowId moreRow) {
+    HistoryTreeModel& model = *params->treeModel;
+    HTREEITEM hMoreItem = (HTREEITEM)model.getViewItem(moreRow);
+    HTREEITEM hParentItem = (HTREEITEM)model.getViewItem(model.getParentRow(moreRow));
+    std::vector<HistoryTreeModel::RowId> rows = model.expandMore(moreRow);
+    TreeView_DeleteItem(hTree, hMoreItem);
+    InsertHistoryRows(hTree, params, hParentItem, rows);
+    return rows.empty() ? NULL : (HTREEITEM)model.getViewItem(rows.front());
+}
 
-    // Ensure the current node is visible AFTER all items are inserted (only at top level call)
-    if (hParentItem == TVI_ROOT && hCurrentItemTree) {
-        TreeView_SelectItem(hTree, hCurrentItemTree); // Select it first
-        TreeView_EnsureVisible(hTree, hCurrentItemTree); // Then ensure visible
+// Expands the items down to 'node' (loading further pages where needed), then selects
+// it. Iterative, so any depth of history is fine.
+void RevealHistoryNode(HWND hTree, HistoryDialogParams* params, const HistoryNode* node) {
+    TIMELINE_SPAN("RevealHistoryNode");
+    HistoryTreeModel& model = *params->treeModel;
+    std::vector<const HistoryNode*> path = HistoryTreeModel::pathFromRoot(node);
+    HistoryTreeModel::RowId row = model.getRootRow();
+
+    for (size_t i = 1; i < path.size(); ++i) {
+        // Expanding sends TVN_ITEMEXPANDING, which inserts the first page of children.
+        TreeView_Expand(hTree, (HTREEITEM)model.getViewItem(row), TVE_EXPAND);
+        HistoryTreeModel::RowId child = model.findChildRow(row, path[i]);
+        while (child == HistoryTreeModel::NO_ROW && model.getMoreRow(row) != HistoryTreeModel::NO_ROW) {
+            ExpandMoreHistoryItem(hTree, params, model.getMoreRow(row));
+            child = model.findChildRow(row, path[i]);
+        }
+        if (child == HistoryTreeModel::NO_ROW) {
+            break; // Not in the tree any more; show as far as we got
+        }
+        row = child;
     }
+
+    HTREEITEM hItem = (HTREEITEM)model.getViewItem(row);
+    TreeView_SelectItem(hTree, hItem); // Select it first
+    TreeView_EnsureVisible(hTree, hItem); // Then ensure visible
 }
 
 
-// Function to recursively remove item and its children from the map
-void RemoveItemAndChildrenFromMap(HWND hTree, HTREEITEM hItem, HistoryDialogParams* params) {
-    if (!hItem || !params) return;
+// Drops the checkout being rebuilt in the background, if any. The worker stops at its
+// next step; the message it still posts finds nothing pending and is ignored.
+void CancelHistoryCheckout(HistoryDialogParams* params) {
+    params->pendingCheckoutToken.cancel();
+    params->pendingCheckoutToken = CancellationToken();
+    params->pendingCheckout = std::future<PieceTable>();
+    params->pendingCheckoutNode.reset();
+}
 
-    // Remove the item itself from the map
-    params->treeItemNodeMap.erase(hItem);
+// Rebuilds the text of a distant version on a worker, from a snapshot of the tree, so
+// the dialog stays responsive. WM_HISTORY_CHECKOUT_READY finishes the switch.
+void StartHistoryCheckout(HWND hDlg, HistoryDialogParams* params, std::shared_ptr<HistoryNode> targetNode) {
+    TIMELINE_SPAN("StartHistoryCheckout");
+    CancelHistoryCheckout(params);
 
-    // Recursively remove children
-    HTREEITEM hChild = TreeView_GetChild(hTree, hItem);
-    while (hChild) {
-        RemoveItemAndChildrenFromMap(hTree, hChild, params);
-        hChild = TreeView_GetNextSibling(hTree, hChild);
+    std::shared_ptr<const HistorySnapshot> snapshot = params->historyManager->getSnapshot();
+    HistorySnapshot::Index target = snapshot->findEntry(targetNode->id);
+    if (target == HistorySnapshot::NO_ENTRY) {
+        return;
     }
+
+    params->pendingCheckoutNode = targetNode;
+    params->pendingCheckout = GetHistoryWorkers().submit(
+        [snapshot, target](const CancellationToken& token) {
+            return snapshot->reconstructDocument(target, token);
+        },
+        params->pendingCheckoutToken,
+        [hDlg] { PostMessage(hDlg, WM_HISTORY_CHECKOUT_READY, 0, 0); });
+
+    EnableWindow(GetDlgItem(hDlg, ID_SWITCH_VERSION), FALSE); // Until done or another pick
+    SetCursor(LoadCursor(nullptr, IDC_APPSTARTING));
 }
 
 //---------------------------------------------------------------------------
@@ -984,14 +1384,14 @@ INT_PTR CALLBACK HistoryDlgProc(HWND hDlg, UINT message, WPARAM wParam, LPARAM l
         }
 
         // --- Populate the TreeView ---
-        // Need the non-const root to start population if map stores non-const
+        // Only the root and the path down to the current version get items now; other
+        // children are inserted when their parent is expanded (TVN_ITEMEXPANDING).
         std::shared_ptr<HistoryNode> root = std::const_pointer_cast<HistoryNode>(params->historyManager->getHistoryTreeRoot());
         params->nodeAtEditorState = params->historyManager->getCurrentNode(); // Still use const for the 'current state' marker
-        params->treeItemNodeMap.clear();
+        params->treeModel = std::make_unique<HistoryTreeModel>(root, params->nodeAtEditorState);
 
-        HTREEITEM hCurrentItemTree = NULL;
-        // Pass the mutable root to the recursive function
-        PopulateHistoryTreeRecursive(hTree, params, root, TVI_ROOT, hCurrentItemTree);
+        InsertHistoryRows(hTree, params, TVI_ROOT, { params->treeModel->getRootRow() });
+        RevealHistoryNode(hTree, params, params->nodeAtEditorState.get());
 
         // Initial button state: Disable both buttons initially
         EnableWindow(hSwitchButton, FALSE);
@@ -1002,11 +1402,10 @@ INT_PTR CALLBACK HistoryDlgProc(HWND hDlg, UINT message, WPARAM wParam, LPARAM l
         // However, it's simpler to just call the enabling logic directly here.
         HTREEITEM hSelectedItem = TreeView_GetSelection(hTree);
         if (hSelectedItem) {
-            auto it = params->treeItemNodeMap.find(hSelectedItem);
-            if (it != params->treeItemNodeMap.end()) {
-                std::shared_ptr<HistoryNode> selectedNode = it->second; // Now non-const
+            std::shared_ptr<HistoryNode> selectedNode = GetHistoryItemNode(hTree, params, hSelectedItem);
+            if (selectedNode) {
                 bool canSwitch = (selectedNode != params->nodeAtEditorState);
-                bool canDelete = !selectedNode->isRoot() && (selectedNode != params->nodeAtEditorState);
+                bool canDelete = !selectedNode->isRoot() && !IsOnPathToEditorState(params, selectedNode);
                 EnableWindow(hSwitchButton, canSwitch);
                 EnableWindow(hDeleteButton, canDelete);
             }
@@ -1021,7 +1420,32 @@ INT_PTR CALLBACK HistoryDlgProc(HWND hDlg, UINT message, WPARAM wParam, LPARAM l
         if (!params) break;
 
         LPNMHDR pnmh = (LPNMHDR)lParam;
-        if (pnmh->idFrom == IDC_HISTORY_TREEVIEW && pnmh->code == TVN_SELCHANGED)
+        if (pnmh->idFrom == IDC_HISTORY_TREEVIEW && pnmh->code == TVN_GETDISPINFO)
+        {
+            // Labels are formatted (once) only for items the tree is about to paint.
+            LPNMTVDISPINFO pDispInfo = (LPNMTVDISPINFO)lParam;
+            HistoryTreeModel::RowId row = (HistoryTreeModel::RowId)pDispInfo->item.lParam;
+            if (pDispInfo->item.mask & TVIF_TEXT) {
+                // The model owns the string and keeps it until the row goes away.
+                pDispInfo->item.pszText = const_cast<LPWSTR>(params->treeModel->getLabel(row).c_str());
+            }
+            if (pDispInfo->item.mask & TVIF_CHILDREN) {
+                pDispInfo->item.cChildren = params->treeModel->hasChildren(row) ? 1 : 0;
+            }
+            return (INT_PTR)TRUE;
+        }
+        else if (pnmh->idFrom == IDC_HISTORY_TREEVIEW && pnmh->code == TVN_ITEMEXPANDING)
+        {
+            // First expansion of an item: insert the first page of its children.
+            LPNMTREEVIEW pnmtv = (LPNMTREEVIEW)lParam;
+            if (pnmtv->action & TVE_EXPAND) {
+                HistoryTreeModel::RowId row = (HistoryTreeModel::RowId)pnmtv->itemNew.lParam;
+                InsertHistoryRows(pnmh->hwndFrom, params, pnmtv->itemNew.hItem, params->treeModel->expand(row));
+            }
+            SetWindowLongPtr(hDlg, DWLP_MSGRESULT, FALSE); // Allow the expansion
+            return (INT_PTR)TRUE;
+        }
+        else if (pnmh->idFrom == IDC_HISTORY_TREEVIEW && pnmh->code == TVN_SELCHANGED)
         {
             HWND hTree = pnmh->hwndFrom;
             HWND hSwitchButton = GetDlgItem(hDlg, ID_SWITCH_VERSION);
@@ -1031,18 +1455,30 @@ INT_PTR CALLBACK HistoryDlgProc(HWND hDlg, UINT message, WPARAM wParam, LPARAM l
             bool enableSwitch = false;
             bool enableDelete = false; // Flag for delete button
 
+            // Picking another version abandons a switch still being prepared.
+            CancelHistoryCheckout(params);
+
+            // Selecting a "more versions" item loads the next page in its place.
+            HistoryTreeModel::RowId selectedRow = GetHistoryItemRow(hTree, hSelectedItem);
+            if (params->treeModel->isMoreRow(selectedRow)) {
+                HTREEITEM hFirstNew = ExpandMoreHistoryItem(hTree, params, selectedRow);
+                if (hFirstNew) {
+                    TreeView_SelectItem(hTree, hFirstNew); // Sends its own TVN_SELCHANGED
+                }
+                return (INT_PTR)TRUE;
+            }
+
             if (hSelectedItem != NULL) {
-                auto it = params->treeItemNodeMap.find(hSelectedItem);
-                if (it != params->treeItemNodeMap.end()) {
-                    std::shared_ptr<HistoryNode> selectedNode = it->second; // Non-const shared_ptr
+                std::shared_ptr<HistoryNode> selectedNode = params->treeModel->getNode(selectedRow);
+                if (selectedNode) {
 
                     // Enable switch if selected node is not the current editor state node
                     if (selectedNode != params->nodeAtEditorState) {
                         enableSwitch = true;
                     }
 
-                    // Enable delete if selected node is NOT root AND NOT current editor state node
-                    if (!selectedNode->isRoot() && selectedNode != params->nodeAtEditorState) {
+                    // Enable delete if selected node is NOT root AND NOT the current editor state node or one of its ancestors
+                    if (!selectedNode->isRoot() && !IsOnPathToEditorState(params, selectedNode)) {
                         enableDelete = true;
                     }
                 }
@@ -1083,22 +1519,35 @@ INT_PTR CALLBACK HistoryDlgProc(HWND hDlg, UINT message, WPARAM wParam, LPARAM l
             HTREEITEM hSelectedItem = TreeView_GetSelection(hTree);
 
             if (hSelectedItem != NULL) {
-                auto it = params->treeItemNodeMap.find(hSelectedItem);
-                if (it != params->treeItemNodeMap.end()) {
-                    // Note: switchToNode needs non-const if it modifies internal state,
-                    // but it likely only reads and reconstructs. Let's assume it takes non-const
-                    // for consistency or if it updates 'currentNode'.
-                    std::shared_ptr<HistoryNode> targetNodeSharedPtr = it->second; // Use non-const
+                std::shared_ptr<HistoryNode> targetNodeSharedPtr = GetHistoryItemNode(hTree, params, hSelectedItem);
+                if (targetNodeSharedPtr) {
 
                     VersionHistoryManager* historyManager = params->historyManager;
                     int tabIndex = params->tabIndex;
 
                     if (historyManager && tabIndex >= 0 && tabIndex < openTabs.size()) {
-                        // Perform the switch (assuming switchToNode handles state reconstruction)
-                        std::wstring newState = historyManager->switchToNode(targetNodeSharedPtr); // Pass non-const
+                        if (!historyManager->isNearbyCheckout(targetNodeSharedPtr)) {
+                            // Far away: rebuilding its text could take a while, so it runs on
+                            // a worker and WM_HISTORY_CHECKOUT_READY completes the switch.
+                            StartHistoryCheckout(hDlg, params, targetNodeSharedPtr);
+                            return (INT_PTR)TRUE;
+                        }
 
-                        // Update the main Rich Edit control
-                        SetRichEditText(openTabs[tabIndex].hEdit, newState, targetNodeSharedPtr);
+                        // Perform the switch along the shortest path through the common ancestor,
+                        // and patch the main Rich Edit control with the net change between the two versions
+                        ChangeSet delta;
+                        try {
+                            delta = historyManager->getNetChange(historyManager->getCurrentNode(), targetNodeSharedPtr);
+                        }
+                        catch (const DamagedHistoryError&) {
+                            MessageBoxW(hDlg, L"The selected version can't be reached: part of its history is damaged.", L"Error", MB_OK | MB_ICONERROR);
+                            return (INT_PTR)TRUE;
+                        }
+                        if (!historyManager->checkoutNode(targetNodeSharedPtr)) {
+                            MessageBoxW(hDlg, L"The selected version can't be reached: part of its history is damaged.", L"Error", MB_OK | MB_ICONERROR);
+                            return (INT_PTR)TRUE;
+                        }
+                        ShowHistoryStep(openTabs[tabIndex], delta);
 
                         // Close the dialog indicating success
                         EndDialog(hDlg, IDOK); // Indicate success (switch happened)
@@ -1120,17 +1569,16 @@ INT_PTR CALLBACK HistoryDlgProc(HWND hDlg, UINT message, WPARAM wParam, LPARAM l
             HTREEITEM hSelectedItem = TreeView_GetSelection(hTree);
 
             if (hSelectedItem != NULL) {
-                auto it = params->treeItemNodeMap.find(hSelectedItem);
-                if (it != params->treeItemNodeMap.end()) {
-                    std::shared_ptr<HistoryNode> nodeToDelete = it->second; // Get the non-const shared_ptr
+                std::shared_ptr<HistoryNode> nodeToDelete = GetHistoryItemNode(hTree, params, hSelectedItem);
+                if (nodeToDelete) {
 
                     // Double-check conditions (redundant with button enabling, but safer)
                     if (nodeToDelete->isRoot()) {
                         MessageBoxW(hDlg, L"Cannot delete the initial root version.", L"Delete Prevented", MB_OK | MB_ICONWARNING);
                         return (INT_PTR)TRUE;
                     }
-                    if (nodeToDelete == params->nodeAtEditorState) {
-                        MessageBoxW(hDlg, L"Cannot delete the version currently active in the editor.", L"Delete Prevented", MB_OK | MB_ICONWARNING);
+                    if (IsOnPathToEditorState(params, nodeToDelete)) {
+                        MessageBoxW(hDlg, L"Cannot delete the version currently active in the editor, or a version it was derived from.", L"Delete Prevented", MB_OK | MB_ICONWARNING);
                         return (INT_PTR)TRUE;
                     }
 
@@ -1150,6 +1598,7 @@ INT_PTR CALLBACK HistoryDlgProc(HWND hDlg, UINT message, WPARAM wParam, LPARAM l
 
                     if (result == IDYES) {
                         // --- Proceed with Deletion ---
+                        CancelHistoryCheckout(params); // Its target may be among the deleted
                         VersionHistoryManager* historyManager = params->historyManager;
                         if (historyManager) {
                             // Get parent item *before* deleting the node, to select it later
@@ -1159,8 +1608,8 @@ INT_PTR CALLBACK HistoryDlgProc(HWND hDlg, UINT message, WPARAM wParam, LPARAM l
 
                             if (deleted) {
                                 // --- Update UI ---
-                                // 1. Remove item and children from the internal map first
-                                RemoveItemAndChildrenFromMap(hTree, hSelectedItem, params);
+                                // 1. Forget the rows of the item and everything loaded under it
+                                params->treeModel->removeRow(GetHistoryItemRow(hTree, hSelectedItem));
 
                                 // 2. Remove the item from the TreeView control
                                 TreeView_DeleteItem(hTree, hSelectedItem);
@@ -1177,7 +1626,7 @@ INT_PTR CALLBACK HistoryDlgProc(HWND hDlg, UINT message, WPARAM wParam, LPARAM l
                             }
                             else {
                                 // Deletion failed (likely prevented by manager's checks again)
-                                MessageBoxW(hDlg, L"Failed to delete the selected version. It might be the root or the active version.", L"Deletion Failed", MB_OK | MB_ICONERROR);
+                                MessageBoxW(hDlg, L"Failed to delete the selected version. It might be the root, the active version or one of its ancestors.", L"Deletion Failed", MB_OK | MB_ICONERROR);
                             }
                         }
                     }
@@ -1194,9 +1643,54 @@ INT_PTR CALLBACK HistoryDlgProc(HWND hDlg, UINT message, WPARAM wParam, LPARAM l
     }
     break; // End WM_COMMAND
 
+    case WM_HISTORY_CHECKOUT_READY:
+    {
+        // Also posted by cancelled jobs; only a finished pending checkout is taken.
+        if (!params || !params->pendingCheckout.valid()
+            || params->pendingCheckout.wait_for(std::chrono::seconds(0)) != std::future_status::ready) {
+            return (INT_PTR)TRUE;
+        }
+        TIMELINE_SPAN("WM_HISTORY_CHECKOUT_READY");
+        std::shared_ptr<HistoryNode> targetNode = params->pendingCheckoutNode;
+        std::future<PieceTable> rebuilt = std::move(params->pendingCheckout);
+        CancelHistoryCheckout(params);
+        SetCursor(LoadCursor(nullptr, IDC_ARROW));
+
+        PieceTable document;
+        try {
+            document = rebuilt.get();
+        }
+        catch (const OperationCancelled&) {
+            return (INT_PTR)TRUE;
+        }
+        catch (const DamagedHistoryError&) {
+            MessageBoxW(hDlg, L"The selected version can't be rebuilt: part of its history is damaged.", L"Error", MB_OK | MB_ICONERROR);
+            return (INT_PTR)TRUE;
+        }
+        catch (const std::exception&) {
+            MessageBoxW(hDlg, L"Failed to rebuild the selected version.", L"Error", MB_OK | MB_ICONERROR);
+            return (INT_PTR)TRUE;
+        }
+
+        VersionHistoryManager* historyManager = params->historyManager;
+        int tabIndex = params->tabIndex;
+        if (tabIndex < 0 || tabIndex >= openTabs.size() || !historyManager->adoptCheckout(targetNode, std::move(document))) {
+            MessageBoxW(hDlg, L"The selected version changed while it was being loaded.", L"Error", MB_OK | MB_ICONERROR);
+            return (INT_PTR)TRUE;
+        }
+        // A distant version shares little with the editor's text: replace it whole.
+        SetRichEditText(openTabs[tabIndex].hEdit, historyManager->getCurrentState(), targetNode);
+        EndDialog(hDlg, IDOK);
+        return (INT_PTR)TRUE;
+    }
+
     case WM_DESTROY:
     {
-        // Clean up map if necessary (shared_ptrs handle memory)
+        // Release the rows (and the nodes they hold) before the tree items go away
+        if (params) {
+            CancelHistoryCheckout(params);
+            params->treeModel.reset();
+        }
         SetWindowLongPtr(hDlg, DWLP_USER, (LONG_PTR)nullptr);
     }
     break;
@@ -1209,6 +1703,7 @@ INT_PTR CALLBACK HistoryDlgProc(HWND hDlg, UINT message, WPARAM wParam, LPARAM l
 // Displays the version history dialog for the current tab.
 //---------------------------------------------------------------------------
 void ShowHistoryTree(HWND hWnd) {
+    TIMELINE_SPAN("ShowHistoryTree");
     if (currentTab < 0 || currentTab >= openTabs.size() || !openTabs[currentTab].historyManager) {
         MessageBoxW(hWnd, L"No active tab or history available.", L"History", MB_OK | MB_ICONWARNING);
         return;
@@ -1218,12 +1713,7 @@ void ShowHistoryTree(HWND hWnd) {
     // are committed *before* showing the history or syncing.
     auto& tab = openTabs[currentTab];
     if (tab.changesSinceLastHistoryPoint) {
-        // Kill any pending idle timer as we are committing now.
-        if (tab.idleTimerId != 0) {
-            KillTimer(hWnd, reinterpret_cast<UINT_PTR>(tab.hEdit));
-            tab.idleTimerId = 0;
-        }
-        // Record the pending change. Use a generic "Auto" message or be more specific if possible.
+        // Record the pending change (which also cancels its idle commit). Use a generic "Auto" message or be more specific if possible.
         // L"Auto (Pending Change)" or L"Auto (Before History View)" might be good descriptions.
         RecordHistoryPoint(hWnd, currentTab, L"Auto (Pending)");
         // Note: RecordHistoryPoint already updates textAtLastHistoryPoint etc.
@@ -1240,7 +1730,7 @@ void ShowHistoryTree(HWND hWnd) {
     params.historyManager = openTabs[currentTab].historyManager.get(); // Pass raw pointer
     params.tabIndex = currentTab;
     params.hParent = hWnd;
-    // params.treeItemNodeMap is initialized empty and populated in WM_INITDIALOG
+    // params.treeModel is created in WM_INITDIALOG
     // params.nodeAtEditorState is set in WM_INITDIALOG
 
     // Create the modal dialog box
@@ -1379,66 +1869,37 @@ LRESULT CALLBACK WndProc(HWND hWnd, UINT message, WPARAM wParam, LPARAM lParam)
         }
         break;
 
+    case WM_FILE_SAVED:
+    {
+        std::unique_ptr<FileSaveResult> result(reinterpret_cast<FileSaveResult*>(lParam));
+        FinishFileSave(*result);
+    }
+    break;
+
     case WM_SIZE:
         ResizeControls(hWnd);
         break;
 
-    //case WM_TIMER:
-    //{
-    //    UINT_PTR timerId = (UINT_PTR)wParam;
-    //    // Find the tab associated with this timer ID  //Maybe TODO:
-    //    int tabIndex = -1;
-    //    for (int i = 0; i < openTabs.size(); ++i) {
-    //        // Compare against the stored ID OR the HWND used as ID
-    //        if (openTabs[i].idleTimerId != 0 && reinterpret_cast<UINT_PTR>(openTabs[i].hEdit) == timerId) {
-    //            // Check if the timer *actually* belongs to this tab,
-    //            // SetTimer might reuse IDs if we don't manage them carefully.
-    //            // Using the HWND as ID is generally safer if HWNDs are unique.
-    //            if (openTabs[i].idleTimerId == GetWindowLongPtr(openTabs[i].hEdit, GWLP_USERDATA)) { /* Example check if storing ID on HWND */ }
-    //            // Simpler: Assume the HWND cast is the ID if that's what SetTimer used.
-    //            tabIndex = i;
-    //            break;
-    //        }
-    //        // Fallback if using sequential IDs stored in idleTimerId directly
-    //        else if (openTabs[i].idleTimerId == timerId) {
-    //            tabIndex = i;
-    //            break;
-    //        }
-    //    }
-
-    //    // Process only if the timer belongs to the *currently active* tab
-    //    // (We generally only want idle commits for the tab being actively edited)
-    //    // We *could* allow idle commits for background tabs, but it might be less expected.
-    //    if (tabIndex != -1 && currentTab == tabIndex) {
-    //        auto& tab = openTabs[tabIndex];
-
-    //        // Kill this specific timer instance *first* regardless of action
-    //        KillTimer(hWnd, timerId);
-    //        tab.idleTimerId = 0; // Mark timer as inactive
-
-    //        // Check if changes actually occurred since the last recorded point
-    //        if (tab.changesSinceLastHistoryPoint) {
-    //            // Now record the history point because idle time elapsed *after* changes
-    //            RecordHistoryPoint(hWnd, tabIndex, L"Auto (Idle)");
-    //            // RecordHistoryPoint resets cumulativeChangeSize and changesSinceLastHistoryPoint
-    //        }
-    //        else {
-    //            // Timer fired, but changes were already committed (e.g., by threshold)
-    //            // or the state reverted. Do nothing.
-    //        }
-    //    }
-    //    else if (tabIndex != -1) {
-    //        // Timer fired for an *inactive* tab, or timer ID mismatch somehow.
-    //        // Kill the timer just to be safe.
-    //        KillTimer(hWnd, timerId);
-    //        // Ensure the corresponding tab's ID is cleared if it matches the timerId
-    //        if (reinterpret_cast<UINT_PTR>(openTabs[tabIndex].hEdit) == timerId) {
-    //            openTabs[tabIndex].idleTimerId = 0;
-    //        }
-    //    }
-    //    return 0; // Indicate message processed
-    //}
-    //break; // End WM_TIMER
+    case WM_TIMER:
+        if (wParam == AUTO_COMMIT_TIMER_ID) {
+            TIMELINE_SPAN("WM_TIMER idle commits");
+            KillTimer(hWnd, AUTO_COMMIT_TIMER_ID);
+            autoCommitTimerArmed = false;
+            // Idle commits for every tab whose deadline passed, active or not. The timer
+            // may also fire early, for a deadline typing has since pushed out.
+            for (AutoCommitScheduler::DocumentId document : autoCommits.takeDue(AutoCommitScheduler::Clock::now())) {
+                for (int i = 0; i < openTabs.size(); ++i) {
+                    if (AutoCommitKey(openTabs[i]) == document && openTabs[i].changesSinceLastHistoryPoint) {
+                        CounterMetric("history.idle_commits").add();
+                        RecordHistoryPoint(hWnd, i, L"Auto (Idle)");
+                        // RecordHistoryPoint clears pendingEdits and changesSinceLastHistoryPoint
+                    }
+                }
+            }
+            ArmAutoCommitTimer(hWnd);
+            return 0;
+        }
+        return DefWindowProc(hWnd, message, wParam, lParam);
     
     case WM_NOTIFY:
         {
@@ -1480,6 +1941,7 @@ LRESULT CALLBACK WndProc(HWND hWnd, UINT message, WPARAM wParam, LPARAM lParam)
                 if (pnmh->code == EN_CHANGE) {
                     // Check processing flag to prevent recursion from history actions
                     if (!tab.processingHistoryAction) {
+                        TIMELINE_SPAN("EN_CHANGE");
                         // --- Actions on ANY change (even if not recorded yet) ---
                         tab.isModified = true; // A change occurred
                         UpdateTabTitle(currentTab);
@@ -1487,58 +1949,61 @@ LRESULT CALLBACK WndProc(HWND hWnd, UINT message, WPARAM wParam, LPARAM lParam)
 
                         // *** START: Significant Change & Timer Logic ***
 
-                        // 1. Get the current state of the editor
-                        std::wstring currentState = GetRichEditText(tab.hEdit);
-
-                        // 2. Calculate the change delta compared to the state *before* this EN_CHANGE
+                        // 1. Capture the change delta compared to the state *before* this EN_CHANGE.
                         //    Note: tab.textBeforeChange holds the state *before* this specific event.
-                        TextChange currentDeltaChange = CalculateTextChange(tab.textBeforeChange, currentState, tab.hEdit);
+                        //    The selections around the edit tell us which span changed, so only that
+                        //    span is read back. Otherwise fall back to diffing the whole document.
+                        CHARRANGE selAfter;
+                        SendMessage(tab.hEdit, EM_EXGETSEL, 0, (LPARAM)&selAfter);
+                        SelectionRange selectionAfter = { (size_t)selAfter.cpMin, (size_t)selAfter.cpMax };
+
+                        ChangeSet currentDeltaChange;
+                        EditSpan span;
+                        if (tab.selectionBeforeChangeValid &&
+                            DeriveEditSpan(tab.textBeforeChange.length(), tab.selectionBeforeChange,
+                                GetRichEditTextLength(tab.hEdit), selectionAfter, span)) {
+                            HWND hEdit = tab.hEdit;
+                            currentDeltaChange = CaptureTextChange(tab.textBeforeChange, span,
+                                [hEdit](size_t position, size_t count) { return GetRichEditTextRange(hEdit, position, count); },
+                                selectionAfter.end);
+                        }
+                        else {
+                            static MetricCounter& fullDiffs = CounterMetric("edit.full_diff_fallbacks");
+                            fullDiffs.add();
+                            std::wstring currentState = GetRichEditText(tab.hEdit);
+                            currentDeltaChange = CalculateTextChange(tab.textBeforeChange, currentState, tab.hEdit);
+                        }
 
-                        // 3. Update the total change size since the last *recorded* history point
-                        size_t changeSizeThisEvent = currentDeltaChange.insertedText.length() + currentDeltaChange.deletedText.length();
+                        if (tab.trace) {
+                            tab.trace->appendEdit(currentDeltaChange);
+                        }
 
-                        
-                        tab.totalChangeSize += changeSizeThisEvent;
+                        // 2. The selection after this edit is the one before the next.
+                        tab.selectionBeforeChange = selectionAfter;
+                        tab.selectionBeforeChangeValid = true;
 
+                        // 3. Fold the delta into the edits since the last *recorded* history
+                        //    point; committing hands them to the history as they are.
+                        tab.pendingEdits.append(currentDeltaChange);
 
                         // 4. Update textBeforeChange to prepare for the *next* EN_CHANGE event
-                        tab.textBeforeChange = currentState;
+                        //    by applying just this delta instead of keeping another full copy.
+                        tab.textBeforeChange.applyChange(currentDeltaChange);
 
                         // 5. Mark that changes have happened since the last *recorded* point
                         tab.changesSinceLastHistoryPoint = true;
 
-                        // 6. Check if the significant change threshold is met
-                        bool committedDueToThreshold = false;
-                        if (tab.totalChangeSize >= SIGNIFICANT_CHANGE_THRESHOLD) {
-                            // Kill any pending idle timer immediately
-                            if (tab.idleTimerId != 0) {
-                                KillTimer(hWnd, reinterpret_cast<UINT_PTR>(tab.hEdit));
-                                tab.idleTimerId = 0; // Mark timer as inactive
-                            }
+                        // 6. Let the scheduler decide: commit now if the edits since the last
+                        //    point reached this tab's threshold, otherwise push its idle commit out.
+                        size_t editedChars = currentDeltaChange.insertedLength() + currentDeltaChange.deletedLength();
+                        if (autoCommits.noteEdit(AutoCommitKey(tab), editedChars, tab.textBeforeChange.length(), AutoCommitScheduler::Clock::now())) {
                             // Record the history point NOW
+                            CounterMetric("history.threshold_commits").add();
                             RecordHistoryPoint(hWnd, currentTab, L"Auto (Significant Change)");
-                            // RecordHistoryPoint resets cumulativeChangeSize and changesSinceLastHistoryPoint
-                            committedDueToThreshold = true;
-                        } else{
-                                OutputDebugStringW((L"EN_CHANGE: Threshold NOT met (" + std::to_wstring(tab.totalChangeSize) + L" < " + std::to_wstring(SIGNIFICANT_CHANGE_THRESHOLD) + L").\n").c_str());
+                            // RecordHistoryPoint clears pendingEdits and changesSinceLastHistoryPoint
                         }
-
-                        // 7. If not committed by threshold, reset/start the idle timer
-                        if (!committedDueToThreshold) {
-                            // Kill previous timer for this tab, if any (ensures only one timer runs)
-                            if (tab.idleTimerId != 0) {
-                                KillTimer(hWnd, reinterpret_cast<UINT_PTR>(tab.hEdit));
-                            }
-                            // Reset/Start the idle timer
-                            UINT_PTR timerIdentifier = reinterpret_cast<UINT_PTR>(tab.hEdit);
-                            const UINT idleTimeoutMs = IDLE_HISTORY_TIMEOUT_MS;
-                            tab.idleTimerId = SetTimer(hWnd,
-                                timerIdentifier,
-                                idleTimeoutMs,
-                                nullptr);
-                            if (tab.idleTimerId == 0) {
-                                OutputDebugStringW(L"Warning: SetTimer failed in EN_CHANGE!\n");
-                            }
+                        else {
+                            ArmAutoCommitTimer(hWnd);
                         }
                         // *** END: Significant Change & Timer Logic ***
                     }
@@ -1547,6 +2012,14 @@ LRESULT CALLBACK WndProc(HWND hWnd, UINT message, WPARAM wParam, LPARAM lParam)
                     }
                 }
                 else if (pnmh->code == EN_SELCHANGE) {
+                    // Remember the selection for incremental change capture, but only while
+                    // the control still matches our baseline; a selection change reported
+                    // after an edit but before its EN_CHANGE must not be mistaken for it.
+                    if (!tab.processingHistoryAction && GetRichEditTextLength(tab.hEdit) == tab.textBeforeChange.length()) {
+                        SELCHANGE* pSelChange = (SELCHANGE*)lParam;
+                        tab.selectionBeforeChange = { (size_t)pSelChange->chrg.cpMin, (size_t)pSelChange->chrg.cpMax };
+                        tab.selectionBeforeChangeValid = true;
+                    }
                     // Handle selection change if needed (e.g., update status bar)
                 }
             }
@@ -1599,18 +2072,15 @@ LRESULT CALLBACK WndProc(HWND hWnd, UINT message, WPARAM wParam, LPARAM lParam)
             if (currentTab >= 0 && currentTab < openTabs.size()) {
                 auto& tab = openTabs[currentTab];
                 if (tab.hEdit && tab.historyManager && tab.historyManager->canUndo()) {
-                    // 1. Move internal pointer
-                    if (tab.historyManager->moveCurrentNodeToParent()) {
-                        // 2. Get new state and node
-                        std::shared_ptr<const HistoryNode> newNode = tab.historyManager->getCurrentNode();
-                        std::wstring newState = tab.historyManager->getCurrentState(); // Or reconstructStateToNode(newNode)
-
-                        // 3. Update editor and tab state (using the modified SetRichEditText)
-                        // SetRichEditText now handles updating textAtLastHistoryPoint etc.
-                        SetRichEditText(tab.hEdit, newState, newNode);
+                    // 1. Move internal pointer, getting back the one edge's change
+                    ChangeSet delta;
+                    if (tab.historyManager->moveCurrentNodeToParent(&delta)) {
+                        // 2. Update editor and tab state with just that change
+                        ShowHistoryStep(tab, delta);
                     }
                     else {
-                        OutputDebugStringW(L"ID_HISTORY_PREVIOUS: moveCurrentNodeToParent failed unexpectedly.\n");
+                        // Only a damaged change in the history journal stops an undo here
+                        MessageBoxW(hWnd, L"Can't go back: the change leading to this version is damaged.", L"Error", MB_OK | MB_ICONERROR);
                     }
                 }
                 else {
@@ -1632,10 +2102,12 @@ LRESULT CALLBACK WndProc(HWND hWnd, UINT message, WPARAM wParam, LPARAM lParam)
                     }
                     else if (branches.size() == 1) {
                         // --- Only one child: Move directly ---
-                        if (tab.historyManager->moveCurrentNodeToChild(0)) { // Move to the first (only) child
-                            std::shared_ptr<const HistoryNode> newNode = tab.historyManager->getCurrentNode();
-                            std::wstring newState = tab.historyManager->getCurrentState();
-                            SetRichEditText(tab.hEdit, newState, newNode);
+                        ChangeSet delta;
+                        if (tab.historyManager->moveCurrentNodeToChild(0, &delta)) { // Move to the first (only) child
+                            ShowHistoryStep(tab, delta);
+                        }
+                        else {
+                            MessageBoxW(hWnd, L"Can't go forward: the change leading to the next version is damaged.", L"Error", MB_OK | MB_ICONERROR);
                         }
                     }
                     else {
@@ -1656,10 +2128,9 @@ LRESULT CALLBACK WndProc(HWND hWnd, UINT message, WPARAM wParam, LPARAM lParam)
                         if (dlgResult == IDOK && params.selectedIndex >= 0 && params.selectedIndex < branches.size()) {
                             // User clicked OK and selected a valid index
                             // Move to the selected child node
-                            if (tab.historyManager->moveCurrentNodeToChild(params.selectedIndex)) {
-                                std::shared_ptr<const HistoryNode> newNode = tab.historyManager->getCurrentNode();
-                                std::wstring newState = tab.historyManager->getCurrentState();
-                                SetRichEditText(tab.hEdit, newState, newNode);
+                            ChangeSet delta;
+                            if (tab.historyManager->moveCurrentNodeToChild(params.selectedIndex, &delta)) {
+                                ShowHistoryStep(tab, delta);
                             }
                             else {
                                 MessageBoxW(hWnd, L"Failed to switch to the selected version.", L"Error", MB_OK | MB_ICONERROR);
@@ -1698,33 +2169,25 @@ LRESULT CALLBACK WndProc(HWND hWnd, UINT message, WPARAM wParam, LPARAM lParam)
                     if (dlgResult == IDOK) {
                         // --- User confirmed, proceed with creating version ---
 
-                        // 1. Get current state
-                        std::wstring currentState = GetRichEditText(tab.hEdit);
+                        // 1. Take the change since the last *recorded* point from the pending
+                        //    edits, or diff the current state if they don't account for it
+                        ChangeSet change;
+                        if (!TakePendingEdits(tab, GetRichEditTextLength(tab.hEdit), change)) {
+                            change = CalculateTextChange(tab.textAtLastHistoryPoint, GetRichEditText(tab.hEdit), tab.hEdit);
+                        }
 
                         // 2. Check if state actually changed since last *recorded* point
-                        if (currentState == tab.textAtLastHistoryPoint) {
+                        if (change.isEmpty()) {
+                            CommitHistoryChange(tab, change, userCommitMessage); // Only resets the baselines
                             MessageBoxW(hWnd, L"No changes detected since the last version point.\nManual version not created.", L"Create Version", MB_OK | MB_ICONINFORMATION);
                             break; // Exit case
                         }
 
-                        // 3. Calculate the change from the last recorded state
-                        TextChange change = CalculateTextChange(tab.textAtLastHistoryPoint, currentState, tab.hEdit);
-
-                        // 4. Ensure the change is not empty (double check)
-                        if (change.insertedText.empty() && change.deletedText.empty()) {
-                            MessageBoxW(hWnd, L"Internal check: No changes detected.\nManual version not created.", L"Create Version", MB_OK | MB_ICONWARNING);
-                            break; // Exit case
-                        }
-
-                        // 5. Record the change WITH the user's message
+                        // 3. Record the change WITH the user's message
                         // If user entered no message, userCommitMessage will be empty, which is fine.
-                        tab.historyManager->recordChange(change, userCommitMessage);
-
-                        // 6. Update the baseline for the next diff
-                        tab.textAtLastHistoryPoint = currentState;
-                        tab.changesSinceLastHistoryPoint = false; // Reset flag
+                        CommitHistoryChange(tab, change, userCommitMessage);
 
-                        // 7. Provide feedback
+                        // 4. Provide feedback
                         MessageBoxW(hWnd, (L"Version created." + (userCommitMessage.empty() ? L"" : L"\nMessage: " + userCommitMessage)).c_str(), L"Commit", MB_OK | MB_ICONINFORMATION);
                     }
                     // else: User cancelled (dlgResult == IDCANCEL or error), do nothing.
@@ -1750,6 +2213,8 @@ LRESULT CALLBACK WndProc(HWND hWnd, UINT message, WPARAM wParam, LPARAM lParam)
         }
         break; // <-- End ID_HELP_SHORTCUTS
 
+        case ID_HELP_DIAGNOSTICS: DialogBox(hInst, MAKEINTRESOURCE(IDD_DIAGNOSTICS), hWnd, DiagnosticsDlgProc); break;
+        case ID_HELP_TIMELINE: ToggleTimelineRecording(hWnd); break;
         case IDM_ABOUT: DialogBox(hInst, MAKEINTRESOURCE(IDD_ABOUTBOX), hWnd, About); break;
         case IDM_EXIT: DestroyWindow(hWnd); break;
 
@@ -1777,6 +2242,11 @@ LRESULT CALLBACK WndProc(HWND hWnd, UINT message, WPARAM wParam, LPARAM lParam)
         break;
 
     case WM_DESTROY:
+        // Files still being written must reach the disk before the process ends.
+        for (std::future<FileSaveResult>& save : pendingFileSaves) {
+            save.wait();
+        }
+        pendingFileSaves.clear();
         PostQuitMessage(0);
         break;
 
@@ -1807,6 +2277,127 @@ INT_PTR CALLBACK About(HWND hDlg, UINT message, WPARAM wParam, LPARAM lParam)
 }
 
 
+// Diagnostics dialog: the metrics registry as a table (see FormatMetricsReport), with
+// the tab names behind the "tab<n>." gauges. Refresh re-reads it, Reset zeroes the
+// counters and latencies, Save writes the JSON form.
+void FillDiagnosticsReport(HWND hDlg) {
+    std::wstring report = L"Tabs\r\n";
+    for (const EditorTabInfo& tab : openTabs) {
+        UpdateTabGauges(tab);
+        std::wstring prefix(tab.metricsPrefix.begin(), tab.metricsPrefix.end());
+        report += L"  " + prefix.substr(0, prefix.length() - 1) + L" = " + tab.fileName + L"\r\n";
+    }
+    // Texts stored once for every tab that holds them (see BlobStore)
+    BlobStore::Stats blobs = BlobStore::global().stats();
+    wchar_t line[256];
+    swprintf(line, 256, L"\r\nShared text\r\n  %zu texts, %zu KB stored for %zu KB referenced by %zu holders (dedup ratio %.2f)\r\n",
+        blobs.blobs, blobs.uniqueBytes / 1024, blobs.referencedBytes / 1024, blobs.references, blobs.dedupRatio());
+    report += line;
+    report += L"\r\n" + FormatMetricsReport(MetricsRegistry::global().snapshot());
+    SetDlgItemTextW(hDlg, IDC_DIAGNOSTICS_TEXT, report.c_str());
+}
+
+INT_PTR CALLBACK DiagnosticsDlgProc(HWND hDlg, UINT message, WPARAM wParam, LPARAM lParam)
+{
+    UNREFERENCED_PARAMETER(lParam);
+    static HFONT hFixedFont = NULL; // The table needs a fixed-pitch font
+
+    switch (message)
+    {
+    case WM_INITDIALOG:
+        hFixedFont = CreateFontW(-12, 0, 0, 0, FW_NORMAL, FALSE, FALSE, FALSE, DEFAULT_CHARSET, OUT_DEFAULT_PRECIS,
+            CLIP_DEFAULT_PRECIS, CLEARTYPE_QUALITY, FIXED_PITCH | FF_MODERN, L"Consolas");
+        if (hFixedFont) {
+            SendDlgItemMessage(hDlg, IDC_DIAGNOSTICS_TEXT, WM_SETFONT, (WPARAM)hFixedFont, FALSE);
+        }
+        FillDiagnosticsReport(hDlg);
+        return (INT_PTR)TRUE;
+
+    case WM_COMMAND:
+        switch (LOWORD(wParam))
+        {
+        case IDC_DIAGNOSTICS_REFRESH:
+            FillDiagnosticsReport(hDlg);
+            return (INT_PTR)TRUE;
+
+        case IDC_DIAGNOSTICS_RESET:
+            MetricsRegistry::global().reset();
+            FillDiagnosticsReport(hDlg);
+            return (INT_PTR)TRUE;
+
+        case IDC_DIAGNOSTICS_SAVE:
+        {
+            WCHAR szFile[MAX_PATH] = L"metrics.json";
+            OPENFILENAME ofn;
+            ZeroMemory(&ofn, sizeof(ofn));
+            ofn.lStructSize = sizeof(ofn);
+            ofn.hwndOwner = hDlg;
+            ofn.lpstrFile = szFile;
+            ofn.nMaxFile = MAX_PATH;
+            ofn.lpstrFilter = L"JSON Files (*.json)\0*.json\0All Files (*.*)\0*.*\0";
+            ofn.lpstrDefExt = L"json";
+            ofn.Flags = OFN_PATHMUSTEXIST | OFN_OVERWRITEPROMPT | OFN_EXPLORER;
+            if (GetSaveFileName(&ofn)) {
+                for (const EditorTabInfo& tab : openTabs) {
+                    UpdateTabGauges(tab);
+                }
+                if (!MetricsRegistry::global().writeJson(szFile)) {
+                    MessageBoxW(hDlg, L"Could not write the metrics file.", L"Save Error", MB_OK | MB_ICONERROR);
+                }
+            }
+            return (INT_PTR)TRUE;
+        }
+
+        case IDOK:
+        case IDCANCEL:
+            EndDialog(hDlg, LOWORD(wParam));
+            return (INT_PTR)TRUE;
+        }
+        break;
+
+    case WM_DESTROY:
+        if (hFixedFont) {
+            DeleteObject(hFixedFont);
+            hFixedFont = NULL;
+        }
+        break;
+    }
+    return (INT_PTR)FALSE;
+}
+
+
+// Help > Record Timeline: the first click starts recording spans (see Timeline.h), the
+// second stops and asks where to save them, as a trace for chrome://tracing or Perfetto.
+void ToggleTimelineRecording(HWND hWnd) {
+#if !TEXTEDITOR_TIMELINE
+    MessageBoxW(hWnd, L"This build was made without timeline spans (TEXTEDITOR_TIMELINE=0).", L"Record Timeline", MB_OK | MB_ICONINFORMATION);
+#else
+    Timeline& timeline = Timeline::global();
+    if (!timeline.isRecording()) {
+        timeline.start();
+        CheckMenuItem(GetMenu(hWnd), ID_HELP_TIMELINE, MF_BYCOMMAND | MF_CHECKED);
+        return;
+    }
+    timeline.stop();
+    CheckMenuItem(GetMenu(hWnd), ID_HELP_TIMELINE, MF_BYCOMMAND | MF_UNCHECKED);
+
+    WCHAR szFile[MAX_PATH] = L"timeline.json";
+    OPENFILENAME ofn;
+    ZeroMemory(&ofn, sizeof(ofn));
+    ofn.lStructSize = sizeof(ofn);
+    ofn.hwndOwner = hWnd;
+    ofn.lpstrFile = szFile;
+    ofn.nMaxFile = MAX_PATH;
+    ofn.lpstrFilter = L"Trace Files (*.json)\0*.json\0All Files (*.*)\0*.*\0";
+    ofn.lpstrDefExt = L"json";
+    ofn.Flags = OFN_PATHMUSTEXIST | OFN_OVERWRITEPROMPT | OFN_EXPLORER;
+    if (GetSaveFileName(&ofn) && !timeline.writeChromeTrace(szFile)) {
+        MessageBoxW(hWnd, L"Could not write the timeline file.", L"Save Error", MB_OK | MB_ICONERROR);
+    }
+#endif
+}
+
+
 INT_PTR CALLBACK ChooseChildCommitDlgProc(HWND hDlg, UINT message, WPARAM wParam, LPARAM lParam) {
     ChooseChildDialogParams* pParams = nullptr;
 
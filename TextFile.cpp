@@ -0,0 +1,588 @@
+#include "TextFile.h"
+#include "MappedFile.h"
+#include "AtomicFileWriter.h"
+#include "Timeline.h"
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define TEXT_FILE_SSE2 1
+#include <emmintrin.h>
+#endif
+#ifdef _MSC_VER
+#include <intrin.h>    // For _BitScanForward
+#endif
+
+namespace {
+    constexpr size_t DETECTION_SAMPLE_BYTES = 4096;
+    constexpr size_t OUTPUT_SLACK = 16; // Vector stores may write one block past the last unit
+    constexpr char32_t REPLACEMENT_CHARACTER = 0xFFFD;
+    constexpr bool WIDE_UNITS = sizeof(wchar_t) == 4; // UTF-32 wchar_t (not Windows)
+    constexpr size_t SAVE_SLICE_UNITS = 256 * 1024; // Units encoded per write when saving
+    constexpr size_t MAX_BYTES_PER_UNIT = 4; // A CR as UTF-16 CRLF, or a 32-bit unit as 4 UTF-8 bytes
+
+    bool isSurrogate(char32_t unit) {
+        return unit >= 0xD800 && unit <= 0xDFFF;
+    }
+
+    bool isHighSurrogate(char32_t unit) {
+        return unit >= 0xD800 && unit <= 0xDBFF;
+    }
+
+    // A unit that the bulk copies below leave to the per-character code.
+    bool needsCloserLook(char32_t unit) {
+        return unit == U'\r' || unit == U'\n' || (WIDE_UNITS && isSurrogate(unit));
+    }
+
+    template <bool BigEndian>
+    char16_t readUnit(const unsigned char* in) {
+        return BigEndian ? static_cast<char16_t>((in[0] << 8) | in[1]) : static_cast<char16_t>(in[0] | (in[1] << 8));
+    }
+
+    void putCodePoint(wchar_t*& out, char32_t codePoint) {
+        if (!WIDE_UNITS && codePoint >= 0x10000) {
+            codePoint -= 0x10000;
+            *out++ = static_cast<wchar_t>(0xD800 + (codePoint >> 10));
+            *out++ = static_cast<wchar_t>(0xDC00 + (codePoint & 0x3FF));
+            return;
+        }
+        *out++ = static_cast<wchar_t>(codePoint);
+    }
+
+    // CRLF and LF become CR. 'afterCr' remembers that the last character written was a
+    // CR, whose LF (if that comes next) is then dropped.
+    void putCharacter(wchar_t*& out, char32_t character, bool& afterCr) {
+        if (character == U'\n') {
+            if (!afterCr) {
+                *out++ = L'\r';
+            }
+            afterCr = false;
+            return;
+        }
+        afterCr = character == U'\r';
+        putCodePoint(out, character);
+    }
+
+#ifdef TEXT_FILE_SSE2
+    unsigned lowestSetBit(unsigned mask) {
+#ifdef _MSC_VER
+        unsigned long index;
+        _BitScanForward(&index, mask);
+        return static_cast<unsigned>(index);
+#else
+        return static_cast<unsigned>(__builtin_ctz(mask));
+#endif
+    }
+
+    // Stores 8 16-bit units as 8 wchar_t.
+    void storeUnits(wchar_t* out, __m128i units) {
+        if constexpr (WIDE_UNITS) {
+            __m128i zero = _mm_setzero_si128();
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(out), _mm_unpacklo_epi16(units, zero));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(out + 4), _mm_unpackhi_epi16(units, zero));
+        }
+        else {
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(out), units);
+        }
+    }
+
+    // Stores 16 bytes as 16 wchar_t, zero-extended.
+    void storeBytes(wchar_t* out, __m128i bytes) {
+        __m128i zero = _mm_setzero_si128();
+        storeUnits(out, _mm_unpacklo_epi8(bytes, zero));
+        storeUnits(out + 8, _mm_unpackhi_epi8(bytes, zero));
+    }
+
+    // Loads 8 wchar_t as 16-bit lanes. 32-bit units above U+FFFF saturate to 0xFFFF;
+    // wideLanes tells them apart from a real U+FFFF where that matters.
+    __m128i loadUnits(const wchar_t* in) {
+        if constexpr (WIDE_UNITS) {
+            // packs is signed: shift U+8000..U+FFFF into range and back.
+            const __m128i bias32 = _mm_set1_epi32(0x8000);
+            const __m128i bias16 = _mm_set1_epi16(static_cast<short>(0x8000));
+            __m128i low = _mm_sub_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(in)), bias32);
+            __m128i high = _mm_sub_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(in + 4)), bias32);
+            return _mm_add_epi16(_mm_packs_epi32(low, high), bias16);
+        }
+        else {
+            return _mm_loadu_si128(reinterpret_cast<const __m128i*>(in));
+        }
+    }
+
+    // Lanes (two mask bits each) holding a value above 0xFFFF, for 32-bit units.
+    unsigned wideLanes(const wchar_t* in) {
+        if constexpr (WIDE_UNITS) {
+            const __m128i highHalf = _mm_set1_epi32(static_cast<int>(0xFFFF0000u));
+            const __m128i zero = _mm_setzero_si128();
+            __m128i lowFits = _mm_cmpeq_epi32(_mm_and_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(in)), highHalf), zero);
+            __m128i highFits = _mm_cmpeq_epi32(_mm_and_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(in + 4)), highHalf), zero);
+            unsigned fits = static_cast<unsigned>(_mm_movemask_epi8(_mm_packs_epi32(lowFits, highFits)));
+            return ~fits & 0xFFFFu;
+        }
+        else {
+            return 0;
+        }
+    }
+#endif
+
+    // Widens bytes into 'out' up to the first line break or, if 'asciiOnly', the first
+    // byte of a multi-byte UTF-8 sequence. Returns how many were copied. May write up to
+    // 16 units past that.
+    size_t copyByteRun(const unsigned char* in, const unsigned char* end, wchar_t* out, bool asciiOnly) {
+        size_t available = static_cast<size_t>(end - in);
+        size_t copied = 0;
+#ifdef TEXT_FILE_SSE2
+        const __m128i cr = _mm_set1_epi8('\r');
+        const __m128i lf = _mm_set1_epi8('\n');
+        while (available - copied >= 16) {
+            __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + copied));
+            unsigned stop = static_cast<unsigned>(_mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(block, cr), _mm_cmpeq_epi8(block, lf))));
+            if (asciiOnly) {
+                stop |= static_cast<unsigned>(_mm_movemask_epi8(block)); // High bit set: not ASCII
+            }
+            storeBytes(out + copied, block); // Whole block; only the part before 'stop' counts
+            if (stop != 0) {
+                return copied + lowestSetBit(stop);
+            }
+            copied += 16;
+        }
+#endif
+        for (; copied < available; ++copied) {
+            unsigned char byte = in[copied];
+            if (byte == '\r' || byte == '\n' || (asciiOnly && byte >= 0x80)) {
+                break;
+            }
+            out[copied] = static_cast<wchar_t>(byte);
+        }
+        return copied;
+    }
+
+    // Same for UTF-16 units, stopping at line breaks and (with 32-bit wchar_t) at
+    // surrogates, which have to be paired up.
+    template <bool BigEndian>
+    size_t copyUnitRun(const unsigned char* in, size_t units, wchar_t* out) {
+        size_t copied = 0;
+#ifdef TEXT_FILE_SSE2
+        const __m128i cr = _mm_set1_epi16('\r');
+        const __m128i lf = _mm_set1_epi16('\n');
+        const __m128i surrogateMask = _mm_set1_epi16(static_cast<short>(0xF800));
+        const __m128i surrogateBits = _mm_set1_epi16(static_cast<short>(0xD800));
+        while (units - copied >= 8) {
+            __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + 2 * copied));
+            if constexpr (BigEndian) {
+                block = _mm_or_si128(_mm_slli_epi16(block, 8), _mm_srli_epi16(block, 8));
+            }
+            __m128i stops = _mm_or_si128(_mm_cmpeq_epi16(block, cr), _mm_cmpeq_epi16(block, lf));
+            if constexpr (WIDE_UNITS) {
+                stops = _mm_or_si128(stops, _mm_cmpeq_epi16(_mm_and_si128(block, surrogateMask), surrogateBits));
+            }
+            unsigned stop = static_cast<unsigned>(_mm_movemask_epi8(stops)); // Two bits per unit
+            storeUnits(out + copied, block);
+            if (stop != 0) {
+                return copied + lowestSetBit(stop) / 2;
+            }
+            copied += 8;
+        }
+#endif
+        for (; copied < units; ++copied) {
+            char16_t unit = readUnit<BigEndian>(in + 2 * copied);
+            if (needsCloserLook(unit)) {
+                break;
+            }
+            out[copied] = static_cast<wchar_t>(unit);
+        }
+        return copied;
+    }
+
+    // Returns false at the first sequence that is not valid UTF-8 (overlong forms and
+    // encoded surrogates included).
+    bool decodeUtf8(const unsigned char* in, const unsigned char* end, wchar_t*& out) {
+        bool afterCr = false;
+        while (in < end) {
+            unsigned char lead = *in;
+            if (lead < 0x80) {
+                if (lead == '\r' || lead == '\n') {
+                    putCharacter(out, lead, afterCr);
+                    ++in;
+                    continue;
+                }
+                size_t run = copyByteRun(in, end, out, true); // At least this byte
+                in += run;
+                out += run;
+                afterCr = false;
+                continue;
+            }
+
+            size_t length;
+            char32_t codePoint;
+            char32_t smallest;
+            if ((lead & 0xE0) == 0xC0) {
+                length = 2; codePoint = lead & 0x1F; smallest = 0x80;
+            }
+            else if ((lead & 0xF0) == 0xE0) {
+                length = 3; codePoint = lead & 0x0F; smallest = 0x800;
+            }
+            else if ((lead & 0xF8) == 0xF0) {
+                length = 4; codePoint = lead & 0x07; smallest = 0x10000;
+            }
+            else {
+                return false;
+            }
+            if (static_cast<size_t>(end - in) < length) {
+                return false;
+            }
+            for (size_t i = 1; i < length; ++i) {
+                if ((in[i] & 0xC0) != 0x80) {
+                    return false;
+                }
+                codePoint = (codePoint << 6) | (in[i] & 0x3F);
+            }
+            if (codePoint < smallest || codePoint > 0x10FFFF || isSurrogate(codePoint)) {
+                return false;
+            }
+            putCodePoint(out, codePoint);
+            afterCr = false;
+            in += length;
+        }
+        return true;
+    }
+
+    void decodeLatin1(const unsigned char* in, const unsigned char* end, wchar_t*& out) {
+        bool afterCr = false;
+        while (in < end) {
+            size_t run = copyByteRun(in, end, out, false);
+            if (run > 0) {
+                in += run;
+                out += run;
+                afterCr = false;
+                continue;
+            }
+            putCharacter(out, *in++, afterCr); // A line break
+        }
+    }
+
+    template <bool BigEndian>
+    void decodeUtf16(const unsigned char* in, size_t units, wchar_t*& out) {
+        bool afterCr = false;
+        size_t i = 0;
+        while (i < units) {
+            char16_t unit = readUnit<BigEndian>(in + 2 * i);
+            if (!needsCloserLook(unit)) {
+                size_t run = copyUnitRun<BigEndian>(in + 2 * i, units - i, out); // At least this unit
+                i += run;
+                out += run;
+                afterCr = false;
+                continue;
+            }
+            if (WIDE_UNITS && isSurrogate(unit)) {
+                char32_t codePoint = REPLACEMENT_CHARACTER;
+                if (unit < 0xDC00 && i + 1 < units) {
+                    char16_t low = readUnit<BigEndian>(in + 2 * (i + 1));
+                    if (low >= 0xDC00 && low <= 0xDFFF) {
+                        codePoint = 0x10000 + ((static_cast<char32_t>(unit) - 0xD800) << 10) + (low - 0xDC00);
+                        ++i;
+                    }
+                }
+                putCodePoint(out, codePoint);
+                afterCr = false;
+                ++i;
+                continue;
+            }
+            putCharacter(out, unit, afterCr);
+            ++i;
+        }
+    }
+
+    // Narrows units into bytes up to the first CR or the first unit not below 'limit'
+    // (0x80 for UTF-8, 0x100 for Latin-1). Returns how many were copied. May write up
+    // to 16 bytes past that.
+    size_t narrowRun(const wchar_t* in, size_t units, unsigned char* out, char32_t limit) {
+        size_t copied = 0;
+#ifdef TEXT_FILE_SSE2
+        const __m128i cr = _mm_set1_epi16('\r');
+        const __m128i zero = _mm_setzero_si128();
+        const __m128i overLimit = _mm_set1_epi16(static_cast<short>(~(limit - 1)));
+        while (units - copied >= 16) {
+            __m128i first = loadUnits(in + copied);
+            __m128i second = loadUnits(in + copied + 8);
+            unsigned stopFirst = ~static_cast<unsigned>(_mm_movemask_epi8(_mm_cmpeq_epi16(_mm_and_si128(first, overLimit), zero)))
+                | static_cast<unsigned>(_mm_movemask_epi8(_mm_cmpeq_epi16(first, cr)));
+            unsigned stopSecond = ~static_cast<unsigned>(_mm_movemask_epi8(_mm_cmpeq_epi16(_mm_and_si128(second, overLimit), zero)))
+                | static_cast<unsigned>(_mm_movemask_epi8(_mm_cmpeq_epi16(second, cr)));
+            unsigned stop = (stopFirst & 0xFFFFu) | ((stopSecond & 0xFFFFu) << 16); // Two bits per unit
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(out + copied), _mm_packus_epi16(first, second));
+            if (stop != 0) {
+                return copied + lowestSetBit(stop) / 2;
+            }
+            copied += 16;
+        }
+#endif
+        for (; copied < units; ++copied) {
+            char32_t unit = static_cast<char32_t>(in[copied]);
+            if (unit == U'\r' || unit >= limit) {
+                break;
+            }
+            out[copied] = static_cast<unsigned char>(unit);
+        }
+        return copied;
+    }
+
+    template <bool BigEndian>
+    void putUtf16(unsigned char*& out, char32_t unit) {
+        *out++ = static_cast<unsigned char>(BigEndian ? unit >> 8 : unit & 0xFF);
+        *out++ = static_cast<unsigned char>(BigEndian ? unit & 0xFF : unit >> 8);
+    }
+
+    // Copies units as UTF-16 up to the first CR or (32-bit units) supplementary
+    // character. Returns how many were copied. May write up to 16 bytes past that.
+    template <bool BigEndian>
+    size_t copyUtf16Run(const wchar_t* in, size_t units, unsigned char* out) {
+        size_t copied = 0;
+#ifdef TEXT_FILE_SSE2
+        const __m128i cr = _mm_set1_epi16('\r');
+        while (units - copied >= 8) {
+            __m128i block = loadUnits(in + copied);
+            unsigned stop = static_cast<unsigned>(_mm_movemask_epi8(_mm_cmpeq_epi16(block, cr))) | wideLanes(in + copied);
+            if constexpr (BigEndian) {
+                block = _mm_or_si128(_mm_slli_epi16(block, 8), _mm_srli_epi16(block, 8));
+            }
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(out + 2 * copied), block);
+            if (stop != 0) {
+                return copied + lowestSetBit(stop) / 2;
+            }
+            copied += 8;
+        }
+#endif
+        unsigned char* cursor = out + 2 * copied;
+        for (; copied < units; ++copied) {
+            char32_t unit = static_cast<char32_t>(in[copied]);
+            if (unit == U'\r' || unit > 0xFFFF) {
+                break;
+            }
+            putUtf16<BigEndian>(cursor, unit);
+        }
+        return copied;
+    }
+
+    // The code point starting at in[i], advancing 'i' past it. With 16-bit units a
+    // surrogate pair is combined; an unpaired surrogate becomes U+FFFD.
+    char32_t takeCodePoint(const wchar_t* in, size_t units, size_t& i) {
+        char32_t unit = static_cast<char32_t>(in[i++]);
+        if (!isSurrogate(unit)) {
+            return unit;
+        }
+        if (!WIDE_UNITS && isHighSurrogate(unit) && i < units) {
+            char32_t low = static_cast<char32_t>(in[i]);
+            if (low >= 0xDC00 && low <= 0xDFFF) {
+                ++i;
+                return 0x10000 + ((unit - 0xD800) << 10) + (low - 0xDC00);
+            }
+        }
+        return REPLACEMENT_CHARACTER;
+    }
+
+    // Encodes 'units' of editor text, not ending inside a surrogate pair, to 'out',
+    // which has room for MAX_BYTES_PER_UNIT per unit plus OUTPUT_SLACK. Returns the
+    // number of bytes written.
+    size_t encodeSlice(const wchar_t* in, size_t units, TextEncoding encoding, unsigned char* out) {
+        unsigned char* start = out;
+        bool latin1 = encoding == TextEncoding::Latin1;
+        bool utf16 = encoding == TextEncoding::Utf16LE || encoding == TextEncoding::Utf16BE;
+        bool bigEndian = encoding == TextEncoding::Utf16BE;
+        size_t i = 0;
+        while (i < units) {
+            size_t run = utf16 ? (bigEndian ? copyUtf16Run<true>(in + i, units - i, out) : copyUtf16Run<false>(in + i, units - i, out))
+                : narrowRun(in + i, units - i, out, latin1 ? 0x100 : 0x80);
+            i += run;
+            out += utf16 ? 2 * run : run;
+            if (i == units) {
+                break;
+            }
+
+            if (in[i] == L'\r') {
+                ++i;
+                if (utf16) {
+                    bigEndian ? putUtf16<true>(out, U'\r') : putUtf16<false>(out, U'\r');
+                    bigEndian ? putUtf16<true>(out, U'\n') : putUtf16<false>(out, U'\n');
+                }
+                else {
+                    *out++ = '\r';
+                    *out++ = '\n';
+                }
+                continue;
+            }
+            if (utf16) {
+                // Only 32-bit units stop here: a supplementary character becomes a pair.
+                char32_t codePoint = static_cast<char32_t>(in[i++]) - 0x10000;
+                char32_t high = 0xD800 + (codePoint >> 10);
+                char32_t low = 0xDC00 + (codePoint & 0x3FF);
+                bigEndian ? putUtf16<true>(out, high) : putUtf16<false>(out, high);
+                bigEndian ? putUtf16<true>(out, low) : putUtf16<false>(out, low);
+                continue;
+            }
+            if (latin1) {
+                *out++ = '?'; // Not expected: SaveTextFile checks that Latin-1 can hold the text
+                ++i;
+                continue;
+            }
+
+            char32_t codePoint = takeCodePoint(in, units, i);
+            if (codePoint < 0x800) {
+                *out++ = static_cast<unsigned char>(0xC0 | (codePoint >> 6));
+            }
+            else if (codePoint < 0x10000) {
+                *out++ = static_cast<unsigned char>(0xE0 | (codePoint >> 12));
+                *out++ = static_cast<unsigned char>(0x80 | ((codePoint >> 6) & 0x3F));
+            }
+            else {
+                *out++ = static_cast<unsigned char>(0xF0 | (codePoint >> 18));
+                *out++ = static_cast<unsigned char>(0x80 | ((codePoint >> 12) & 0x3F));
+                *out++ = static_cast<unsigned char>(0x80 | ((codePoint >> 6) & 0x3F));
+            }
+            *out++ = static_cast<unsigned char>(0x80 | (codePoint & 0x3F));
+        }
+        return static_cast<size_t>(out - start);
+    }
+
+    bool hasUtf8Bom(const unsigned char* bytes, size_t size) {
+        return size >= 3 && bytes[0] == 0xEF && bytes[1] == 0xBB && bytes[2] == 0xBF;
+    }
+}
+
+TextEncoding DetectTextEncoding(const unsigned char* bytes, size_t size) {
+    if (hasUtf8Bom(bytes, size)) {
+        return TextEncoding::Utf8Bom;
+    }
+    if (size >= 2 && bytes[0] == 0xFF && bytes[1] == 0xFE) {
+        return TextEncoding::Utf16LE;
+    }
+    if (size >= 2 && bytes[0] == 0xFE && bytes[1] == 0xFF) {
+        return TextEncoding::Utf16BE;
+    }
+
+    // No BOM. Mostly-ASCII text in UTF-16 has a zero in every other byte, UTF-8 and
+    // Latin-1 text has none at all.
+    size_t sample = std::min(size, DETECTION_SAMPLE_BYTES) & ~static_cast<size_t>(1);
+    size_t evenZeros = 0;
+    size_t oddZeros = 0;
+    for (size_t i = 0; i < sample; i += 2) {
+        evenZeros += bytes[i] == 0;
+        oddZeros += bytes[i + 1] == 0;
+    }
+    size_t pairs = sample / 2;
+    if (oddZeros * 2 > pairs && evenZeros * 4 < oddZeros) {
+        return TextEncoding::Utf16LE;
+    }
+    if (evenZeros * 2 > pairs && oddZeros * 4 < evenZeros) {
+        return TextEncoding::Utf16BE;
+    }
+    return TextEncoding::Utf8;
+}
+
+TextEncoding DecodeEditorText(const unsigned char* bytes, size_t size, TextEncoding encoding, std::wstring& out) {
+    // Output is written through a raw cursor into a string sized for the worst case
+    // (one unit per input byte or UTF-16 unit), then trimmed.
+    wchar_t* cursor = nullptr;
+    switch (encoding) {
+    case TextEncoding::Utf16LE:
+    case TextEncoding::Utf16BE:
+    {
+        bool bigEndian = encoding == TextEncoding::Utf16BE;
+        if (size >= 2 && bytes[0] == (bigEndian ? 0xFE : 0xFF) && bytes[1] == (bigEndian ? 0xFF : 0xFE)) {
+            bytes += 2;
+            size -= 2;
+        }
+        size_t units = size / 2; // A stray last byte is dropped
+        out.resize(units + OUTPUT_SLACK);
+        cursor = &out[0];
+        if (bigEndian) {
+            decodeUtf16<true>(bytes, units, cursor);
+        }
+        else {
+            decodeUtf16<false>(bytes, units, cursor);
+        }
+        out.resize(static_cast<size_t>(cursor - out.data()));
+        return encoding;
+    }
+
+    case TextEncoding::Utf8:
+    case TextEncoding::Utf8Bom:
+        if (hasUtf8Bom(bytes, size)) {
+            bytes += 3;
+            size -= 3;
+            encoding = TextEncoding::Utf8Bom;
+        }
+        out.resize(size + OUTPUT_SLACK);
+        cursor = &out[0];
+        if (decodeUtf8(bytes, bytes + size, cursor)) {
+            out.resize(static_cast<size_t>(cursor - out.data()));
+            return encoding;
+        }
+        break; // Not UTF-8 after all: start over as Latin1
+
+    case TextEncoding::Latin1:
+        break;
+    }
+
+    out.resize(size + OUTPUT_SLACK);
+    cursor = &out[0];
+    decodeLatin1(bytes, bytes + size, cursor);
+    out.resize(static_cast<size_t>(cursor - out.data()));
+    return TextEncoding::Latin1;
+}
+
+bool LoadTextFile(const std::wstring& path, std::wstring& out, TextEncoding* encoding) {
+    TIMELINE_SPAN("LoadTextFile");
+    MappedFile file;
+    if (!file.open(path)) {
+        return false;
+    }
+    TextEncoding used = DecodeEditorText(file.data(), file.size(), DetectTextEncoding(file.data(), file.size()), out);
+    if (encoding) {
+        *encoding = used;
+    }
+    return true;
+}
+
+bool SaveTextFile(const std::wstring& path, const std::wstring& text, TextEncoding encoding, TextEncoding* written) {
+    TIMELINE_SPAN("SaveTextFile");
+    if (encoding == TextEncoding::Latin1
+        && std::any_of(text.begin(), text.end(), [](wchar_t ch) { return static_cast<char32_t>(ch) > 0xFF; })) {
+        encoding = TextEncoding::Utf8;
+    }
+
+    AtomicFileWriter file;
+    if (!file.open(path)) {
+        return false;
+    }
+    static const unsigned char utf8Bom[] = { 0xEF, 0xBB, 0xBF };
+    static const unsigned char utf16LeBom[] = { 0xFF, 0xFE };
+    static const unsigned char utf16BeBom[] = { 0xFE, 0xFF };
+    switch (encoding) {
+    case TextEncoding::Utf8Bom: file.write(utf8Bom, sizeof(utf8Bom)); break;
+    case TextEncoding::Utf16LE: file.write(utf16LeBom, sizeof(utf16LeBom)); break;
+    case TextEncoding::Utf16BE: file.write(utf16BeBom, sizeof(utf16BeBom)); break;
+    default: break;
+    }
+
+    std::vector<unsigned char> buffer(std::min(text.length(), SAVE_SLICE_UNITS) * MAX_BYTES_PER_UNIT + OUTPUT_SLACK);
+    for (size_t start = 0; start < text.length();) {
+        size_t units = std::min(SAVE_SLICE_UNITS, text.length() - start);
+        if (start + units < text.length() && isHighSurrogate(static_cast<char32_t>(text[start + units - 1]))) {
+            units--; // Keep the pair together for the next slice
+        }
+        size_t bytes = encodeSlice(text.data() + start, units, encoding, buffer.data());
+        if (!file.write(buffer.data(), bytes)) {
+            return false;
+        }
+        start += units;
+    }
+    if (!file.commit()) {
+        return false;
+    }
+    if (written) {
+        *written = encoding;
+    }
+    return true;
+}
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <string>
+#include <cstddef>    // For size_t
+
+// Loading text files into the editor's form: wchar_t units with a lone CR as the line
+// break (what Rich Edit uses), whatever the file's encoding and line endings. The file
+// is memory-mapped and transcoded straight into the final string in one pass, which
+// also converts CRLF and LF to CR; runs of ASCII (or of BMP units, for UTF-16) are
+// widened 16 bytes at a time with SSE2 where available. Saving goes the other way, with
+// CRLF line breaks, narrowing runs the same way.
+
+enum class TextEncoding {
+    Utf8,      // Also plain ASCII
+    Utf8Bom,
+    Utf16LE,   // With or without a BOM
+    Utf16BE,
+    Latin1,    // Not valid UTF-8: every byte is taken as the character of that code
+};
+
+// Guesses the encoding of a file from its first bytes: a BOM if there is one, else the
+// zero bytes that ASCII text has in UTF-16, else UTF-8.
+TextEncoding DetectTextEncoding(const unsigned char* bytes, size_t size);
+
+// Decodes 'bytes' in 'encoding' into editor text in 'out', skipping a BOM. Returns the
+// encoding actually used: UTF-8 that turns out to be invalid is decoded as Latin1.
+// Where wchar_t is 32 bits, UTF-16 surrogate pairs are combined and supplementary
+// characters are single units; unpaired surrogates become U+FFFD.
+TextEncoding DecodeEditorText(const unsigned char* bytes, size_t size, TextEncoding encoding, std::wstring& out);
+
+// Maps the file at 'path', detects its encoding and decodes it into 'out'. Returns
+// false if the file cannot be opened. 'encoding', if given, receives the encoding used.
+bool LoadTextFile(const std::wstring& path, std::wstring& out, TextEncoding* encoding = nullptr);
+
+// Writes editor text to 'path' in 'encoding': CR line breaks become CRLF, and Utf8Bom
+// and UTF-16 files start with a BOM. Latin1 text with characters beyond U+00FF is
+// written as Utf8 instead. The file is replaced atomically (see AtomicFileWriter) and
+// encoded a slice at a time into one reused buffer, each slice a single large write.
+// Returns false if it could not be written; 'written', if given, receives the
+// encoding used.
+bool SaveTextFile(const std::wstring& path, const std::wstring& text, TextEncoding encoding, TextEncoding* written = nullptr);
@@ -0,0 +1,166 @@
+#include "Timeline.h"
+#include <algorithm>
+#include <cstdio>     // For snprintf
+#include <filesystem>
+#include <fstream>
+
+namespace {
+    std::string jsonEscape(const char* text) {
+        std::string escaped;
+        for (; *text; ++text) {
+            if (*text == '"' || *text == '\\') escaped.push_back('\\');
+            escaped.push_back(*text);
+        }
+        return escaped;
+    }
+
+    // Microseconds with nanosecond digits, as trace viewers expect.
+    std::string formatMicros(uint64_t nanos) {
+        char number[32];
+        snprintf(number, sizeof(number), "%llu.%03llu", static_cast<unsigned long long>(nanos / 1000),
+            static_cast<unsigned long long>(nanos % 1000));
+        return number;
+    }
+}
+
+Timeline::Timeline() : epoch(std::chrono::steady_clock::now()) {}
+
+Timeline& Timeline::global() {
+    static Timeline timeline;
+    return timeline;
+}
+
+void Timeline::start(size_t eventsPerThreadLimit) {
+    eventsPerThread.store(std::max<size_t>(eventsPerThreadLimit, 1), std::memory_order_relaxed);
+    // Each thread's buffer notices the new id on its next span and starts over.
+    recordingId.fetch_add(1, std::memory_order_release);
+    recording.store(true, std::memory_order_relaxed);
+}
+
+void Timeline::stop() {
+    recording.store(false, std::memory_order_relaxed);
+}
+
+uint64_t Timeline::nowNanos() const {
+    return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - epoch).count());
+}
+
+Timeline::ThreadBuffer& Timeline::currentThreadBuffer() {
+    thread_local ThreadBuffer* buffer = nullptr; // There is only the global timeline
+    if (!buffer) {
+        std::lock_guard<std::mutex> guard(lock);
+        buffers.push_back(std::make_unique<ThreadBuffer>());
+        buffer = buffers.back().get();
+        buffer->threadId = static_cast<unsigned>(buffers.size());
+    }
+    return *buffer;
+}
+
+void Timeline::setThreadName(const char* name) {
+    currentThreadBuffer().threadName.store(name, std::memory_order_relaxed);
+}
+
+// The ring buffer is a seqlock of sorts: a span claims its slot (bumping 'claimed')
+// before writing it and publishes it by bumping 'written', so an export that read a
+// slot while it was being overwritten sees the claim and drops it (see visitEvents).
+void Timeline::record(const char* name, uint64_t startNanos, uint64_t endNanos) {
+    ThreadBuffer& buffer = currentThreadBuffer();
+    unsigned id = recordingId.load(std::memory_order_acquire);
+    if (buffer.recordingId.load(std::memory_order_relaxed) != id) {
+        // First span of this recording on this thread. Exports skip the buffer until
+        // its id matches, so the slots can be replaced.
+        size_t capacity = eventsPerThread.load(std::memory_order_relaxed);
+        if (buffer.capacity != capacity) {
+            buffer.slots.reset(new Slot[capacity]);
+            buffer.capacity = capacity;
+        }
+        buffer.claimed.store(0, std::memory_order_relaxed);
+        buffer.written.store(0, std::memory_order_relaxed);
+        buffer.recordingId.store(id, std::memory_order_release);
+    }
+
+    uint64_t index = buffer.written.load(std::memory_order_relaxed);
+    buffer.claimed.store(index + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    Slot& slot = buffer.slots[index % buffer.capacity];
+    slot.name.store(name, std::memory_order_relaxed);
+    slot.startNanos.store(startNanos, std::memory_order_relaxed);
+    slot.durationNanos.store(endNanos > startNanos ? endNanos - startNanos : 0, std::memory_order_relaxed);
+    buffer.written.store(index + 1, std::memory_order_release);
+}
+
+template <typename Visit>
+void Timeline::visitEvents(const ThreadBuffer& buffer, Visit visit) const {
+    if (buffer.recordingId.load(std::memory_order_acquire) != recordingId.load(std::memory_order_relaxed)) {
+        return; // Nothing recorded on this thread since start()
+    }
+    struct Event { uint64_t index; const char* name; uint64_t startNanos; uint64_t durationNanos; };
+    std::vector<Event> events;
+    uint64_t end = buffer.written.load(std::memory_order_acquire);
+    uint64_t first = end > buffer.capacity ? end - buffer.capacity : 0;
+    events.reserve(static_cast<size_t>(end - first));
+    for (uint64_t index = first; index < end; ++index) {
+        const Slot& slot = buffer.slots[index % buffer.capacity];
+        events.push_back(Event{ index, slot.name.load(std::memory_order_relaxed),
+            slot.startNanos.load(std::memory_order_relaxed), slot.durationNanos.load(std::memory_order_relaxed) });
+    }
+    std::atomic_thread_fence(std::memory_order_acquire);
+    // Slots claimed by spans since (including one still being written) may be torn.
+    uint64_t claimed = buffer.claimed.load(std::memory_order_relaxed);
+    uint64_t safeFirst = claimed > buffer.capacity ? claimed - buffer.capacity : 0;
+    for (const Event& event : events) {
+        if (event.index >= safeFirst && event.name) {
+            visit(event.name, event.startNanos, event.durationNanos);
+        }
+    }
+}
+
+std::string Timeline::toChromeTraceJson() const {
+    std::lock_guard<std::mutex> guard(lock);
+    std::string json = "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+    json += "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"tid\":0,\"args\":{\"name\":\"TextEditor\"}}";
+    for (const auto& buffer : buffers) {
+        std::string tid = std::to_string(buffer->threadId);
+        if (const char* threadName = buffer->threadName.load(std::memory_order_relaxed)) {
+            json += ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" + tid
+                + ",\"args\":{\"name\":\"" + jsonEscape(threadName) + "\"}}";
+        }
+        visitEvents(*buffer, [&](const char* name, uint64_t startNanos, uint64_t durationNanos) {
+            json += ",\n{\"name\":\"" + jsonEscape(name) + "\",\"ph\":\"X\",\"pid\":1,\"tid\":" + tid
+                + ",\"ts\":" + formatMicros(startNanos) + ",\"dur\":" + formatMicros(durationNanos) + "}";
+        });
+    }
+    json += "\n]}\n";
+    return json;
+}
+
+bool Timeline::writeChromeTrace(const std::wstring& path) const {
+    std::ofstream out(std::filesystem::path(path), std::ios::binary | std::ios::trunc);
+    if (!out) {
+        return false;
+    }
+    out << toChromeTraceJson();
+    return static_cast<bool>(out);
+}
+
+size_t Timeline::eventCount() const {
+    std::lock_guard<std::mutex> guard(lock);
+    size_t count = 0;
+    for (const auto& buffer : buffers) {
+        visitEvents(*buffer, [&](const char*, uint64_t, uint64_t) { count++; });
+    }
+    return count;
+}
+
+size_t Timeline::droppedCount() const {
+    std::lock_guard<std::mutex> guard(lock);
+    size_t dropped = 0;
+    unsigned id = recordingId.load(std::memory_order_relaxed);
+    for (const auto& buffer : buffers) {
+        if (buffer->recordingId.load(std::memory_order_acquire) == id) {
+            uint64_t written = buffer->written.load(std::memory_order_relaxed);
+            dropped += static_cast<size_t>(written > buffer->capacity ? written - buffer->capacity : 0);
+        }
+    }
+    return dropped;
+}
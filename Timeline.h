@@ -0,0 +1,116 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>    // For size_t
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// A timeline of what each thread did and for how long: nested spans (TIMELINE_SPAN at
+// the top of a function), exported in Chrome's trace-event format for chrome://tracing
+// or Perfetto. Where Metrics.h answers "how slow is a checkout usually", this answers
+// "what ran on the UI thread during that one stalled checkout".
+//
+// Recording is off until start(). While it is off a span costs one relaxed load; while
+// on, two clock reads and a few stores into the calling thread's ring buffer, with no
+// lock and no allocation (the buffer is allocated on the thread's first span). Each
+// thread keeps its latest 'eventsPerThread' spans. Building with TEXTEDITOR_TIMELINE=0
+// removes the spans altogether.
+
+#ifndef TEXTEDITOR_TIMELINE
+#define TEXTEDITOR_TIMELINE 1
+#endif
+
+class Timeline {
+public:
+    static const size_t DEFAULT_EVENTS_PER_THREAD = 64 * 1024;
+
+    // The timeline every TIMELINE_SPAN records to.
+    static Timeline& global();
+
+    // Starts a new recording, dropping the previous one. Not concurrently with an export.
+    void start(size_t eventsPerThread = DEFAULT_EVENTS_PER_THREAD);
+    void stop();
+    bool isRecording() const { return recording.load(std::memory_order_relaxed); }
+
+    // Names the calling thread in exports. 'name' must outlive the timeline (a literal).
+    void setThreadName(const char* name);
+
+    // Adds a finished span of the calling thread; 'name' must be a literal. Times are
+    // from nowNanos().
+    void record(const char* name, uint64_t startNanos, uint64_t endNanos);
+    uint64_t nowNanos() const;
+
+    // The current recording as Chrome trace-event JSON ("X" events, microseconds).
+    // Safe while recording continues: spans still being overwritten are left out.
+    std::string toChromeTraceJson() const;
+    bool writeChromeTrace(const std::wstring& path) const;
+    size_t eventCount() const;   // Spans an export would contain
+    size_t droppedCount() const; // Spans the ring buffers already overwrote
+
+private:
+    Timeline();
+
+    // One per thread that ever recorded a span, owned by the timeline and reused by
+    // later recordings. Only its thread writes to it; slots are atomics so exports can
+    // read them at the same time.
+    struct Slot {
+        std::atomic<const char*> name{ nullptr };
+        std::atomic<uint64_t> startNanos{ 0 };
+        std::atomic<uint64_t> durationNanos{ 0 };
+    };
+    struct ThreadBuffer {
+        unsigned threadId = 0;                     // Small number, for the export
+        std::atomic<const char*> threadName{ nullptr };
+        std::atomic<unsigned> recordingId{ 0 };    // The recording the slots belong to
+        std::unique_ptr<Slot[]> slots;
+        size_t capacity = 0;
+        std::atomic<uint64_t> claimed{ 0 };        // Spans ever started writing this recording
+        std::atomic<uint64_t> written{ 0 };        // Of which finished
+    };
+
+    std::atomic<bool> recording{ false };
+    std::atomic<unsigned> recordingId{ 0 };
+    std::atomic<size_t> eventsPerThread{ DEFAULT_EVENTS_PER_THREAD };
+    const std::chrono::steady_clock::time_point epoch;
+    mutable std::mutex lock; // Guards 'buffers' (the list, not their contents)
+    std::vector<std::unique_ptr<ThreadBuffer>> buffers;
+
+    ThreadBuffer& currentThreadBuffer();
+    // Copies the spans of a buffer that are safe to read: [first, end) of its writes.
+    template <typename Visit> void visitEvents(const ThreadBuffer& buffer, Visit visit) const;
+};
+
+// Records the enclosing scope as a span, if the timeline is recording.
+class ScopedSpan {
+public:
+    explicit ScopedSpan(const char* name)
+        : name(Timeline::global().isRecording() ? name : nullptr) {
+        if (this->name) {
+            startNanos = Timeline::global().nowNanos();
+        }
+    }
+    ~ScopedSpan() {
+        if (name) {
+            Timeline& timeline = Timeline::global();
+            timeline.record(name, startNanos, timeline.nowNanos());
+        }
+    }
+    ScopedSpan(const ScopedSpan&) = delete;
+    ScopedSpan& operator=(const ScopedSpan&) = delete;
+
+private:
+    const char* name;
+    uint64_t startNanos = 0;
+};
+
+#if TEXTEDITOR_TIMELINE
+#define TIMELINE_CONCAT_INNER(a, b) a##b
+#define TIMELINE_CONCAT(a, b) TIMELINE_CONCAT_INNER(a, b)
+#define TIMELINE_SPAN(name) ScopedSpan TIMELINE_CONCAT(timelineSpan, __LINE__)(name)
+#else
+#define TIMELINE_SPAN(name) ((void)0)
+#endif
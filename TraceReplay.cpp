@@ -0,0 +1,347 @@
+#include "TraceReplay.h"
+#include "VersionHistoryManager.h"
+#include "ChangeCapture.h"
+#include <algorithm>
+#include <chrono>
+#include <unordered_map>
+#include <vector>
+
+namespace {
+    using Clock = std::chrono::steady_clock;
+
+    double elapsedMicros(Clock::time_point start) {
+        return std::chrono::duration<double, std::micro>(Clock::now() - start).count();
+    }
+
+    TraceOperationStats summarize(std::vector<double>& samples) {
+        TraceOperationStats stats;
+        if (samples.empty()) {
+            return stats;
+        }
+        std::sort(samples.begin(), samples.end());
+        stats.count = samples.size();
+        for (double sample : samples) {
+            stats.totalMicros += sample;
+        }
+        stats.p50Micros = samples[samples.size() / 2];
+        stats.p99Micros = samples[std::min(samples.size() - 1, samples.size() * 99 / 100)];
+        stats.maxMicros = samples.back();
+        return stats;
+    }
+
+    std::wstring widen(const char* text) {
+        std::wstring wide;
+        while (*text) wide.push_back(static_cast<wchar_t>(*text++));
+        return wide;
+    }
+}
+
+const char* TraceRecordTypeName(TraceRecordType type) {
+    switch (type) {
+    case TraceRecordType::Config:     return "config";
+    case TraceRecordType::Root:       return "root";
+    case TraceRecordType::Node:       return "node";
+    case TraceRecordType::Edit:       return "edit";
+    case TraceRecordType::Record:     return "record";
+    case TraceRecordType::Parent:     return "parent";
+    case TraceRecordType::Child:      return "child";
+    case TraceRecordType::Checkout:   return "checkout";
+    case TraceRecordType::SetCurrent: return "set_current";
+    case TraceRecordType::Delete:     return "delete";
+    case TraceRecordType::Compact:    return "compact";
+    }
+    return "unknown";
+}
+
+bool ReplayTrace(const std::wstring& tracePath, TraceReplayResult& result) {
+    result = TraceReplayResult();
+    EditTraceReader reader;
+    if (!reader.open(tracePath)) {
+        return false;
+    }
+
+    TraceRecord config;
+    config.checkpointInterval = VersionHistoryManager::DEFAULT_CHECKPOINT_INTERVAL;
+    config.checkpointBudgetBytes = VersionHistoryManager::DEFAULT_CHECKPOINT_BUDGET_BYTES;
+
+    std::unique_ptr<VersionHistoryManager> history;
+    std::unordered_map<uint64_t, std::shared_ptr<HistoryNode>> nodes; // Trace id -> replayed node
+    std::map<std::string, std::vector<double>> samples;
+    PieceTable editorText; // What the editor control held, for replaying captured edits
+    bool inSnapshot = true;
+    Clock::time_point setupStart = Clock::now();
+
+    auto findNode = [&nodes](uint64_t id) -> std::shared_ptr<HistoryNode> {
+        auto it = nodes.find(id);
+        return it != nodes.end() ? it->second : nullptr;
+    };
+
+    auto diverged = [&result](size_t recordIndex, const TraceRecord& record, const wchar_t* what) {
+        if (result.divergences++ == 0) {
+            result.firstDivergence = L"record " + std::to_wstring(recordIndex) + L" ("
+                + widen(TraceRecordTypeName(record.type)) + L"): " + what;
+        }
+    };
+
+    TraceRecord record;
+    while (reader.next(record)) {
+        size_t recordIndex = result.records++;
+        result.sessionMicros = record.elapsedMicros;
+
+        if (record.type == TraceRecordType::Config) {
+            config = record;
+            continue;
+        }
+        if (record.type == TraceRecordType::Root) {
+            history = std::make_unique<VersionHistoryManager>(record.text);
+            history->setCheckpointPolicy(config.checkpointInterval, config.checkpointBudgetBytes);
+            VersionHistoryManager::RetentionPolicy retention;
+            retention.maxNodes = config.maxNodes;
+            retention.maxBytes = config.maxBytes;
+            retention.maxAge = std::chrono::seconds(config.maxAgeSeconds);
+            history->setRetentionPolicy(retention);
+            history->setPayloadCompression(config.payloadCompression);
+            nodes.clear();
+            nodes[record.nodeId] = std::const_pointer_cast<HistoryNode>(history->getHistoryTreeRoot());
+            inSnapshot = true;
+            setupStart = Clock::now();
+            continue;
+        }
+        if (!history) {
+            return false; // Operations before any snapshot
+        }
+
+        // --- Snapshot: rebuild the tree the session started from (untimed) ---
+        if (inSnapshot) {
+            if (record.type == TraceRecordType::Node) {
+                std::shared_ptr<HistoryNode> parent = findNode(record.parentId);
+                if (!parent) {
+                    return false;
+                }
+                history->checkoutNode(parent);
+                history->recordChange(record.change, record.text);
+                nodes[record.nodeId] = history->getMutableCurrentNode();
+                result.snapshotNodes++;
+                continue;
+            }
+            if (record.type == TraceRecordType::SetCurrent) {
+                if (std::shared_ptr<HistoryNode> current = findNode(record.nodeId)) {
+                    history->checkoutNode(current);
+                }
+                editorText = history->getCurrentDocument();
+                inSnapshot = false;
+                result.setupMillis = elapsedMicros(setupStart) / 1000.0;
+                continue;
+            }
+            inSnapshot = false; // A truncated snapshot: replay what follows as is
+            result.setupMillis = elapsedMicros(setupStart) / 1000.0;
+        }
+
+        // --- Timed operations ---
+        std::vector<double>& timings = samples[TraceRecordTypeName(record.type)];
+        Clock::time_point start;
+        switch (record.type) {
+        case TraceRecordType::Edit:
+            start = Clock::now();
+            editorText.applyChange(record.change);
+            timings.push_back(elapsedMicros(start));
+            continue; // Not a history operation; nothing to verify
+        case TraceRecordType::Record:
+            start = Clock::now();
+            history->recordChange(record.change, record.text);
+            timings.push_back(elapsedMicros(start));
+            nodes[record.outcome.currentNodeId] = history->getMutableCurrentNode();
+            break;
+        case TraceRecordType::Parent:
+            start = Clock::now();
+            history->moveCurrentNodeToParent();
+            timings.push_back(elapsedMicros(start));
+            break;
+        case TraceRecordType::Child:
+            start = Clock::now();
+            history->moveCurrentNodeToChild(static_cast<size_t>(record.count));
+            timings.push_back(elapsedMicros(start));
+            break;
+        case TraceRecordType::Checkout:
+        case TraceRecordType::SetCurrent:
+        case TraceRecordType::Delete: {
+            std::shared_ptr<HistoryNode> target = findNode(record.nodeId);
+            if (!target) {
+                diverged(recordIndex, record, L"target node is not in the replayed tree");
+                continue;
+            }
+            start = Clock::now();
+            if (record.type == TraceRecordType::Checkout) {
+                history->checkoutNode(target);
+            }
+            else if (record.type == TraceRecordType::SetCurrent) {
+                history->setCurrentNode(target);
+            }
+            else {
+                history->deleteNode(target);
+                nodes.erase(record.nodeId);
+            }
+            timings.push_back(elapsedMicros(start));
+            break;
+        }
+        case TraceRecordType::Compact:
+            start = Clock::now();
+            history->compactHistory(static_cast<size_t>(record.count));
+            timings.push_back(elapsedMicros(start));
+            break;
+        default:
+            diverged(recordIndex, record, L"unexpected record after the snapshot");
+            continue;
+        }
+
+        // The editor shows whatever the history operation left current.
+        editorText = history->getCurrentDocument();
+
+        const PieceTable& document = history->getCurrentDocument();
+        if (findNode(record.outcome.currentNodeId) != history->getMutableCurrentNode()) {
+            diverged(recordIndex, record, L"ended on a different node");
+        }
+        else if (document.length() != record.outcome.contentLength || document.contentHash() != record.outcome.contentHash) {
+            diverged(recordIndex, record, L"document differs");
+        }
+        else if (history->getNodeCount() != record.outcome.nodeCount) {
+            diverged(recordIndex, record, L"node count differs");
+        }
+        result.peakHistoryBytes = std::max(result.peakHistoryBytes,
+            history->getHistoryBytes() + history->getCheckpointMemoryUsage());
+    }
+
+    if (!history) {
+        return false;
+    }
+    if (inSnapshot) {
+        result.setupMillis = elapsedMicros(setupStart) / 1000.0;
+    }
+    for (auto& entry : samples) {
+        result.operations[entry.first] = summarize(entry.second);
+    }
+    result.truncated = reader.isTruncated();
+    result.finalNodeCount = history->getNodeCount();
+    result.peakHistoryBytes = std::max(result.peakHistoryBytes,
+        history->getHistoryBytes() + history->getCheckpointMemoryUsage());
+    return true;
+}
+
+bool ReadTracedEdits(const std::wstring& tracePath, std::wstring& initialText, std::vector<TimedEdit>& edits) {
+    edits.clear();
+    EditTraceReader reader;
+    if (!reader.open(tracePath)) {
+        return false;
+    }
+
+    // Only the snapshot's current text matters here, so its tree is rebuilt plainly.
+    std::unique_ptr<VersionHistoryManager> history;
+    std::unordered_map<uint64_t, std::shared_ptr<HistoryNode>> nodes;
+    bool inSnapshot = true;
+    TraceRecord record;
+    while (reader.next(record)) {
+        if (record.type == TraceRecordType::Config) {
+            continue;
+        }
+        if (record.type == TraceRecordType::Root) {
+            history = std::make_unique<VersionHistoryManager>(record.text);
+            history->setCheckpointPolicy(0, 0);
+            nodes.clear();
+            nodes[record.nodeId] = std::const_pointer_cast<HistoryNode>(history->getHistoryTreeRoot());
+            edits.clear();
+            inSnapshot = true;
+            continue;
+        }
+        if (!history) {
+            return false;
+        }
+        if (inSnapshot) {
+            auto parent = nodes.find(record.parentId);
+            if (record.type == TraceRecordType::Node && parent != nodes.end()) {
+                history->checkoutNode(parent->second);
+                history->recordChange(record.change, record.text);
+                nodes[record.nodeId] = history->getMutableCurrentNode();
+                continue;
+            }
+            auto current = nodes.find(record.nodeId);
+            if (record.type == TraceRecordType::SetCurrent && current != nodes.end()) {
+                history->checkoutNode(current->second);
+            }
+            initialText = history->getCurrentState();
+            inSnapshot = false;
+            if (record.type == TraceRecordType::SetCurrent) {
+                continue;
+            }
+        }
+
+        if (record.type == TraceRecordType::Edit) {
+            edits.push_back(TimedEdit{ record.elapsedMicros, std::move(record.change) });
+        }
+        else if (record.type != TraceRecordType::Record && record.type != TraceRecordType::Compact) {
+            break; // The editor's text was replaced; later edits apply to a text we don't have
+        }
+    }
+    if (history && inSnapshot) {
+        initialText = history->getCurrentState();
+    }
+    return history != nullptr;
+}
+
+AutoCommitSimulation SimulateAutoCommits(const std::wstring& initialText, const std::vector<TimedEdit>& edits,
+                                         const AutoCommitScheduler::Policy& policy) {
+    using Time = AutoCommitScheduler::TimePoint;
+    const AutoCommitScheduler::DocumentId document = 0;
+
+    AutoCommitSimulation result;
+    AutoCommitScheduler scheduler(policy);
+    VersionHistoryManager history(initialText);
+    PieceTable editorText(initialText);
+    EditCoalescer pending;
+    std::vector<double> costs;
+    size_t committedChars = 0;
+
+    auto commit = [&]() {
+        committedChars += pending.editedLength();
+        ChangeSet change = pending.take();
+        Clock::time_point start = Clock::now();
+        if (!change.isEmpty()) {
+            history.recordChange(change, L"Auto");
+        }
+        double micros = elapsedMicros(start);
+        costs.push_back(micros);
+        scheduler.noteCommit(document, std::chrono::microseconds(static_cast<long long>(micros)));
+    };
+    // Idle commits whose deadlines passed by 'now'.
+    auto commitIdle = [&](Time now) {
+        for (std::optional<Time> deadline = scheduler.nextDeadline(); deadline && *deadline <= now; deadline = scheduler.nextDeadline()) {
+            for (AutoCommitScheduler::DocumentId due : scheduler.takeDue(*deadline)) {
+                (void)due; // Only one document
+                commit();
+                result.idleCommits++;
+            }
+        }
+    };
+
+    for (const TimedEdit& edit : edits) {
+        Time now = Time(std::chrono::microseconds(edit.elapsedMicros));
+        commitIdle(now);
+
+        editorText.applyChange(edit.change);
+        pending.append(edit.change);
+        result.edits++;
+        result.maxPendingChars = std::max(result.maxPendingChars, pending.editedLength());
+        size_t editedChars = edit.change.insertedLength() + edit.change.deletedLength();
+        if (scheduler.noteEdit(document, editedChars, editorText.length(), now)) {
+            commit();
+            result.thresholdCommits++;
+        }
+    }
+    commitIdle(Time::max()); // The session ended; the last idle deadline passes too
+
+    size_t commits = result.thresholdCommits + result.idleCommits;
+    result.commits = summarize(costs);
+    result.meanCommittedChars = commits ? static_cast<double>(committedChars) / commits : 0;
+    const PieceTable& recorded = history.getCurrentDocument();
+    result.consistent = recorded.length() == editorText.length() && recorded.contentHash() == editorText.contentHash();
+    return result;
+}
@@ -0,0 +1,73 @@
+#pragma once
+
+#include <string>
+#include <map>
+#include <vector>
+#include <cstddef>    // For size_t
+#include <cstdint>
+#include "EditTrace.h"
+#include "AutoCommitScheduler.h"
+
+// Headless replay of an editing trace (see EditTrace.h). The trace's snapshot is
+// rebuilt into a fresh VersionHistoryManager with the session's policies (untimed),
+// then every recorded edit and history operation is performed again in order and
+// timed on its own. After each operation the replay's current node, node count and
+// document hash are compared with what the session recorded.
+
+struct TraceOperationStats {
+    size_t count = 0;
+    double totalMicros = 0;
+    double p50Micros = 0;
+    double p99Micros = 0;
+    double maxMicros = 0;
+};
+
+struct TraceReplayResult {
+    size_t records = 0;
+    size_t snapshotNodes = 0;
+    bool truncated = false;           // The trace ended in a torn record
+    uint64_t sessionMicros = 0;       // Wall time the recorded session spanned
+    double setupMillis = 0;           // Rebuilding the snapshot
+    std::map<std::string, TraceOperationStats> operations; // By record type name
+    size_t divergences = 0;           // Operations whose outcome differed from the session
+    std::wstring firstDivergence;
+    size_t peakHistoryBytes = 0;      // Largest getHistoryBytes() + checkpoint memory seen
+    size_t finalNodeCount = 0;
+};
+
+// Replays the trace at 'tracePath'. Returns false if it can't be read or has no
+// snapshot to start from.
+bool ReplayTrace(const std::wstring& tracePath, TraceReplayResult& result);
+
+// Lower-case name of a record type, as used in TraceReplayResult::operations.
+const char* TraceRecordTypeName(TraceRecordType type);
+
+// --- Auto-commit simulation ---
+// The typing of a trace replayed on simulated time through an AutoCommitScheduler:
+// edits are folded into an EditCoalescer, and whenever the scheduler says so (at its
+// threshold, or when an idle deadline passes between two edits) they are recorded in a
+// fresh history. Commit costs are measured and fed back, as the editor does. The
+// commits the session itself made are ignored, so policies can be compared.
+
+struct TimedEdit {
+    uint64_t elapsedMicros = 0; // Since the start of the trace
+    ChangeSet change;
+};
+
+struct AutoCommitSimulation {
+    size_t edits = 0;
+    size_t thresholdCommits = 0;
+    size_t idleCommits = 0;
+    TraceOperationStats commits;      // Measured cost of each commit
+    size_t maxPendingChars = 0;       // Most edited characters ever left uncommitted
+    double meanCommittedChars = 0;    // Edited characters per commit
+    bool consistent = true;           // The history ended on the edited text
+};
+
+// The editor text after the trace's snapshot and the edits that follow it, up to the
+// first history operation that would replace that text (a move or a deletion).
+// Returns false if the trace can't be read or has no snapshot.
+bool ReadTracedEdits(const std::wstring& tracePath, std::wstring& initialText, std::vector<TimedEdit>& edits);
+
+AutoCommitSimulation SimulateAutoCommits(const std::wstring& initialText, const std::vector<TimedEdit>& edits,
+                                         const AutoCommitScheduler::Policy& policy);
@@ -1,58 +1,158 @@
 #include "VersionHistoryManager.h"
-#include <Windows.h>
 #include <stack>
+#include <ctime>
 #include <algorithm>
+#include <filesystem>
+#include "BlobStore.h"
+#include "ChangePacking.h"
+#include "Metrics.h"
+#include "Timeline.h"
+
+namespace {
+    // localtime_s is the MSVC spelling; POSIX has localtime_r with swapped arguments.
+    void toLocalTime(time_t time, tm& local) {
+#ifdef _WIN32
+        localtime_s(&local, &time);
+#else
+        localtime_r(&time, &local);
+#endif
+    }
+}
 
 // --- Helper Function: ---
 
-std::wstring VersionHistoryManager::applyChangeToString(const std::wstring& text, const TextChange& change) {
+std::wstring VersionHistoryManager::applyChangeToString(const std::wstring& text, const ChangeSet& change) {
     std::wstring result = text;
+    applyChangeInPlace(result, change);
+    return result;
+}
+
+void VersionHistoryManager::applyChangeInPlace(std::wstring& text, const TextChange& change) {
     size_t pos = change.position;
     size_t delLength = change.deletedText.length();
-    size_t insLength = change.insertedText.length();
 
     // keep position to be within the bounds of the string
-    if (pos > result.length()) {
-        pos = result.length();
+    if (pos > text.length()) {
+        pos = text.length();
     }
 
-    // Perform deletion first, clamping length if necessary
-    if (delLength > 0) {
-        if (pos + delLength > result.length()) {
-            delLength = result.length() - pos; // Adjust length if it goes past the end
-        }
-        if (delLength > 0) { // Check again after adjustment
-            result.erase(pos, delLength);
-        }
+    // Clamp the deletion if it goes past the end
+    if (pos + delLength > text.length()) {
+        delLength = text.length() - pos;
     }
 
-    // Perform insertion
-    if (insLength > 0) {
-        result.insert(pos, change.insertedText);
+    // A single replace shifts the tail once, instead of once for erase and once for insert.
+    if (delLength > 0 || !change.insertedText.empty()) {
+        text.replace(pos, delLength, change.insertedText);
     }
+}
 
-    return result;
+void VersionHistoryManager::applyChangeInPlace(std::wstring& text, const ChangeSet& changes) {
+    std::vector<const TextChange*> hunks;
+    hunks.reserve(changes.hunks.size());
+    for (const TextChange& hunk : changes.hunks) {
+        hunks.push_back(&hunk);
+    }
+    applyChangesInPlace(text, hunks);
+}
+
+void VersionHistoryManager::applyChangesInPlace(std::wstring& text, const std::vector<const TextChange*>& changes) {
+    if (changes.empty()) {
+        return;
+    }
+
+    // Reserve once for the worst case so no apply step has to reallocate.
+    size_t peakLength = text.length();
+    for (const TextChange* change : changes) {
+        peakLength += change->insertedText.length();
+    }
+    text.reserve(peakLength);
+
+    size_t i = 0;
+    while (i < changes.size()) {
+        // Common case: the next change is elsewhere in the document, apply directly.
+        if (i + 1 == changes.size() || !changes[i]->canMergeWith(*changes[i + 1])) {
+            applyChangeInPlace(text, *changes[i]);
+            ++i;
+            continue;
+        }
+
+        // A run of touching changes (e.g. consecutive typing): fold them into one
+        // change, which only costs their payload size, then shift the buffer once.
+        TextChange batch = *changes[i];
+        ++i;
+        while (i < changes.size() && batch.tryMerge(*changes[i])) {
+            ++i;
+        }
+        applyChangeInPlace(text, batch);
+    }
 }
 
 // --- Constructor ---
 
 VersionHistoryManager::VersionHistoryManager(const std::wstring& initialContent)
-    : initialRootState(initialContent) {
+    : rootDocument(BlobStore::global().intern(initialContent)) { // One copy however many tabs open the text
     // Root node represents the initial state; it has no parent and no change leading to it.
-    root = std::make_shared<HistoryNode>();
+    root = std::allocate_shared<HistoryNode>(ArenaAllocator<HistoryNode>(nodeArena));
+    root->contentHash = rootDocument.contentHash();
+    root->contentLength = rootDocument.length();
     currentNode = root;
+    currentDocument = rootDocument;
+    indexNode(root);
+    historyBytes = nodeSizeInBytes(*root);
+}
+
+VersionHistoryManager::~VersionHistoryManager() {
+    journalCurrentNode();
 }
 
 // --- Core Recording Method ---
 
-void VersionHistoryManager::recordChange(const TextChange& change, const std::wstring&message) {
+void VersionHistoryManager::recordChange(const ChangeSet& change, const std::wstring&message) {
+    TIMELINE_SPAN("VersionHistoryManager::recordChange");
+    static LatencyHistogram& latency = LatencyMetric("history.record_change");
+    ScopedLatency timing(latency);
     // Avoid recording changes that result in no actual text difference.
-    if (change.insertedText.empty() && change.deletedText.empty()) {
+    if (change.isEmpty()) {
+        return;
+    }
+
+    // Normalize each hunk against the text it actually applies to: clamp the position
+    // and take the deleted text from the document. Applying it is unchanged, but the
+    // stored change is now exactly reversible even if the caller's baseline had drifted.
+    // Hunks apply in sequence, so each one is normalized against the document as the
+    // hunks before it left it. Empty hunks are dropped.
+    ChangeSet recorded;
+    recorded.hunks.reserve(change.hunks.size());
+    PieceTable document = currentDocument;
+    for (const TextChange& hunk : change.hunks) {
+        TextChange normalized = hunk;
+        normalized.position = std::min(hunk.position, document.length());
+        normalized.deletedText = document.substr(normalized.position, hunk.deletedText.length());
+        if (normalized.insertedText.empty() && normalized.deletedText.empty()) {
+            continue;
+        }
+        document.applyChange(normalized);
+        recorded.hunks.push_back(std::move(normalized));
+    }
+    if (recorded.isEmpty()) {
         return;
     }
 
     // Create a new node representing the state *after* the change.
-    auto newNode = std::make_shared<HistoryNode>(currentNode, change, message);
+    auto newNode = std::allocate_shared<HistoryNode>(ArenaAllocator<HistoryNode>(nodeArena), currentNode.get(), ChangeSet(), message);
+    newNode->id = nextNodeId++;
+    storeChange(*newNode, std::move(recorded));
+    nodeCount++;
+    historyBytes += nodeSizeInBytes(*newNode);
+    treeGeneration++;
+
+    // Advance the live document and derive the node's content hash from it. This is
+    // O(log n) per hunk: the piece table maintains the hash as the change is applied.
+    currentDocument = std::move(document);
+    newNode->contentHash = currentDocument.contentHash();
+    newNode->contentLength = currentDocument.length();
+    indexNode(newNode);
 
     // Add the new node as a child of the current node.
     currentNode->children.push_back(newNode);
@@ -62,24 +162,59 @@ void VersionHistoryManager::recordChange(const TextChange& change, const std::ws
     // before making this new change.
     currentNode = newNode;
 
-    // Optional: Implement history pruning (e.g., limit depth or node count) here if needed.
+    // Store a checkpoint at regular depths so later reconstructions of this branch
+    // replay at most 'checkpointInterval' changes. The live document is exactly this
+    // node's text, so the checkpoint is an O(1) piece-table snapshot.
+    if (checkpointInterval > 0 && newNode->depth % checkpointInterval == 0) {
+        storeCheckpoint(newNode, currentDocument);
+    }
+
+    if (journal) {
+        journal->appendNode(*newNode);
+        journaledCurrentId = newNode->id; // A node record moves the journal's current node too
+        if (newNode->depth % JOURNAL_CHECKPOINT_INTERVAL == 0) {
+            journal->appendCheckpoint(newNode->id, currentDocument);
+        }
+    }
+    if (trace) {
+        TraceRecord record;
+        record.type = TraceRecordType::Record;
+        record.text = message;
+        record.change = change;
+        record.outcome = traceOutcome();
+        trace->append(record);
+    }
+
+    // History is bounded by the retention policy; see compactHistory, which the caller
+    // runs in idle time rather than here.
 }
 
 
-void VersionHistoryManager::setCurrentNode(std::shared_ptr<HistoryNode> node) {
+bool VersionHistoryManager::setCurrentNode(std::shared_ptr<HistoryNode> node) {
     // Basic validation: Ensure the node actually exists (is part of the tree reachable from root)?
     // This could involve walking up the parent chain from 'node' to see if we reach 'root'.
     // For performance, we might skip this check, assuming the caller provides a valid node
     // obtained from findNodeMatchingState or getHistoryTreeRoot/getChildren traversal.
     if (node) { // At least check if it's not null
-        currentNode = node;
+        if (node != currentNode) {
+            try {
+                currentDocument = reconstructDocumentToNode(node);
+            }
+            catch (const DamagedHistoryError&) {
+                return false; // Its text can't be rebuilt; stay where we are
+            }
+            currentNode = node;
+            traceOperation(TraceRecordType::SetCurrent, node->id);
+        }
         // NOTE: This function ONLY changes the internal pointer.
         // It does NOT update the editor content or the 'textAtLastHistoryPoint' baseline.
         // The caller (e.g., SyncHistoryManagerToEditor, History UI logic) is responsible
         // for coordinating the editor state and baseline text updates.
+        return true;
     }
     else {
         // Handle error: Tried to set current node to null? .
+        return false;
     }
 }
 
@@ -87,7 +222,7 @@ void VersionHistoryManager::setCurrentNode(std::shared_ptr<HistoryNode> node) {
 
 bool VersionHistoryManager::canUndo() const {
     // Can undo if the current node is not the root (meaning it has a parent).
-    return currentNode && !currentNode->parent.expired();
+    return currentNode && currentNode->parent != nullptr;
 }
 
 bool VersionHistoryManager::canRedo() const {
@@ -96,20 +231,35 @@ bool VersionHistoryManager::canRedo() const {
 }
 
 // Moves internal pointer back for synchronization after undo.
-bool VersionHistoryManager::moveCurrentNodeToParent() {
+bool VersionHistoryManager::moveCurrentNodeToParent(ChangeSet* appliedChange) {
+    TIMELINE_SPAN("VersionHistoryManager::moveCurrentNodeToParent");
     if (!canUndo()) {
         return false;
     }
-    std::shared_ptr<HistoryNode> parentNode = currentNode->parent.lock();
+    HistoryNode* parentNode = currentNode->parent;
     if (parentNode) {
-        currentNode = parentNode;
+        // Undo just this edge on the live document, unless its change is damaged: then
+        // we stay here rather than show a wrong text for the parent.
+        ChangeSet buffer;
+        const ChangeSet* change = currentNode->tryGetChange(buffer);
+        if (!change) {
+            return false;
+        }
+        ChangeSet reverse = change->getReverseChange();
+        currentDocument.applyChange(reverse);
+        if (appliedChange) {
+            *appliedChange = std::move(reverse);
+        }
+        currentNode = parentNode->shared_from_this();
+        traceOperation(TraceRecordType::Parent);
         return true;
     }
     return false; // Should not happen if canUndo was true, but check anyway
 }
 
 // Moves internal pointer forward for synchronization after standard redo.
-bool VersionHistoryManager::moveCurrentNodeToChild(size_t childIndex) {
+bool VersionHistoryManager::moveCurrentNodeToChild(size_t childIndex, ChangeSet* appliedChange) {
+    TIMELINE_SPAN("VersionHistoryManager::moveCurrentNodeToChild");
     if (!canRedo()) {
         return false;
     }
@@ -123,13 +273,58 @@ bool VersionHistoryManager::moveCurrentNodeToChild(size_t childIndex) {
 
     // Check bounds again after potential adjustment
     if (targetIndex < currentNode->children.size()) {
-        currentNode = currentNode->children[targetIndex];
+        std::shared_ptr<HistoryNode> child = currentNode->children[targetIndex];
+        ChangeSet buffer;
+        const ChangeSet* change = child->tryGetChange(buffer);
+        if (!change) {
+            return false; // Damaged: the child's text can't be had from here
+        }
+        currentDocument.applyChange(*change);
+        if (appliedChange) {
+            *appliedChange = *change;
+        }
+        currentNode = std::move(child);
+        traceOperation(TraceRecordType::Child, 0, targetIndex);
         return true;
     }
 
     return false;
 }
 
+// Steps to the parent and sends just that edge's change to 'sink'.
+bool VersionHistoryManager::stepToParent(EditSink& sink) {
+    ChangeSet delta;
+    if (!moveCurrentNodeToParent(&delta)) {
+        return false;
+    }
+    ApplyChangeSetToSink(delta, sink);
+    return true;
+}
+
+// Steps to a child and sends just that edge's change to 'sink'.
+bool VersionHistoryManager::stepToChild(EditSink& sink, size_t childIndex) {
+    ChangeSet delta;
+    if (!moveCurrentNodeToChild(childIndex, &delta)) {
+        return false;
+    }
+    ApplyChangeSetToSink(delta, sink);
+    return true;
+}
+
+bool VersionHistoryManager::stepToParent(std::wstring& text) {
+    StringEditSink sink(text);
+    return stepToParent(sink);
+}
+
+bool VersionHistoryManager::stepToChild(std::wstring& text, size_t childIndex) {
+    StringEditSink sink(text);
+    return stepToChild(sink, childIndex);
+}
+
+const PieceTable& VersionHistoryManager::getCurrentDocument() const {
+    return currentDocument;
+}
+
 
 std::vector<std::wstring> VersionHistoryManager::getRedoBranchDescriptions() const {
     std::vector<std::wstring> descriptions;
@@ -148,7 +343,7 @@ std::vector<std::wstring> VersionHistoryManager::getRedoBranchDescriptions() con
         // Format timestamp
         time_t tt = std::chrono::system_clock::to_time_t(child->timestamp);
         tm local_tm;
-        localtime_s(&local_tm, &tt);
+        toLocalTime(tt, local_tm);
         char timeBuffer[80];
         strftime(timeBuffer, sizeof(timeBuffer), "%H:%M:%S", &local_tm); // e.g., 14:35:10
         // Or use: "%Y-%m-%d %H:%M:%S" for full date and time
@@ -168,9 +363,15 @@ std::vector<std::wstring> VersionHistoryManager::getRedoBranchDescriptions() con
             description += L" (Auto)"; // Indicate automatic commit if no message
         }
 
-        description += L" (+" + std::to_wstring(child->changeFromParent.insertedText.length())
-            + L" / -" + std::to_wstring(child->changeFromParent.deletedText.length())
-            + L")";
+        ChangeSet buffer;
+        if (const ChangeSet* change = child->tryGetChange(buffer)) {
+            description += L" (+" + std::to_wstring(change->insertedLength())
+                + L" / -" + std::to_wstring(change->deletedLength())
+                + L")";
+        }
+        else {
+            description += L" (damaged)";
+        }
 
         descriptions.push_back(description);
     }
@@ -180,139 +381,362 @@ std::vector<std::wstring> VersionHistoryManager::getRedoBranchDescriptions() con
 
 // --- State Reconstruction and Switching ---
 
-// Reconstructs state by applying changes down from the root to the target node.
+// Reconstructs state by applying changes down from the nearest cached or checkpointed
+// ancestor (or the root) to the target node, and caches the result.
 std::wstring VersionHistoryManager::reconstructStateToNode(std::shared_ptr<const HistoryNode> targetNode) const {
+    TIMELINE_SPAN("VersionHistoryManager::reconstructStateToNode");
+    static LatencyHistogram& latency = LatencyMetric("history.reconstruct_state");
+    ScopedLatency timing(latency);
     if (!targetNode) {
         return L""; // Return empty for null target
     }
 
-    // Use a stack to store changes while walking up to the root.
-    std::stack<TextChange> changesToApply;
-    std::shared_ptr<const HistoryNode> walker = targetNode;
-
-    while (walker && !walker->isRoot()) {
-        changesToApply.push(walker->changeFromParent);
-        // Check parent validity before locking
-        if (walker->parent.expired()) break;
-        walker = walker->parent.lock();
+    // Collect the changes while walking up to the nearest cached state, checkpoint (in
+    // memory or in the journal) or the root. Pointers stay valid because 'targetNode'
+    // keeps its whole ancestor chain alive (parents own their children) until we are
+    // done applying.
+    std::vector<const TextChange*> changesToApply;
+    std::deque<ChangeSet> decoded;
+    const HistoryNode* walker = targetNode.get();
+    std::wstring currentState;
+    bool haveStart = false;
+    bool fromCache = false;
+
+    // Hunks are pushed last-first so the whole list can be reversed at the end.
+    while (walker) {
+        if (auto cached = findCachedState(*walker)) {
+            if (walker == targetNode.get()) {
+                stateCacheStats.hits++;
+                return *cached;
+            }
+            stateCacheStats.ancestorHits++;
+            currentState = *cached;
+            haveStart = true;
+            fromCache = true;
+            break;
+        }
+        if (walker->isRoot()) {
+            break;
+        }
+        if (walker->hasCheckpoint()) {
+            currentState = walker->checkpointState->toString();
+            haveStart = true;
+            break;
+        }
+        if (loadJournalCheckpoint(*walker, currentState)) {
+            haveStart = true;
+            break;
+        }
+        // Packed changes are decoded into 'decoded' (a deque, so the hunks don't move)
+        // and dropped again when we return.
+        ChangeSet buffer;
+        const ChangeSet* change = &walker->getChange(buffer);
+        if (change == &buffer) {
+            decoded.push_back(std::move(buffer));
+            change = &decoded.back();
+        }
+        const std::vector<TextChange>& hunks = change->hunks;
+        for (auto it = hunks.rbegin(); it != hunks.rend(); ++it) {
+            changesToApply.push_back(&*it);
+        }
+        walker = walker->parent;
     }
 
-    // Start with the initial state stored at the manager level.
-    std::wstring currentState = initialRootState;
-
-    // Apply changes sequentially down from the root.
-    while (!changesToApply.empty()) {
-        currentState = applyChangeToString(currentState, changesToApply.top());
-        changesToApply.pop();
+    // Start with the cached text or checkpoint if we stopped at one, otherwise the
+    // initial state.
+    if (!haveStart) {
+        currentState = rootDocument.toString();
+    }
+    if (!fromCache) {
+        stateCacheStats.misses++;
     }
 
+    // Apply changes sequentially down from the starting point, in one working buffer.
+    std::reverse(changesToApply.begin(), changesToApply.end());
+    applyChangesInPlace(currentState, changesToApply);
+
+    cacheState(*targetNode, currentState);
     return currentState;
 }
 
 // Gets the state corresponding to the internal current node pointer.
 std::wstring VersionHistoryManager::getCurrentState() const {
-    // Reconstruct state based on where the internal 'currentNode' pointer is.
-    return reconstructStateToNode(currentNode);
+    // The live document already holds the text at 'currentNode'; no replay needed.
+    return currentDocument.toString();
+}
+
+bool VersionHistoryManager::currentStateEquals(const std::wstring& state) const {
+    return currentDocument.equals(state);
 }
 
 // Switches the internal pointer and returns the full state for the History UI.
 std::wstring VersionHistoryManager::switchToNode(std::shared_ptr<HistoryNode> targetNode) {
+    TIMELINE_SPAN("VersionHistoryManager::switchToNode");
     if (!targetNode) {
         throw std::invalid_argument("Target node cannot be null for switchToNode.");
     }
 
-    // Optional: Add validation here to ensure targetNode belongs to this tree,
-    //           though it adds overhead. Assume valid node is passed from UI.
+    if (!checkoutNode(targetNode)) {
+        throw std::runtime_error("switchToNode: the target can't be reached through the damaged history.");
+    }
 
-    // Reconstruct the state at the target node BEFORE changing the internal pointer.
-    std::wstring targetState = reconstructStateToNode(targetNode);
+    // Return the full text state for the editor UI to display.
+    return currentDocument.toString();
+}
+
+bool VersionHistoryManager::checkoutNode(std::shared_ptr<HistoryNode> targetNode, EditSink* sink) {
+    if (!targetNode) {
+        throw std::invalid_argument("Target node cannot be null for checkoutNode.");
+    }
+    if (targetNode == currentNode) {
+        return true;
+    }
+    // Computed before moving; it needs the node we are leaving. A damaged change on
+    // the way leaves nothing to send the sink, so the checkout is refused.
+    ChangeSet netChange;
+    if (sink) {
+        try {
+            netChange = getNetChange(currentNode, targetNode);
+        }
+        catch (const DamagedHistoryError&) {
+            return false;
+        }
+    }
+
+    // Nearby targets (a sibling branch, a few steps back) are reached by undoing up to
+    // the common ancestor and redoing down from it on the live document. Far ones are
+    // rebuilt from the nearest checkpoint instead, which bounds the replay, and so are
+    // nearby ones whose path crosses a damaged change: the rebuild may not need it.
+    // Nothing is changed until the new text is complete.
+    bool moved = false;
+    if (isNearbyCheckout(targetNode)) {
+        const HistoryNode* ancestor = lowestCommonAncestor(currentNode.get(), targetNode.get());
+        try {
+            currentDocument.applyChange(composeChange(currentNode.get(), targetNode.get(), ancestor, false));
+            moved = true;
+        }
+        catch (const DamagedHistoryError&) {
+        }
+    }
+    if (!moved) {
+        try {
+            currentDocument = reconstructDocumentToNode(targetNode);
+        }
+        catch (const DamagedHistoryError&) {
+            return false;
+        }
+    }
 
     // Update the internal current node pointer *after* successful reconstruction.
     currentNode = targetNode;
+    traceOperation(TraceRecordType::Checkout, targetNode->id);
 
-    // Return the full text state for the editor UI to display.
-    return targetState;
+    if (sink) {
+        ApplyChangeSetToSink(netChange, *sink);
+    }
+    return true;
 }
 
-// --- Node Finding (for Syncing Editor State to History) ---
-
-std::shared_ptr<HistoryNode> VersionHistoryManager::findNodeMatchingState(const std::wstring& targetState) const {
-    // Uses Breadth-First Search (BFS) with state caching to find the node.
-    // This is necessary to sync the editor's state (after standard undo/redo)
-    // with our internal history tree before showing the history UI.
+bool VersionHistoryManager::isNearbyCheckout(std::shared_ptr<const HistoryNode> targetNode) const {
+    const HistoryNode* ancestor = lowestCommonAncestor(currentNode.get(), targetNode.get());
+    if (!ancestor) {
+        return false;
+    }
+    size_t pathLength = (currentNode->level - ancestor->level) + (targetNode->level - ancestor->level);
+    size_t rebuildLength = targetNode->level; // Replay from the root, or less from a checkpoint
+    if (checkpointInterval > 0) {
+        rebuildLength = std::min(rebuildLength, checkpointInterval);
+    }
+    return pathLength <= rebuildLength;
+}
 
-    std::queue<std::shared_ptr<HistoryNode>> q;
-    // Cache previously reconstructed states to avoid redundant computation.
-    // Key: Node pointer, Value: Reconstructed text state for that node.
-    std::map<std::shared_ptr<const HistoryNode>, std::wstring> stateCache;
+// --- Ancestor Queries ---
+
+// Brings the jump pointers of 'node' and its ancestors up to date. Jump pointers follow
+// the skew-binary scheme: a node jumps to its parent's jump's jump when the two jumps
+// below its parent span equal distances, otherwise to its parent. Any ancestor is then
+// reachable in O(log n) hops. Nodes recorded since the last query, and every node after
+// one was removed from the tree, are refreshed here on first use, top-down.
+void VersionHistoryManager::refreshAncestorIndex(const HistoryNode* node) const {
+    std::vector<const HistoryNode*> stale;
+    for (const HistoryNode* walker = node; walker && walker->ancestorEpoch != ancestorEpoch; walker = walker->parent) {
+        stale.push_back(walker);
+    }
 
-    if (!root) return nullptr; // Should not happen if constructed properly
+    for (auto it = stale.rbegin(); it != stale.rend(); ++it) {
+        const HistoryNode* current = *it;
+        const HistoryNode* parent = current->parent;
+        if (!parent) {
+            current->level = 0;
+            current->jump = current; // A root (or detached subtree top) jumps to itself
+        }
+        else {
+            const HistoryNode* parentJump = parent->jump;
+            current->level = parent->level + 1;
+            current->jump = (parent->level - parentJump->level == parentJump->level - parentJump->jump->level)
+                ? parentJump->jump : parent;
+        }
+        current->ancestorEpoch = ancestorEpoch;
+    }
+}
 
-    // Initialize BFS with the root node and its known state.
-    q.push(root);
-    stateCache[root] = initialRootState;
+// The ancestor of 'node' (or the node itself) at 'level' edges from the root.
+// 'node' must be refreshed.
+const HistoryNode* VersionHistoryManager::ancestorAtLevel(const HistoryNode* node, size_t level) {
+    while (node->level > level) {
+        node = node->jump->level >= level ? node->jump : node->parent;
+    }
+    return node;
+}
 
-    // Keep track of visited nodes during BFS ONLY IF the graph could have cycles
-    // (not possible with weak_ptr parent, shared_ptr children). So, not strictly needed here.
-    // std::set<std::shared_ptr<const HistoryNode>> visited;
-    // visited.insert(root);
+// Returns nullptr if the nodes are not in the same tree (e.g. one was deleted).
+const HistoryNode* VersionHistoryManager::lowestCommonAncestor(const HistoryNode* first, const HistoryNode* second) const {
+    if (!first || !second) {
+        return nullptr;
+    }
+    refreshAncestorIndex(first);
+    refreshAncestorIndex(second);
 
-    while (!q.empty()) {
-        std::shared_ptr<HistoryNode> node = q.front();
-        q.pop();
+    if (first->level > second->level) {
+        first = ancestorAtLevel(first, second->level);
+    }
+    else {
+        second = ancestorAtLevel(second, first->level);
+    }
 
-        // Retrieve the state for the current node (should be in cache from parent or initial).
-        std::wstring nodeState;
-        auto it = stateCache.find(node);
-        if (it != stateCache.end()) {
-            nodeState = it->second;
+    // Same level from here on, so both jump pointers land on the same level too. Jump
+    // while that stays below the common ancestor, otherwise step to the parent.
+    while (first != second) {
+        if (first->level == 0) {
+            return nullptr; // Two different roots
+        }
+        if (first->jump != second->jump) {
+            first = first->jump;
+            second = second->jump;
         }
         else {
-            // This case should ideally not happen if BFS proceeds level by level
-            // and states are cached when children are processed. If it does,
-            // reconstruct and cache. This indicates potential issue elsewhere.
-            // For robustness:
-            nodeState = reconstructStateToNode(node);
-            stateCache[node] = nodeState;
-        }
-
-        if (nodeState != targetState) {
-            // Optional: Add code here to compare character by character and log the first difference
-            for (size_t i = 0; i < std::min(targetState.length(), nodeState.length()); ++i) {
-                if (targetState[i] != nodeState[i]) {
-                    break;
-                }
-            }
-            if (targetState.length() != nodeState.length()) {
-                OutputDebugStringW(L"  States have different lengths.\n");
-            }
+            first = first->parent;
+            second = second->parent;
         }
+    }
+    return first;
+}
 
+std::shared_ptr<const HistoryNode> VersionHistoryManager::findCommonAncestor(std::shared_ptr<const HistoryNode> first, std::shared_ptr<const HistoryNode> second) const {
+    const HistoryNode* ancestor = lowestCommonAncestor(first.get(), second.get());
+    return ancestor ? ancestor->shared_from_this() : nullptr;
+}
 
-        // Check if this node's state matches the target state.
-        if (nodeState == targetState) {
-            // Found a match. Return this node.
-            // Note: If multiple nodes can have identical text states, this finds
-            // the first one encountered in BFS. You might need different logic
-            // (e.g., find latest timestamp) if specific duplicates must be handled.
-            return node;
+ChangeSet VersionHistoryManager::getNetChange(std::shared_ptr<const HistoryNode> from, std::shared_ptr<const HistoryNode> to) const {
+    const HistoryNode* ancestor = lowestCommonAncestor(from.get(), to.get());
+    if (!ancestor) {
+        throw std::invalid_argument("getNetChange: nodes are not in the same history tree.");
+    }
+    return composeChange(from.get(), to.get(), ancestor, true);
+}
+
+// Chains the reverse changes from 'from' up to 'ancestor' and the changes from there
+// down to 'to'. With 'fold', touching hunks are merged as they come and what is left
+// is trimmed to the characters that really differ, so edits that cancel out along the
+// path (typed, then deleted again) disappear from the result.
+ChangeSet VersionHistoryManager::composeChange(const HistoryNode* from, const HistoryNode* to, const HistoryNode* ancestor, bool fold) {
+    std::vector<const HistoryNode*> downPath;
+    for (const HistoryNode* walker = to; walker != ancestor; walker = walker->parent) {
+        downPath.push_back(walker);
+    }
+
+    ChangeSet composed;
+    auto append = [&composed, fold](const ChangeSet& change) {
+        for (const TextChange& hunk : change.hunks) {
+            if (!fold || composed.hunks.empty() || !composed.hunks.back().tryMerge(hunk)) {
+                composed.hunks.push_back(hunk);
+            }
         }
+    };
 
-        // Process children: reconstruct their state, cache it, and add to queue.
-        for (const auto& child : node->children) {
-            if (child /* && visited.find(child) == visited.end() */) { // Check if child is valid
-                // Calculate child state based on parent state and the change
-                if (stateCache.find(child) == stateCache.end()) {
-                    std::wstring childState = applyChangeToString(nodeState, child->changeFromParent);
-                    stateCache[child] = childState;
-                    q.push(child);
-                }
-                // visited.insert(child); // Only needed if cycles are possible
+    ChangeSet buffer;
+    for (const HistoryNode* walker = from; walker != ancestor; walker = walker->parent) {
+        append(walker->getChange(buffer).getReverseChange());
+    }
+    for (auto it = downPath.rbegin(); it != downPath.rend(); ++it) {
+        append((*it)->getChange(buffer));
+    }
+
+    if (fold) {
+        ChangeSet trimmed;
+        for (TextChange& hunk : composed.hunks) {
+            size_t prefix = 0;
+            size_t common = std::min(hunk.insertedText.length(), hunk.deletedText.length());
+            while (prefix < common && hunk.insertedText[prefix] == hunk.deletedText[prefix]) {
+                prefix++;
+            }
+            size_t suffix = 0;
+            while (suffix < common - prefix
+                && hunk.insertedText[hunk.insertedText.length() - 1 - suffix] == hunk.deletedText[hunk.deletedText.length() - 1 - suffix]) {
+                suffix++;
+            }
+            if (hunk.insertedText.length() == hunk.deletedText.length() && prefix + suffix == common) {
+                continue; // No net effect
             }
+            hunk.position += prefix;
+            hunk.insertedText = hunk.insertedText.substr(prefix, hunk.insertedText.length() - prefix - suffix);
+            hunk.deletedText = hunk.deletedText.substr(prefix, hunk.deletedText.length() - prefix - suffix);
+            trimmed.hunks.push_back(std::move(hunk));
+        }
+        composed = std::move(trimmed);
+    }
+    return composed;
+}
+
+// --- Node Finding (for Syncing Editor State to History) ---
+
+std::shared_ptr<HistoryNode> VersionHistoryManager::findNodeMatchingState(const std::wstring& targetState) const {
+    TIMELINE_SPAN("VersionHistoryManager::findNodeMatchingState");
+    static LatencyHistogram& latency = LatencyMetric("history.find_matching_state");
+    ScopedLatency timing(latency);
+    // Probes the state index with the target's content hash and length. This is
+    // necessary to sync the editor's state (after standard undo/redo) with our
+    // internal history tree before showing the history UI.
+    uint64_t targetHash = PieceTable::hashText(targetState);
+    auto range = stateIndex.equal_range(stateKey(targetHash, targetState.length()));
+
+    std::vector<std::shared_ptr<HistoryNode>> candidates;
+    for (auto it = range.first; it != range.second; ++it) {
+        std::shared_ptr<HistoryNode> node = it->second.lock();
+        if (node && node->contentHash == targetHash && node->contentLength == targetState.length()) {
+            candidates.push_back(node);
         }
     }
 
-    // Target state was not found anywhere in the reachable history tree.
+    if (candidates.empty()) {
+        // Target state was not found anywhere in the history tree.
+        return nullptr;
+    }
+
+    // Nodes sharing the key hold identical texts reached on different paths, or just
+    // colliding ones: the hash is not collision-resistant, so even a single candidate
+    // is confirmed against the full text. Callers make the node current and record
+    // later edits against it. Prefer the shallowest node like the former breadth-first
+    // search did.
+    std::sort(candidates.begin(), candidates.end(),
+        [](const std::shared_ptr<HistoryNode>& a, const std::shared_ptr<HistoryNode>& b) {
+            return a->depth < b->depth;
+        });
+    // A candidate whose text can't be rebuilt (a damaged change) is no match: the
+    // caller couldn't make it current anyway.
+    for (const auto& node : candidates) {
+        bool matches;
+        try {
+            matches = node == currentNode ? currentStateEquals(targetState)
+                : reconstructDocumentToNode(node).equals(targetState);
+        }
+        catch (const DamagedHistoryError&) {
+            matches = false;
+        }
+        if (matches) {
+            return node;
+        }
+    }
     return nullptr;
 }
 
@@ -337,6 +761,7 @@ std::shared_ptr<HistoryNode> VersionHistoryManager::getMutableCurrentNode() {
 }
 
 bool VersionHistoryManager::deleteNode(std::shared_ptr<HistoryNode> nodeToDelete) {
+    TIMELINE_SPAN("VersionHistoryManager::deleteNode");
     if (!nodeToDelete) {
         return false;
     }
@@ -352,9 +777,13 @@ bool VersionHistoryManager::deleteNode(std::shared_ptr<HistoryNode> nodeToDelete
     if (nodeToDelete == getMutableCurrentNode()) {
         return false;
     }
+    //    ... or any of its ancestors, which would cut the current node off the tree.
+    if (lowestCommonAncestor(nodeToDelete.get(), currentNode.get()) == nodeToDelete.get()) {
+        return false;
+    }
 
     // 3. Get the parent 
-    std::shared_ptr<HistoryNode> parentNode = nodeToDelete->parent.lock();
+    HistoryNode* parentNode = nodeToDelete->parent;
     if (!parentNode) {
         // This indicates an orphaned node or inconsistent tree state, which shouldn't happen
         // in a correctly managed tree unless nodeToDelete was already detached.
@@ -367,13 +796,36 @@ bool VersionHistoryManager::deleteNode(std::shared_ptr<HistoryNode> nodeToDelete
     auto it = std::find(childrenVec.begin(), childrenVec.end(), nodeToDelete);
 
     if (it != childrenVec.end()) {
-        // Found the child, erase it from the parent's vector.
+        // Release checkpoints held by the subtree first. The UI may still hold
+        // shared_ptrs to these nodes, so we cannot rely on destruction to free them.
+        std::vector<HistoryNode*> pending = { nodeToDelete.get() };
+        while (!pending.empty()) {
+            HistoryNode* node = pending.back();
+            pending.pop_back();
+            releaseCheckpoint(*node);
+            unindexNode(node);
+            removeNodeAccounting(*node);
+            journalRemovedNodes++;
+            for (const auto& child : node->children) {
+                if (child) pending.push_back(child.get());
+            }
+        }
+        if (journal) {
+            journal->appendDelete(nodeToDelete->id);
+        }
+        checkpointedNodes.erase(std::remove_if(checkpointedNodes.begin(), checkpointedNodes.end(),
+            [](const std::weak_ptr<HistoryNode>& weak) {
+                auto node = weak.lock();
+                return !node || !node->hasCheckpoint();
+            }), checkpointedNodes.end());
+
+        // Found the child, detach it and erase it from the parent's vector.
         // Erasing the shared_ptr decrements its reference count. If this was the last
         // shared_ptr holding the node (and its subtree, assuming no other external refs),
-        // the node and its children will be destructed recursively due to shared_ptr mechanics.
+        // the subtree is released (iteratively, see ~HistoryNode) back to the node arena.
+        nodeToDelete->parent = nullptr;
         childrenVec.erase(it);
-        // The node's parent weak_ptr will become expired naturally.
-        // Children's parent weak_ptrs (if any were deleted recursively) also expire.
+        traceOperation(TraceRecordType::Delete, nodeToDelete->id);
         return true;
     }
     else {
@@ -381,3 +833,895 @@ bool VersionHistoryManager::deleteNode(std::shared_ptr<HistoryNode> nodeToDelete
         return false;
     }
 }
+
+
+// --- Checkpoints ---
+
+void VersionHistoryManager::setCheckpointPolicy(size_t interval, size_t memoryBudgetBytes) {
+    checkpointInterval = interval;
+    checkpointBudgetBytes = memoryBudgetBytes;
+
+    if (checkpointInterval == 0) {
+        // Checkpoints disabled: drop everything we hold.
+        for (const auto& weak : checkpointedNodes) {
+            if (auto node = weak.lock()) {
+                releaseCheckpoint(*node);
+            }
+        }
+        checkpointedNodes.clear();
+        checkpointBytes = 0;
+        return;
+    }
+
+    // Existing checkpoints are kept; only the budget is enforced immediately.
+    // The new interval applies to nodes recorded from now on.
+    evictCheckpointsOverBudget();
+}
+
+size_t VersionHistoryManager::getCheckpointInterval() const {
+    return checkpointInterval;
+}
+
+size_t VersionHistoryManager::getCheckpointBudget() const {
+    return checkpointBudgetBytes;
+}
+
+size_t VersionHistoryManager::getCheckpointMemoryUsage() const {
+    return checkpointBytes;
+}
+
+size_t VersionHistoryManager::checkpointSizeInBytes(const PieceTable& state) {
+    // Text buffers are shared with the root and other checkpoints; count only the pieces.
+    return state.memoryFootprint();
+}
+
+// Builds a piece-table snapshot of the target's text, starting from the nearest
+// checkpointed ancestor. Never materializes the whole document.
+PieceTable VersionHistoryManager::reconstructDocumentToNode(const std::shared_ptr<const HistoryNode>& targetNode) const {
+    TIMELINE_SPAN("VersionHistoryManager::reconstructDocumentToNode");
+    std::vector<const HistoryNode*> nodesToApply;
+    const HistoryNode* walker = targetNode.get();
+    PieceTable document = rootDocument;
+    std::wstring journalText;
+
+    while (walker && !walker->isRoot()) {
+        if (walker->hasCheckpoint()) {
+            document = *walker->checkpointState;
+            break;
+        }
+        if (loadJournalCheckpoint(*walker, journalText)) {
+            document = PieceTable(std::move(journalText));
+            break;
+        }
+        nodesToApply.push_back(walker);
+        walker = walker->parent;
+    }
+
+    // The replayed text goes to a buffer of the result's own, freed along with it.
+    document = document.withPrivateBuffer();
+
+    // Applied one at a time, so at most one packed change is unpacked at any moment.
+    ChangeSet buffer;
+    for (auto it = nodesToApply.rbegin(); it != nodesToApply.rend(); ++it) {
+        document.applyChange((*it)->getChange(buffer));
+    }
+    return document;
+}
+
+void VersionHistoryManager::storeCheckpoint(const std::shared_ptr<HistoryNode>& node, PieceTable state) {
+    if (!node || node->hasCheckpoint()) {
+        return;
+    }
+
+    size_t size = checkpointSizeInBytes(state);
+    if (size > checkpointBudgetBytes) {
+        return; // A single snapshot larger than the whole budget is never checkpointed
+    }
+
+    node->checkpointState = std::make_shared<const PieceTable>(std::move(state));
+    checkpointBytes += size;
+    checkpointedNodes.push_back(node);
+
+    evictCheckpointsOverBudget();
+}
+
+void VersionHistoryManager::releaseCheckpoint(HistoryNode& node) {
+    if (!node.hasCheckpoint()) {
+        return;
+    }
+    checkpointBytes -= checkpointSizeInBytes(*node.checkpointState);
+    node.checkpointState.reset();
+}
+
+void VersionHistoryManager::evictCheckpointsOverBudget() {
+    // Oldest checkpoints go first; recent branches are the ones users revisit most.
+    while (checkpointBytes > checkpointBudgetBytes && !checkpointedNodes.empty()) {
+        if (auto node = checkpointedNodes.front().lock()) {
+            releaseCheckpoint(*node);
+        }
+        checkpointedNodes.pop_front();
+    }
+}
+
+
+// --- State Cache ---
+
+void VersionHistoryManager::setStateCacheBudget(size_t budgetBytes) {
+    stateCacheBudgetBytes = budgetBytes;
+    evictCachedStatesOverBudget();
+}
+
+size_t VersionHistoryManager::getStateCacheBudget() const {
+    return stateCacheBudgetBytes;
+}
+
+VersionHistoryManager::StateCacheStats VersionHistoryManager::getStateCacheStats() const {
+    StateCacheStats stats = stateCacheStats;
+    stats.entries = stateCache.size();
+    return stats;
+}
+
+void VersionHistoryManager::clearStateCache() {
+    stateCache.clear();
+    stateCacheIndex.clear();
+    stateCacheStats.bytes = 0;
+}
+
+size_t VersionHistoryManager::cachedStateSizeInBytes(const std::wstring& text) {
+    return sizeof(CachedState) + text.capacity() * sizeof(wchar_t);
+}
+
+// Returns the cached text of 'node', if any, and marks it most recently used.
+std::shared_ptr<const std::wstring> VersionHistoryManager::findCachedState(const HistoryNode& node) const {
+    auto it = stateCacheIndex.find(node.id);
+    if (it == stateCacheIndex.end()) {
+        return nullptr;
+    }
+    stateCache.splice(stateCache.begin(), stateCache, it->second);
+    return it->second->text;
+}
+
+void VersionHistoryManager::cacheState(const HistoryNode& node, std::wstring text) const {
+    text.shrink_to_fit(); // Replay may have reserved well past the final length
+    size_t size = cachedStateSizeInBytes(text);
+    if (size > stateCacheBudgetBytes / 2 || stateCacheIndex.count(node.id)) {
+        return;
+    }
+    stateCache.push_front(CachedState{ node.id, std::make_shared<const std::wstring>(std::move(text)) });
+    stateCacheIndex.emplace(node.id, stateCache.begin());
+    stateCacheStats.bytes += size;
+    evictCachedStatesOverBudget();
+}
+
+void VersionHistoryManager::forgetCachedState(uint64_t nodeId) const {
+    auto it = stateCacheIndex.find(nodeId);
+    if (it == stateCacheIndex.end()) {
+        return;
+    }
+    stateCacheStats.bytes -= cachedStateSizeInBytes(*it->second->text);
+    stateCache.erase(it->second);
+    stateCacheIndex.erase(it);
+}
+
+void VersionHistoryManager::evictCachedStatesOverBudget() const {
+    while (stateCacheStats.bytes > stateCacheBudgetBytes && !stateCache.empty()) {
+        forgetCachedState(stateCache.back().nodeId);
+    }
+}
+
+
+// --- State Index ---
+
+uint64_t VersionHistoryManager::stateKey(uint64_t contentHash, size_t contentLength) {
+    return contentHash ^ (static_cast<uint64_t>(contentLength) * 0x9E3779B97F4A7C15ull);
+}
+
+void VersionHistoryManager::indexNode(const std::shared_ptr<HistoryNode>& node) {
+    stateIndex.emplace(stateKey(node->contentHash, node->contentLength), node);
+}
+
+void VersionHistoryManager::unindexNode(const HistoryNode* node) {
+    auto range = stateIndex.equal_range(stateKey(node->contentHash, node->contentLength));
+    for (auto it = range.first; it != range.second;) {
+        std::shared_ptr<HistoryNode> indexed = it->second.lock();
+        if (!indexed || indexed.get() == node) {
+            it = stateIndex.erase(it); // Also drops stale entries sharing the key
+        }
+        else {
+            ++it;
+        }
+    }
+}
+
+
+// --- Payload Storage ---
+
+void VersionHistoryManager::setPayloadCompression(bool enabled) {
+    compressPayloads = enabled; // Applies to changes stored from now on
+}
+
+bool VersionHistoryManager::isPayloadCompressionEnabled() const {
+    return compressPayloads;
+}
+
+void VersionHistoryManager::setTextSharing(bool enabled) {
+    shareTexts = enabled; // Applies to changes stored from now on
+}
+
+bool VersionHistoryManager::isTextSharingEnabled() const {
+    return shareTexts;
+}
+
+// --- Retention and Compaction ---
+
+void VersionHistoryManager::setRetentionPolicy(const RetentionPolicy& policy) {
+    retentionPolicy = policy;
+    compactionStack.clear(); // Start a fresh pass under the new limits
+}
+
+const VersionHistoryManager::RetentionPolicy& VersionHistoryManager::getRetentionPolicy() const {
+    return retentionPolicy;
+}
+
+size_t VersionHistoryManager::getNodeCount() const {
+    return nodeCount;
+}
+
+size_t VersionHistoryManager::getHistoryBytes() const {
+    return historyBytes;
+}
+
+bool VersionHistoryManager::isAutoCommit(const HistoryNode& node) {
+    return node.commitMessage.empty() || node.commitMessage.compare(0, 4, L"Auto") == 0;
+}
+
+size_t VersionHistoryManager::changeSizeInBytes(const ChangeSet& change) {
+    size_t size = change.hunks.size() * sizeof(TextChange);
+    for (const TextChange& hunk : change.hunks) {
+        size += (hunk.insertedText.length() + hunk.deletedText.length()) * sizeof(wchar_t);
+    }
+    return size;
+}
+
+// Sets a node's change, packed if payload compression is on, and its size estimate.
+void VersionHistoryManager::storeChange(HistoryNode& node, ChangeSet change) const {
+    node.journalChangeOffset = 0;
+    // Always fresh objects: snapshots may still share the previous payload.
+    node.sharedTexts = shareTexts ? ShareChangeTexts(change, SHARED_TEXT_MIN_CHARS) : nullptr;
+    if (compressPayloads || node.sharedTexts) {
+        // What is left of a change with shared texts is packed as well: it is only
+        // usable once they are filled back in, which decoding does.
+        node.packedChange = std::make_shared<const std::string>(PackChangeSet(change));
+        node.changeFromParent.reset();
+        // Shared texts count in full, since the node keeps them alive whoever else does.
+        node.changeBytes = node.packedChange->size() + (node.sharedTexts ? SharedChangeTextsSize(*node.sharedTexts) : 0);
+    }
+    else {
+        node.packedChange.reset();
+        node.changeBytes = changeSizeInBytes(change);
+        node.changeFromParent = std::make_shared<const ChangeSet>(std::move(change));
+    }
+}
+
+size_t VersionHistoryManager::nodeSizeInBytes(const HistoryNode& node) {
+    return sizeof(HistoryNode) + node.changeBytes + node.commitMessage.length() * sizeof(wchar_t);
+}
+
+void VersionHistoryManager::removeNodeAccounting(HistoryNode& node) {
+    forgetCachedState(node.id); // Its id is never reused, but the entry would only take room
+    nodeCount--;
+    historyBytes -= nodeSizeInBytes(node);
+    ancestorEpoch++; // Jump pointers may lead to this node; rebuild them on next use
+    treeGeneration++;
+}
+
+bool VersionHistoryManager::isOverRetentionBudget() const {
+    return (retentionPolicy.maxNodes > 0 && nodeCount > retentionPolicy.maxNodes)
+        || (retentionPolicy.maxBytes > 0 && historyBytes > retentionPolicy.maxBytes);
+}
+
+// Nodes removed elsewhere (deleteNode, an earlier squash) may still be alive through
+// the UI's shared_ptrs; they are no longer reachable from their parent.
+bool VersionHistoryManager::isAttached(const std::shared_ptr<HistoryNode>& node) const {
+    if (node == root) {
+        return true;
+    }
+    HistoryNode* parent = node->parent;
+    return parent && std::find(parent->children.begin(), parent->children.end(), node) != parent->children.end();
+}
+
+bool VersionHistoryManager::isPrunableLeaf(const HistoryNode& node, std::chrono::system_clock::time_point cutoff) const {
+    // A leaf other than the current node is never on the path to the current state.
+    return node.children.empty() && &node != currentNode.get() && &node != root.get()
+        && isAutoCommit(node) && node.timestamp < cutoff
+        && !(retentionPolicy.keepNode && retentionPolicy.keepNode(node));
+}
+
+// Removes 'node' if it is a stale dead leaf, then its parent if that became one, and so on.
+void VersionHistoryManager::pruneDeadLeaves(std::shared_ptr<HistoryNode> node, std::chrono::system_clock::time_point cutoff, CompactionResult& result) {
+    while (node && isPrunableLeaf(*node, cutoff)) {
+        if (!node->parent) {
+            return;
+        }
+        std::shared_ptr<HistoryNode> parent = node->parent->shared_from_this();
+
+        size_t bytes = nodeSizeInBytes(*node);
+        releaseCheckpoint(*node);
+        unindexNode(node.get());
+        removeNodeAccounting(*node);
+        auto& siblings = parent->children;
+        node->parent = nullptr;
+        siblings.erase(std::remove(siblings.begin(), siblings.end(), node), siblings.end());
+        if (journal) {
+            journal->appendDelete(node->id);
+        }
+        journalRemovedNodes++;
+
+        result.nodesRemoved++;
+        result.bytesReclaimed += bytes;
+        node = parent;
+    }
+}
+
+// Folds an automatic commit into its only child when that child is automatic too.
+// The child keeps its text (and identity) and takes the node's place in the tree.
+// Returns the child, or nullptr if the node can't be squashed.
+std::shared_ptr<HistoryNode> VersionHistoryManager::squashIntoChild(const std::shared_ptr<HistoryNode>& node, CompactionResult& result) {
+    if (node == root || node == currentNode || node->children.size() != 1 || !isAutoCommit(*node)
+        || (retentionPolicy.keepNode && retentionPolicy.keepNode(*node))) {
+        return nullptr;
+    }
+    std::shared_ptr<HistoryNode> child = node->children.front();
+    HistoryNode* parent = node->parent;
+    if (!child || !parent || !isAutoCommit(*child)) {
+        return nullptr;
+    }
+
+    // The child's change applies right after the node's, so the hunks simply
+    // concatenate; touching ones (typically consecutive typing) fold into one.
+    // A damaged change can't be folded into anything; both nodes stay as they are.
+    ChangeSet nodeBuffer, childBuffer;
+    const ChangeSet* nodeChange = node->tryGetChange(nodeBuffer);
+    const ChangeSet* childChange = child->tryGetChange(childBuffer);
+    if (!nodeChange || !childChange) {
+        return nullptr;
+    }
+    ChangeSet combined = *nodeChange;
+    for (const TextChange& hunk : childChange->hunks) {
+        if (combined.hunks.empty() || !combined.hunks.back().tryMerge(hunk)) {
+            combined.hunks.push_back(hunk);
+        }
+    }
+
+    size_t bytesBefore = nodeSizeInBytes(*node) + nodeSizeInBytes(*child);
+    releaseCheckpoint(*node);
+    unindexNode(node.get());
+    removeNodeAccounting(*node);
+    historyBytes -= nodeSizeInBytes(*child);
+
+    storeChange(*child, std::move(combined));
+    child->parent = parent;
+    child->depth = node->depth; // Descendants keep theirs; depth stays increasing
+    historyBytes += nodeSizeInBytes(*child);
+
+    std::replace(parent->children.begin(), parent->children.end(), node, child);
+    node->children.clear();
+    node->parent = nullptr;
+
+    // The child's record is rewritten with its new parent before the node goes away. A
+    // run of squashes folds into one survivor, which is only written once it stops
+    // growing, instead of once per squash with an ever longer change.
+    if (journal) {
+        if (journalSquashSurvivor != node) {
+            journalSquashes();
+        }
+        journalSquashSurvivor = child;
+        journalSquashedIds.push_back(node->id);
+    }
+    journalRemovedNodes++;
+
+    size_t bytesAfter = nodeSizeInBytes(*child);
+    result.nodesRemoved++;
+    result.bytesReclaimed += (bytesBefore > bytesAfter) ? bytesBefore - bytesAfter : 0;
+    return child;
+}
+
+VersionHistoryManager::CompactionResult VersionHistoryManager::compactHistory(size_t maxNodesToVisit) {
+    TIMELINE_SPAN("VersionHistoryManager::compactHistory");
+    CompactionResult result;
+    bool ageLimited = retentionPolicy.maxAge.count() > 0;
+    if (!ageLimited && !isOverRetentionBudget()) {
+        compactionStack.clear();
+        journalSquashes();
+        if (isJournalWorthRewriting()) {
+            rewriteJournal();
+        }
+        // Traced even though nothing changed: it resets the pass a replay must resume.
+        traceOperation(TraceRecordType::Compact, 0, maxNodesToVisit);
+        return result;
+    }
+
+    // Each slice continues a depth-first pass from the root, oldest nodes first.
+    // Nodes recorded meanwhile are picked up by the next pass.
+    if (compactionStack.empty()) {
+        compactionStack.push_back(root);
+    }
+
+    auto cutoff = std::chrono::system_clock::now() - retentionPolicy.maxAge;
+    size_t visited = 0;
+    while (!compactionStack.empty() && visited < maxNodesToVisit) {
+        std::shared_ptr<HistoryNode> node = compactionStack.back().lock();
+        compactionStack.pop_back();
+        if (!node || !isAttached(node)) {
+            continue;
+        }
+        visited++;
+
+        if (ageLimited && isPrunableLeaf(*node, cutoff)) {
+            pruneDeadLeaves(node, cutoff, result);
+            continue;
+        }
+        if (isOverRetentionBudget()) {
+            if (std::shared_ptr<HistoryNode> survivor = squashIntoChild(node, result)) {
+                compactionStack.push_back(survivor); // It may squash into its own child next
+                continue;
+            }
+        }
+
+        for (auto it = node->children.rbegin(); it != node->children.rend(); ++it) {
+            compactionStack.push_back(*it);
+        }
+    }
+
+    result.finished = compactionStack.empty();
+    journalSquashes();
+    if (isJournalWorthRewriting()) {
+        rewriteJournal();
+    }
+    traceOperation(TraceRecordType::Compact, 0, maxNodesToVisit);
+    return result;
+}
+
+
+// --- Background Access ---
+
+std::shared_ptr<const HistorySnapshot> VersionHistoryManager::getSnapshot() {
+    TIMELINE_SPAN("VersionHistoryManager::getSnapshot");
+    if (snapshot && snapshotTreeGeneration == treeGeneration) {
+        if (snapshotCurrentNode != currentNode.get()) {
+            // Same tree, the pointer moved: share the node table.
+            snapshot = std::make_shared<const HistorySnapshot>(*snapshot, *currentNode, currentDocument);
+            snapshotCurrentNode = currentNode.get();
+        }
+        return snapshot;
+    }
+    snapshot = std::make_shared<const HistorySnapshot>(*root, *currentNode, rootDocument, currentDocument);
+    snapshotTreeGeneration = treeGeneration;
+    snapshotCurrentNode = currentNode.get();
+    return snapshot;
+}
+
+std::shared_ptr<HistoryNode> VersionHistoryManager::findNodeForEntry(const HistorySnapshot::Entry& entry) const {
+    // Entries carry their text's hash, so the state index finds the node in O(1).
+    auto range = stateIndex.equal_range(stateKey(entry.contentHash, entry.contentLength));
+    for (auto it = range.first; it != range.second; ++it) {
+        std::shared_ptr<HistoryNode> node = it->second.lock();
+        if (node && node->id == entry.id) {
+            return node;
+        }
+    }
+    return nullptr;
+}
+
+bool VersionHistoryManager::adoptCheckout(std::shared_ptr<HistoryNode> targetNode, PieceTable document) {
+    if (!targetNode || !lowestCommonAncestor(targetNode.get(), root.get())) {
+        return false; // Deleted or compacted away since the text was rebuilt
+    }
+    if (document.length() != targetNode->contentLength || document.contentHash() != targetNode->contentHash) {
+        return false;
+    }
+    if (targetNode != currentNode) {
+        currentDocument = std::move(document);
+        currentNode = targetNode;
+        traceOperation(TraceRecordType::Checkout, targetNode->id);
+    }
+    return true;
+}
+
+// --- Trace ---
+
+TraceOutcome VersionHistoryManager::traceOutcome() const {
+    TraceOutcome outcome;
+    outcome.currentNodeId = currentNode->id;
+    outcome.nodeCount = nodeCount;
+    outcome.contentHash = currentDocument.contentHash();
+    outcome.contentLength = currentDocument.length();
+    return outcome;
+}
+
+void VersionHistoryManager::traceOperation(TraceRecordType type, uint64_t nodeId, uint64_t count) const {
+    if (trace) {
+        trace->appendOperation(type, nodeId, count, traceOutcome());
+    }
+}
+
+void VersionHistoryManager::attachTrace(std::shared_ptr<EditTraceWriter> writer) {
+    trace = std::move(writer);
+    if (!trace) {
+        return;
+    }
+
+    TraceRecord config;
+    config.type = TraceRecordType::Config;
+    config.checkpointInterval = checkpointInterval;
+    config.checkpointBudgetBytes = checkpointBudgetBytes;
+    config.maxNodes = retentionPolicy.maxNodes;
+    config.maxBytes = retentionPolicy.maxBytes;
+    config.maxAgeSeconds = static_cast<uint64_t>(retentionPolicy.maxAge.count());
+    config.payloadCompression = compressPayloads;
+    trace->append(config);
+
+    // Snapshot of the tree, parents first, so a replay starts from the same history.
+    TraceRecord record;
+    record.type = TraceRecordType::Root;
+    record.nodeId = root->id;
+    record.text = rootDocument.toString();
+    trace->append(record);
+
+    std::vector<const HistoryNode*> pending = { root.get() };
+    while (!pending.empty()) {
+        const HistoryNode* node = pending.back();
+        pending.pop_back();
+        // Children in order, so the replay recreates them in the same order.
+        for (const auto& child : node->children) {
+            ChangeSet buffer;
+            record = TraceRecord();
+            record.type = TraceRecordType::Node;
+            record.nodeId = child->id;
+            record.parentId = node->id;
+            record.text = child->commitMessage;
+            const ChangeSet* change = child->tryGetChange(buffer);
+            if (!change) {
+                trace.reset(); // A damaged tree can't be traced faithfully; don't start
+                return;
+            }
+            record.change = *change;
+            trace->append(record);
+        }
+        for (auto it = node->children.rbegin(); it != node->children.rend(); ++it) {
+            pending.push_back(it->get());
+        }
+    }
+    traceOperation(TraceRecordType::SetCurrent, currentNode->id);
+}
+
+// --- Journal ---
+
+bool VersionHistoryManager::loadJournalCheckpoint(const HistoryNode& node, std::wstring& outText) const {
+    // A checkpoint record that fails its checksum is simply skipped: replay continues
+    // further up the tree.
+    return node.journalCheckpointOffset != 0 && node.journalFile
+        && HistoryJournal::decodeText(*node.journalFile, node.journalCheckpointOffset, outText);
+}
+
+// Stepping through history only moves the pointer, and the editor does that on every
+// undo, redo and history-dialog click. Rather than append and flush a record each time,
+// the journal is brought up to date here, when it is flushed (see attachJournal).
+void VersionHistoryManager::journalCurrentNode() {
+    if (journal && journaledCurrentId != currentNode->id && journal->appendCurrent(currentNode->id)) {
+        journaledCurrentId = currentNode->id;
+    }
+}
+
+bool VersionHistoryManager::attachJournal(const std::wstring& journalPath) {
+    if (journal && journal->getPath() == journalPath) {
+        journalCurrentNode(); // Already journaling there; a save is a good time to flush
+        return true;
+    }
+
+    journalCurrentNode(); // The journal being left behind gets the last position too
+    journal.reset();
+    if (journalPath == foreignJournalPath) {
+        return false;
+    }
+    journal = std::make_unique<HistoryJournal>(journalPath);
+    bool ok;
+    if (journalPath == loadedJournalPath) {
+        ok = journal->openForAppend();
+        journalCurrentNode();
+    }
+    else {
+        ok = writeWholeTreeToJournal(*journal);
+        journaledCurrentId = currentNode->id;
+        journalWholeBytes = journal->getLength();
+        journalRemovedNodes = 0;
+    }
+    if (!ok) {
+        journal.reset();
+    }
+    return ok;
+}
+
+void VersionHistoryManager::detachJournal() {
+    journalCurrentNode();
+    journal.reset();
+}
+
+std::wstring VersionHistoryManager::getJournalPath() const {
+    return journal ? journal->getPath() : std::wstring();
+}
+
+// Writes the root, every node (parents first) and the current pointer to a new journal,
+// noting in 'written' (if given) where each node's records went.
+bool VersionHistoryManager::writeWholeTreeToJournal(HistoryJournal& target, std::vector<JournaledNode>* written) {
+    if (!target.create(rootDocument)) {
+        return false;
+    }
+
+    // Depth-first, carrying each node's text along (piece-table copies are O(1)) so the
+    // periodic journal checkpoints cost no extra reconstruction.
+    std::vector<std::pair<std::shared_ptr<HistoryNode>, PieceTable>> pending;
+    for (auto it = root->children.rbegin(); it != root->children.rend(); ++it) {
+        pending.emplace_back(*it, rootDocument);
+    }
+    while (!pending.empty()) {
+        std::shared_ptr<HistoryNode> node = std::move(pending.back().first);
+        PieceTable document = std::move(pending.back().second);
+        pending.pop_back();
+
+        // A change still in the loaded journal is decoded to be written and dropped
+        // again, so writing out a long history doesn't leave all of it in memory.
+        // A damaged change can't be written out faithfully, so neither can the tree.
+        size_t loadedOffset = node->journalChangeOffset;
+        ChangeSet buffer;
+        const ChangeSet* change = node->tryGetChange(buffer);
+        if (!change) {
+            return false;
+        }
+        document.applyChange(*change);
+        JournaledNode record{ node, target.getLength(), 0 };
+        if (!target.appendNode(*node)) {
+            return false;
+        }
+        if (loadedOffset != 0) {
+            node->changeFromParent.reset();
+            node->journalChangeOffset = loadedOffset;
+        }
+        if (node->depth % JOURNAL_CHECKPOINT_INTERVAL == 0) {
+            record.checkpointOffset = target.getLength();
+            target.appendCheckpoint(node->id, document);
+        }
+        if (written) {
+            written->push_back(std::move(record));
+        }
+        for (auto it = node->children.rbegin(); it != node->children.rend(); ++it) {
+            pending.emplace_back(*it, document);
+        }
+    }
+    return target.appendCurrent(currentNode->id);
+}
+
+// Writes the pending run of squashes: the survivor's record with its new parent and
+// combined change, then the deletes. Deleting the first folded node also drops the later
+// ones, its descendants in the journal, but not the survivor, which has moved up.
+void VersionHistoryManager::journalSquashes() {
+    if (!journalSquashSurvivor) {
+        return;
+    }
+    if (journal) {
+        journal->appendNode(*journalSquashSurvivor);
+        for (uint64_t id : journalSquashedIds) {
+            journal->appendDelete(id);
+        }
+        journaledCurrentId = journalSquashSurvivor->id; // A node record moves it; the next flush puts it back
+    }
+    journalSquashSurvivor.reset();
+    journalSquashedIds.clear();
+}
+
+// Removed nodes leave their records (and the deletes) in the journal for good, so once
+// that is worth a rewrite the file is replaced by one holding only the tree as it is:
+// when a third of the node records are dead, or the file has grown by half since it was
+// last written whole. Either way a rewrite follows work proportional to its own cost,
+// however often compaction runs.
+bool VersionHistoryManager::isJournalWorthRewriting() const {
+    return journal && journalRemovedNodes > 0
+        && (journalRemovedNodes >= nodeCount / 2 || journal->getLength() >= journalWholeBytes + journalWholeBytes / 2);
+}
+
+// The new journal is written next to the old one and renamed over it, so a crash
+// leaves one or the other, never half of each. Nodes then read from the new file. If
+// the old one can't be replaced (Windows refuses while a snapshot still maps it),
+// journaling carries on appending to it.
+bool VersionHistoryManager::rewriteJournal() {
+    TIMELINE_SPAN("VersionHistoryManager::rewriteJournal");
+    std::wstring journalPath = journal->getPath();
+    std::wstring rewrittenPath = journalPath + L".compact";
+    std::vector<JournaledNode> written;
+    bool ok;
+    {
+        HistoryJournal rewritten(rewrittenPath);
+        ok = writeWholeTreeToJournal(rewritten, &written);
+    } // Closed before the rename
+
+    journalCurrentNode(); // In case the old journal stays
+    journal.reset();
+    std::error_code error;
+    if (ok) {
+        std::filesystem::rename(std::filesystem::path(rewrittenPath), std::filesystem::path(journalPath), error);
+    }
+    journal = std::make_unique<HistoryJournal>(journalPath);
+    if (!ok || error) {
+        std::filesystem::remove(std::filesystem::path(rewrittenPath), error);
+        if (!journal->openForAppend()) {
+            journal.reset();
+        }
+        return false;
+    }
+    if (!journal->openForAppend()) {
+        journal.reset(); // Nodes keep reading the old file's mapping, which stays valid
+        return false;
+    }
+    journaledCurrentId = currentNode->id;
+    journalWholeBytes = journal->getLength();
+    journalRemovedNodes = 0;
+
+    auto mapping = std::make_shared<MappedFile>();
+    if (!mapping->open(journalPath)) {
+        return true; // As above: the old mapping still backs the nodes
+    }
+    for (const JournaledNode& record : written) {
+        HistoryNode& node = *record.node;
+        if (node.journalChangeOffset != 0) {
+            node.journalChangeOffset = record.changeOffset;
+        }
+        node.journalCheckpointOffset = record.checkpointOffset;
+        node.journalFile = mapping;
+    }
+    journalMapping = mapping;
+    loadedJournalPath = journalPath;
+    return true;
+}
+
+std::unique_ptr<VersionHistoryManager> VersionHistoryManager::loadFromJournal(const std::wstring& journalPath) {
+    auto mapping = std::make_shared<MappedFile>();
+    if (!mapping->open(journalPath)) {
+        return nullptr; // No journal yet
+    }
+
+    HistoryJournal::Contents contents;
+    if (!HistoryJournal::read(*mapping, contents)) {
+        return nullptr;
+    }
+
+    // Cut off a torn record left by a crash, so new records follow intact ones. While
+    // another manager writes the journal, the 'torn' record may just be one it hasn't
+    // finished flushing: that file is left alone and never written from here.
+    bool foreign = HistoryJournal::isClaimed(journalPath);
+    if (!foreign && contents.validLength < mapping->size()) {
+        mapping->close();
+        std::error_code error;
+        std::filesystem::resize_file(std::filesystem::path(journalPath), contents.validLength, error);
+        if (error || !mapping->open(journalPath)) {
+            return nullptr;
+        }
+    }
+
+    auto manager = std::make_unique<VersionHistoryManager>(contents.rootText);
+
+    // Build the tree skeleton from the record headers. Changes stay in the mapping.
+    std::unordered_map<uint64_t, std::shared_ptr<HistoryNode>> nodesById;
+    nodesById.reserve(contents.nodes.size() + 1);
+    manager->stateIndex.reserve(contents.nodes.size() + 1);
+    nodesById[0] = manager->root;
+    for (HistoryJournal::NodeEntry& entry : contents.nodes) {
+        auto parentIt = nodesById.find(entry.parentId);
+        if (parentIt == nodesById.end()) {
+            continue; // Inconsistent record; skip it rather than guess
+        }
+        std::shared_ptr<HistoryNode>& parent = parentIt->second;
+
+        auto existing = nodesById.find(entry.id);
+        if (existing != nodesById.end()) {
+            // Compaction squashed the run of nodes above this one into it: it takes the
+            // place of the run's top among the new parent's children and now holds the
+            // combined change. The squashed nodes' Delete records follow, so the whole
+            // run is still in the tree here and its top is found by walking up to the
+            // new parent.
+            std::shared_ptr<HistoryNode> node = existing->second;
+            HistoryNode* oldParent = node->parent;
+            if (!oldParent || node == manager->root) {
+                continue;
+            }
+            HistoryNode* runTop = oldParent;
+            while (runTop && runTop->parent != parent.get()) {
+                runTop = runTop->parent;
+            }
+            auto& oldSiblings = oldParent->children;
+            oldSiblings.erase(std::remove(oldSiblings.begin(), oldSiblings.end(), node), oldSiblings.end());
+            auto& siblings = parent->children;
+            siblings.insert(std::find_if(siblings.begin(), siblings.end(),
+                [runTop](const std::shared_ptr<HistoryNode>& sibling) { return sibling.get() == runTop; }), node);
+
+            node->parent = parent.get();
+            node->depth = parent->depth + 1;
+            manager->historyBytes -= nodeSizeInBytes(*node);
+            node->changeBytes = entry.changeBytes;
+            manager->historyBytes += nodeSizeInBytes(*node);
+            node->journalChangeOffset = entry.recordOffset;
+            continue;
+        }
+
+        auto node = std::allocate_shared<HistoryNode>(ArenaAllocator<HistoryNode>(manager->nodeArena), parent.get(), ChangeSet(), std::move(entry.message));
+        node->id = entry.id;
+        node->timestamp = std::chrono::system_clock::time_point(std::chrono::milliseconds(entry.timestampMs));
+        node->contentHash = entry.contentHash;
+        node->contentLength = entry.contentLength;
+        node->journalFile = mapping;
+        node->journalChangeOffset = entry.recordOffset;
+        node->changeBytes = entry.changeBytes;
+
+        parent->children.push_back(node);
+        manager->nodeCount++;
+        manager->historyBytes += nodeSizeInBytes(*node);
+        manager->indexNode(node);
+        manager->nextNodeId = std::max(manager->nextNodeId, entry.id + 1);
+        nodesById.emplace(entry.id, std::move(node));
+    }
+
+    for (const HistoryJournal::CheckpointEntry& checkpoint : contents.checkpoints) {
+        auto it = nodesById.find(checkpoint.nodeId);
+        if (it != nodesById.end()) {
+            it->second->journalCheckpointOffset = checkpoint.recordOffset;
+        }
+    }
+
+    // Replay deletions: detach each subtree and forget its nodes.
+    for (uint64_t deletedId : contents.deletedNodes) {
+        auto it = nodesById.find(deletedId);
+        if (it == nodesById.end() || it->second == manager->root) {
+            continue;
+        }
+        std::shared_ptr<HistoryNode> deleted = it->second;
+        if (HistoryNode* parent = deleted->parent) {
+            auto& siblings = parent->children;
+            siblings.erase(std::remove(siblings.begin(), siblings.end(), deleted), siblings.end());
+            deleted->parent = nullptr;
+        }
+        std::vector<HistoryNode*> pending = { deleted.get() };
+        while (!pending.empty()) {
+            HistoryNode* node = pending.back();
+            pending.pop_back();
+            manager->unindexNode(node);
+            manager->removeNodeAccounting(*node);
+            nodesById.erase(node->id);
+            for (const auto& child : node->children) {
+                pending.push_back(child.get());
+            }
+        }
+    }
+
+    auto currentIt = nodesById.find(contents.currentNodeId);
+    std::shared_ptr<HistoryNode> current = (currentIt != nodesById.end()) ? currentIt->second : manager->root;
+    // A damaged change on the way to the journal's current node leaves the history at
+    // the damaged node's parent, the nearest version above it that can be rebuilt.
+    for (;;) {
+        try {
+            manager->currentDocument = manager->reconstructDocumentToNode(current);
+            break;
+        }
+        catch (const DamagedHistoryError& error) {
+            current = nodesById.at(error.nodeId)->parent->shared_from_this();
+        }
+    }
+    manager->currentNode = current;
+
+    manager->journalMapping = mapping;
+    manager->loadedJournalPath = journalPath;
+    if (foreign) {
+        manager->foreignJournalPath = journalPath;
+    }
+    manager->journaledCurrentId = contents.currentNodeId;
+    manager->journalWholeBytes = contents.validLength;
+    return manager;
+}
@@ -9,9 +9,13 @@
 #include <stack>        
 #include <queue>        
 #include <map>          
+#include <unordered_map>
+#include <deque>        
+#include <list>         
 #include <chrono>       
 #include <limits>       
 #include <stdexcept>    
+#include <functional>
 
 // First include TextChange.h as it doesn't depend on HistoryNode
 #include "TextChange.h"
@@ -21,12 +25,18 @@ class HistoryNode;
 
 // Now include HistoryNode.h after forward declaration
 #include "HistoryNode.h"
+#include "PieceTable.h"
+#include "HistoryJournal.h"
+#include "NodeArena.h"
+#include "EditSink.h"
+#include "EditTrace.h"
+#include "HistorySnapshot.h"
 
 class VersionHistoryManager {
 public:
     // Constructor and Destructor
     explicit VersionHistoryManager(const std::wstring& initialContent);
-    ~VersionHistoryManager() = default;
+    ~VersionHistoryManager(); // Writes the journal's last pointer move
 
     // Deleted copy/move constructors and assignment operators
     VersionHistoryManager(const VersionHistoryManager&) = delete;
@@ -35,20 +45,53 @@ public:
     VersionHistoryManager& operator=(VersionHistoryManager&&) = delete;
 
     // Core Recording Operation
-    void recordChange(const TextChange& change, const std::wstring& message = L"");
+    // Accepts a single TextChange or a multi-hunk ChangeSet from the diff engine.
+    void recordChange(const ChangeSet& change, const std::wstring& message = L"");
 
     // Sets the internal current node pointer directly, Used after finding a matching state or navigating via history UI.
-    void setCurrentNode(std::shared_ptr<HistoryNode> node);
+    // Returns false, and stays put, if the node's text can't be rebuilt (a change it needs is
+    // damaged, see DamagedHistoryError).
+    bool setCurrentNode(std::shared_ptr<HistoryNode> node);
 
     // State Information & Navigation
     bool canUndo() const;
     bool canRedo() const;
-    bool moveCurrentNodeToParent();
-    bool moveCurrentNodeToChild(size_t childIndex = std::numeric_limits<size_t>::max());
+    // Moving across one edge only applies that edge's change to the live document. If
+    // 'appliedChange' is given it receives that change (old text -> new text), so a
+    // caller holding the text elsewhere, such as the edit control, can patch it too.
+    // A damaged edge makes them return false without moving.
+    bool moveCurrentNodeToParent(ChangeSet* appliedChange = nullptr);
+    bool moveCurrentNodeToChild(size_t childIndex = std::numeric_limits<size_t>::max(), ChangeSet* appliedChange = nullptr);
+    // Same moves for a caller-held copy of the text: the sink (or 'text') must hold the
+    // current node's text and receives the edge's change as minimal replaces, at the
+    // cost of the edge's delta instead of a rebuild of the whole document.
+    bool stepToParent(EditSink& sink);
+    bool stepToChild(EditSink& sink, size_t childIndex = std::numeric_limits<size_t>::max());
+    bool stepToParent(std::wstring& text);
+    bool stepToChild(std::wstring& text, size_t childIndex = std::numeric_limits<size_t>::max());
     std::vector<std::wstring> getRedoBranchDescriptions() const;
     std::wstring switchToNode(std::shared_ptr<HistoryNode> targetNode);
+    // Moves the current node to 'targetNode' along the shortest route: undo up to the
+    // common ancestor and redo down from it when that is short, otherwise rebuild from
+    // the nearest checkpoint. Unlike switchToNode it does not flatten the text; a
+    // 'sink' holding the current text is sent the net change (see getNetChange).
+    // Returns false, changing nothing, if a damaged change is in the way.
+    bool checkoutNode(std::shared_ptr<HistoryNode> targetNode, EditSink* sink = nullptr);
+    // Whether checkoutNode would reach 'targetNode' by walking through the common
+    // ancestor (costing only the changes on that path) rather than rebuilding its text.
+    bool isNearbyCheckout(std::shared_ptr<const HistoryNode> targetNode) const;
+    // Lowest common ancestor of two nodes, in O(log n) via jump pointers; nullptr if
+    // they are not in the same tree.
+    std::shared_ptr<const HistoryNode> findCommonAncestor(std::shared_ptr<const HistoryNode> first, std::shared_ptr<const HistoryNode> second) const;
+    // The change turning the text at 'from' into the text at 'to', composed along the
+    // path through their common ancestor with cancelling edits folded away, so a caller
+    // can patch one state into the other instead of replacing it.
+    // These two throw DamagedHistoryError if a change they need can't be read.
+    ChangeSet getNetChange(std::shared_ptr<const HistoryNode> from, std::shared_ptr<const HistoryNode> to) const;
     std::wstring reconstructStateToNode(std::shared_ptr<const HistoryNode> targetNode) const;
     std::wstring getCurrentState() const;
+    const PieceTable& getCurrentDocument() const; // Text at the current node, without flattening it
+    bool currentStateEquals(const std::wstring& state) const; // Compares without reconstructing
     // History Modification
     bool deleteNode(std::shared_ptr<HistoryNode> nodeToDelete); // Use non-const shared_ptr as we modify the tree
     std::shared_ptr<HistoryNode> findNodeMatchingState(const std::wstring& state) const;
@@ -59,13 +102,253 @@ public:
     // Be careful using this, primarily for internal operations like deletion checks.
     std::shared_ptr<HistoryNode> getMutableCurrentNode();
 
+    // Checkpoint Policy
+    // Every 'interval' levels of depth a node stores a snapshot of its text, so
+    // reconstruction replays at most 'interval' changes. Oldest checkpoints are evicted
+    // once their piece trees exceed 'memoryBudgetBytes'. An interval of 0 disables them.
+    void setCheckpointPolicy(size_t interval, size_t memoryBudgetBytes);
+    size_t getCheckpointInterval() const;
+    size_t getCheckpointBudget() const;
+    size_t getCheckpointMemoryUsage() const; // Bytes currently held by checkpoints
+
+    static constexpr size_t DEFAULT_CHECKPOINT_INTERVAL = 32;
+    static constexpr size_t DEFAULT_CHECKPOINT_BUDGET_BYTES = 128 * 1024 * 1024;
+
+    // State Cache
+    // Texts produced by reconstructStateToNode are kept in a least-recently-used cache
+    // bounded by 'budgetBytes', so asking for a version again costs a copy, and
+    // reconstructing any other version starts from its nearest cached ancestor when that
+    // is closer than a checkpoint. (Checkouts rebuild piece tables, where replaying from
+    // a checkpoint is cheaper than copying a whole text, and don't use it.) A text larger than half the budget is not cached, so one huge
+    // version cannot push out all the others. A budget of 0 disables the cache.
+    struct StateCacheStats {
+        uint64_t hits = 0;         // The version itself was cached
+        uint64_t ancestorHits = 0; // Started from a cached ancestor
+        uint64_t misses = 0;
+        size_t entries = 0;
+        size_t bytes = 0;          // Held by the cached texts
+        double hitRate() const {
+            uint64_t lookups = hits + ancestorHits + misses;
+            return lookups ? static_cast<double>(hits + ancestorHits) / lookups : 0.0;
+        }
+    };
+
+    void setStateCacheBudget(size_t budgetBytes);
+    size_t getStateCacheBudget() const;
+    StateCacheStats getStateCacheStats() const;
+    void clearStateCache();
+
+    static constexpr size_t DEFAULT_STATE_CACHE_BUDGET_BYTES = 64 * 1024 * 1024;
+
+    // Retention Policy
+    // Bounds how much history is kept. Compaction drops dead branches (leaves other than
+    // the current node) older than 'maxAge', and while the tree is over 'maxNodes' or
+    // 'maxBytes' it squashes runs of automatic commits into one node per run. Named
+    // commits, the root, the current node and anything 'keepNode' accepts are never
+    // removed. A limit of 0 means unlimited; the default keeps everything.
+    struct RetentionPolicy {
+        size_t maxNodes = 0;
+        size_t maxBytes = 0;
+        std::chrono::seconds maxAge{ 0 };
+        std::function<bool(const HistoryNode&)> keepNode; // Optional
+    };
+
+    struct CompactionResult {
+        size_t nodesRemoved = 0;
+        size_t bytesReclaimed = 0;
+        bool finished = true; // False if more work remains for the next call
+    };
+
+    void setRetentionPolicy(const RetentionPolicy& policy);
+    const RetentionPolicy& getRetentionPolicy() const;
+    // Runs one bounded slice of compaction, visiting at most 'maxNodesToVisit' nodes and
+    // resuming where the previous slice stopped, so it can run in idle time on the UI
+    // thread. Call again while the result is not finished.
+    CompactionResult compactHistory(size_t maxNodesToVisit = 256);
+    size_t getNodeCount() const;
+    size_t getHistoryBytes() const; // Approximate bytes held by nodes and their changes
+    // Automatic commits have no message or one starting with "Auto".
+    static bool isAutoCommit(const HistoryNode& node);
+
+    // Payload Storage
+    // When enabled, changes recorded from then on are kept packed (see ChangePacking.h):
+    // narrowed to Latin-1 or UTF-8 where possible and LZ4-compressed above a size
+    // threshold. They are decoded on demand while replaying and not kept unpacked.
+    // Off by default, which keeps every change as plain TextChange strings.
+    void setPayloadCompression(bool enabled);
+    bool isPayloadCompressionEnabled() const;
+    // When enabled (the default), texts of at least SHARED_TEXT_MIN_CHARS characters in
+    // changes recorded from then on are kept in the process-wide BlobStore, so a block
+    // pasted again, in this history or another tab's, is held once. Such changes are
+    // stored packed and decoded on demand, as with compression. The initial text is
+    // always shared.
+    void setTextSharing(bool enabled);
+    bool isTextSharingEnabled() const;
+    static constexpr size_t SHARED_TEXT_MIN_CHARS = 128; // Below this a blob costs more than it saves
+
+    // Persistence
+    // Appends every change and deletion to the journal at 'journalPath'. A manager
+    // loaded from that journal keeps appending to it; otherwise the whole tree is written
+    // out first, replacing any file already there. Returns false (and keeps history in
+    // memory only) if the journal cannot be written, or if another manager journals to
+    // it: the first tab on a document journals, any other keeps its history in memory.
+    // Moving the current node without recording is not written step by step: the last
+    // position is written when the journal is attached again at the same path (after a
+    // save), detached, or the manager is destroyed. Once enough of the journal is records
+    // of removed nodes, compaction rewrites it with only the tree that is left.
+    bool attachJournal(const std::wstring& journalPath);
+    void detachJournal();
+    std::wstring getJournalPath() const; // Empty when not journaling
+
+    // Rebuilds a history from a journal, or returns nullptr if there is none (or it is
+    // unreadable). The file is memory-mapped and only node headers are parsed; each
+    // node's change and the journal's checkpoints are decoded when first needed. A
+    // journal another manager is writing is loaded as it stands, but the loaded manager
+    // never journals to it.
+    static std::unique_ptr<VersionHistoryManager> loadFromJournal(const std::wstring& journalPath);
+
+    // Background Access
+    // A read-only copy of the tree and the current text for worker threads (see
+    // HistorySnapshot.h). The copy is reused until the tree changes, and its node
+    // table is shared when only the current node moved, so asking again is cheap.
+    std::shared_ptr<const HistorySnapshot> getSnapshot();
+    // The live node a snapshot entry stands for, or nullptr if it has left the tree.
+    std::shared_ptr<HistoryNode> findNodeForEntry(const HistorySnapshot::Entry& entry) const;
+    // Finishes a checkout whose text was rebuilt elsewhere, e.g. by a worker from a
+    // snapshot. Returns false, changing nothing, if 'targetNode' is no longer in the
+    // tree or 'document' is not its text.
+    bool adoptCheckout(std::shared_ptr<HistoryNode> targetNode, PieceTable document);
+
+    // Tracing
+    // Writes this manager's policies and its whole tree to 'writer', then every
+    // operation that changes the tree or the current node (see EditTrace.h), so the
+    // session can be replayed headless. Pass nullptr to stop tracing.
+    void attachTrace(std::shared_ptr<EditTraceWriter> writer);
+
+    // Every this many levels of depth the journal stores the full text, so loading
+    // never has to replay more than this many changes from the file.
+    static constexpr size_t JOURNAL_CHECKPOINT_INTERVAL = 256;
+
+    // In-place application: mutate 'text' directly instead of producing a copy.
+    // applyChangesInPlace reserves capacity once for the whole sequence and folds
+    // runs of touching changes together so each run costs a single buffer shift.
+    static void applyChangeInPlace(std::wstring& text, const TextChange& change);
+    static void applyChangeInPlace(std::wstring& text, const ChangeSet& changes);
+    static void applyChangesInPlace(std::wstring& text, const std::vector<const TextChange*>& changes);
+    // The copying form: 'text' with 'change' applied, as a new string. Nothing in the
+    // engine replays through it any more; it stays as the baseline history_bench compares
+    // the in-place path against.
+    static std::wstring applyChangeToString(const std::wstring& text, const ChangeSet& change);
+
 private:
     // Internal State
-    std::wstring initialRootState;
+    // Every node of this tree is allocated from here (see NodeArena). Declared first so
+    // it exists before the root is created.
+    std::shared_ptr<NodeArena> nodeArena = std::make_shared<NodeArena>();
+    PieceTable rootDocument; // Initial state, read from the BlobStore; checkpoints are derived from it and share its buffer
+    PieceTable currentDocument; // Text at currentNode, kept in step with every pointer move
     std::shared_ptr<HistoryNode> root;
     std::shared_ptr<HistoryNode> currentNode;
 
+    // State Index: (content hash, length) -> nodes with that text, for findNodeMatchingState
+    std::unordered_multimap<uint64_t, std::weak_ptr<HistoryNode>> stateIndex;
+
+    // Checkpoint State
+    size_t checkpointInterval = DEFAULT_CHECKPOINT_INTERVAL;
+    size_t checkpointBudgetBytes = DEFAULT_CHECKPOINT_BUDGET_BYTES;
+    size_t checkpointBytes = 0;
+    std::deque<std::weak_ptr<HistoryNode>> checkpointedNodes; // Oldest first, for eviction
+
+    // State Cache State: texts by node id, most recently used first. Reconstruction is
+    // const, so the cache and its counters are mutable.
+    struct CachedState {
+        uint64_t nodeId;
+        std::shared_ptr<const std::wstring> text;
+    };
+    size_t stateCacheBudgetBytes = DEFAULT_STATE_CACHE_BUDGET_BYTES;
+    mutable std::list<CachedState> stateCache;
+    mutable std::unordered_map<uint64_t, std::list<CachedState>::iterator> stateCacheIndex;
+    mutable StateCacheStats stateCacheStats;
+
+    // Retention State
+    RetentionPolicy retentionPolicy;
+    size_t nodeCount = 1; // Root included
+    size_t historyBytes = 0;
+    std::vector<std::weak_ptr<HistoryNode>> compactionStack; // Pending nodes of the current pass
+
+    // Payload State
+    bool compressPayloads = false;
+    bool shareTexts = true;
+
+    // Ancestor Index State
+    uint64_t ancestorEpoch = 1; // Bumped whenever a node leaves the tree
+
+    // Journal State
+    uint64_t nextNodeId = 1; // Root is 0
+    std::unique_ptr<HistoryJournal> journal;
+    std::shared_ptr<const MappedFile> journalMapping; // Backs the nodes loaded from it
+    std::wstring loadedJournalPath;
+    // Loaded while another manager was writing it. Its records may be followed by ones
+    // this manager doesn't know, so appending here would clash with their ids, and
+    // replacing it would lose them: it stays unwritten by this manager.
+    std::wstring foreignJournalPath;
+    uint64_t journaledCurrentId = 0; // The current node as the journal has it
+    size_t journalWholeBytes = 0;    // Journal length when last written out whole (or loaded)
+    size_t journalRemovedNodes = 0;  // Nodes removed since then, their records dead weight
+    // Squashes not yet written: the node the run was folded into so far, and the nodes
+    // folded (see squashIntoChild).
+    std::shared_ptr<HistoryNode> journalSquashSurvivor;
+    std::vector<uint64_t> journalSquashedIds;
+
+    // Trace State
+    std::shared_ptr<EditTraceWriter> trace;
+
+    // Snapshot State
+    uint64_t treeGeneration = 1; // Bumped whenever a node is added or removed
+    std::shared_ptr<const HistorySnapshot> snapshot;
+    uint64_t snapshotTreeGeneration = 0;
+    const HistoryNode* snapshotCurrentNode = nullptr;
+
     // Helper Functions
-    static std::wstring applyChangeToString(const std::wstring& text, const TextChange& change);
+    void indexNode(const std::shared_ptr<HistoryNode>& node);
+    void unindexNode(const HistoryNode* node);
+    static uint64_t stateKey(uint64_t contentHash, size_t contentLength);
+    PieceTable reconstructDocumentToNode(const std::shared_ptr<const HistoryNode>& targetNode) const;
+    void storeCheckpoint(const std::shared_ptr<HistoryNode>& node, PieceTable state);
+    void releaseCheckpoint(HistoryNode& node);
+    void evictCheckpointsOverBudget();
+    static size_t checkpointSizeInBytes(const PieceTable& state);
+    std::shared_ptr<const std::wstring> findCachedState(const HistoryNode& node) const;
+    void cacheState(const HistoryNode& node, std::wstring text) const;
+    void forgetCachedState(uint64_t nodeId) const;
+    void evictCachedStatesOverBudget() const;
+    static size_t cachedStateSizeInBytes(const std::wstring& text);
+    bool isOverRetentionBudget() const;
+    bool isPrunableLeaf(const HistoryNode& node, std::chrono::system_clock::time_point cutoff) const;
+    bool isAttached(const std::shared_ptr<HistoryNode>& node) const;
+    void pruneDeadLeaves(std::shared_ptr<HistoryNode> node, std::chrono::system_clock::time_point cutoff, CompactionResult& result);
+    std::shared_ptr<HistoryNode> squashIntoChild(const std::shared_ptr<HistoryNode>& node, CompactionResult& result);
+    void removeNodeAccounting(HistoryNode& node);
+    static size_t nodeSizeInBytes(const HistoryNode& node);
+    static size_t changeSizeInBytes(const ChangeSet& change);
+    void storeChange(HistoryNode& node, ChangeSet change) const;
+    bool loadJournalCheckpoint(const HistoryNode& node, std::wstring& outText) const;
+    // Where writeWholeTreeToJournal put a node's records (checkpoint 0: none).
+    struct JournaledNode {
+        std::shared_ptr<HistoryNode> node;
+        size_t changeOffset = 0;
+        size_t checkpointOffset = 0;
+    };
+    bool writeWholeTreeToJournal(HistoryJournal& target, std::vector<JournaledNode>* written = nullptr);
+    bool rewriteJournal();
+    void journalSquashes();
+    bool isJournalWorthRewriting() const;
+    void journalCurrentNode();
+    TraceOutcome traceOutcome() const;
+    void traceOperation(TraceRecordType type, uint64_t nodeId = 0, uint64_t count = 0) const;
+    void refreshAncestorIndex(const HistoryNode* node) const;
+    static const HistoryNode* ancestorAtLevel(const HistoryNode* node, size_t level);
+    const HistoryNode* lowestCommonAncestor(const HistoryNode* first, const HistoryNode* second) const;
+    static ChangeSet composeChange(const HistoryNode* from, const HistoryNode* to, const HistoryNode* ancestor, bool fold);
 };
 